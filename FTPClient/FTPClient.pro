@@ -10,18 +10,17 @@ TARGET = FTPClient
 TEMPLATE = app
 
 
+include(FtpEngine.pri)
+
 SOURCES += main.cpp\
-    FtpClient.cpp \
     FtpClientWidget.cpp \
     MainWindow.cpp \
-    QUtilityBox.cpp
+    FtpListingModel.cpp
 
 HEADERS  += \
-    FtpClient.h \
     FtpClientWidget.h \
     MainWindow.h \
-    QtBaseType.h \
-    QUtilityBox.h
+    FtpListingModel.h
 
 FORMS    += \
     FtpClientWidget.ui \
@@ -30,7 +29,7 @@ FORMS    += \
 RESOURCES += \
     ftp.qrc
 
-RC_FILE = icon.rc
+win32:RC_FILE = icon.rc
 
 OTHER_FILES += \
     images/file.png \
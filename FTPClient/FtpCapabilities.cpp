@@ -0,0 +1,218 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpCapabilities.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Server features from FEAT, cached per server
+**********************************************************************/
+
+#include "FtpCapabilities.h"
+#include <QSettings>
+#include <QFileInfo>
+
+namespace
+{
+    struct Feature_Name
+    {
+        const char *name;
+        int feature;
+    };
+
+    // Feature keyword as listed in FEAT reply
+    const Feature_Name s_featureNames[] = {
+        { "MLSD",           FtpCapabilities::CAP_MLSD },
+        { "SIZE",           FtpCapabilities::CAP_SIZE },
+        { "MDTM",           FtpCapabilities::CAP_MDTM },
+        { "REST STREAM",    FtpCapabilities::CAP_REST_STREAM },
+        { "EPSV",           FtpCapabilities::CAP_EPSV },
+        { "EPRT",           FtpCapabilities::CAP_EPRT },
+        { "UTF8",           FtpCapabilities::CAP_UTF8 },
+        { "MODE Z",         FtpCapabilities::CAP_MODE_Z },
+        { "XCRC",           FtpCapabilities::CAP_XCRC },
+        { "XMD5",           FtpCapabilities::CAP_XMD5 },
+        { "XSHA1",          FtpCapabilities::CAP_XSHA1 },
+        { "TVFS",           FtpCapabilities::CAP_TVFS }
+    };
+
+    const int s_featureCount = sizeof(s_featureNames) / sizeof(s_featureNames[0]);
+}
+
+
+FtpCapabilities::FtpCapabilities() :
+    m_valid(false),
+    m_features(0)
+{
+}
+
+void FtpCapabilities::clear()
+{
+    m_valid = false;
+    m_features = 0;
+    m_hashAlgorithms.clear();
+    m_mlstFacts.clear();
+    m_updateTime = QDateTime();
+}
+
+bool FtpCapabilities::isValid() const
+{
+    return m_valid;
+}
+
+void FtpCapabilities::parseFeatReply(const QString &reply)
+{
+    QStringList lines = reply.split('\n');
+
+    clear();
+
+    for(int i = 0; i < lines.size(); i++)
+    {
+        QString line = lines.at(i).trimmed();
+        QString upperLine = line.toUpper();
+
+        for(int j = 0; j < s_featureCount; j++)
+        {
+            if(upperLine == s_featureNames[j].name)
+            {
+                m_features |= s_featureNames[j].feature;
+            }
+        }
+
+        if(upperLine.startsWith("HASH "))
+        {
+            // e.g. "HASH SHA-1*;SHA-256;MD5;CRC32", * marks the current one
+            m_features |= CAP_HASH;
+            m_hashAlgorithms = upperLine.mid(5).remove('*').split(';', QString::SkipEmptyParts);
+        }
+        else if(upperLine.startsWith("MLST "))
+        {
+            // e.g. "MLST type*;size*;modify*;", MLSD comes with MLST
+            m_features |= CAP_MLSD;
+            m_mlstFacts = line.mid(5).toLower().remove('*').split(';', QString::SkipEmptyParts);
+        }
+        else if(upperLine.startsWith("REST STREAM"))
+        {
+            m_features |= CAP_REST_STREAM;
+        }
+    }
+
+    m_valid = true;
+    m_updateTime = QDateTime::currentDateTime();
+}
+
+void FtpCapabilities::setFeatUnsupported()
+{
+    clear();
+
+    m_valid = true;
+    m_updateTime = QDateTime::currentDateTime();
+}
+
+bool FtpCapabilities::has(int feature) const
+{
+    return (m_features & feature) == feature;
+}
+
+int FtpCapabilities::features() const
+{
+    return m_features;
+}
+
+QStringList FtpCapabilities::hashAlgorithms() const
+{
+    return m_hashAlgorithms;
+}
+
+QStringList FtpCapabilities::mlstFacts() const
+{
+    return m_mlstFacts;
+}
+
+QDateTime FtpCapabilities::updateTime() const
+{
+    return m_updateTime;
+}
+
+bool FtpCapabilities::load(const QString &host, int port)
+{
+    bool ret = false;
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, "FTPClient", "capabilities");
+
+    clear();
+
+    settings.beginGroup(cacheKey(host, port));
+
+    QDateTime updateTime = settings.value("updated").toDateTime();
+    if(updateTime.isValid()
+            && updateTime.daysTo(QDateTime::currentDateTime()) < CACHE_MAX_AGE_DAYS)
+    {
+        m_features = settings.value("features", 0).toInt();
+        m_hashAlgorithms = settings.value("hash").toStringList();
+        m_mlstFacts = settings.value("mlst").toStringList();
+        m_updateTime = updateTime;
+        m_valid = true;
+
+        ret = true;
+    }
+
+    settings.endGroup();
+
+    return ret;
+}
+
+void FtpCapabilities::save(const QString &host, int port) const
+{
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, "FTPClient", "capabilities");
+
+    if(!m_valid)
+    {
+        return;
+    }
+
+    settings.beginGroup(cacheKey(host, port));
+    settings.setValue("features", m_features);
+    settings.setValue("hash", m_hashAlgorithms);
+    settings.setValue("mlst", m_mlstFacts);
+    settings.setValue("updated", m_updateTime);
+    settings.endGroup();
+}
+
+QString FtpCapabilities::toString() const
+{
+    QStringList names;
+
+    for(int j = 0; j < s_featureCount; j++)
+    {
+        if(m_features & s_featureNames[j].feature)
+        {
+            names.append(s_featureNames[j].name);
+        }
+    }
+
+    if(has(CAP_HASH))
+    {
+        names.append(QString("HASH %1").arg(m_hashAlgorithms.join(";")));
+    }
+
+    return names.isEmpty() ? QString("none") : names.join(", ");
+}
+
+QString FtpCapabilities::settingsDir()
+{
+    // QSettings reads its file when constructed, ask it only once
+    static QString dir;
+
+    if(dir.isEmpty())
+    {
+        QSettings settings(QSettings::IniFormat, QSettings::UserScope, "FTPClient", "capabilities");
+
+        dir = QFileInfo(settings.fileName()).absolutePath();
+    }
+
+    return dir;
+}
+
+QString FtpCapabilities::cacheKey(const QString &host, int port)
+{
+    // QSettings treats '/' and '\' as group separators
+    return QString("%1_%2").arg(host.toLower()).arg(port).replace('/', '_').replace('\\', '_');
+}
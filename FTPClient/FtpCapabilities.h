@@ -0,0 +1,83 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpCapabilities.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Server features from FEAT, cached per server
+**********************************************************************/
+
+#ifndef FTPCAPABILITIES_H
+#define FTPCAPABILITIES_H
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+
+class FtpCapabilities
+{
+public:
+    FtpCapabilities();
+
+    enum{
+        CAP_MLSD        = 0x0001,
+        CAP_SIZE        = 0x0002,
+        CAP_MDTM        = 0x0004,
+        CAP_REST_STREAM = 0x0008,
+        CAP_EPSV        = 0x0010,
+        CAP_EPRT        = 0x0020,
+        CAP_UTF8        = 0x0040,
+        CAP_HASH        = 0x0080,
+        CAP_MODE_Z      = 0x0100,
+        CAP_XCRC        = 0x0200,
+        CAP_XMD5        = 0x0400,
+        CAP_XSHA1       = 0x0800,
+        CAP_TVFS        = 0x1000
+    };
+
+    enum{
+        CACHE_MAX_AGE_DAYS = 7  // Re-query FEAT after this age
+    };
+
+    void clear();
+
+    // True after a FEAT reply was parsed or a cache entry was loaded,
+    // a server rejecting FEAT is valid with no features
+    bool isValid() const;
+
+    // Parse the text of a FEAT reply
+    void parseFeatReply(const QString &reply);
+
+    // Mark server as not supporting FEAT
+    void setFeatUnsupported();
+
+    bool has(int feature) const;
+    int features() const;
+
+    // Algorithms from the HASH feature, e.g. "SHA-1", "MD5"
+    QStringList hashAlgorithms() const;
+
+    // Facts from the MLST feature, e.g. "size", "modify", "type"
+    QStringList mlstFacts() const;
+
+    QDateTime updateTime() const;
+
+    // Persist per host:port across runs
+    bool load(const QString &host, int port);
+    void save(const QString &host, int port) const;
+
+    // Human readable list of features
+    QString toString() const;
+
+    // Dir of the settings files, journals and histories are kept below it
+    static QString settingsDir();
+
+private:
+    bool m_valid;
+    int m_features;
+    QStringList m_hashAlgorithms;
+    QStringList m_mlstFacts;
+    QDateTime m_updateTime;
+
+    static QString cacheKey(const QString &host, int port);
+};
+
+#endif // FTPCAPABILITIES_H
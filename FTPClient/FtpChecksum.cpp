@@ -0,0 +1,244 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpChecksum.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Incremental checksum for transfer verification
+**********************************************************************/
+
+#include "FtpChecksum.h"
+#include <QtEndian>
+#include <zlib.h>
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define FTP_CRC32C_HW 1
+#endif
+
+#ifndef FTP_CRC32C_HW
+namespace
+{
+    const quint32 CRC32C_POLY = 0x82F63B78; // Reflected Castagnoli polynomial
+
+    // Slice-by-8 tables for the software CRC32C
+    quint32 s_crc32cTable[8][256];
+
+    bool initCrc32cTable()
+    {
+        for(quint32 i = 0; i < 256; i++)
+        {
+            quint32 crc = i;
+            for(int j = 0; j < 8; j++)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+            }
+            s_crc32cTable[0][i] = crc;
+        }
+
+        for(quint32 i = 0; i < 256; i++)
+        {
+            for(int k = 1; k < 8; k++)
+            {
+                quint32 prev = s_crc32cTable[k - 1][i];
+                s_crc32cTable[k][i] = (prev >> 8) ^ s_crc32cTable[0][prev & 0xFF];
+            }
+        }
+
+        return true;
+    }
+
+    const bool s_crc32cTableReady = initCrc32cTable();
+}
+#endif
+
+
+FtpChecksum::FtpChecksum(int algorithm) :
+    m_algorithm(algorithm),
+    m_crc(0),
+    m_pHash(NULL)
+{
+    if(CHECKSUM_MD5 == m_algorithm)
+    {
+        m_pHash = new QCryptographicHash(QCryptographicHash::Md5);
+    }
+    else if(CHECKSUM_SHA1 == m_algorithm)
+    {
+        m_pHash = new QCryptographicHash(QCryptographicHash::Sha1);
+    }
+}
+
+FtpChecksum::~FtpChecksum()
+{
+    delete m_pHash;
+}
+
+void FtpChecksum::reset()
+{
+    m_crc = 0;
+
+    if(NULL != m_pHash)
+    {
+        m_pHash->reset();
+    }
+}
+
+void FtpChecksum::addData(const char *data, qint64 len)
+{
+    switch(m_algorithm)
+    {
+    case CHECKSUM_CRC32:
+        // zlib crc32 takes uInt lengths
+        while(len > 0)
+        {
+            uInt slice = (uInt)qMin<qint64>(len, 0x40000000);
+            m_crc = crc32(m_crc, (const Bytef *)data, slice);
+            data += slice;
+            len -= slice;
+        }
+        break;
+
+    case CHECKSUM_CRC32C:
+        m_crc = crc32c(m_crc, data, len);
+        break;
+
+    case CHECKSUM_MD5:
+    case CHECKSUM_SHA1:
+        m_pHash->addData(data, (int)len);
+        break;
+
+    default:
+        break;
+    }
+}
+
+int FtpChecksum::algorithm() const
+{
+    return m_algorithm;
+}
+
+QString FtpChecksum::hexResult() const
+{
+    QString ret = "";
+
+    switch(m_algorithm)
+    {
+    case CHECKSUM_CRC32:
+    case CHECKSUM_CRC32C:
+        ret = QString::number(m_crc, 16).rightJustified(8, '0');
+        break;
+
+    case CHECKSUM_MD5:
+    case CHECKSUM_SHA1:
+        ret = QString::fromLatin1(m_pHash->result().toHex());
+        break;
+
+    default:
+        break;
+    }
+
+    return ret;
+}
+
+QString FtpChecksum::algorithmName(int algorithm)
+{
+    switch(algorithm)
+    {
+    case CHECKSUM_CRC32:
+        return "CRC32";
+    case CHECKSUM_CRC32C:
+        return "CRC32C";
+    case CHECKSUM_MD5:
+        return "MD5";
+    case CHECKSUM_SHA1:
+        return "SHA-1";
+    default:
+        return "";
+    }
+}
+
+QString FtpChecksum::legacyCommand(int algorithm)
+{
+    switch(algorithm)
+    {
+    case CHECKSUM_CRC32:
+        return "XCRC";
+    case CHECKSUM_MD5:
+        return "XMD5";
+    case CHECKSUM_SHA1:
+        return "XSHA1";
+    default:
+        return "";
+    }
+}
+
+int FtpChecksum::hexLength(int algorithm)
+{
+    switch(algorithm)
+    {
+    case CHECKSUM_CRC32:
+    case CHECKSUM_CRC32C:
+        return 8;
+    case CHECKSUM_MD5:
+        return 32;
+    case CHECKSUM_SHA1:
+        return 40;
+    default:
+        return 0;
+    }
+}
+
+quint32 FtpChecksum::crc32c(quint32 crc, const char *data, qint64 len)
+{
+    const uchar *p = (const uchar *)data;
+
+    crc = ~crc;
+
+#ifdef FTP_CRC32C_HW
+#if defined(__x86_64__) || defined(_M_X64)
+    quint64 crc64 = crc;
+    while(len >= 8)
+    {
+        quint64 value;
+        memcpy(&value, p, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        p += 8;
+        len -= 8;
+    }
+    crc = (quint32)crc64;
+#endif
+    while(len >= 4)
+    {
+        quint32 value;
+        memcpy(&value, p, 4);
+        crc = _mm_crc32_u32(crc, value);
+        p += 4;
+        len -= 4;
+    }
+    while(len > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+#else
+    while(len >= 8)
+    {
+        quint32 lo = qFromLittleEndian<quint32>(p) ^ crc;
+        quint32 hi = qFromLittleEndian<quint32>(p + 4);
+
+        crc = s_crc32cTable[7][lo & 0xFF] ^ s_crc32cTable[6][(lo >> 8) & 0xFF]
+            ^ s_crc32cTable[5][(lo >> 16) & 0xFF] ^ s_crc32cTable[4][lo >> 24]
+            ^ s_crc32cTable[3][hi & 0xFF] ^ s_crc32cTable[2][(hi >> 8) & 0xFF]
+            ^ s_crc32cTable[1][(hi >> 16) & 0xFF] ^ s_crc32cTable[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while(len > 0)
+    {
+        crc = s_crc32cTable[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+#endif
+
+    return ~crc;
+}
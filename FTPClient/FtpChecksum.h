@@ -0,0 +1,59 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpChecksum.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Incremental checksum for transfer verification
+**********************************************************************/
+
+#ifndef FTPCHECKSUM_H
+#define FTPCHECKSUM_H
+#include <QString>
+#include <QByteArray>
+#include <QCryptographicHash>
+
+class FtpChecksum
+{
+public:
+    enum{
+        CHECKSUM_NONE = 0,
+        CHECKSUM_CRC32,     // XCRC / HASH CRC32
+        CHECKSUM_CRC32C,    // Castagnoli, manifest only
+        CHECKSUM_MD5,       // XMD5 / HASH MD5
+        CHECKSUM_SHA1       // XSHA1 / HASH SHA-1
+    };
+
+    explicit FtpChecksum(int algorithm = CHECKSUM_CRC32);
+    ~FtpChecksum();
+
+    void reset();
+    void addData(const char *data, qint64 len);
+
+    int algorithm() const;
+
+    // Lower case hex digest
+    QString hexResult() const;
+
+    // Name used by the HASH command, e.g. "SHA-1"
+    static QString algorithmName(int algorithm);
+
+    // Name of the legacy command, e.g. "XCRC", empty if none
+    static QString legacyCommand(int algorithm);
+
+    // Number of hex digits of a digest
+    static int hexLength(int algorithm);
+
+    // CRC32C, uses SSE4.2 crc32 instruction when the build targets it
+    static quint32 crc32c(quint32 crc, const char *data, qint64 len);
+
+private:
+    int m_algorithm;
+    quint32 m_crc;
+    QCryptographicHash *m_pHash;
+
+    // Disable copy, QCryptographicHash is not copyable
+    FtpChecksum(const FtpChecksum &);
+    FtpChecksum &operator=(const FtpChecksum &);
+};
+
+#endif // FTPCHECKSUM_H
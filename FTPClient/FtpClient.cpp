@@ -9,18 +9,97 @@ PURPOSE:        FTP client
 #include "FtpClient.h"
 #include <QFileInfo>
 #include <QDir>
+#include <QDirIterator>
 #include "QUtilityBox.h"
+#include "FtpTarArchive.h"
+#include "FtpCompressDevice.h"
+#include "FtpHashDevice.h"
+#include "FtpFxpTransfer.h"
+#include "FtpTransferJournal.h"
+#include "FtpHotFolder.h"
+#include "FtpConnector.h"
+#include "FtpDataTransfer.h"
+#include "FtpChecksum.h"
+#include "FtpPlainSession.h"
+#include "FtpTlsSession.h"
+#include "FtpRemoteBatch.h"
+#include "FtpListenerPool.h"
+#include <QTextStream>
+#include <QRegExp>
+
+#ifdef Q_OS_WIN
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
 
 
 FtpClient::FtpClient(QObject *parent):
+    QObject(parent),
     m_ftp(NULL),
     m_pUrl(new QUrl),
+    m_tlsMode(TLS_NONE),
+    m_tlsVerifyPeer(true),
+    m_pConnector(NULL),
     m_pFile(NULL),
     m_connectedFlag(false),
-    m_putDirFlag(false)
+    m_cancelFlag(false),
+    m_pJournal(new FtpTransferJournal(this)),
+    m_currentJournalId(0),
+    m_pHotFolder(new FtpHotFolder(this)),
+    m_featCmdId(-1),
+    m_packSmallFiles(false),
+    m_packThreshold(FTP_DEFAULT_PACK_THRESHOLD),
+    m_pArchive(NULL),
+    m_archivePutId(-1),
+    m_archiveRequeued(false),
+    m_manifestPutId(-1),
+    m_compressMode(COMPRESS_NONE),
+    m_compressLevel(FtpCompressDevice::COMPRESS_DEFAULT_LEVEL),
+    m_pCompress(NULL),
+    m_modeZCmdId(-1),
+    m_modeZRefused(false),
+    m_verifyAlgorithm(FtpChecksum::CHECKSUM_NONE),
+    m_pHashDevice(NULL),
+    m_downloadBatchFlag(false),
+    m_batchTotalBytes(0),
+    m_batchDoneBytes(0),
+    m_batchFileCount(0),
+    m_currentGetSize(-1),
+    m_transferCmdId(-1),
+    m_transferRequeued(false),
+    m_heldDirection(-1),
+    m_retryTimer(this),
+    m_retryAfterLogin(false),
+    m_connectFailures(0),
+    m_pDataTransfer(NULL),
+    m_mirrorIndex(0),
+    m_pBatch(NULL),
+    m_listCmdId(-1),
+    m_batchSessions(FtpRemoteBatch::BATCH_DEFAULT_SESSIONS),
+    m_listingTimer(this),
+    m_dataMode(FtpSession::DATA_MODE_PASSIVE),
+    m_pListenerPool(new FtpListenerPool(this)),
+    m_pHistory(new FtpTransferHistory(this))
 {
     m_statusMsg.clear();
     m_pUrl->setScheme("ftp");
+
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, SIGNAL(timeout()), this, SLOT(retryTransfer()));
+
+    m_listingTimer.setSingleShot(true);
+    m_listingTimer.setInterval(LISTING_REPORT_MSECS);
+    connect(&m_listingTimer, SIGNAL(timeout()), this, SLOT(reportListingGrowth()));
+
+    connect(m_pHotFolder, SIGNAL(filesReady(QStringList)), this, SLOT(dealHotFiles(QStringList)));
+    connect(m_pHotFolder, SIGNAL(dirCreated(QString)), this, SLOT(dealHotDir(QString)));
+
+    qRegisterMetaType<QUrlInfo>("QUrlInfo");
+    qRegisterMetaType<qint64>("qint64");
 }
 
 FtpClient::~FtpClient()
@@ -34,59 +113,334 @@ bool FtpClient::connectToServer()
 {
     bool ret = false;
 
-    if(NULL == m_ftp)
-    {
-        m_ftp = new QFtp(this);
-        connect(m_ftp, SIGNAL(commandFinished(int,bool)), this, SLOT(ftpCommandFinished(int,bool)));
-        connect(m_ftp, SIGNAL(listInfo(QUrlInfo)), this, SLOT(addToList(QUrlInfo)));
-        connect(m_ftp, SIGNAL(dataTransferProgress(qint64,qint64)),
-                this, SLOT(updateDataTransferProgress(qint64,qint64)));
-        connect(m_ftp, SIGNAL(stateChanged(int)),
-                this, SLOT(dealStateChanged(int)));
-    }
-
     if (!m_pUrl->isValid() || m_pUrl->scheme().toLower() != QLatin1String("ftp"))
     {
         return ret;
     }
-    else
-    {
-        m_ftp->connectToHost(m_pUrl->host(), m_pUrl->port());
 
-        if (!m_pUrl->userName().isEmpty())
-        {
-            m_ftp->login(QUrl::fromPercentEncoding(m_pUrl->userName().toLatin1()), m_pUrl->password());
-        }
-        else
+    m_connectTimer.start();
+
+    // Reconnect goes straight to the address that won, no lookup
+    if(NULL != m_ftp)
+    {
+        // TLS mode changed since the last connect
+        if((TLS_EXPLICIT == m_tlsMode) != (NULL != qobject_cast<FtpTlsSession *>(m_ftp)))
         {
-            m_ftp->login();
+            m_ftp->disconnect(this);
+            m_ftp->abort();
+            m_ftp->deleteLater();
+            createFtp();
+            failOperations(-1, tr("Session replaced"));
+
+            // Ids of the old session mean nothing to the new one
+            m_featCmdId = -1;
+            m_listCmdId = -1;
+            m_transferCmdId = -1;
+            m_modeZCmdId = -1;
         }
 
-        if (!m_pUrl->path().isEmpty())
+        m_connectMetrics = tr("cached address");
+        startSession(m_serverAddress.isNull() ? m_pUrl->host() : m_serverAddress.toString());
+
+        return true;
+    }
+
+    if(NULL == m_pConnector)
+    {
+        m_pConnector = new FtpConnector(this);
+        connect(m_pConnector, SIGNAL(finished(bool)), this, SLOT(dealConnectorFinished(bool)));
+    }
+
+    // QFtp is created once an address answered, until then
+    // requests see m_ftp == NULL and do nothing
+    m_pConnector->start(m_pUrl->host(), m_pUrl->port());
+
+    m_statusMsg = tr("Resolving %1...").arg(m_pUrl->host());
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    ret = true;
+
+    return ret;
+}
+
+void FtpClient::dealConnectorFinished(bool ok)
+{
+    if(!ok)
+    {
+        m_statusMsg = tr("Unable to connect to the FTP server "
+                         "at %1: %2")
+                .arg(m_pUrl->host())
+                .arg(m_pConnector->errorString());
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+        emit connectedStatus(false);
+
+        // Cached addresses may be stale, the next attempt resolves again
+        if(m_pConnector->fromCache())
         {
-            m_ftp->cd(m_pUrl->path());
+            FtpConnector::invalidate(m_pUrl->host());
         }
-        else
+
+        // A retry waits for this connection
+        if(-1 != m_retry.direction)
         {
-            m_ftp->cd("/");
+            int errorClass = FtpRetryPolicy::ERROR_TRANSIENT;
+
+            m_connectFailures++;
+            m_retryAfterLogin = false;
+
+            // Host not found: only another mirror is worth a try
+            if(0 == m_pConnector->candidateCount())
+            {
+                if(m_mirrorHosts.isEmpty())
+                {
+                    errorClass = FtpRetryPolicy::ERROR_PERMANENT;
+                }
+                m_connectFailures = qMax<int>(m_connectFailures, FtpRetryPolicy::RETRY_FAILOVER_ATTEMPTS);
+            }
+
+            if(!scheduleRetry(m_retry.direction, m_retry.compressed,
+                              errorClass, m_pConnector->errorString()))
+            {
+                abandonRetry();
+            }
         }
 
-        ret = true;
+        return;
     }
 
-    return ret;
+    m_serverAddress = m_pConnector->address();
+    m_connectMetrics = tr("resolve %1 ms%2, race %3 ms, %4 of %5 addresses tried")
+            .arg(m_pConnector->resolveMsecs())
+            .arg(m_pConnector->fromCache() ? tr(" (cached)") : QString())
+            .arg(m_pConnector->raceMsecs())
+            .arg(m_pConnector->attemptCount())
+            .arg(m_pConnector->candidateCount());
+
+    // A race won by the first address took one TCP handshake, that is
+    // one round trip. Later attempts include their head start delays
+    if(1 == m_pConnector->attemptCount())
+    {
+        m_socketTuning.setMeasuredRoundTripMsecs((int)m_pConnector->raceMsecs());
+    }
+
+    if(NULL == m_ftp)
+    {
+        createFtp();
+    }
+    else
+    {
+        m_ftp->setSocketTuning(m_socketTuning);
+    }
+
+    startSession(m_serverAddress.toString());
+}
+
+void FtpClient::createFtp()
+{
+    if(TLS_EXPLICIT == m_tlsMode)
+    {
+        // Certificate is checked against the name, not the raced address
+        m_ftp = new FtpTlsSession(m_pUrl->host(), m_tlsVerifyPeer, this);
+    }
+    else
+    {
+        m_ftp = new FtpPlainSession(this);
+    }
+
+    m_ftp->setListenerPool(m_pListenerPool);
+    m_ftp->setDataMode(m_dataMode);
+    m_ftp->setSocketTuning(m_socketTuning);
+
+    connect(m_ftp, SIGNAL(commandFinished(int,bool)), this, SLOT(ftpCommandFinished(int,bool)));
+    connect(m_ftp, SIGNAL(listInfo(QUrlInfo)), this, SLOT(addToList(QUrlInfo)));
+    connect(m_ftp, SIGNAL(dataTransferProgress(qint64,qint64)),
+            this, SLOT(updateDataTransferProgress(qint64,qint64)));
+    connect(m_ftp, SIGNAL(stateChanged(int)),
+            this, SLOT(dealStateChanged(int)));
+    connect(m_ftp, SIGNAL(rawCommandReply(int,QString)),
+            this, SLOT(dealRawCommandReply(int,QString)));
+    connect(m_ftp, SIGNAL(commandStarted(int)), this, SLOT(traceCommandStarted(int)));
+}
+
+void FtpClient::startSession(const QString &hostAddress)
+{
+    m_ftp->connectToHost(hostAddress, m_pUrl->port());
+
+    // Uploads left over by a crash are resumed after login
+    if(!m_pJournal->isOpen())
+    {
+        m_pJournal->open(FtpTransferJournal::defaultPath(m_pUrl->host(), m_pUrl->port(),
+                                                         m_pUrl->userName()));
+    }
+
+    // A mirror keeps its own history
+    QString historyPath = FtpTransferHistory::defaultPath(m_pUrl->host(), m_pUrl->port());
+    if(!m_pHistory->isOpen() || m_pHistory->path() != historyPath)
+    {
+        m_pHistory->open(historyPath);
+    }
+
+    if (!m_pUrl->userName().isEmpty())
+    {
+        m_ftp->login(QUrl::fromPercentEncoding(m_pUrl->userName().toLatin1()), m_pUrl->password());
+    }
+    else
+    {
+        m_ftp->login();
+    }
+
+    // A new session may get another server behind the name
+    m_modeZRefused = false;
+
+    // Server features from cache, otherwise ask FEAT once
+    if(m_capabilities.load(m_pUrl->host(), m_pUrl->port()))
+    {
+        m_statusMsg = tr("Cached features of %1: %2")
+                .arg(m_pUrl->host())
+                .arg(m_capabilities.toString());
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+        emit capabilitiesChanged();
+    }
+
+    if (!m_pUrl->path().isEmpty())
+    {
+        m_ftp->cd(m_pUrl->path());
+    }
+    else
+    {
+        m_ftp->cd("/");
+    }
+
+    // After the cd, a refused FEAT would drop it
+    if(!m_capabilities.isValid())
+    {
+        m_featCmdId = queueRawCommand("FEAT");
+    }
+}
+
+void FtpClient::dropConnection()
+{
+    clearDataTransfer();
+
+    if(NULL != m_ftp)
+    {
+        // Its remaining signals would report the failure again
+        m_ftp->disconnect(this);
+        m_ftp->abort();
+        m_ftp->close();
+        m_ftp->deleteLater();
+        m_ftp = NULL;
+    }
+
+    // After m_ftp is gone, operations started from their slots fail too
+    failOperations(-1, tr("Connection dropped"));
+
+    m_connectedFlag = false;
+    m_serverAddress.clear();
+    m_capabilities.clear();
+    m_featCmdId = -1;
+    m_listCmdId = -1;
+    m_transferCmdId = -1;
+    m_modeZCmdId = -1;
+    m_rawCommandText.clear();
+    m_pendingVerify.clear();
+
+    // Their SIZE replies will not come, upload them again
+    QList<struct File_Info> resumed = m_resumeSizeCmds.values();
+    for(int i = resumed.size() - 1; i >= 0; i--)
+    {
+        m_uploadFileQueue.prepend(resumed.at(i));
+    }
+    m_resumeSizeCmds.clear();
+
+    m_trace.record(FtpTrace::TRACE_EVENT, -1, 0, "Connection dropped");
+
+    // Emit signal
+    emit connectedStatus(false);
 }
 
 bool FtpClient::disconnectFromServer()
 {
     bool ret = false;
 
+    if(NULL != m_pConnector)
+    {
+        m_pConnector->abort();
+    }
+
+    m_retryTimer.stop();
+    m_retryAfterLogin = false;
+    m_connectFailures = 0;
+
+    // No QFtp command is left to close the file of a resumed transfer
+    if(NULL != m_pDataTransfer && NULL != m_pFile)
+    {
+        m_pFile->close();
+        delete m_pFile;
+        m_pFile = NULL;
+    }
+    clearDataTransfer();
+    m_retry = Retry_Info();
+    m_cancelFlag = false;
+
     if (NULL != m_ftp)
     {
         m_ftp->abort();
         m_ftp->close();
         m_ftp->deleteLater();
         m_ftp = NULL;
+        failOperations(-1, tr("Disconnected"));
+
+        if(NULL != m_pArchive)
+        {
+            m_pArchive->close();
+            m_pArchive->deleteLater();
+            m_pArchive = NULL;
+        }
+        m_archivePutId = -1;
+        m_manifestPutId = -1;
+
+        if(NULL != m_pCompress)
+        {
+            m_pCompress->close();
+            delete m_pCompress;
+            m_pCompress = NULL;
+        }
+        m_capabilities.clear();
+        m_featCmdId = -1;
+        m_listCmdId = -1;
+        m_transferCmdId = -1;
+        m_modeZCmdId = -1;
+
+        delete m_pHashDevice;
+        m_pHashDevice = NULL;
+        m_pendingVerify.clear();
+        m_heldDirection = -1;
+
+        m_remoteMeta.clear();
+        m_sizeCmds.clear();
+        m_mdtmCmds.clear();
+        m_downloadFileQueue.clear();
+        m_downloadBatchFlag = false;
+
+        m_rawCommandText.clear();
+
+        // Unfinished entries stay in the journal for the next connection
+        if(0 != m_currentJournalId)
+        {
+            m_pJournal->setState(m_currentJournalId, FtpTransferJournal::STATE_FAILED);
+            m_currentJournalId = 0;
+        }
+        m_pJournal->close();
+        m_resumeSizeCmds.clear();
+        m_uploadFileQueue.clear();
+        m_trace.record(FtpTrace::TRACE_EVENT, -1, 0, "Disconnect");
 
         m_statusMsg = tr("Disconnected from FTP server %1...")
                 .arg(m_pUrl->host());
@@ -106,11 +460,47 @@ void FtpClient::ftpCommandFinished(int commandId, bool error)
     //qDebug() << "ftpCommandFinished commandId=" << commandId;
     //qDebug() << "ftpCommandFinished m_ftp->currentCommand()=" << m_ftp->currentCommand();
 
+    m_trace.record(FtpTrace::TRACE_EVENT, commandId, 0,
+                   error ? QString("Failed: %1").arg(m_ftp->errorString()) : QString("Done"));
+
+    // Only sessions that open data connections themselves can time them
+    if(QFtp::Get == m_ftp->currentCommand() || QFtp::Put == m_ftp->currentCommand()
+            || QFtp::List == m_ftp->currentCommand())
+    {
+        recordDataSetup(m_ftp->dataMode(), m_ftp->dataSetupMsecs());
+    }
+
+    // QFtp drops the commands queued behind a failed one without a word.
+    // What waited for their replies goes on once the failure was handled
+    if(error && dropQueuedCommands(commandId))
+    {
+        QTimer::singleShot(0, this, SLOT(continueQueues()));
+    }
+
+    // Operations answer on their own handle, the switch is for the rest
+    if(finishOperation(commandId, error))
+    {
+        return;
+    }
+
     switch(m_ftp->currentCommand())
     {
     case QFtp::ConnectToHost:
         if (error)
         {
+            m_connectFailures++;
+
+            // A retry waits for this connection, keep the queues
+            if(-1 != m_retry.direction)
+            {
+                if(!scheduleRetry(m_retry.direction, m_retry.compressed,
+                                  FtpRetryPolicy::ERROR_TRANSIENT, m_ftp->errorString()))
+                {
+                    abandonRetry();
+                }
+                break;
+            }
+
             m_statusMsg = tr("Unable to connect to the FTP server "
                                         "at %1. Please check that the host name is correct.")
                                      .arg(m_pUrl->host());
@@ -122,6 +512,14 @@ void FtpClient::ftpCommandFinished(int commandId, bool error)
         break;
 
     case QFtp::Login:
+        // Listeners are open before the first transfer asks for one
+        if(!error && FtpSession::DATA_MODE_ACTIVE == m_dataMode)
+        {
+            QHostAddress localAddress = m_ftp->localAddress();
+
+            m_pListenerPool->prepare(localAddress.isNull() ? FtpListenerPool::routeAddress(m_serverAddress)
+                                                           : localAddress);
+        }
         break;
 
     case QFtp::Mkdir:
@@ -134,64 +532,92 @@ void FtpClient::ftpCommandFinished(int commandId, bool error)
         break;
 
     case QFtp::Get:
-        if (error)
-        {
-            m_statusMsg = tr("Canceled download of %1")
-                    .arg(m_pFile->fileName());
+    {
+        bool compressed = (NULL != m_pCompress);
 
-            m_pFile->close();
-            m_pFile->remove();
-        }
-        else
-        {
-            m_statusMsg = tr("Downloaded at %1")
-                    .arg(m_pFile->fileName());
+        m_transferCmdId = -1;
 
-            m_pFile->close();
+        if (!finishCompression())
+        {
+            error = true;
         }
 
-        // Emit status message
-        emit updateStatusMsg(m_statusMsg);
+        finishHashing(error);
 
-        delete m_pFile;
-        m_pFile = NULL;
+        // Partial file is kept, a plain download continues at its end.
+        // Not when the user canceled it
+        if (error && !m_cancelFlag && scheduleRetry(FtpDataTransfer::DIRECTION_GET, compressed,
+                                   FtpRetryPolicy::classifyError(m_ftp->error(), m_ftp->errorString()),
+                                   m_ftp->errorString()))
+        {
+            break;
+        }
+
+        finishGet(error);
 
         break;
+    }
 
     case QFtp::Put:
+    {
         refreshList();
 
-        if (error)
+        if(commandId == m_archivePutId || commandId == m_manifestPutId)
         {
-            m_statusMsg = tr("Failed to upload of %1")
-                    .arg(m_pFile->fileName());
+            finishArchiveUpload(commandId, error);
+            break;
         }
-        else
+
+        bool compressed = (NULL != m_pCompress);
+
+        m_transferCmdId = -1;
+
+        finishCompression();
+        finishHashing(error);
+
+        if (error && scheduleRetry(FtpDataTransfer::DIRECTION_PUT, compressed,
+                                   FtpRetryPolicy::classifyError(m_ftp->error(), m_ftp->errorString()),
+                                   m_ftp->errorString()))
         {
-            m_statusMsg = tr("Uploaded %1 to server")
-                    .arg(m_pFile->fileName());
+            break;
         }
 
-        // Emit status message
-        emit updateStatusMsg(m_statusMsg);
+        finishPut(error);
 
-        m_pFile->close();
-        delete m_pFile;
-        m_pFile = NULL;
+        break;
+    }
+
+    case QFtp::List:
+        m_listCmdId = -1;
+
+        // Rows left since the last report, then drop the growth slack
+        m_listingTimer.stop();
+        m_listing.squeeze();
+        reportListingGrowth();
 
-        // Check upload queue, if not empty send out the files in queue
-        if(false == processUploadQueue() && m_putDirFlag)
+        if(!m_listGlob.isEmpty())
         {
-            // Reset flag
-            m_putDirFlag = false;
+            // Not every server expands globs, the widget filters the full list
+            if(error)
+            {
+                m_statusMsg = tr("Server did not list matches of %1, listing all")
+                        .arg(m_listGlob);
 
-            // file upload complete, go back to parent dir
-            cdToParent();
-        }
+                // Emit status message
+                emit updateStatusMsg(m_statusMsg);
+
+                refreshList();
+                break;
+            }
 
+            m_listGlob.clear();
+        }
         break;
 
-    case QFtp::List:
+    case QFtp::RawCommand:
+        // Replies came through dealRawCommandReply. Transfers waiting for
+        // them are queued here, where a refused command can not drop them
+        continueQueues();
         break;
 
     default:
@@ -199,346 +625,2978 @@ void FtpClient::ftpCommandFinished(int commandId, bool error)
     }
 }
 
-void FtpClient::updateDataTransferProgress(qint64 readBytes, qint64 totalBytes)
+void FtpClient::finishGet(bool error)
 {
-    int progress = 100 * readBytes / totalBytes;
+    recordTransfer(FtpTransferHistory::DIRECTION_GET, error);
+    m_cancelFlag = false;
 
-    // Emit signal
-    emit updateProgressVal(progress);
-}
+    if (error)
+    {
+        m_statusMsg = tr("Canceled download of %1")
+                .arg(m_pFile->fileName());
 
-void FtpClient::dealStateChanged(int state)
-{
-    m_statusMsg.clear();
+        m_pFile->close();
+        m_pFile->remove();
+    }
+    else
+    {
+        m_statusMsg = tr("Downloaded at %1")
+                .arg(m_pFile->fileName());
 
-    switch(state)
+        // Drop preallocated space the server did not fill
+        if(m_pFile->size() > m_pFile->pos())
+        {
+            m_pFile->resize(m_pFile->pos());
+        }
+
+        m_pFile->close();
+
+        setFileModifiedTime(m_pFile->fileName(), m_currentGetMtime);
+    }
+
+    if(m_retry.retries > 0)
     {
-    case QFtp::Unconnected:
-        m_connectedFlag = false;
+        m_statusMsg.append(tr(" after %1 retries").arg(m_retry.retries));
+        if(error)
+        {
+            m_retryStats.givenUp++;
+        }
+        else
+        {
+            m_retryStats.recovered++;
+        }
+    }
+    m_retry = Retry_Info();
 
-        m_statusMsg = tr("Disconnected from FTP server %1...")
-                .arg(m_pUrl->host());
-        break;
-    case QFtp::HostLookup:
-        break;
-    case QFtp::Connecting:
-        m_statusMsg = tr("Connecting to FTP server %1...")
-                .arg(m_pUrl->host());
-        break;
-    case QFtp::Connected:
-        m_connectedFlag = true;
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
 
-        m_statusMsg = tr("Connected to FTP server %1...")
-                .arg(m_pUrl->host());
-        break;
-    case QFtp::LoggedIn:
-        m_statusMsg = tr("Logged onto %1")
-                .arg(m_pUrl->host());
-        break;
-    case QFtp::Closing:
-        m_connectedFlag = false;
-//        m_statusMsg = tr("Closing FTP server %1...")
-//                .arg(m_pUrl->host());
-        break;
-    default:
-        break;
+    delete m_pFile;
+    m_pFile = NULL;
+
+    if(m_downloadBatchFlag)
+    {
+        m_batchDoneBytes += qMax<qint64>(m_currentGetSize, 0);
     }
 
-    //Emit signal
-    emit connectedStatus(m_connectedFlag);
+    // Not a total for whatever transfer comes next
+    m_currentGetSize = -1;
+    m_currentGetMtime = QDateTime();
 
-    if(!m_statusMsg.isEmpty())
+    // A failed checksum command would drop the next get, continueQueues
+    // goes on once its reply is in
+    if(!m_pendingVerify.isEmpty())
     {
-        emit updateStatusMsg(m_statusMsg);
+        m_heldDirection = FtpDataTransfer::DIRECTION_GET;
+        return;
     }
+
+    continueAfterGet();
 }
 
-void FtpClient::addToList(const QUrlInfo &urlInfo)
+void FtpClient::continueAfterGet()
 {
+    if(m_downloadBatchFlag)
+    {
+        processDownloadQueue();
+    }
+
+    // Hot folder uploads queued while downloading
+    if(isTransferIdle())
+    {
+        processUploadQueue();
+    }
+}
+
+void FtpClient::finishPut(bool error)
+{
+    recordTransfer(FtpTransferHistory::DIRECTION_PUT, error);
+
+    if(0 != m_currentJournalId)
+    {
+        m_pJournal->setState(m_currentJournalId, error ? FtpTransferJournal::STATE_FAILED
+                                                       : FtpTransferJournal::STATE_DONE);
+        m_currentJournalId = 0;
+    }
+
+    if (error)
+    {
+        m_statusMsg = tr("Failed to upload of %1")
+                .arg(m_pFile->fileName());
+    }
+    else
+    {
+        m_statusMsg = tr("Uploaded %1 to server")
+                .arg(m_pFile->fileName());
+    }
+
+    if(m_retry.retries > 0)
+    {
+        m_statusMsg.append(tr(" after %1 retries").arg(m_retry.retries));
+        if(error)
+        {
+            m_retryStats.givenUp++;
+        }
+        else
+        {
+            m_retryStats.recovered++;
+        }
+    }
+    m_retry = Retry_Info();
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    m_pFile->close();
+    delete m_pFile;
+    m_pFile = NULL;
+
+    // Next put waits for the checksum reply, see finishGet
+    if(!m_pendingVerify.isEmpty())
+    {
+        m_heldDirection = FtpDataTransfer::DIRECTION_PUT;
+        return;
+    }
+
+    continueUploadQueue();
+}
+
+void FtpClient::continueUploadQueue()
+{
+    // Check upload queue, if not empty send out the files in queue
+    if(false == processUploadQueue())
+    {
+        QString retryStats = takeRetryStats() + takeDataSetupStats();
+
+        if(!retryStats.isEmpty())
+        {
+            m_statusMsg = tr("Upload queue done%1").arg(retryStats);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+
+        finishPutDir();
+    }
+}
+
+void FtpClient::finishPutDir()
+{
+    QString path = m_putDirReturnPath;
+
+    if(path.isEmpty())
+    {
+        return;
+    }
+
+    m_putDirReturnPath.clear();
+
+    // Not cdToParent(), the queue may have left the uploaded dir
+    cdTo(path);
+}
+
+void FtpClient::updateDataTransferProgress(qint64 readBytes, qint64 totalBytes)
+{
+    if(NULL != m_ftp && m_operations.contains(m_ftp->currentId()))
+    {
+        QPointer<FtpOperation> op = m_operations.value(m_ftp->currentId());
+
+        if(!op.isNull())
+        {
+            // Emit signal
+            emit op->progress(readBytes, totalBytes);
+        }
+        return;
+    }
+
+    // Archive is streamed as sequential device, QFtp does not know its size
+    if(totalBytes <= 0 && NULL != m_pArchive)
+    {
+        totalBytes = m_pArchive->totalSize();
+    }
+
+    // Server did not report a size, use the prefetched one. Only set
+    // while a download runs
+    if(totalBytes <= 0 && NULL != m_pFile && m_currentGetSize > 0)
+    {
+        totalBytes = m_currentGetSize;
+    }
+
+    if(m_downloadBatchFlag && m_batchTotalBytes > 0 && NULL != m_pFile)
+    {
+        qint64 doneBytes = m_batchDoneBytes + readBytes;
+
+        // Report at most 4 times per second
+        if(!m_batchReportTimer.isValid() || m_batchReportTimer.elapsed() >= 250)
+        {
+            int etaSecs = -1;
+            if(doneBytes > 0)
+            {
+                etaSecs = (int)(m_batchTimer.elapsed() * (m_batchTotalBytes - doneBytes) / doneBytes / 1000);
+            }
+
+            m_batchReportTimer.start();
+
+            // Emit signal
+            emit updateBatchProgress(doneBytes, m_batchTotalBytes, etaSecs);
+        }
+    }
+
+    if(totalBytes <= 0)
+    {
+        return;
+    }
+
+    int progress = 100 * qMin(readBytes, totalBytes) / totalBytes;
+
+    // Emit signal
+    emit updateProgressVal(progress);
+}
+
+void FtpClient::dealStateChanged(int state)
+{
+    m_statusMsg.clear();
+
+    m_trace.record(FtpTrace::TRACE_EVENT, -1, 0, QString("State %1").arg(state));
+
+    switch(state)
+    {
+    case QFtp::Unconnected:
+        m_connectedFlag = false;
+
+        m_statusMsg = tr("Disconnected from FTP server %1...")
+                .arg(m_pUrl->host());
+        break;
+    case QFtp::HostLookup:
+        break;
+    case QFtp::Connecting:
+        m_statusMsg = tr("Connecting to FTP server %1...")
+                .arg(m_pUrl->host());
+        break;
+    case QFtp::Connected:
+        m_connectedFlag = true;
+
+        m_statusMsg = tr("Connected to FTP server %1 (%2) in %3 ms, %4")
+                .arg(m_pUrl->host())
+                .arg(m_serverAddress.toString())
+                .arg(m_connectTimer.isValid() ? m_connectTimer.elapsed() : 0)
+                .arg(m_connectMetrics);
+
+        if(!m_ftp->securityInfo().isEmpty())
+        {
+            m_statusMsg.append(tr(", TLS %1").arg(m_ftp->securityInfo()));
+        }
+        break;
+    case QFtp::LoggedIn:
+        m_statusMsg = tr("Logged onto %1")
+                .arg(m_pUrl->host());
+
+        m_connectFailures = 0;
+
+        // Reconnected (or failed over) for a retry
+        if(m_retryAfterLogin)
+        {
+            m_retryAfterLogin = false;
+            restartTransfer();
+        }
+
+        // Queue held for a checksum reply the dropped connection lost
+        if(-1 != m_heldDirection)
+        {
+            continueQueues();
+        }
+
+        resumeJournal();
+
+        // Hot folder files that showed up while offline
+        if(isTransferIdle())
+        {
+            processUploadQueue();
+        }
+        break;
+    case QFtp::Closing:
+        m_connectedFlag = false;
+//        m_statusMsg = tr("Closing FTP server %1...")
+//                .arg(m_pUrl->host());
+        break;
+    default:
+        break;
+    }
+
+    //Emit signal
+    emit connectedStatus(m_connectedFlag);
+
+    if(!m_statusMsg.isEmpty())
+    {
+        emit updateStatusMsg(m_statusMsg);
+    }
+}
+
+void FtpClient::dealRawCommandReply(int replyCode, const QString &detail)
+{
+    if(NULL != m_ftp)
+    {
+        m_trace.record(FtpTrace::TRACE_REPLY, m_ftp->currentId(), replyCode, detail);
+    }
+
+    if(NULL != m_ftp && m_operations.contains(m_ftp->currentId()))
+    {
+        QPointer<FtpOperation> op = m_operations.value(m_ftp->currentId());
+
+        if(!op.isNull())
+        {
+            op->m_replyCode = replyCode;
+            op->m_replyText = detail;
+        }
+        return;
+    }
+
+    // Handled by the resumed transfer itself
+    if(NULL != m_ftp && NULL != m_pDataTransfer && m_pDataTransfer->ownsCommand(m_ftp->currentId()))
+    {
+        return;
+    }
+
+    // QFtp drops the get/put queued behind a refused MODE Z,
+    // dropQueuedCommands queues it again uncompressed
+    if(NULL != m_ftp && m_ftp->currentId() == m_modeZCmdId)
+    {
+        m_modeZCmdId = -1;
+
+        if(replyCode >= 400)
+        {
+            m_modeZRefused = true;
+
+            m_statusMsg = tr("MODE Z refused by %1, transfer uncompressed: %2 %3")
+                    .arg(m_pUrl->host())
+                    .arg(replyCode)
+                    .arg(detail);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+        return;
+    }
+
+    if(NULL != m_ftp && m_ftp->currentId() == m_featCmdId)
+    {
+        m_featCmdId = -1;
+
+        // 211 lists the features, 5xx means there are none. Other replies
+        // (421, 4xx) tell nothing about the server, the next login asks again
+        if(211 == replyCode)
+        {
+            m_capabilities.parseFeatReply(detail);
+        }
+        else if(replyCode >= 500)
+        {
+            m_capabilities.setFeatUnsupported();
+        }
+        else
+        {
+            m_statusMsg = tr("Features of %1 not known: %2 %3")
+                    .arg(m_pUrl->host())
+                    .arg(replyCode)
+                    .arg(detail);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+
+            return;
+        }
+
+        // Remember, so later logins skip the round trip
+        m_capabilities.save(m_pUrl->host(), m_pUrl->port());
+
+        m_statusMsg = tr("Features of %1: %2")
+                .arg(m_pUrl->host())
+                .arg(m_capabilities.toString());
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+        emit capabilitiesChanged();
+
+        return;
+    }
+
+    if(NULL != m_ftp && m_sizeCmds.contains(m_ftp->currentId()))
+    {
+        QString name = m_sizeCmds.take(m_ftp->currentId());
+
+        // "213 <size>"
+        m_remoteMeta[name].size = (213 == replyCode) ? detail.trimmed().toLongLong() : -1;
+
+        return;
+    }
+
+    if(NULL != m_ftp && m_mdtmCmds.contains(m_ftp->currentId()))
+    {
+        QString name = m_mdtmCmds.take(m_ftp->currentId());
+        QDateTime mtime;
+
+        // "213 YYYYMMDDHHMMSS[.sss]" in UTC
+        if(213 == replyCode)
+        {
+            mtime = QDateTime::fromString(detail.trimmed().left(14), "yyyyMMddhhmmss");
+            mtime.setTimeSpec(Qt::UTC);
+        }
+
+        m_remoteMeta[name].mtime = mtime;
+
+        return;
+    }
+
+    if(NULL != m_ftp && m_resumeSizeCmds.contains(m_ftp->currentId()))
+    {
+        struct File_Info info = m_resumeSizeCmds.take(m_ftp->currentId());
+        QFileInfo localInfo(info.dirPath + "/" + info.fileName);
+
+        // Upload finished before the crash but its done record was lost
+        if(213 == replyCode && detail.trimmed().toLongLong() == localInfo.size())
+        {
+            m_pJournal->setState(info.journalId, FtpTransferJournal::STATE_DONE);
+
+            m_statusMsg = tr("%1 is already complete on server").arg(info.fileName);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+        else
+        {
+            m_uploadFileQueue.prepend(info);
+        }
+
+        return;
+    }
+
+    if(NULL != m_ftp && m_pendingVerify.contains(m_ftp->currentId()))
+    {
+        struct Verify_Info info = m_pendingVerify.take(m_ftp->currentId());
+
+        if(replyCode >= 400)
+        {
+            m_statusMsg = tr("Server could not checksum %1: %2")
+                    .arg(info.fileName)
+                    .arg(detail);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+        else
+        {
+            reportVerifyResult(info.fileName, info.localDigest, parseDigest(detail, info.algorithm));
+        }
+
+        return;
+    }
+
+    m_statusMsg = tr("Server reply %1: %2")
+            .arg(replyCode)
+            .arg(detail);
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    if(NULL != m_ftp)
+    {
+        // Emit signal
+        emit rawCommandReply(m_ftp->currentId(), replyCode, detail);
+    }
+}
+
+void FtpClient::addToList(const QUrlInfo &urlInfo)
+{
+    // Entries of a listAsync belong to its operation, not the server list
+    if(NULL != m_ftp && m_operations.contains(m_ftp->currentId()))
+    {
+        QPointer<FtpOperation> op = m_operations.value(m_ftp->currentId());
+
+        if(!op.isNull())
+        {
+            op->m_entries.append(urlInfo);
+        }
+        return;
+    }
+
+    // Servers may list a name twice, the store keeps the first
+    if(!m_listing.add(urlInfo))
+    {
+        return;
+    }
+
+    // One report per batch of rows, not one queued signal per name
+    if(!m_listingTimer.isActive())
+    {
+        m_listingTimer.start();
+    }
+
+    // Emit signal
+    emit updateListInfo(urlInfo);
+}
+
+void FtpClient::reportListingGrowth()
+{
+    // Emit signal
+    emit listingGrown(m_listing.size());
+}
+
+void FtpClient::setUserInfo(QString user, QString pwd)
+{
+    m_pUrl->setUserName(user);
+    m_pUrl->setPassword(pwd);
+}
+
+void FtpClient::setHostPort(QString ip, int port)
+{
+    m_primaryHost = ip;
+    m_mirrorIndex = 0;
+
+    m_pUrl->setHost(ip);
+    m_pUrl->setPort(port);
+}
+
+void FtpClient::setPath(QString path)
+{
+    m_pUrl->setPath(path);
+}
+
+void FtpClient::get(QString fileName, QString dir)
+{
+    if (NULL == m_ftp)
+    {
+        return;
+    }
+
+    reConnectToServer();
+
+    // In gzip file mode <name>.gz is stored unpacked as <name>
+    QString localName = fileName;
+    if(COMPRESS_GZIP_FILE == m_compressMode && localName.endsWith(".gz"))
+    {
+        localName.chop(3);
+    }
+
+    QString fullFileName = "";
+    fullFileName.append(dir);
+    fullFileName.append("/");
+    fullFileName.append(localName);
+
+    if (QFile::exists(fullFileName))
+    {
+        m_statusMsg = tr("There already exists a file called %1 in the current directory")
+                .arg(localName);
+    }
+    else
+    {
+        struct Remote_Meta meta = m_remoteMeta.value(fileName);
+
+        m_currentGetSize = meta.size;
+        m_currentGetMtime = meta.mtime;
+        m_transferRemoteName = fileName;
+        m_transferTimer.start();
+        m_transferError.clear();
+
+        m_pFile = new QFile(fullFileName);
+        if (!m_pFile->open(QIODevice::WriteOnly))
+        {
+            m_statusMsg = tr("Unable to save the file %1: %2")
+                    .arg(fullFileName)
+                    .arg(m_pFile->errorString());
+
+            delete m_pFile;
+            m_pFile = NULL;
+            m_currentGetSize = -1;
+            m_currentGetMtime = QDateTime();
+        }
+        else
+        {
+            QString remoteName = fileName;
+            QIODevice *target = beginHashing(m_pFile, QIODevice::WriteOnly, localName, fileName);
+
+            // Plain files are not unpacked in gzip file mode
+            if(localName != fileName || COMPRESS_MODE_Z == m_compressMode)
+            {
+                target = beginCompression(target, QIODevice::WriteOnly, remoteName);
+            }
+
+            // Size on server is the local size unless data is unpacked
+            if(NULL == m_pCompress && m_currentGetSize > 0)
+            {
+                preallocateFile(m_pFile, m_currentGetSize);
+            }
+
+            int getId = m_ftp->get(fileName, target);
+
+            m_transferCmdId = getId;
+            m_transferInfo = File_Info();
+            m_transferInfo.fileName = fileName;
+            m_transferInfo.dirPath = dir;
+            m_transferRequeued = false;
+
+            if(NULL != m_pHashDevice)
+            {
+                m_pHashDevice->setTrace(&m_trace, FtpTrace::TRACE_DATA_IN, getId);
+            }
+            endCompressionMode();
+
+            m_statusMsg = tr("Downloading %1...").arg(fileName);
+        }
+    }
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+}
+
+void FtpClient::getFiles(QStringList fileNames, QString dir)
+{
+    // SIZE is tried when FEAT is still unknown, most servers have it
+    bool prefetchSize = !m_capabilities.isValid() || m_capabilities.has(FtpCapabilities::CAP_SIZE);
+    bool prefetchMdtm = m_capabilities.has(FtpCapabilities::CAP_MDTM);
+    bool binaryType = false;
+
+    if (NULL == m_ftp || fileNames.isEmpty())
+    {
+        return;
+    }
+
+    reConnectToServer();
+
+    // QFtp sends the queued SIZE/MDTM commands back to back, downloads
+    // start when the last one finished (see continueQueues)
+    for(int i = 0; i < fileNames.size(); i++)
+    {
+        const QString &name = fileNames.at(i);
+        struct File_Info info;
+
+        info.fileName = name;
+        info.dirPath = dir;
+        m_downloadFileQueue.push_back(info);
+
+        if(m_remoteMeta.contains(name))
+        {
+            continue;
+        }
+
+        m_remoteMeta.insert(name, Remote_Meta());
+
+        // LIST already gave the size of plain files, links show their own
+        int listingId = m_listing.find(name);
+        if(m_listing.isFile(listingId) && m_listing.fileSize(listingId) >= 0)
+        {
+            m_remoteMeta[name].size = m_listing.fileSize(listingId);
+        }
+        else if(prefetchSize)
+        {
+            // QFtp sends TYPE I only with RETR, some servers refuse
+            // SIZE in ASCII mode ("550 SIZE not allowed in ASCII mode")
+            if(!binaryType)
+            {
+                queueRawCommand("TYPE I");
+                binaryType = true;
+            }
+
+            m_sizeCmds.insert(queueRawCommand(QString("SIZE %1").arg(name)), name);
+        }
+        if(prefetchMdtm)
+        {
+            m_mdtmCmds.insert(queueRawCommand(QString("MDTM %1").arg(name)), name);
+        }
+    }
+
+    if(m_sizeCmds.isEmpty() && m_mdtmCmds.isEmpty())
+    {
+        startDownloadBatch();
+    }
+}
+
+void FtpClient::put(QString fileName, QString dir)
+{
+    QByteArray data;
+
+    if (NULL == m_ftp)
+    {
+        return;
+    }
+
+    reConnectToServer();
+
+    QString fullFileName = "";
+    fullFileName.append(dir);
+    fullFileName.append("/");
+    fullFileName.append(fileName);
+
+    QFileInfo fileInfo(fullFileName);
+
+    // If it's a file
+    if(fileInfo.isFile())
+    {
+        if (!QFile::exists(fullFileName))
+        {
+            m_statusMsg = tr("No file called %1 in the current directory")
+                    .arg(fileName);
+        }
+        else
+        {
+            m_pFile = new QFile(fullFileName);
+            if (!m_pFile->open(QIODevice::ReadOnly))
+            {
+                m_statusMsg = tr("Unable to Open the file %1: %2")
+                        .arg(fullFileName).arg(m_pFile->errorString());
+            }
+            else
+            {
+                QString remoteName = fileName;
+                m_transferRemoteName = fileName;
+                m_transferTimer.start();
+                m_transferError.clear();
+                m_currentGetSize = -1;
+
+                QIODevice *source = beginHashing(m_pFile, QIODevice::ReadOnly, fileName, fileName);
+                source = beginCompression(source, QIODevice::ReadOnly, remoteName);
+
+                m_transferInfo = File_Info();
+                m_transferInfo.fileName = fileName;
+                m_transferInfo.dirPath = dir;
+                m_transferRequeued = false;
+
+                if(source == m_pFile)
+                {
+                    data = m_pFile->readAll();
+
+                    m_transferCmdId = m_ftp->put(data, remoteName);
+                }
+                else
+                {
+                    int putId = m_ftp->put(source, remoteName);
+
+                    m_transferCmdId = putId;
+                    if(NULL != m_pHashDevice)
+                    {
+                        m_pHashDevice->setTrace(&m_trace, FtpTrace::TRACE_DATA_OUT, putId);
+                    }
+                    endCompressionMode();
+                }
+
+                m_statusMsg = tr("Uploading %1...").arg(remoteName);
+            }
+        }
+    }
+    // If it's a directory
+    else if(fileInfo.isDir())
+    {
+        mkdir(fileName);
+        m_statusMsg = tr("Created directory %1").arg(fileName);
+
+        if(!putFilesInDir(fullFileName))
+        {
+        }
+    }
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+}
+
+void FtpClient::cancelDownload()
+{
+    if (NULL == m_ftp)
+    {
+        return;
+    }
+
+    // Files of a batch not started yet go too
+    m_downloadFileQueue.clear();
+
+    // Waiting for a retry, nothing runs
+    if(FtpDataTransfer::DIRECTION_GET == m_retry.direction && NULL == m_pDataTransfer
+            && (m_retryTimer.isActive() || m_retryAfterLogin))
+    {
+        m_retryTimer.stop();
+        m_retryAfterLogin = false;
+        abandonRetry();
+        return;
+    }
+
+    // Resumed download runs outside QFtp, no Get finishes it
+    if(NULL != m_pDataTransfer)
+    {
+        if(FtpDataTransfer::DIRECTION_GET == m_pDataTransfer->direction() && NULL != m_pFile)
+        {
+            clearDataTransfer();
+            finishGet(true);
+        }
+        return;
+    }
+
+    // Uploads read m_pFile, downloads write it
+    if(NULL == m_pFile || !(m_pFile->openMode() & QIODevice::WriteOnly))
+    {
+        return;
+    }
+
+    m_cancelFlag = true;
+    m_ftp->abort();
+
+    // Get was still queued, abort dropped it without a commandFinished.
+    // Else the running Get fails and finishGet removes the partial file,
+    // m_pFile and the devices wrapping it are in use until then
+    if(QFtp::Get != m_ftp->currentCommand())
+    {
+        finishCompression();
+        finishHashing(true);
+        finishGet(true);
+    }
+}
+
+void FtpClient::connectOrDisconnect()
+{
+    if (disconnectFromServer())
+    {
+        return;
+    }
+
+    connectToServer();
+}
+
+void FtpClient::cdTo(QString path)
+{
+    setPath(path);
+
+    // Prefetched metadata is per directory
+    m_remoteMeta.clear();
+
+    if(NULL != m_ftp)
+    {
+        reConnectToServer();
+        m_ftp->cd(path);
+    }
+}
+
+void FtpClient::cdToRoot()
+{
+    cdTo("/");
+}
+
+void FtpClient::cdToParent()
+{
+    QString path = m_pUrl->path();
+    path = path.left(path.lastIndexOf('/'));
+
+    qDebug() <<"cdToParent cdTo=" << path;
+    cdTo(path);
+}
+
+void FtpClient::mkdir(QString dir)
+{
+    if(NULL != m_ftp)
+    {
+       reConnectToServer();
+       m_ftp->mkdir(dir);
+    }
+}
+
+void FtpClient::setSmallFilePacking(bool enable, qint64 threshold, QString siteCmd)
+{
+    m_packSmallFiles = enable;
+    m_packThreshold = threshold;
+    m_unpackSiteCmd = siteCmd;
+}
+
+void FtpClient::setCompression(int mode, int level)
+{
+    m_compressMode = mode;
+    m_compressLevel = qBound(1, level, 9);
+}
+
+void FtpClient::setIntegrityCheck(int algorithm)
+{
+    m_verifyAlgorithm = algorithm;
+}
+
+bool FtpClient::loadChecksumManifest(QString path)
+{
+    bool ret = false;
+    QFile file(path);
+
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        m_statusMsg = tr("Unable to open checksum manifest %1: %2")
+                .arg(path)
+                .arg(file.errorString());
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+
+        return ret;
+    }
+
+    QTextStream in(&file);
+    QRegExp lineRx("^([0-9A-Fa-f]+)\\s+\\*?(.+)$");
+
+    m_manifestDigests.clear();
+    while(!in.atEnd())
+    {
+        QString line = in.readLine().trimmed();
+
+        if(lineRx.exactMatch(line))
+        {
+            QString name = QFileInfo(lineRx.cap(2)).fileName();
+            m_manifestDigests.insert(name, lineRx.cap(1).toLower());
+        }
+    }
+
+    m_statusMsg = tr("Loaded %1 checksums from %2")
+            .arg(m_manifestDigests.size())
+            .arg(path);
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    ret = true;
+
+    return ret;
+}
+
+FtpCapabilities FtpClient::capabilities() const
+{
+    return m_capabilities;
+}
+
+const FtpListingStore *FtpClient::listing() const
+{
+    return &m_listing;
+}
+
+void FtpClient::refreshCapabilities()
+{
+    if(NULL != m_ftp)
+    {
+        reConnectToServer();
+        m_featCmdId = queueRawCommand("FEAT");
+    }
+}
+
+int FtpClient::sendRawCommand(QString command)
+{
+    if(NULL == m_ftp)
+    {
+        return -1;
+    }
+
+    reConnectToServer();
+
+    return queueRawCommand(command);
+}
+
+void FtpClient::fxpFiles(QObject *dest, QStringList fileNames)
+{
+    FtpClient *destClient = qobject_cast<FtpClient *>(dest);
+
+    if(NULL == m_ftp || NULL == destClient || destClient == this
+            || destClient->thread() != thread())
+    {
+        m_statusMsg = tr("FXP needs two connected sessions");
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+
+        return;
+    }
+
+    FtpFxpTransfer *transfer = new FtpFxpTransfer(this, destClient, fileNames, this);
+
+    // Report through the signals of this client
+    connect(transfer, SIGNAL(statusMsg(QString)), this, SIGNAL(updateStatusMsg(QString)));
+    connect(transfer, SIGNAL(progressVal(int)), this, SIGNAL(updateProgressVal(int)));
+    connect(transfer, SIGNAL(finished(bool)), transfer, SLOT(deleteLater()));
+    connect(destClient, SIGNAL(destroyed()), transfer, SLOT(deleteLater()));
+
+    transfer->start();
+}
+
+void FtpClient::setTraceEnabled(bool enable)
+{
+    m_trace.setEnabled(enable);
+}
+
+void FtpClient::dumpTrace()
+{
+    // Emit signal
+    emit traceDumped(m_trace.dump());
+}
+
+void FtpClient::dumpHistory(int bucketSecs)
+{
+    // Records are written unbuffered, the report sees those of all sessions.
+    // Reading runs here in the engine thread, not in the widget
+
+    // Emit signal
+    emit historyDumped(FtpTransferHistory::report(bucketSecs));
+}
+
+void FtpClient::clearTrace()
+{
+    m_trace.clear();
+}
+
+void FtpClient::traceCommandStarted(int commandId)
+{
+    static const char *const commandNames[] = {
+        "None", "SetTransferMode", "SetProxy", "ConnectToHost", "Login", "Close",
+        "List", "Cd", "Get", "Put", "Remove", "Mkdir", "Rmdir", "Rename", "RawCommand"
+    };
+    QString text;
+
+    if(NULL == m_ftp)
+    {
+        return;
+    }
+
+    if(QFtp::RawCommand == m_ftp->currentCommand())
+    {
+        text = m_rawCommandText.take(commandId);
+    }
+    else if(m_ftp->currentCommand() >= QFtp::None && m_ftp->currentCommand() <= QFtp::RawCommand)
+    {
+        text = commandNames[m_ftp->currentCommand()];
+
+        if((QFtp::Get == m_ftp->currentCommand() || QFtp::Put == m_ftp->currentCommand())
+                && NULL != m_pFile)
+        {
+            text.append(" ").append(QFileInfo(m_pFile->fileName()).fileName());
+        }
+    }
+
+    m_trace.record(FtpTrace::TRACE_COMMAND, commandId, 0, text);
+}
+
+void FtpClient::setHotFolder(QString localDir, QString remoteDir)
+{
+    if(localDir.isEmpty())
+    {
+        if(m_pHotFolder->isActive())
+        {
+            m_statusMsg = tr("Stopped watching %1").arg(m_pHotFolder->rootDir());
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+
+        m_pHotFolder->stop();
+        return;
+    }
+
+    m_hotRemoteDir = remoteDir.isEmpty() ? m_pUrl->path() : remoteDir;
+
+    if(m_pHotFolder->start(localDir))
+    {
+        m_statusMsg = tr("Watching %1, new files go to %2")
+                .arg(m_pHotFolder->rootDir())
+                .arg(m_hotRemoteDir);
+    }
+    else
+    {
+        m_statusMsg = tr("Unable to watch %1").arg(localDir);
+    }
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+}
+
+void FtpClient::dealHotFiles(QStringList paths)
+{
+    QDir rootDir(m_pHotFolder->rootDir());
+
+    for(int i = 0; i < paths.size(); i++)
+    {
+        QFileInfo fileInfo(paths.at(i));
+        QString relativeDir = rootDir.relativeFilePath(fileInfo.absolutePath());
+        QString remoteDir = m_hotRemoteDir;
+
+        if("." != relativeDir)
+        {
+            remoteDir.append("/").append(relativeDir);
+        }
+
+        // Journaled like any queued upload
+        pushUploadQueue(fileInfo.fileName(), fileInfo.absolutePath(), remoteDir);
+    }
+
+    if(NULL != m_ftp && isTransferIdle())
+    {
+        processUploadQueue();
+    }
+}
+
+void FtpClient::dealHotDir(QString relativePath)
+{
+    if(NULL == m_ftp)
+    {
+        return;
+    }
+
+    reConnectToServer();
+
+    // Queued ahead of the uploads into it
+    m_ftp->mkdir(m_hotRemoteDir + "/" + relativePath);
+}
+
+void FtpClient::setRetryPolicy(int maxAttempts, int baseDelayMsecs, int maxDelayMsecs)
+{
+    m_retryPolicy.setMaxAttempts(maxAttempts);
+    m_retryPolicy.setDelays(baseDelayMsecs, maxDelayMsecs);
+}
+
+void FtpClient::setMirrors(QStringList hosts)
+{
+    m_mirrorHosts = hosts;
+    m_mirrorHosts.removeAll(m_primaryHost);
+    m_mirrorIndex = 0;
+}
+
+void FtpClient::setTls(int mode, bool verifyPeer)
+{
+    // Used by the session created on the next connect
+    m_tlsMode = (TLS_EXPLICIT == mode) ? TLS_EXPLICIT : TLS_NONE;
+    m_tlsVerifyPeer = verifyPeer;
+}
+
+void FtpClient::setDataMode(int mode)
+{
+    m_dataMode = qBound((int)FtpSession::DATA_MODE_PASSIVE, mode, (int)FtpSession::DATA_MODE_ACTIVE);
+
+    if(NULL != m_ftp)
+    {
+        m_ftp->setDataMode(m_dataMode);
+    }
+}
+
+void FtpClient::setListenerPoolSize(int size)
+{
+    m_pListenerPool->setSize(size);
+}
+
+void FtpClient::setSocketTuning(qint64 bandwidth, int roundTripMsecs, int notSentLowat, int queueDepth)
+{
+    m_socketTuning.setBandwidth(bandwidth);
+    m_socketTuning.setRoundTripMsecs(roundTripMsecs);
+    m_socketTuning.setNotSentLowat(notSentLowat);
+    m_socketTuning.setQueueDepth(queueDepth);
+
+    if(NULL != m_ftp)
+    {
+        m_ftp->setSocketTuning(m_socketTuning);
+    }
+
+    if(0 == m_socketTuning.bufferBytes())
+    {
+        return;
+    }
+
+    m_statusMsg = tr("Data connections use %1").arg(m_socketTuning.toString());
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+}
+
+void FtpClient::removeTree(QStringList names)
+{
+    FtpRemoteBatch *batch = createBatch();
+
+    if(NULL != batch)
+    {
+        batch->removeTree(m_pUrl->path(), names);
+    }
+}
+
+void FtpClient::renameFiles(QStringList fromNames, QStringList toNames)
+{
+    FtpRemoteBatch *batch = createBatch();
+
+    if(NULL != batch)
+    {
+        batch->renameFiles(m_pUrl->path(), fromNames, toNames);
+    }
+}
+
+void FtpClient::chmodTree(QStringList names, QString mode, bool recursive)
+{
+    FtpRemoteBatch *batch = createBatch();
+
+    if(NULL != batch)
+    {
+        batch->chmodTree(m_pUrl->path(), names, mode, recursive);
+    }
+}
+
+void FtpClient::setBatchSessions(int count)
+{
+    m_batchSessions = count;
+}
+
+FtpRemoteBatch *FtpClient::createBatch()
+{
+    if(NULL == m_ftp || !m_connectedFlag || NULL != m_pBatch)
+    {
+        m_statusMsg = (NULL != m_pBatch) ? tr("Another bulk operation is running")
+                                         : tr("Not connected");
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+
+        return NULL;
+    }
+
+    m_pBatch = new FtpRemoteBatch(this);
+    m_pBatch->setSessionCount(m_batchSessions);
+    m_pBatch->setDataMode(m_dataMode, m_pListenerPool);
+    m_pBatch->setServer(m_pUrl->host(),
+                        m_serverAddress.isNull() ? m_pUrl->host() : m_serverAddress.toString(),
+                        m_pUrl->port(),
+                        QUrl::fromPercentEncoding(m_pUrl->userName().toLatin1()),
+                        m_pUrl->password(),
+                        TLS_EXPLICIT == m_tlsMode, m_tlsVerifyPeer);
+
+    // Report through the signals of this client
+    connect(m_pBatch, SIGNAL(statusMsg(QString)), this, SIGNAL(updateStatusMsg(QString)));
+    connect(m_pBatch, SIGNAL(progressVal(int)), this, SIGNAL(updateProgressVal(int)));
+    connect(m_pBatch, SIGNAL(finished(bool)), this, SLOT(dealBatchFinished(bool)));
+
+    return m_pBatch;
+}
+
+void FtpClient::dealBatchFinished(bool ok)
+{
+    Q_UNUSED(ok);
+
+    m_pBatch->deleteLater();
+    m_pBatch = NULL;
+
+    // One refresh for the whole batch
+    if(NULL != m_ftp && m_connectedFlag)
+    {
+        refreshList();
+    }
+}
+
+bool FtpClient::scheduleRetry(int direction, bool compressed, int errorClass, const QString &reason)
+{
+    QString localPath = (NULL != m_pFile) ? m_pFile->fileName() : m_retry.localPath;
+    int delay = 0;
+
+    m_transferError = reason;
+
+    // First failure of this file
+    if(direction != m_retry.direction || localPath != m_retry.localPath)
+    {
+        m_retry = Retry_Info();
+        m_retry.direction = direction;
+        m_retry.localPath = localPath;
+        m_retry.remoteName = m_transferRemoteName;
+        m_retry.compressed = compressed;
+    }
+
+    clearDataTransfer();
+
+    if(!m_retryPolicy.shouldRetry(errorClass, m_retry.retries))
+    {
+        return false;
+    }
+
+    // Left over when QFtp dropped a queued get/put after a failed connect
+    delete m_pHashDevice;
+    m_pHashDevice = NULL;
+    delete m_pCompress;
+    m_pCompress = NULL;
+
+    if(NULL != m_pFile)
+    {
+        // Bytes written so far are the confirmed offset, not the preallocated size
+        if(FtpDataTransfer::DIRECTION_GET == direction && !compressed && m_pFile->isOpen())
+        {
+            m_pFile->resize(m_pFile->pos());
+        }
+
+        m_pFile->close();
+        delete m_pFile;
+        m_pFile = NULL;
+    }
+
+    delay = m_retryPolicy.delayMsecs(m_retry.retries);
+    m_retry.retries++;
+    m_retryStats.retries++;
+
+    m_statusMsg = tr("Transfer of %1 failed (%2), retry %3 of %4 in %5 ms")
+            .arg(QFileInfo(localPath).fileName())
+            .arg(reason)
+            .arg(m_retry.retries)
+            .arg(m_retryPolicy.maxAttempts())
+            .arg(delay);
+
+    m_trace.record(FtpTrace::TRACE_EVENT, -1, 0, m_statusMsg);
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    // Emit signal
+    emit transferRetried(QFileInfo(localPath).fileName(), m_retry.retries, delay);
+
+    m_retryTimer.start(delay);
+
+    return true;
+}
+
+void FtpClient::abandonRetry()
+{
+    // finishGet/finishPut close and report the file
+    if(NULL == m_pFile)
+    {
+        m_pFile = new QFile(m_retry.localPath);
+    }
+
+    if(FtpDataTransfer::DIRECTION_GET == m_retry.direction)
+    {
+        finishGet(true);
+    }
+    else
+    {
+        finishPut(true);
+    }
+}
+
+void FtpClient::retryTransfer()
+{
+    if(-1 == m_retry.direction)
+    {
+        return;
+    }
+
+    // Host keeps refusing, try the next mirror
+    if(m_connectFailures >= FtpRetryPolicy::RETRY_FAILOVER_ATTEMPTS && failoverToMirror())
+    {
+        m_retryAfterLogin = true;
+        return;
+    }
+
+    // Connection was dropped, QFtp comes back after the connector
+    if(NULL == m_ftp)
+    {
+        m_retryAfterLogin = true;
+        connectToServer();
+        return;
+    }
+
+    // Transfer is queued behind connect and login
+    reConnectToServer();
+    restartTransfer();
+}
+
+void FtpClient::restartTransfer()
+{
+    QFileInfo fileInfo(m_retry.localPath);
+    bool canResume = !m_capabilities.isValid() || m_capabilities.has(FtpCapabilities::CAP_REST_STREAM);
+    bool opened = false;
+
+    if(NULL == m_ftp)
+    {
+        return;
+    }
+
+    // Compressed stream can not continue in the middle, send it again
+    if(m_retry.compressed)
+    {
+        if(FtpDataTransfer::DIRECTION_GET == m_retry.direction)
+        {
+            QFile::remove(m_retry.localPath);
+            get(m_retry.remoteName, fileInfo.absolutePath());
+        }
+        else
+        {
+            put(fileInfo.fileName(), fileInfo.absolutePath());
+        }
+
+        if(NULL == m_pFile)
+        {
+            abandonRetry();
+        }
+
+        return;
+    }
+
+    m_pFile = new QFile(m_retry.localPath);
+
+    if(FtpDataTransfer::DIRECTION_GET == m_retry.direction)
+    {
+        opened = m_pFile->open(canResume ? (QIODevice::WriteOnly | QIODevice::Append)
+                                         : (QIODevice::WriteOnly | QIODevice::Truncate));
+    }
+    else
+    {
+        opened = m_pFile->open(QIODevice::ReadOnly);
+    }
+
+    if(!opened)
+    {
+        m_statusMsg = tr("Unable to open the file %1: %2")
+                .arg(m_retry.localPath)
+                .arg(m_pFile->errorString());
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+
+        abandonRetry();
+        return;
+    }
+
+    m_pDataTransfer = new FtpDataTransfer(m_ftp, m_serverAddress, this);
+    connect(m_pDataTransfer, SIGNAL(commandQueued(int,QString)), this, SLOT(traceRawCommand(int,QString)));
+    connect(m_pDataTransfer, SIGNAL(progress(qint64,qint64)), this, SLOT(dealDataTransferProgress(qint64,qint64)));
+    connect(m_pDataTransfer, SIGNAL(finished(bool)), this, SLOT(dealDataTransferFinished(bool)));
+
+    if(FtpDataTransfer::DIRECTION_GET == m_retry.direction)
+    {
+        m_pDataTransfer->get(m_retry.remoteName, m_pFile, m_pFile->size(), m_currentGetSize);
+
+        m_statusMsg = tr("Resuming download of %1 at byte %2...")
+                .arg(m_retry.remoteName)
+                .arg(m_pFile->size());
+    }
+    else
+    {
+        m_pDataTransfer->put(m_retry.remoteName, m_pFile, canResume);
+
+        m_statusMsg = canResume ? tr("Resuming upload of %1 where the server copy ends...").arg(m_retry.remoteName)
+                                : tr("Uploading %1 again...").arg(m_retry.remoteName);
+    }
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+}
+
+void FtpClient::dealDataTransferProgress(qint64 doneBytes, qint64 totalBytes)
+{
+    updateDataTransferProgress(doneBytes, totalBytes);
+}
+
+void FtpClient::dealDataTransferFinished(bool ok)
+{
+    int direction = FtpDataTransfer::DIRECTION_GET;
+    int errorClass = FtpRetryPolicy::ERROR_TRANSIENT;
+    QString reason;
+
+    if(NULL == m_pDataTransfer || NULL == m_pFile)
+    {
+        return;
+    }
+
+    direction = m_pDataTransfer->direction();
+    recordDataSetup(m_pDataTransfer->dataMode(), m_pDataTransfer->setupMsecs());
+
+    if(ok)
+    {
+        clearDataTransfer();
+
+        // Hash device saw only the last part, digest the whole file
+        if(FtpChecksum::CHECKSUM_NONE != m_verifyAlgorithm)
+        {
+            m_pFile->flush();
+            verifyWholeFile(m_pFile->fileName(), m_retry.remoteName);
+        }
+
+        if(FtpDataTransfer::DIRECTION_GET == direction)
+        {
+            finishGet(false);
+        }
+        else
+        {
+            finishPut(false);
+        }
+        return;
+    }
+
+    // No reply code: data connection failed
+    if(m_pDataTransfer->replyCode() > 0)
+    {
+        errorClass = FtpRetryPolicy::classifyReply(m_pDataTransfer->replyCode());
+    }
+    reason = m_pDataTransfer->errorString();
+
+    if(scheduleRetry(direction, false, errorClass, reason))
+    {
+        return;
+    }
+
+    if(FtpDataTransfer::DIRECTION_GET == direction)
+    {
+        finishGet(true);
+    }
+    else
+    {
+        finishPut(true);
+    }
+}
+
+void FtpClient::clearDataTransfer()
+{
+    if(NULL == m_pDataTransfer)
+    {
+        return;
+    }
+
+    m_pDataTransfer->disconnect(this);
+    m_pDataTransfer->abort();
+    m_pDataTransfer->deleteLater();
+    m_pDataTransfer = NULL;
+}
+
+void FtpClient::verifyWholeFile(const QString &path, const QString &remoteName)
+{
+    FtpChecksum checksum(m_verifyAlgorithm);
+    QFile file(path);
+
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return;
+    }
+
+    while(!file.atEnd())
+    {
+        QByteArray data = file.read(1024 * 1024);
+
+        if(data.isEmpty())
+        {
+            break;
+        }
+
+        checksum.addData(data.constData(), data.size());
+    }
+
+    verifyTransfer(QFileInfo(path).fileName(), remoteName, checksum.hexResult());
+}
+
+bool FtpClient::failoverToMirror()
+{
+    QString host;
+
+    if(m_mirrorHosts.isEmpty())
+    {
+        return false;
+    }
+
+    // Primary host is index 0, the list wraps around to it
+    m_mirrorIndex = (m_mirrorIndex + 1) % (m_mirrorHosts.size() + 1);
+    host = (0 == m_mirrorIndex) ? m_primaryHost : m_mirrorHosts.at(m_mirrorIndex - 1);
+
+    m_statusMsg = tr("%1 does not answer, failing over to %2")
+            .arg(m_pUrl->host())
+            .arg(host);
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    dropConnection();
+
+    m_pUrl->setHost(host);
+    m_connectFailures = 0;
+    m_retryStats.failovers++;
+
+    connectToServer();
+
+    return true;
+}
+
+QString FtpClient::takeRetryStats()
+{
+    QString text;
+
+    if(0 == m_retryStats.retries && 0 == m_retryStats.failovers)
+    {
+        return text;
+    }
+
+    text = tr(", %1 retries: %2 recovered, %3 given up, %4 failovers")
+            .arg(m_retryStats.retries)
+            .arg(m_retryStats.recovered)
+            .arg(m_retryStats.givenUp)
+            .arg(m_retryStats.failovers);
+
+    m_retryStats = Retry_Stats();
+
+    return text;
+}
+
+void FtpClient::recordDataSetup(int mode, qint64 msecs)
+{
+    if(msecs < 0)
+    {
+        return;
+    }
+
+    struct Setup_Stats &stats = m_setupStats[mode];
+
+    stats.count++;
+    stats.totalMsecs += msecs;
+    stats.maxMsecs = qMax(stats.maxMsecs, msecs);
+}
+
+void FtpClient::recordTransfer(int direction, bool error)
+{
+    FtpTransferHistory::History_Record record;
+    QString remoteDir = m_pUrl->path();
+
+    if(NULL == m_pFile)
+    {
+        return;
+    }
+
+    record.finished = QDateTime::currentDateTimeUtc();
+    record.server = QString("%1:%2").arg(m_pUrl->host()).arg(m_pUrl->port());
+    record.path = (remoteDir.endsWith('/') ? remoteDir : remoteDir + "/") + m_transferRemoteName;
+    record.direction = direction;
+    record.durationMsecs = m_transferTimer.isValid() ? m_transferTimer.elapsed() : 0;
+    record.retries = m_retry.retries;
+    record.ok = !error;
+
+    if(!error)
+    {
+        // Local bytes, a compressed transfer moved fewer on the wire
+        record.bytes = (FtpTransferHistory::DIRECTION_GET == direction) ? m_pFile->pos() : m_pFile->size();
+    }
+    else if(!m_transferError.isEmpty())
+    {
+        record.error = m_transferError;
+    }
+    else if(m_cancelFlag)
+    {
+        record.error = tr("Canceled");
+    }
+    else if(NULL != m_ftp)
+    {
+        record.error = m_ftp->errorString();
+    }
+
+    m_pHistory->append(record);
+
+    m_transferTimer.invalidate();
+    m_transferError.clear();
+}
+
+QString FtpClient::takeDataSetupStats()
+{
+    QString text;
+    QMap<int, struct Setup_Stats>::const_iterator it;
+
+    for(it = m_setupStats.constBegin(); it != m_setupStats.constEnd(); ++it)
+    {
+        if(0 == it.value().count)
+        {
+            continue;
+        }
+
+        text.append(tr(", %1 data setup %2 ms avg, %3 ms max over %4")
+                    .arg(FtpSession::dataModeName(it.key()))
+                    .arg(it.value().totalMsecs / it.value().count)
+                    .arg(it.value().maxMsecs)
+                    .arg(it.value().count));
+
+        if(FtpSession::DATA_MODE_ACTIVE == it.key())
+        {
+            text.append(tr(" (%1 pooled listeners, %2 opened on demand)")
+                        .arg(m_pListenerPool->hits())
+                        .arg(m_pListenerPool->misses()));
+        }
+    }
+
+    m_setupStats.clear();
+
+    return text;
+}
+
+void FtpClient::traceRawCommand(int commandId, QString command)
+{
+    if(m_trace.isEnabled())
+    {
+        m_rawCommandText.insert(commandId, command);
+    }
+}
+
+bool FtpClient::isTransferIdle() const
+{
+    return NULL == m_pFile && NULL == m_pArchive && !m_downloadBatchFlag && -1 == m_retry.direction
+            && m_sizeCmds.isEmpty() && m_mdtmCmds.isEmpty() && m_resumeSizeCmds.isEmpty()
+            && m_pendingVerify.isEmpty();
+}
+
+int FtpClient::queueRawCommand(const QString &command)
+{
+    int commandId = m_ftp->rawCommand(command);
+
+    if(m_trace.isEnabled())
+    {
+        // Never keep a password in the trace
+        m_rawCommandText.insert(commandId, command.startsWith("PASS ", Qt::CaseInsensitive) ? QString("PASS ****") : command);
+    }
+
+    return commandId;
+}
+
+bool FtpClient::getConnectionStatus() const
+{
+    return m_connectedFlag;
+}
+
+void FtpClient::reConnectToServer()
+{
+    if(!m_connectedFlag)
+    {
+        connectToServer();
+    }
+}
+
+bool FtpClient::putFilesInDir(QString dir)
+{
+    bool ret = false;
+    QUtilityBox toolBox;
+    QFileInfoList infoList = toolBox.getFolderInfo(dir);
+
+    if(NULL == m_ftp)
+    {
+        return ret;
+    }
+
+    if(m_packSmallFiles)
+    {
+        return putPackedFilesInDir(dir);
+    }
+
+    QDir dirInfo(dir);
+    QString newDir = m_pUrl->path().append("/").append(dirInfo.dirName());
+
+    for(int i = 0; i < infoList.size(); i++)
+    {
+        if(infoList.at(i).isFile())
+        {
+            pushUploadQueue(infoList.at(i).fileName(), infoList.at(i).canonicalPath(), newDir);
+        }
+    }
+
+    // Send out the 1st file in Queue
+    // There are . and .. dir, so here infoList.size() at least >= 2
+    if(infoList.size() > 2 && !m_uploadFileQueue.isEmpty())
+    {
+        // A dir put while another runs returns to where the first started
+        if(m_putDirReturnPath.isEmpty())
+        {
+            // No path is the root the session started in
+            m_putDirReturnPath = m_pUrl->path().isEmpty() ? QString("/") : m_pUrl->path();
+        }
+
+        // Enter to created dir to upload files
+        cdTo(newDir);
+
+        processUploadQueue();
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool FtpClient::putPackedFilesInDir(QString dir)
+{
+    bool ret = false;
+    QDir dirInfo(dir);
+    QString newDir = m_pUrl->path().append("/").append(dirInfo.dirName());
+
+    // Only one archive upload at a time
+    if(NULL == m_ftp || NULL != m_pArchive)
+    {
+        return ret;
+    }
+
+    m_pArchive = new FtpTarArchive(this);
+
+    // Large files are sent one by one into their subdir,
+    // small ones of every depth go to the archive
+    QStringList largeFileDirs;
+    QDirIterator it(dir, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+    while(it.hasNext())
+    {
+        it.next();
+
+        QFileInfo fileInfo = it.fileInfo();
+        QString relativePath = dirInfo.relativeFilePath(fileInfo.filePath());
+
+        if(fileInfo.size() >= m_packThreshold)
+        {
+            QString relativeDir = QFileInfo(relativePath).path();
+            QString remoteDir = newDir;
+
+            // Unpacking may not create it, no small file may live there
+            if("." != relativeDir)
+            {
+                QStringList parts = relativeDir.split('/');
+                QString parent;
+
+                for(int i = 0; i < parts.size(); i++)
+                {
+                    parent = parent.isEmpty() ? parts.at(i) : parent + "/" + parts.at(i);
+                    if(!largeFileDirs.contains(parent))
+                    {
+                        largeFileDirs.append(parent);
+                    }
+                }
+
+                remoteDir.append("/").append(relativeDir);
+            }
+
+            pushUploadQueue(fileInfo.fileName(), fileInfo.canonicalPath(), remoteDir);
+        }
+        else
+        {
+            m_pArchive->addFile(fileInfo.filePath(), relativePath);
+        }
+    }
+
+    if(0 == m_pArchive->fileCount())
+    {
+        delete m_pArchive;
+        m_pArchive = NULL;
+    }
+
+    if(NULL != m_pArchive || !m_uploadFileQueue.isEmpty())
+    {
+        // A dir put while another runs returns to where the first started
+        if(m_putDirReturnPath.isEmpty())
+        {
+            // No path is the root the session started in
+            m_putDirReturnPath = m_pUrl->path().isEmpty() ? QString("/") : m_pUrl->path();
+        }
+
+        // Enter to created dir to upload files
+        cdTo(newDir);
+
+        // Parents first, queued ahead of the uploads into them
+        for(int i = 0; i < largeFileDirs.size(); i++)
+        {
+            m_ftp->mkdir(newDir + "/" + largeFileDirs.at(i));
+        }
+
+        if(NULL != m_pArchive)
+        {
+            QString archiveName = dirInfo.dirName() + ".tar";
+
+            m_pArchive->open(QIODevice::ReadOnly);
+            m_archiveRequeued = false;
+
+            QIODevice *source = beginCompression(m_pArchive, QIODevice::ReadOnly, archiveName);
+            m_archivePutId = m_ftp->put(source, archiveName);
+            m_archiveName = archiveName;
+            endCompressionMode();
+
+            // Manifest and unpack command follow once the archive is stored
+
+            m_statusMsg = tr("Uploading %1 files packed in %2...")
+                    .arg(m_pArchive->fileCount())
+                    .arg(archiveName);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+        else
+        {
+            processUploadQueue();
+        }
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+void FtpClient::finishArchiveUpload(int commandId, bool error)
+{
+    if(commandId == m_archivePutId)
+    {
+        m_archivePutId = -1;
+
+        if(!finishCompression())
+        {
+            error = true;
+        }
+
+        if (error)
+        {
+            m_statusMsg = tr("Failed to upload archive: %1")
+                    .arg(m_ftp->errorString());
+        }
+        else
+        {
+            m_statusMsg = tr("Uploaded archive of %1 files, %2 bytes")
+                    .arg(m_pArchive->fileCount())
+                    .arg(m_pArchive->totalSize());
+        }
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+
+        QStringList failedFiles = m_pArchive->failedFiles();
+        for(int i = 0; i < failedFiles.size(); i++)
+        {
+            m_statusMsg = tr("Unable to read %1, packed as zero bytes")
+                    .arg(failedFiles.at(i));
+            emit updateStatusMsg(m_statusMsg);
+        }
+
+        // No manifest for a failed archive, and no unpacking of a partial one
+        if(!error)
+        {
+            m_manifestPutId = m_ftp->put(m_pArchive->manifest(), m_archiveName + ".manifest");
+
+            if(!m_unpackSiteCmd.isEmpty())
+            {
+                queueRawCommand(QString("SITE %1").arg(QString(m_unpackSiteCmd).replace("%1", m_archiveName)));
+            }
+        }
+
+        m_pArchive->close();
+        m_pArchive->deleteLater();
+        m_pArchive = NULL;
+
+        if(error)
+        {
+            // Still send out the large files, then go back
+            if(false == processUploadQueue())
+            {
+                finishPutDir();
+            }
+        }
+    }
+    else if(commandId == m_manifestPutId)
+    {
+        m_manifestPutId = -1;
+
+        if (error)
+        {
+            m_statusMsg = tr("Failed to upload archive manifest: %1")
+                    .arg(m_ftp->errorString());
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+
+        // Send out the large files, then go back
+        if(false == processUploadQueue())
+        {
+            finishPutDir();
+        }
+    }
+}
+
+void FtpClient::pushUploadQueue(QString fileName, QString dirPath, QString remoteDir)
+{
+    struct File_Info info;
+    info.fileName = fileName;
+    info.dirPath = dirPath;
+    info.remoteDir = remoteDir;
+
+    if(m_pJournal->isOpen())
+    {
+        info.journalId = m_pJournal->append(fileName, dirPath, remoteDir);
+    }
+
+    m_uploadFileQueue.push_back(info);
+}
+
+bool FtpClient::popUploadQueue(struct File_Info &in)
+{
+    bool ret = false;
+
+    if(!m_uploadFileQueue.isEmpty())
+    {
+        in = m_uploadFileQueue.at(0);
+        m_uploadFileQueue.pop_front();
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool FtpClient::processUploadQueue()
+{
+    bool ret = false;
+    struct File_Info info;
+
+    ret = popUploadQueue(info);
+
+    // Files removed since they were queued would stall the queue
+    while(ret && !QFileInfo(info.dirPath + "/" + info.fileName).isFile())
+    {
+        if(0 != info.journalId)
+        {
+            m_pJournal->setState(info.journalId, FtpTransferJournal::STATE_DONE);
+        }
+
+        m_statusMsg = tr("Skipped %1, it no longer exists").arg(info.fileName);
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+
+        ret = popUploadQueue(info);
+    }
+
+    if(ret)
+    {
+        // Resumed entries may belong to another dir
+        if(!info.remoteDir.isEmpty() && info.remoteDir != m_pUrl->path())
+        {
+            cdTo(info.remoteDir);
+        }
+
+        if(0 != info.journalId)
+        {
+            m_pJournal->setState(info.journalId, FtpTransferJournal::STATE_IN_FLIGHT);
+            m_currentJournalId = info.journalId;
+        }
+
+        put(info.fileName, info.dirPath);
+    }
+
+    return ret;
+}
+
+void FtpClient::resumeJournal()
+{
+    // Only when idle, a running queue is already journaled
+    if(!m_pJournal->isOpen() || NULL != m_pFile || !m_uploadFileQueue.isEmpty()
+            || !m_resumeSizeCmds.isEmpty() || -1 != m_retry.direction)
+    {
+        return;
+    }
+
+    QList<FtpTransferJournal::Journal_Entry> entries = m_pJournal->unfinished();
+    if(entries.isEmpty())
+    {
+        return;
+    }
+
+    for(int i = 0; i < entries.size(); i++)
+    {
+        const FtpTransferJournal::Journal_Entry &entry = entries.at(i);
+        struct File_Info info;
+
+        info.fileName = entry.fileName;
+        info.dirPath = entry.localDir;
+        info.remoteDir = entry.remoteDir;
+        info.journalId = entry.id;
+
+        // Interrupted upload may be complete, ask its size before sending again
+        if(FtpTransferJournal::STATE_IN_FLIGHT == entry.state)
+        {
+            m_resumeSizeCmds.insert(queueRawCommand(QString("SIZE %1/%2").arg(entry.remoteDir).arg(entry.fileName)), info);
+        }
+        else
+        {
+            m_uploadFileQueue.push_back(info);
+        }
+    }
+
+    m_statusMsg = tr("Resuming %1 unfinished uploads of last run").arg(entries.size());
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    if(m_resumeSizeCmds.isEmpty())
+    {
+        processUploadQueue();
+    }
+}
+
+void FtpClient::refreshList()
+{
+    m_listGlob.clear();
+    m_listingTimer.stop();
+    m_listing.clear();
+
     // Emit signal
-    emit updateListInfo(urlInfo);
+    emit clearListInfo();
+
+    m_listCmdId = m_ftp->list();
 }
 
-void FtpClient::setUserInfo(QString user, QString pwd)
+void FtpClient::listMatching(QString glob)
 {
-    m_pUrl->setUserName(user);
-    m_pUrl->setPassword(pwd);
+    if(NULL == m_ftp)
+    {
+        return;
+    }
+
+    // "LIST -la" style options or spaces would not reach the server as a glob
+    if(glob.isEmpty() || glob.startsWith('-') || glob.contains(' '))
+    {
+        refreshList();
+        return;
+    }
+
+    m_listGlob = glob;
+    m_listingTimer.stop();
+    m_listing.clear();
+
+    // Emit signal
+    emit clearListInfo();
+
+    // Names arrive through listInfo while the server still sends
+    m_listCmdId = m_ftp->list(glob);
 }
 
-void FtpClient::setHostPort(QString ip, int port)
+FtpOperation *FtpClient::cdAsync(const QString &path)
 {
-    m_pUrl->setHost(ip);
-    m_pUrl->setPort(port);
+    FtpOperation *op = createOperation(QFtp::Cd);
+
+    if(op->isFinished())
+    {
+        return op;
+    }
+
+    // Keep following the session, cdToParent starts from here
+    setPath(path);
+    m_remoteMeta.clear();
+
+    return startOperation(op, m_ftp->cd(path));
+}
+
+FtpOperation *FtpClient::mkdirAsync(const QString &dir)
+{
+    FtpOperation *op = createOperation(QFtp::Mkdir);
+
+    return op->isFinished() ? op : startOperation(op, m_ftp->mkdir(dir));
+}
+
+FtpOperation *FtpClient::rmdirAsync(const QString &dir)
+{
+    FtpOperation *op = createOperation(QFtp::Rmdir);
+
+    return op->isFinished() ? op : startOperation(op, m_ftp->rmdir(dir));
+}
+
+FtpOperation *FtpClient::removeAsync(const QString &fileName)
+{
+    FtpOperation *op = createOperation(QFtp::Remove);
+
+    return op->isFinished() ? op : startOperation(op, m_ftp->remove(fileName));
+}
+
+FtpOperation *FtpClient::renameAsync(const QString &oldName, const QString &newName)
+{
+    FtpOperation *op = createOperation(QFtp::Rename);
+
+    return op->isFinished() ? op : startOperation(op, m_ftp->rename(oldName, newName));
+}
+
+FtpOperation *FtpClient::rawCommandAsync(const QString &command)
+{
+    FtpOperation *op = createOperation(QFtp::RawCommand);
+
+    return op->isFinished() ? op : startOperation(op, queueRawCommand(command));
+}
+
+FtpOperation *FtpClient::listAsync(const QString &dir)
+{
+    FtpOperation *op = createOperation(QFtp::List);
+
+    return op->isFinished() ? op : startOperation(op, m_ftp->list(dir));
+}
+
+FtpOperation *FtpClient::getAsync(const QString &remoteName, const QString &localPath)
+{
+    QFile *file = NULL;
+    FtpOperation *op = createOperation(QFtp::Get);
+
+    if(op->isFinished())
+    {
+        return op;
+    }
+
+    file = new QFile(localPath, op);
+    if(!file->open(QIODevice::WriteOnly))
+    {
+        op->failLater(tr("Unable to open %1: %2").arg(localPath).arg(file->errorString()));
+        return op;
+    }
+
+    op->m_pDevice = file;
+
+    return startOperation(op, m_ftp->get(remoteName, file));
+}
+
+FtpOperation *FtpClient::getAsync(const QString &remoteName, QIODevice *sink)
+{
+    FtpOperation *op = createOperation(QFtp::Get);
+
+    if(op->isFinished())
+    {
+        return op;
+    }
+
+    if(NULL == sink || !sink->isWritable())
+    {
+        op->failLater(tr("Sink for %1 is not open for writing").arg(remoteName));
+        return op;
+    }
+
+    // Own data socket, QFtp would buffer what the sink can not take yet
+    createOperationTransfer(op)->get(remoteName, sink);
+
+    return op;
+}
+
+FtpOperation *FtpClient::putAsync(const QString &localPath, const QString &remoteName)
+{
+    QFile *file = NULL;
+    FtpOperation *op = createOperation(QFtp::Put);
+
+    if(op->isFinished())
+    {
+        return op;
+    }
+
+    file = new QFile(localPath, op);
+    if(!file->open(QIODevice::ReadOnly))
+    {
+        op->failLater(tr("Unable to open %1: %2").arg(localPath).arg(file->errorString()));
+        return op;
+    }
+
+    op->m_pDevice = file;
+
+    return startOperation(op, m_ftp->put(file, remoteName));
+}
+
+FtpOperation *FtpClient::putAsync(QIODevice *source, const QString &remoteName)
+{
+    FtpOperation *op = createOperation(QFtp::Put);
+
+    if(op->isFinished())
+    {
+        return op;
+    }
+
+    if(NULL == source || !source->isReadable())
+    {
+        op->failLater(tr("Source for %1 is not open for reading").arg(remoteName));
+        return op;
+    }
+
+    // QFtp copies all a sequential device has into the socket buffer
+    createOperationTransfer(op)->put(remoteName, source);
+
+    return op;
+}
+
+FtpOperation *FtpClient::createOperation(int type)
+{
+    FtpOperation *op = new FtpOperation(type, this);
+
+    if(NULL == m_ftp)
+    {
+        op->failLater(tr("Not connected"));
+    }
+    else
+    {
+        reConnectToServer();
+    }
+
+    return op;
+}
+
+FtpOperation *FtpClient::startOperation(FtpOperation *op, int commandId)
+{
+    op->m_commandId = commandId;
+    m_operations.insert(commandId, op);
+
+    return op;
+}
+
+bool FtpClient::finishOperation(int commandId, bool error)
+{
+    bool owned = m_operations.contains(commandId);
+    QPointer<FtpOperation> op = m_operations.take(commandId);
+    QString reason = error ? m_ftp->errorString() : QString();
+
+    // QFtp drops the commands queued behind a failed one without a word
+    if(error)
+    {
+        failOperations(commandId, reason);
+    }
+
+    if(!owned)
+    {
+        return false;
+    }
+
+    // Deleted by its caller before the answer came
+    if(op.isNull())
+    {
+        return true;
+    }
+
+    if(error)
+    {
+        failOperation(op, reason);
+    }
+    else if(NULL == op->m_pTransfer)
+    {
+        op->finish(true);
+    }
+
+    // A transfer finishes on its own once data and control are done
+    return true;
+}
+
+void FtpClient::failOperations(int afterId, const QString &reason)
+{
+    QList<int> commandIds = m_operations.keys();
+
+    // Snapshot, a finished slot may start new operations
+    for(int i = 0; i < commandIds.size(); i++)
+    {
+        if(commandIds.at(i) <= afterId)
+        {
+            continue;
+        }
+
+        QPointer<FtpOperation> op = m_operations.take(commandIds.at(i));
+        if(!op.isNull())
+        {
+            failOperation(op, reason);
+        }
+    }
+}
+
+void FtpClient::failOperation(FtpOperation *op, const QString &reason)
+{
+    if(NULL != op->m_pTransfer)
+    {
+        op->m_pTransfer->disconnect(this);
+        op->m_pTransfer->abort();
+    }
+
+    op->finish(false, reason);
+}
+
+FtpDataTransfer *FtpClient::createOperationTransfer(FtpOperation *op)
+{
+    FtpDataTransfer *transfer = new FtpDataTransfer(m_ftp, m_serverAddress, op);
+
+    op->m_pTransfer = transfer;
+
+    connect(transfer, SIGNAL(commandQueued(int,QString)), this, SLOT(dealOperationCommand(int,QString)));
+    connect(transfer, SIGNAL(progress(qint64,qint64)), op, SIGNAL(progress(qint64,qint64)));
+    connect(transfer, SIGNAL(finished(bool)), this, SLOT(dealOperationTransferFinished(bool)));
+
+    return transfer;
+}
+
+void FtpClient::dealOperationCommand(int commandId, QString command)
+{
+    FtpDataTransfer *transfer = qobject_cast<FtpDataTransfer *>(sender());
+    FtpOperation *op = (NULL == transfer) ? NULL : qobject_cast<FtpOperation *>(transfer->parent());
+
+    traceRawCommand(commandId, command);
+
+    if(NULL == op)
+    {
+        return;
+    }
+
+    // RETR/STOR is queued last
+    op->m_commandId = commandId;
+    m_operations.insert(commandId, op);
+}
+
+void FtpClient::dealOperationTransferFinished(bool ok)
+{
+    FtpDataTransfer *transfer = qobject_cast<FtpDataTransfer *>(sender());
+    FtpOperation *op = (NULL == transfer) ? NULL : qobject_cast<FtpOperation *>(transfer->parent());
+
+    if(NULL == op)
+    {
+        return;
+    }
+
+    recordDataSetup(transfer->dataMode(), transfer->setupMsecs());
+
+    op->m_bytes = transfer->transferredBytes();
+    op->finish(ok, transfer->errorString());
+}
+
+QIODevice *FtpClient::beginCompression(QIODevice *device, QIODevice::OpenMode mode, QString &remoteName)
+{
+    int format = FtpCompressDevice::FORMAT_ZLIB;
+
+    if(NULL != m_pCompress)
+    {
+        if(COMPRESS_NONE != m_compressMode)
+        {
+            m_statusMsg = tr("Compression is busy with another transfer, %1 goes uncompressed")
+                    .arg(remoteName);
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+        return device;
+    }
+
+    if(COMPRESS_MODE_Z == m_compressMode)
+    {
+        // Reconnecting, FEAT is not in yet
+        if(!m_capabilities.isValid())
+        {
+            m_capabilities.load(m_pUrl->host(), m_pUrl->port());
+        }
+
+        // Still unknown: try it, a refusal sends the transfer again uncompressed
+        if(m_modeZRefused
+                || (m_capabilities.isValid() && !m_capabilities.has(FtpCapabilities::CAP_MODE_Z)))
+        {
+            m_statusMsg = tr("MODE Z is not supported by %1, transfer uncompressed")
+                    .arg(m_pUrl->host());
+            emit updateStatusMsg(m_statusMsg);
+
+            return device;
+        }
+    }
+    else if(COMPRESS_GZIP_FILE == m_compressMode)
+    {
+        format = FtpCompressDevice::FORMAT_GZIP;
+
+        if(mode & QIODevice::ReadOnly)
+        {
+            remoteName.append(".gz");
+        }
+    }
+    else
+    {
+        return device;
+    }
+
+    m_pCompress = new FtpCompressDevice(device, (FtpCompressDevice::Format)format, m_compressLevel);
+    if(!m_pCompress->open(mode))
+    {
+        delete m_pCompress;
+        m_pCompress = NULL;
+
+        return device;
+    }
+
+    if(FtpCompressDevice::FORMAT_ZLIB == format)
+    {
+        m_modeZCmdId = queueRawCommand("MODE Z");
+    }
+
+    return m_pCompress;
+}
+
+void FtpClient::endCompressionMode()
+{
+    if(NULL != m_pCompress && COMPRESS_MODE_Z == m_compressMode)
+    {
+        queueRawCommand("MODE S");
+    }
+}
+
+bool FtpClient::finishCompression()
+{
+    bool ret = true;
+
+    if(NULL == m_pCompress)
+    {
+        return ret;
+    }
+
+    m_pCompress->close();
+
+    if(m_pCompress->hasStreamError())
+    {
+        m_statusMsg = tr("Compressed data stream is corrupt or incomplete");
+
+        ret = false;
+    }
+    else
+    {
+        m_statusMsg = tr("Compression %1:1 (%2 -> %3 bytes), %4 ms CPU")
+                .arg(m_pCompress->ratio(), 0, 'f', 1)
+                .arg(m_pCompress->rawBytes())
+                .arg(m_pCompress->compressedBytes())
+                .arg(m_pCompress->codecMsecs());
+    }
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    delete m_pCompress;
+    m_pCompress = NULL;
+
+    return ret;
 }
 
-void FtpClient::setPath(QString path)
-{
-    m_pUrl->setPath(path);
+QIODevice *FtpClient::beginHashing(QIODevice *device, QIODevice::OpenMode mode,
+                                   const QString &localName, const QString &remoteName)
+{
+    bool verify = (FtpChecksum::CHECKSUM_NONE != m_verifyAlgorithm);
+
+    if((!verify && !m_trace.isEnabled()) || NULL != m_pHashDevice)
+    {
+        return device;
+    }
+
+    m_pHashDevice = new FtpHashDevice(device, m_verifyAlgorithm);
+    if(!m_pHashDevice->open(mode))
+    {
+        delete m_pHashDevice;
+        m_pHashDevice = NULL;
+
+        return device;
+    }
+
+    m_verifyLocalName = localName;
+    m_verifyRemoteName = remoteName;
+
+    return m_pHashDevice;
 }
 
-void FtpClient::get(QString fileName, QString dir)
+void FtpClient::finishHashing(bool error)
 {
-    if (NULL == m_ftp)
+    if(NULL == m_pHashDevice)
     {
         return;
     }
 
-    reConnectToServer();
+    m_pHashDevice->close();
 
-    QString fullFileName = "";
-    fullFileName.append(dir);
-    fullFileName.append("/");
-    fullFileName.append(fileName);
+    // Device only sampled data for the trace
+    if(!error && FtpChecksum::CHECKSUM_NONE != m_pHashDevice->checksum().algorithm())
+    {
+        verifyTransfer(m_verifyLocalName, m_verifyRemoteName, m_pHashDevice->checksum().hexResult());
+    }
 
-    if (QFile::exists(fullFileName))
+    delete m_pHashDevice;
+    m_pHashDevice = NULL;
+}
+
+void FtpClient::verifyTransfer(const QString &localName, const QString &remoteName, const QString &localDigest)
+{
+    QString algorithmName = FtpChecksum::algorithmName(m_verifyAlgorithm);
+    QString legacyCmd = FtpChecksum::legacyCommand(m_verifyAlgorithm);
+    bool hasLegacyHashCmd = ("XCRC" == legacyCmd && m_capabilities.has(FtpCapabilities::CAP_XCRC))
+            || ("XMD5" == legacyCmd && m_capabilities.has(FtpCapabilities::CAP_XMD5))
+            || ("XSHA1" == legacyCmd && m_capabilities.has(FtpCapabilities::CAP_XSHA1));
+    struct Verify_Info info;
+    int cmdId = -1;
+
+    info.fileName = remoteName;
+    info.localDigest = localDigest;
+    info.algorithm = m_verifyAlgorithm;
+
+    // Manifest entry needs no round trip
+    if(m_manifestDigests.contains(localName))
     {
-        m_statusMsg = tr("There already exists a file called %1 in the current directory")
-                .arg(fileName);
+        reportVerifyResult(localName, localDigest, m_manifestDigests.value(localName));
+        return;
     }
-    else
+
+    // In gzip file mode the server stores other bytes than we hashed
+    if(COMPRESS_GZIP_FILE != m_compressMode)
     {
-        m_pFile = new QFile(fullFileName);
-        if (!m_pFile->open(QIODevice::WriteOnly))
+        if(m_capabilities.hashAlgorithms().contains(algorithmName))
         {
-            m_statusMsg = tr("Unable to save the file %1: %2")
-                    .arg(fullFileName)
-                    .arg(m_pFile->errorString());
-
-            delete m_pFile;
-            m_pFile = NULL;
+            queueRawCommand(QString("OPTS HASH %1").arg(algorithmName));
+            cmdId = queueRawCommand(QString("HASH %1").arg(remoteName));
         }
-        else
+        else if(hasLegacyHashCmd)
         {
-            m_ftp->get(fileName, m_pFile);
-
-            m_statusMsg = tr("Downloading %1...").arg(fileName);
+            cmdId = queueRawCommand(QString("%1 %2").arg(legacyCmd).arg(remoteName));
         }
     }
 
-    // Emit status message
-    emit updateStatusMsg(m_statusMsg);
+    if(cmdId >= 0)
+    {
+        m_pendingVerify.insert(cmdId, info);
+    }
+    else
+    {
+        m_statusMsg = tr("%1 of %2 is %3, no server checksum to compare")
+                .arg(algorithmName)
+                .arg(remoteName)
+                .arg(localDigest);
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+    }
 }
 
-void FtpClient::put(QString fileName, QString dir)
+void FtpClient::reportVerifyResult(const QString &fileName, const QString &localDigest, const QString &remoteDigest)
 {
-    QByteArray data;
+    bool ok = !remoteDigest.isEmpty() && (0 == localDigest.compare(remoteDigest, Qt::CaseInsensitive));
 
-    if (NULL == m_ftp)
+    if(ok)
     {
-        return;
+        m_statusMsg = tr("Verified %1, checksum %2")
+                .arg(fileName)
+                .arg(localDigest);
+    }
+    else
+    {
+        m_statusMsg = tr("Checksum mismatch for %1: local %2, expected %3")
+                .arg(fileName)
+                .arg(localDigest)
+                .arg(remoteDigest.isEmpty() ? tr("unknown") : remoteDigest);
     }
 
-    reConnectToServer();
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
 
-    QString fullFileName = "";
-    fullFileName.append(dir);
-    fullFileName.append("/");
-    fullFileName.append(fileName);
+    // Emit signal
+    emit integrityChecked(fileName, ok);
+}
 
-    QFileInfo fileInfo(fullFileName);
+QString FtpClient::parseDigest(const QString &reply, int algorithm)
+{
+    QStringList tokens = reply.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+    QRegExp hexRx("^(0x)?([0-9A-Fa-f]+)$");
+    int hexLength = FtpChecksum::hexLength(algorithm);
 
-    // If it's a file
-    if(fileInfo.isFile())
+    // HASH: "<algorithm> <range> <digest> <name>", XCRC/XMD5: "<digest>"
+    for(int i = 0; i < tokens.size(); i++)
     {
-        if (!QFile::exists(fullFileName))
+        if(!hexRx.exactMatch(tokens.at(i)))
         {
-            m_statusMsg = tr("No file called %1 in the current directory")
-                    .arg(fileName);
+            continue;
         }
-        else
-        {
-            m_pFile = new QFile(fullFileName);
-            if (!m_pFile->open(QIODevice::ReadOnly))
-            {
-                m_statusMsg = tr("Unable to Open the file %1: %2")
-                        .arg(fullFileName).arg(m_pFile->errorString());
-            }
-            else
-            {
-                data = m_pFile->readAll();
 
-                m_ftp->put(data, fileName);
+        QString digest = hexRx.cap(2).toLower();
 
-                m_statusMsg = tr("Uploading %1...").arg(fileName);
-            }
+        if(digest.size() == hexLength)
+        {
+            return digest;
         }
-    }
-    // If it's a directory
-    else if(fileInfo.isDir())
-    {
-        mkdir(fileName);
-        m_statusMsg = tr("Created directory %1").arg(fileName);
 
-        if(!putFilesInDir(fullFileName))
+        // Some servers drop leading zeros of a CRC written as 0x...
+        if(!hexRx.cap(1).isEmpty() && digest.size() < hexLength)
         {
+            return digest.rightJustified(hexLength, '0');
         }
     }
 
-    // Emit status message
-    emit updateStatusMsg(m_statusMsg);
+    return "";
 }
 
-void FtpClient::cancelDownload()
+void FtpClient::startDownloadBatch()
 {
-    if (NULL == m_ftp)
+    // Already running, new files were appended to the queue
+    if(m_downloadBatchFlag || m_downloadFileQueue.isEmpty())
     {
         return;
     }
 
-    m_ftp->abort();
+    m_batchTotalBytes = 0;
+    m_batchDoneBytes = 0;
+    m_batchFileCount = m_downloadFileQueue.size();
 
-    if (m_pFile->exists())
+    for(int i = 0; i < m_downloadFileQueue.size(); i++)
     {
-        m_pFile->close();
-        m_pFile->remove();
+        m_batchTotalBytes += qMax<qint64>(m_remoteMeta.value(m_downloadFileQueue.at(i).fileName).size, 0);
     }
 
-    delete m_pFile;
-    m_pFile = NULL;
+    m_statusMsg = tr("Downloading %1 files, %2 bytes...")
+            .arg(m_batchFileCount)
+            .arg(m_batchTotalBytes);
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    m_downloadBatchFlag = true;
+    m_batchTimer.start();
+    m_batchReportTimer.invalidate();
+
+    processDownloadQueue();
 }
 
-void FtpClient::connectOrDisconnect()
+bool FtpClient::processDownloadQueue()
 {
-    if (disconnectFromServer())
+    while(!m_downloadFileQueue.isEmpty())
     {
-        return;
+        struct File_Info info = m_downloadFileQueue.takeFirst();
+
+        get(info.fileName, info.dirPath);
+
+        // Transfer started, continue when it finished
+        if(NULL != m_pFile)
+        {
+            return true;
+        }
+
+        // Skipped (e.g. local file exists), count it as done
+        m_batchDoneBytes += qMax<qint64>(m_remoteMeta.value(info.fileName).size, 0);
     }
 
-    connectToServer();
+    if(m_downloadBatchFlag)
+    {
+        qint64 elapsed = qMax<qint64>(m_batchTimer.elapsed(), 1);
+
+        m_statusMsg = tr("Batch of %1 files done, %2 bytes in %3 s (%4 KB/s)%5")
+                .arg(m_batchFileCount)
+                .arg(m_batchDoneBytes)
+                .arg(elapsed / 1000.0, 0, 'f', 1)
+                .arg(m_batchDoneBytes / elapsed)
+                .arg(takeRetryStats() + takeDataSetupStats());
+
+        // Emit status message
+        emit updateStatusMsg(m_statusMsg);
+        emit updateBatchProgress(m_batchTotalBytes, m_batchTotalBytes, 0);
+
+        m_downloadBatchFlag = false;
+    }
+
+    return false;
 }
 
-void FtpClient::cdTo(QString path)
+bool FtpClient::dropQueuedCommands(int commandId)
 {
-    setPath(path);
+    bool ret = false;
 
-    if(NULL != m_ftp)
+    // Prefetches left count as refused, size and time stay unknown
+    if(!m_sizeCmds.isEmpty() || !m_mdtmCmds.isEmpty())
     {
-        reConnectToServer();
-        m_ftp->cd(path);
+        m_sizeCmds.clear();
+        m_mdtmCmds.clear();
+
+        ret = true;
     }
-}
 
-void FtpClient::cdToRoot()
-{
-    cdTo("/");
-}
+    // Journal entries whose size is not known go up again
+    if(!m_resumeSizeCmds.isEmpty())
+    {
+        QList<struct File_Info> resumed = m_resumeSizeCmds.values();
 
-void FtpClient::cdToParent()
-{
-    QString path = m_pUrl->path();
-    path = path.left(path.lastIndexOf('/'));
+        for(int i = resumed.size() - 1; i >= 0; i--)
+        {
+            m_uploadFileQueue.prepend(resumed.at(i));
+        }
+        m_resumeSizeCmds.clear();
 
-    qDebug() <<"cdToParent cdTo=" << path;
-    cdTo(path);
-}
+        ret = true;
+    }
 
-void FtpClient::mkdir(QString dir)
-{
-    if(NULL != m_ftp)
+    // HASH after a refused OPTS HASH
+    if(!m_pendingVerify.isEmpty())
     {
-       reConnectToServer();
-       m_ftp->mkdir(dir);
+        QList<struct Verify_Info> verifies = m_pendingVerify.values();
+
+        for(int i = 0; i < verifies.size(); i++)
+        {
+            m_statusMsg = tr("Server could not checksum %1: %2")
+                    .arg(verifies.at(i).fileName)
+                    .arg(m_ftp->errorString());
+
+            // Emit status message
+            emit updateStatusMsg(m_statusMsg);
+        }
+        m_pendingVerify.clear();
+
+        ret = true;
     }
-}
 
-bool FtpClient::getConnectionStatus() const
-{
-    return m_connectedFlag;
-}
+    // Queued here, after QFtp cleared its queue
+    if(m_featCmdId > commandId)
+    {
+        m_featCmdId = queueRawCommand("FEAT");
+    }
 
-void FtpClient::reConnectToServer()
-{
-    if(!m_connectedFlag)
+    if(m_listCmdId > commandId)
     {
-        connectToServer();
+        refreshList();
+    }
+
+    if(NULL != m_pFile && m_transferCmdId > commandId)
+    {
+        requeueTransfer();
+    }
+
+    if(NULL != m_pArchive && m_archivePutId > commandId)
+    {
+        requeueArchive();
     }
+
+    return ret;
 }
 
-bool FtpClient::putFilesInDir(QString dir)
+void FtpClient::requeueTransfer()
 {
-    bool ret = false;
-    QUtilityBox toolBox;
-    QFileInfoList infoList = toolBox.getFolderInfo(dir);
+    bool download = (0 != (m_pFile->openMode() & QIODevice::WriteOnly));
+    struct File_Info info = m_transferInfo;
 
-    if(NULL == m_ftp)
+    m_transferCmdId = -1;
+
+    // The devices wrapping m_pFile never saw data
+    if(NULL != m_pCompress)
     {
-        return ret;
+        m_pCompress->close();
+        delete m_pCompress;
+        m_pCompress = NULL;
     }
+    delete m_pHashDevice;
+    m_pHashDevice = NULL;
 
-    for(int i = 0; i < infoList.size(); i++)
+    // Dropped again, the command before it keeps failing
+    if(m_transferRequeued)
     {
-        if(infoList.at(i).isFile())
+        if(download)
+        {
+            finishGet(true);
+        }
+        else
         {
-            pushUploadQueue(infoList.at(i).fileName(), infoList.at(i).canonicalPath());
+            finishPut(true);
         }
+        return;
     }
 
-    // Send out the 1st file in Queue
-    // There are . and .. dir, so here infoList.size() at least >= 2
-    if(infoList.size() > 2)
+    m_pFile->close();
+    if(download)
     {
-        struct File_Info info;
-        if(popUploadQueue(info))
-        {
-            // Set flag indicate putting files in dir
-            m_putDirFlag = true;
+        // get() does not overwrite a file
+        m_pFile->remove();
+    }
+    delete m_pFile;
+    m_pFile = NULL;
 
-            // Enter to created dir to upload files
-            QDir dirInfo(dir);
-            QString newDir = m_pUrl->path().append("/").append(dirInfo.dirName());
-            cdTo(newDir);
+    m_statusMsg = tr("A failed command dropped the transfer of %1, queued again")
+            .arg(info.fileName);
 
-            put(info.fileName, info.dirPath);
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
 
-            ret = true;
-        }
+    // The cd queued before it may have gone too
+    m_ftp->cd(m_pUrl->path().isEmpty() ? QString("/") : m_pUrl->path());
+
+    if(download)
+    {
+        get(info.fileName, info.dirPath);
+    }
+    else
+    {
+        put(info.fileName, info.dirPath);
     }
 
-    return ret;
+    m_transferRequeued = true;
 }
 
-void FtpClient::pushUploadQueue(QString fileName, QString dirPath)
+void FtpClient::requeueArchive()
 {
-    struct File_Info info;
-    info.fileName = fileName;
-    info.dirPath = dirPath;
-
-    m_uploadFileQueue.push_back(info);
-}
+    QString archiveName = m_archiveName;
 
-bool FtpClient::popUploadQueue(struct File_Info &in)
-{
-    bool ret = false;
+    // Dropped again, the command before it keeps failing
+    if(m_archiveRequeued)
+    {
+        finishArchiveUpload(m_archivePutId, true);
+        return;
+    }
 
-    if(!m_uploadFileQueue.isEmpty())
+    // Nothing was read from the archive yet
+    if(NULL != m_pCompress)
     {
-        in = m_uploadFileQueue.at(0);
-        m_uploadFileQueue.pop_front();
+        m_pCompress->close();
+        delete m_pCompress;
+        m_pCompress = NULL;
+    }
 
-        ret = true;
+    // beginCompression appends .gz again
+    if(archiveName.endsWith(".tar.gz"))
+    {
+        archiveName.chop(3);
     }
 
-    return ret;
+    m_statusMsg = tr("A failed command dropped the transfer of %1, queued again")
+            .arg(archiveName);
+
+    // Emit status message
+    emit updateStatusMsg(m_statusMsg);
+
+    // The cd queued before it may have gone too
+    m_ftp->cd(m_pUrl->path().isEmpty() ? QString("/") : m_pUrl->path());
+
+    // Uncompressed if MODE Z was what failed
+    QIODevice *source = beginCompression(m_pArchive, QIODevice::ReadOnly, archiveName);
+    m_archivePutId = m_ftp->put(source, archiveName);
+    m_archiveName = archiveName;
+    endCompressionMode();
+
+    m_archiveRequeued = true;
 }
 
-bool FtpClient::processUploadQueue()
+void FtpClient::continueQueues()
 {
-    bool ret = false;
-    struct File_Info info;
+    // Replies still due, or a transfer runs and its end goes on
+    if(NULL == m_ftp || NULL != m_pFile || -1 != m_retry.direction
+            || !m_sizeCmds.isEmpty() || !m_mdtmCmds.isEmpty() || !m_resumeSizeCmds.isEmpty()
+            || !m_pendingVerify.isEmpty())
+    {
+        return;
+    }
 
-    ret = popUploadQueue(info);
-    if(ret)
+    int held = m_heldDirection;
+
+    m_heldDirection = -1;
+
+    // Get/put held back until the checksum of the last one was answered
+    if(FtpDataTransfer::DIRECTION_GET == held)
     {
-        put(info.fileName, info.dirPath);
+        continueAfterGet();
+    }
+    else if(FtpDataTransfer::DIRECTION_PUT == held)
+    {
+        continueUploadQueue();
+    }
+    else
+    {
+        startDownloadBatch();
     }
 
-    return ret;
+    // Journal entries waiting for their SIZE replies
+    if(isTransferIdle() && -1 == m_archivePutId && -1 == m_manifestPutId)
+    {
+        processUploadQueue();
+    }
 }
 
-void FtpClient::refreshList()
+bool FtpClient::preallocateFile(QFile *file, qint64 size)
 {
-    // Emit signal
-    emit clearListInfo();
+#ifdef Q_OS_LINUX
+    // Allocate real blocks, resize() would only create a sparse file
+    return 0 == posix_fallocate(file->handle(), 0, size);
+#else
+    // SetEndOfFile allocates on NTFS
+    return file->resize(size);
+#endif
+}
+
+void FtpClient::setFileModifiedTime(const QString &path, const QDateTime &mtime)
+{
+    if(!mtime.isValid())
+    {
+        return;
+    }
 
-    m_ftp->list();
+#ifdef Q_OS_WIN
+    struct _utimbuf times;
+    times.actime = mtime.toTime_t();
+    times.modtime = mtime.toTime_t();
+    _wutime((const wchar_t *)path.utf16(), &times);
+#else
+    struct utimbuf times;
+    times.actime = mtime.toTime_t();
+    times.modtime = mtime.toTime_t();
+    utime(QFile::encodeName(path).constData(), &times);
+#endif
 }
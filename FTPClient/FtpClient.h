@@ -9,6 +9,7 @@ PURPOSE:        FTP client
 #ifndef FTPCLIENT_H
 #define FTPCLIENT_H
 #include <QObject>
+#include <QMetaType>
 #include <QFtp>
 #include <QNetworkSession>
 #include <QNetworkConfigurationManager>
@@ -16,6 +17,32 @@ PURPOSE:        FTP client
 #include <QUrl>
 #include <QUrlInfo>
 #include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QHostAddress>
+#include <QTimer>
+#include <QPointer>
+#include "FtpCapabilities.h"
+#include "FtpTrace.h"
+#include "FtpRetryPolicy.h"
+#include "FtpSocketTuning.h"
+#include "FtpTransferHistory.h"
+#include "FtpListingStore.h"
+#include "FtpOperation.h"
+
+class FtpTarArchive;
+class FtpCompressDevice;
+class FtpHashDevice;
+class FtpTransferJournal;
+class FtpHotFolder;
+class FtpConnector;
+class FtpDataTransfer;
+class FtpSession;
+class FtpRemoteBatch;
+class FtpListenerPool;
 
 class FtpClient : public QObject
 {
@@ -26,19 +53,58 @@ public:
 
 public:
     enum{
-        FTP_DEFAULT_PORT = 21
+        FTP_DEFAULT_PORT = 21,
+        FTP_DEFAULT_PACK_THRESHOLD = 64 * 1024
+    };
+
+    enum{
+        COMPRESS_NONE = 0,
+        COMPRESS_MODE_Z,        // Deflate on data channel, needs MODE Z in FEAT
+        COMPRESS_GZIP_FILE      // Put as <name>.gz, get <name>.gz unpacked
+    };
+
+    enum{
+        LISTING_REPORT_MSECS = 50
+    };
+
+    enum{
+        TLS_NONE = 0,
+        TLS_EXPLICIT            // AUTH TLS on the control port, PROT P for data
     };
 
 signals:
     void updateProgressVal(int);
+    void updateBatchProgress(qint64 doneBytes, qint64 totalBytes, int etaSecs);
     void updateStatusMsg(QString);
     void updateListInfo(const QUrlInfo&);
     void clearListInfo();
+
+    // listing() holds count entries now, sent at most every
+    // LISTING_REPORT_MSECS while a LIST runs and once when it finished
+    void listingGrown(int count);
     void connectedStatus(bool);
+    void integrityChecked(QString fileName, bool ok);
+    void capabilitiesChanged();
+
+    // Reply to a command sent by sendRawCommand
+    void rawCommandReply(int commandId, int replyCode, QString detail);
+
+    // Text of the protocol trace, answer to dumpTrace
+    void traceDumped(QString text);
+
+    // Throughput report of the transfer history, answer to dumpHistory
+    void historyDumped(QString text);
+
+    // Transfer of fileName failed and is tried again in delayMsecs
+    void transferRetried(QString fileName, int retry, int delayMsecs);
 
 public slots:
 
     void get(QString fileName, QString dir);
+
+    // Download several files of current server dir, SIZE/MDTM of all files
+    // are fetched first to preallocate local files and give a batch ETA
+    void getFiles(QStringList fileNames, QString dir);
     void put(QString fileName, QString dir);
 
     void setUserInfo(QString user, QString pwd);
@@ -54,19 +120,163 @@ public slots:
     void cdToParent();
     void mkdir(QString dir);
 
+    // Pack files smaller than threshold into one tar archive when uploading a dir,
+    // siteCmd is sent as "SITE <siteCmd>" after upload, %1 is replaced by archive name
+    void setSmallFilePacking(bool enable, qint64 threshold = FTP_DEFAULT_PACK_THRESHOLD,
+                             QString siteCmd = "");
+
+    // Compression used by the following transfers, level 1 (fast) to 9 (best)
+    void setCompression(int mode, int level = 6);
+
+    // Verify transfers with FtpChecksum algorithm, CHECKSUM_NONE to disable.
+    // Digest is computed while data streams and compared with manifest or server HASH/XCRC
+    void setIntegrityCheck(int algorithm);
+
+    // Load "<hex digest>  <file name>" lines (md5sum/sha1sum format)
+    bool loadChecksumManifest(QString path);
+
+    // Features of the connected server, from cache or FEAT at login
+    FtpCapabilities capabilities() const;
+
+    // Entries of the current server dir. Filled in the thread of this
+    // object, safe to read from others as the store locks itself
+    const FtpListingStore *listing() const;
+
+    // Query FEAT again, ignoring the cache
+    void refreshCapabilities();
+
+    // Queue a raw FTP command, return command id or -1 if not connected
+    int sendRawCommand(QString command);
+
+    // Copy files from current dir of this server to current dir of dest
+    // (a FtpClient in the same thread) without passing through this host
+    void fxpFiles(QObject *dest, QStringList fileNames);
+
+    // Protocol trace of commands, replies and sampled data chunks,
+    // on by default and kept in a fixed size ring buffer
+    void setTraceEnabled(bool enable);
+    void dumpTrace();
+
+    // Every finished get/put is recorded per server on disk. Reports the
+    // rate percentiles of all servers in buckets of bucketSecs
+    void dumpHistory(int bucketSecs = FtpTransferHistory::HISTORY_DEFAULT_BUCKET_SECS);
+    void clearTrace();
+
+    // Upload files that appear below localDir to remoteDir (current server
+    // dir if empty) once their writes settled. Empty localDir stops it
+    void setHotFolder(QString localDir, QString remoteDir = "");
+
+    // Failed transfers with a transient error (4xx, lost connection) are
+    // retried up to maxAttempts times with jittered exponential backoff,
+    // plain transfers resume at the last confirmed offset
+    void setRetryPolicy(int maxAttempts,
+                        int baseDelayMsecs = FtpRetryPolicy::RETRY_BASE_DELAY_MSECS,
+                        int maxDelayMsecs = FtpRetryPolicy::RETRY_MAX_DELAY_MSECS);
+
+    // Hosts with the same content, tried in turn when the current
+    // host refused repeated reconnects during a retry
+    void setMirrors(QStringList hosts);
+
+    // Protect control and data connections with TLS from the next connect
+    // on, verifyPeer false accepts self-signed server certificates
+    void setTls(int mode, bool verifyPeer = true);
+
+    // FtpSession::DATA_MODE_*, passive by default. Plain sessions take it
+    // for the following commands, FTPS from the next transfer on
+    void setDataMode(int mode);
+
+    // Listening sockets kept open for active mode, 0 opens one per transfer
+    void setListenerPoolSize(int size);
+
+    // Size data connection buffers for a link of bandwidth (bytes per
+    // second) and round trip, -1 takes the connect time measured to the
+    // server. 0 bandwidth leaves buffers to the system. notSentLowat and
+    // queueDepth see FtpSocketTuning. FtpDataTransfer and FTPS sessions
+    // open their own data sockets and take it, QFtp gets and puts do not
+    void setSocketTuning(qint64 bandwidth, int roundTripMsecs = -1, int notSentLowat = 0,
+                         int queueDepth = FtpSocketTuning::TUNING_DEFAULT_QUEUE_DEPTH);
+
+    // Bulk operations on entries of the current server dir. They run on
+    // their own parallel sessions from a listed manifest, the listing is
+    // refreshed once when all are done. Dirs are deleted with their content
+    void removeTree(QStringList names);
+    void renameFiles(QStringList fromNames, QStringList toNames);
+    void chmodTree(QStringList names, QString mode, bool recursive = true);
+    void setBatchSessions(int count);
+
+    // List only the names of the current server dir matching glob, the
+    // server expands it ("LIST *.log"). Empty glob lists the whole dir
+    void listMatching(QString glob);
+
+public:
+    // Operations that report to their own FtpOperation instead of the
+    // shared status signals. Call them in the thread of this object, the
+    // operation is a child of it: delete it or setAutoDelete when done.
+    // Not connected fails it once the event loop runs. They queue behind
+    // the running commands and leave the server list and queues alone
+    FtpOperation *cdAsync(const QString &path);
+    FtpOperation *mkdirAsync(const QString &dir);
+    FtpOperation *rmdirAsync(const QString &dir);
+    FtpOperation *removeAsync(const QString &fileName);
+    FtpOperation *renameAsync(const QString &oldName, const QString &newName);
+    FtpOperation *rawCommandAsync(const QString &command);
+    FtpOperation *listAsync(const QString &dir = QString());
+    FtpOperation *getAsync(const QString &remoteName, const QString &localPath);
+
+    // Stream remoteName into sink, opened for writing by the caller and
+    // left open. Nothing touches the disk: a QProcess, socket or a
+    // QIODevice subclass whose writeData consumes the chunks will do. A
+    // sink that falls behind holds the data connection back (see
+    // FtpDataTransfer), so memory stays flat for any file size
+    FtpOperation *getAsync(const QString &remoteName, QIODevice *sink);
+    FtpOperation *putAsync(const QString &localPath, const QString &remoteName);
+
+    // Upload what source delivers as remoteName, without staging it on
+    // disk. source is opened for reading by the caller. A sequential one
+    // (QProcess, socket, a QIODevice generating data in readData) may
+    // have any length: it is read only while the data connection has
+    // room and ends with its readChannelFinished. Throughput is in
+    // bytesPerSecond of the operation while progress comes in
+    FtpOperation *putAsync(QIODevice *source, const QString &remoteName);
+
 private slots:
 
     void connectOrDisconnect();
     void cancelDownload();
     void ftpCommandFinished(int commandId, bool error);
     void addToList(const QUrlInfo &urlInfo);
+    void reportListingGrowth();
     void updateDataTransferProgress(qint64 readBytes, qint64 totalBytes);
     void dealStateChanged(int state);
+    void dealRawCommandReply(int replyCode, const QString &detail);
+    void traceCommandStarted(int commandId);
+    void dealHotFiles(QStringList paths);
+    void dealHotDir(QString relativePath);
+    void dealConnectorFinished(bool ok);
+    void traceRawCommand(int commandId, QString command);
+    void retryTransfer();
+    void dealDataTransferProgress(qint64 doneBytes, qint64 totalBytes);
+    void dealDataTransferFinished(bool ok);
+    void dealBatchFinished(bool ok);
+    void dealOperationCommand(int commandId, QString command);
+    void dealOperationTransferFinished(bool ok);
+
+    // Start what waited for raw command replies: the download batch once
+    // its prefetches are in, the next get/put once the checksum of the
+    // last one was answered, resumed uploads once their sizes are known
+    void continueQueues();
 
 private:
 
-    QFtp *m_ftp;
+    FtpSession *m_ftp;              // QFtp or FTPS session, see m_tlsMode
     QUrl *m_pUrl;
+    int m_tlsMode;
+    bool m_tlsVerifyPeer;
+
+    FtpConnector *m_pConnector;     // Resolves and races addresses before QFtp connects
+    QHostAddress m_serverAddress;   // Winner of the last race, reused to reconnect
+    QElapsedTimer m_connectTimer;
+    QString m_connectMetrics;       // Resolve/race figures for the connected message
 
     QFile *m_pFile;
 
@@ -76,28 +286,297 @@ private:
 
     struct File_Info
     {
+        File_Info() : journalId(0) {}
+
         QString fileName;
         QString dirPath;
+        QString remoteDir;      // Server dir to upload to, empty for current dir
+        quint32 journalId;      // Entry in m_pJournal, 0 if not journaled
     };
 
     QList<struct File_Info> m_uploadFileQueue;
 
-    bool m_putDirFlag;  // This flag is used to indicate upload dir to server
+    // Server dir to go back to when the upload of a local dir is done,
+    // empty if none runs. The queue may cd to other dirs meanwhile
+    QString m_putDirReturnPath;
+    bool m_cancelFlag;                  // Running download was aborted by cancelDownload
+
+    FtpTransferJournal *m_pJournal;     // Upload queue on disk, survives a crash
+    quint32 m_currentJournalId;         // Journal entry of running upload
+    QMap<int, struct File_Info> m_resumeSizeCmds;   // SIZE of uploads cut off by a crash
+
+    FtpHotFolder *m_pHotFolder;
+    QString m_hotRemoteDir;
+
+    FtpCapabilities m_capabilities;     // Server features, cached per host:port
+    int m_featCmdId;
+
+    bool m_packSmallFiles;      // Pack small files of an uploaded dir into an archive
+    qint64 m_packThreshold;     // Files smaller than this size are packed
+    QString m_unpackSiteCmd;    // SITE command to unpack the archive on server
+
+    FtpTarArchive *m_pArchive;  // Archive being uploaded
+    QString m_archiveName;
+    int m_archivePutId;
+    bool m_archiveRequeued;     // Archive put already queued again once
+    int m_manifestPutId;
+
+    int m_compressMode;
+    int m_compressLevel;
+    FtpCompressDevice *m_pCompress;     // Compression of current transfer
+    int m_modeZCmdId;
+    bool m_modeZRefused;                // Server refused MODE Z this session
+
+    int m_verifyAlgorithm;
+    FtpHashDevice *m_pHashDevice;       // Checksum of current transfer
+    QString m_verifyLocalName;
+    QString m_verifyRemoteName;
+    QHash<QString, QString> m_manifestDigests;
+
+    struct Verify_Info
+    {
+        QString fileName;
+        QString localDigest;
+        int algorithm;
+    };
+
+    QMap<int, struct Verify_Info> m_pendingVerify; // Keyed by HASH command id
+
+    struct Remote_Meta
+    {
+        Remote_Meta() : size(-1) {}
+
+        qint64 size;        // -1 if unknown
+        QDateTime mtime;    // UTC, invalid if unknown
+    };
+
+    QHash<QString, struct Remote_Meta> m_remoteMeta;   // Of current server dir
+    QMap<int, QString> m_sizeCmds;      // Prefetch SIZE command id to file name
+    QMap<int, QString> m_mdtmCmds;      // Prefetch MDTM command id to file name
+
+    QList<struct File_Info> m_downloadFileQueue;
+    bool m_downloadBatchFlag;           // Batch download in progress
+    qint64 m_batchTotalBytes;
+    qint64 m_batchDoneBytes;            // Bytes of finished files in batch
+    int m_batchFileCount;
+    QElapsedTimer m_batchTimer;
+    QElapsedTimer m_batchReportTimer;   // Throttles batch progress signal
+
+    qint64 m_currentGetSize;            // Prefetched size of running download
+    QDateTime m_currentGetMtime;
+
+    FtpTrace m_trace;
+    QHash<int, QString> m_rawCommandText;   // Queued raw commands, traced when sent
+
+    QString m_transferRemoteName;       // Remote name of running get/put
+    int m_transferCmdId;                // Get/put last queued for m_pFile
+    struct File_Info m_transferInfo;    // Its arguments, queued again if QFtp dropped it
+    bool m_transferRequeued;            // Already queued again once
+    int m_heldDirection;                // Get/put done, queue waits for its checksum
+
+    struct Retry_Info
+    {
+        Retry_Info() : direction(-1), compressed(false), retries(0) {}
+
+        int direction;          // FtpDataTransfer::DIRECTION_*, -1 if no retry pending
+        QString localPath;
+        QString remoteName;
+        bool compressed;        // Restarted from scratch, offset means nothing
+        int retries;
+    };
+
+    struct Retry_Stats
+    {
+        Retry_Stats() : retries(0), recovered(0), givenUp(0), failovers(0) {}
+
+        int retries;
+        int recovered;          // Transfers that succeeded after a retry
+        int givenUp;            // Transfers that failed after a retry
+        int failovers;
+    };
+
+    FtpRetryPolicy m_retryPolicy;
+    Retry_Info m_retry;                 // Transfer being retried
+    Retry_Stats m_retryStats;           // Since the last batch or queue report
+    QTimer m_retryTimer;
+    bool m_retryAfterLogin;             // Reconnect running, retry when logged in
+    int m_connectFailures;              // Failed connects in a row
+    FtpDataTransfer *m_pDataTransfer;   // Resumed transfer at an offset
+
+    QString m_primaryHost;
+    QStringList m_mirrorHosts;
+    int m_mirrorIndex;                  // 0 is the primary host
+
+    FtpRemoteBatch *m_pBatch;           // Running bulk operation
+
+    QString m_listGlob;                 // Of the running LIST, empty if none
+    int m_listCmdId;                    // LIST of the server list, -1 if none queued
+
+    struct Setup_Stats
+    {
+        Setup_Stats() : count(0), totalMsecs(0), maxMsecs(0) {}
+
+        int count;
+        qint64 totalMsecs;
+        qint64 maxMsecs;
+    };
+
+    int m_dataMode;
+    FtpListenerPool *m_pListenerPool;
+    FtpSocketTuning m_socketTuning;
+    QMap<int, struct Setup_Stats> m_setupStats;     // By data mode, since the last report
+    FtpListingStore m_listing;          // Of current server dir
+    QTimer m_listingTimer;              // Throttles listingGrown
+    int m_batchSessions;
+
+    QMap<int, QPointer<FtpOperation> > m_operations;   // By command id, until finished
+
+    FtpTransferHistory *m_pHistory;     // Of the connected server
+    QElapsedTimer m_transferTimer;      // Running get/put, retries included
+    QString m_transferError;            // Last failure of the running get/put
+
+    // New operation of type, failed later if not connected
+    FtpOperation *createOperation(int type);
+
+    // Own commandId by op, fail it if the command could not be queued
+    FtpOperation *startOperation(FtpOperation *op, int commandId);
+
+    // Finish the operation owning commandId, false if none does. A failed
+    // command also fails the operations queued behind it, QFtp drops them
+    bool finishOperation(int commandId, bool error);
+    void failOperations(int afterId, const QString &reason);
+
+    // Forget or queue again the commands QFtp dropped after commandId
+    // failed, true if continueQueues has something to go on with
+    bool dropQueuedCommands(int commandId);
+
+    // Queue the dropped get/put of m_pFile again, fail it the second time
+    void requeueTransfer();
+
+    // Same for the archive of a dir put
+    void requeueArchive();
+    void failOperation(FtpOperation *op, const QString &reason);
+
+    // FtpDataTransfer of op on m_ftp, its commands are owned by op
+    FtpDataTransfer *createOperationTransfer(FtpOperation *op);
+
+    // Batch on the server of this session, NULL if one runs or not connected
+    FtpRemoteBatch *createBatch();
+
+    // Queue a raw command on m_ftp and note its text for the trace
+    int queueRawCommand(const QString &command);
 
     // Re-connect to server
     void reConnectToServer();
 
+    // Create m_ftp and hook up its signals
+    void createFtp();
+
+    // Queue connect, login, cd and FEAT on m_ftp
+    void startSession(const QString &hostAddress);
+
+    // Drop m_ftp without touching the queues, a retry reconnects
+    void dropConnection();
+
     // Upload all files in dir to server
     bool putFilesInDir(QString dir);
 
-    void pushUploadQueue(QString fileName, QString dirPath);
+    // Upload small files in dir as one archive, large files go to upload queue
+    bool putPackedFilesInDir(QString dir);
+    void finishArchiveUpload(int commandId, bool error);
+
+    void pushUploadQueue(QString fileName, QString dirPath, QString remoteDir);
     bool popUploadQueue(struct File_Info &in);
 
     void refreshList();
 
+    // Wrap device for compressed transfer according to compress mode,
+    // remoteName gets the .gz suffix in gzip file mode.
+    // Returns device itself if no compression is used
+    QIODevice *beginCompression(QIODevice *device, QIODevice::OpenMode mode, QString &remoteName);
+
+    // Switch back to stream mode after a MODE Z transfer was queued
+    void endCompressionMode();
+
+    // Report compression stats, return false if compressed data was corrupt
+    bool finishCompression();
+
+    // Wrap device to checksum data of the transfer if verification is enabled,
+    // or to sample it into the trace
+    QIODevice *beginHashing(QIODevice *device, QIODevice::OpenMode mode,
+                            const QString &localName, const QString &remoteName);
+    void finishHashing(bool error);
+
+    // Compare digest with manifest, or ask server for its digest
+    void verifyTransfer(const QString &localName, const QString &remoteName, const QString &localDigest);
+    void reportVerifyResult(const QString &fileName, const QString &localDigest, const QString &remoteDigest);
+    static QString parseDigest(const QString &reply, int algorithm);
+
     // Send out files in upload queue
     bool processUploadQueue();
 
+    // Queue uploads the journal still has from an earlier run
+    void resumeJournal();
+
+    // No transfer or prefetch running, the upload queue may be started
+    bool isTransferIdle() const;
+
+    // Report result of a finished get/put and start the next queued one
+    void finishGet(bool error);
+    void finishPut(bool error);
+
+    // Start the next queued download or upload after a get
+    void continueAfterGet();
+
+    // Start the next queued upload, or end the queue
+    void continueUploadQueue();
+
+    // Upload of a local dir is done, cd back to where it started
+    void finishPutDir();
+
+    // Keep the partial file and retry the failed transfer later,
+    // false if errorClass or the retry count rule it out
+    bool scheduleRetry(int direction, bool compressed, int errorClass, const QString &reason);
+
+    // Start the retry on the logged in m_ftp
+    void restartTransfer();
+
+    // Give up the pending retry, report the file as failed
+    void abandonRetry();
+
+    // Detach and delete m_pDataTransfer
+    void clearDataTransfer();
+
+    // Checksum the complete local file after a resumed transfer
+    void verifyWholeFile(const QString &path, const QString &remoteName);
+
+    // Switch to the next host of mirror list, false if there is none
+    bool failoverToMirror();
+
+    // Retry figures for the end of a batch, empty if nothing was retried
+    QString takeRetryStats();
+
+    // Data connection setup times of a transfer, and their report for the
+    // end of a batch, empty if none was timed
+    void recordDataSetup(int mode, qint64 msecs);
+    QString takeDataSetupStats();
+
+    // Append the get/put of m_pFile that ends now to the history
+    void recordTransfer(int direction, bool error);
+
+    // Start downloads once all prefetch replies arrived
+    void startDownloadBatch();
+
+    // Start next file in download queue, false when queue is empty
+    bool processDownloadQueue();
+
+    // Reserve disk space for a download of known size
+    static bool preallocateFile(QFile *file, qint64 size);
+    static void setFileModifiedTime(const QString &path, const QDateTime &mtime);
+
 };
 
+// Signals of FtpClient are queued when it runs in an engine thread
+Q_DECLARE_METATYPE(QUrlInfo)
+
 #endif // FTPCLIENT_H
@@ -11,18 +11,35 @@ PURPOSE:        FTP client widget UI
 #include "QtBaseType.h"
 #include <QIcon>
 #include <QFileDialog>
+#include <QDialog>
+#include <QVBoxLayout>
+#include <QPlainTextEdit>
+#include <QMessageBox>
 #include <QDateTime>
 #include <QDir>
+#include <QItemSelectionModel>
 #include "QUtilityBox.h"
 #include <QDebug>
 
 FtpClientWidget::FtpClientWidget(QWidget *parent) :
     QWidget(parent),
     ui(new Ui::FtpClientWidget),
-    ftpClient(NULL)
+    ftpClient(NULL),
+    m_connectedFlag(false),
+    m_serverModel(this),
+    m_filterTimer(this),
+    m_serverListFiltered(false)
 {
     ui->setupUi(this);
 
+    // View asks for the rows in sight only, a dir of a million names costs
+    // no more widgets than one of ten
+    ui->listView_server->setModel(&m_serverModel);
+
+    m_filterTimer.setSingleShot(true);
+    m_filterTimer.setInterval(FILTER_DELAY_MSECS);
+    connect(&m_filterTimer, SIGNAL(timeout()), this, SLOT(applyServerFilter()));
+
     // Init Widget Font type and size
     initWidgetFont();
 
@@ -35,9 +52,9 @@ FtpClientWidget::FtpClientWidget(QWidget *parent) :
     connect(ui->listWidget_local, SIGNAL(pressed(QModelIndex)),
                 this, SLOT(enableUploadButton()));
 
-    connect(ui->listWidget_server, SIGNAL(itemActivated(QListWidgetItem*)),
-                this, SLOT(processServerListItem(QListWidgetItem*)));
-    connect(ui->listWidget_server, SIGNAL(pressed(QModelIndex)),
+    connect(ui->listView_server, SIGNAL(activated(QModelIndex)),
+                this, SLOT(processServerListItem(QModelIndex)));
+    connect(ui->listView_server, SIGNAL(pressed(QModelIndex)),
             this, SLOT(enableDownloadButton()));
 
 }
@@ -64,21 +81,66 @@ void FtpClientWidget::bindModel(FtpClient *modelP)
         unbind();
 
         ftpClient = modelP;
-        connect(ftpClient, SIGNAL(updateListInfo(QUrlInfo)), this, SLOT(addToServerList(QUrlInfo)));
+
+        // Store is read under its own lock, rows show up as listingGrown says
+        m_serverModel.setStore(ftpClient->listing());
+        connect(ftpClient, SIGNAL(listingGrown(int)), &m_serverModel, SLOT(refresh()));
         connect(ftpClient, SIGNAL(updateProgressVal(int)), this, SLOT(updateProgress(int)));
+        connect(ftpClient, SIGNAL(updateBatchProgress(qint64,qint64,int)),
+                this, SLOT(updateBatchProgress(qint64,qint64,int)));
         connect(ftpClient, SIGNAL(updateStatusMsg(QString)), this, SLOT(updateStatusBar(QString)));
         connect(ftpClient, SIGNAL(connectedStatus(bool)), this, SLOT(updateConnectionStatus(bool)));
         connect(ftpClient, SIGNAL(clearListInfo()), this, SLOT(clearServerList()));
+        connect(ftpClient, SIGNAL(traceDumped(QString)), this, SLOT(showTrace(QString)));
+        connect(ftpClient, SIGNAL(historyDumped(QString)), this, SLOT(showHistory(QString)));
+
+        // FtpClient may live in another thread, never call it directly
+        connect(this, SIGNAL(requestHostPort(QString,int)), ftpClient, SLOT(setHostPort(QString,int)));
+        connect(this, SIGNAL(requestUserInfo(QString,QString)), ftpClient, SLOT(setUserInfo(QString,QString)));
+        connect(this, SIGNAL(requestTls(int)), ftpClient, SLOT(setTls(int)));
+        connect(this, SIGNAL(requestDataMode(int)), ftpClient, SLOT(setDataMode(int)));
+        connect(this, SIGNAL(requestConnect()), ftpClient, SLOT(connectToServer()));
+        connect(this, SIGNAL(requestDisconnect()), ftpClient, SLOT(disconnectFromServer()));
+        connect(this, SIGNAL(requestGet(QString,QString)), ftpClient, SLOT(get(QString,QString)));
+        connect(this, SIGNAL(requestGetFiles(QStringList,QString)), ftpClient, SLOT(getFiles(QStringList,QString)));
+        connect(this, SIGNAL(requestPut(QString,QString)), ftpClient, SLOT(put(QString,QString)));
+        connect(this, SIGNAL(requestCdTo(QString)), ftpClient, SLOT(cdTo(QString)));
+        connect(this, SIGNAL(requestRemoveTree(QStringList)), ftpClient, SLOT(removeTree(QStringList)));
+        connect(this, SIGNAL(requestListMatching(QString)), ftpClient, SLOT(listMatching(QString)));
+        connect(this, SIGNAL(requestDumpTrace()), ftpClient, SLOT(dumpTrace()));
+        connect(this, SIGNAL(requestDumpHistory()), ftpClient, SLOT(dumpHistory()));
     }
 }
 
+QStringList FtpClientWidget::selectedServerFiles() const
+{
+    QModelIndexList rows = ui->listView_server->selectionModel()->selectedRows();
+    QStringList fileNames;
+
+    for(int i = 0; i < rows.size(); i++)
+    {
+        // Directories are not transferred
+        if(!m_serverModel.isDir(rows.at(i).row()))
+        {
+            fileNames.append(m_serverModel.name(rows.at(i).row()));
+        }
+    }
+
+    return fileNames;
+}
+
 void FtpClientWidget::unbind()
 {
     if(NULL != ftpClient)
     {
         disconnect(ftpClient, 0 , this , 0);
+        disconnect(this, 0 , ftpClient , 0);
+        disconnect(ftpClient, 0, &m_serverModel, 0);
     }
 
+    // Store goes away with ftpClient
+    m_serverModel.setStore(NULL);
+
     ftpClient = NULL;
 }
 
@@ -122,38 +184,68 @@ void FtpClientWidget::on_pushButton_connect_clicked()
 
     if(NULL != ftpClient)
     {
-        if(ftpClient->getConnectionStatus())
+        if(m_connectedFlag)
         {
-            ftpClient->disconnectFromServer();
+            emit requestDisconnect();
         }
         else
         {
-            ftpClient->setHostPort(ui->lineEdit_IP->text(), ui->lineEdit_port->text().toInt());
-            ftpClient->setUserInfo(ui->lineEdit_userName->text(), ui->lineEdit_password->text());
-            ftpClient->connectToServer();
+            emit requestHostPort(ui->lineEdit_IP->text(), ui->lineEdit_port->text().toInt());
+            emit requestUserInfo(ui->lineEdit_userName->text(), ui->lineEdit_password->text());
+            emit requestTls(ui->checkBox_tls->isChecked() ? FtpClient::TLS_EXPLICIT : FtpClient::TLS_NONE);
+
+            // Items are in FtpSession::DATA_MODE_* order
+            emit requestDataMode(ui->comboBox_dataMode->currentIndex());
+            emit requestConnect();
+
+            emit sessionTitleChanged(ui->lineEdit_IP->text());
         }
     }
 }
 
 
-void FtpClientWidget::addToServerList(const QUrlInfo &urlInfo)
+void FtpClientWidget::applyServerFilter()
 {
-    //qDebug() << "addToServerList " << urlInfo.name();
+    QString filter = ui->lineEdit_serverFilter->text();
+
+    m_serverModel.setFilter(filter);
+
+    if(!filter.isEmpty())
+    {
+        ui->label_status->setText(tr("%1 of %2 entries match \"%3\"")
+                                  .arg(m_serverModel.rowCount())
+                                  .arg(m_serverModel.entryCount())
+                                  .arg(filter));
+    }
+}
 
-    QListWidgetItem* item = new QListWidgetItem(urlInfo.name());
+void FtpClientWidget::on_lineEdit_serverFilter_textChanged(const QString &text)
+{
+    Q_UNUSED(text);
 
-    QPixmap pixmap(urlInfo.isDir() ? ":/images/dir.png" : ":/images/file.png");
-    item->setIcon(QIcon(pixmap));
+    // Search when typing pauses, not for every key
+    m_filterTimer.start();
+}
 
-    // Search the item in the list
-    QList<QListWidgetItem *> listItems = ui->listWidget_server->findItems(urlInfo.name(), Qt::MatchExactly);
+void FtpClientWidget::on_lineEdit_serverFilter_returnPressed()
+{
+    QString filter = ui->lineEdit_serverFilter->text();
 
-    // Not found in the list, add to list
-    if(0 == listItems.size())
+    if(NULL == ftpClient || !m_connectedFlag)
     {
-        ui->listWidget_server->addItem(item);
+        return;
+    }
 
-        isServerDirectory[urlInfo.name()] = urlInfo.isDir();
+    // Let the server pick the matches of a glob instead of listing all
+    if(FtpListingIndex::isGlob(filter))
+    {
+        m_serverListFiltered = true;
+        emit requestListMatching(filter);
+    }
+    else if(filter.isEmpty() && m_serverListFiltered)
+    {
+        m_serverListFiltered = false;
+        emit requestListMatching(QString());
     }
 }
 
@@ -169,6 +261,24 @@ void FtpClientWidget::updateProgress(int value)
     }
 }
 
+void FtpClientWidget::updateBatchProgress(qint64 doneBytes, qint64 totalBytes, int etaSecs)
+{
+    if(totalBytes <= 0)
+    {
+        return;
+    }
+
+    QString etaStr = (etaSecs < 0) ? QString("--:--")
+                                   : QString("%1:%2").arg(etaSecs / 60).arg(etaSecs % 60, 2, 10, QChar('0'));
+
+    // Status label only, the log would be flooded
+    ui->label_status->setText(tr("Batch %1% (%2 of %3 KB), ETA %4")
+                              .arg(100 * doneBytes / totalBytes)
+                              .arg(doneBytes / 1024)
+                              .arg(totalBytes / 1024)
+                              .arg(etaStr));
+}
+
 void FtpClientWidget::updateStatusBar(QString str)
 {
     ui->label_status->setText(str);
@@ -181,6 +291,8 @@ void FtpClientWidget::updateStatusBar(QString str)
 
 void FtpClientWidget::updateConnectionStatus(bool isConnected)
 {
+    m_connectedFlag = isConnected;
+
     if(isConnected)
     {
         ui->pushButton_connect->setText(tr("Disconnect"));
@@ -249,8 +361,17 @@ void FtpClientWidget::on_pushButton_download_clicked()
 
     if(enableDownloadButton())
     {
-        QString fileName = ui->listWidget_server->currentItem()->text();
-        ftpClient->get(fileName, ui->lineEdit_localDir->text());
+        QStringList fileNames = selectedServerFiles();
+
+        if(fileNames.size() > 1)
+        {
+            emit requestGetFiles(fileNames, ui->lineEdit_localDir->text());
+        }
+        else
+        {
+            QString fileName = m_serverModel.name(ui->listView_server->currentIndex().row());
+            emit requestGet(fileName, ui->lineEdit_localDir->text());
+        }
     }
 }
 
@@ -264,7 +385,7 @@ void FtpClientWidget::on_pushButton_upload_clicked()
     if(enableUploadButton())
     {
         QString fileName = ui->listWidget_local->currentItem()->text();
-        ftpClient->put(fileName, ui->lineEdit_localDir->text());
+        emit requestPut(fileName, ui->lineEdit_localDir->text());
     }
 }
 
@@ -287,19 +408,17 @@ void FtpClientWidget::processLocalListItem(QListWidgetItem *item)
     }
 }
 
-void FtpClientWidget::processServerListItem(QListWidgetItem *item)
+void FtpClientWidget::processServerListItem(const QModelIndex &index)
 {
-    QString name = item->text();
-    if (isServerDirectory.value(name))
+    QString name = m_serverModel.name(index.row());
+    if (m_serverModel.isDir(index.row()))
     {
-        // Clear list widget of server dir
-        clearServerList();
-
+        // List is cleared by ftpClient when the new dir is listed
         QString path = ui->lineEdit_serverDir->text();
         path.append("/");
         path.append(name);
 
-        ftpClient->cdTo(path);
+        emit requestCdTo(path);
         ui->lineEdit_serverDir->setText(path);
     }
 }
@@ -324,11 +443,11 @@ void FtpClientWidget::cdToParent()
 
     if (path.isEmpty())
     {
-        ftpClient->cdTo("/");
+        emit requestCdTo("/");
     }
     else
     {
-        ftpClient->cdTo(path);
+        emit requestCdTo(path);
     }
 }
 
@@ -337,11 +456,82 @@ void FtpClientWidget::on_pushButton_serverBack_clicked()
     cdToParent();
 }
 
+void FtpClientWidget::on_pushButton_serverDelete_clicked()
+{
+    QModelIndexList rows = ui->listView_server->selectionModel()->selectedRows();
+    QStringList names;
+
+    if(NULL == ftpClient || rows.isEmpty())
+    {
+        return;
+    }
+
+    // Dirs too, unlike selectedServerFiles()
+    for(int i = 0; i < rows.size(); i++)
+    {
+        names.append(m_serverModel.name(rows.at(i).row()));
+    }
+
+    if(QMessageBox::Yes != QMessageBox::question(this, tr("Delete"),
+                                                  tr("Delete %1 selected entries and everything below them?")
+                                                  .arg(names.size()),
+                                                  QMessageBox::Yes | QMessageBox::No, QMessageBox::No))
+    {
+        return;
+    }
+
+    emit requestRemoveTree(names);
+}
+
 void FtpClientWidget::on_pushButton_clear_clicked()
 {
     ui->textEdit_log->clear();
 }
 
+void FtpClientWidget::on_pushButton_trace_clicked()
+{
+    // Answer arrives through showTrace
+    emit requestDumpTrace();
+}
+
+void FtpClientWidget::showTrace(QString text)
+{
+    showTextDialog(tr("Protocol trace"), text);
+}
+
+void FtpClientWidget::on_pushButton_history_clicked()
+{
+    // Answer arrives through showHistory
+    emit requestDumpHistory();
+}
+
+void FtpClientWidget::showHistory(QString text)
+{
+    showTextDialog(tr("Transfer history"), text);
+}
+
+void FtpClientWidget::showTextDialog(const QString &title, const QString &text)
+{
+    QDialog *dialog = new QDialog(this);
+    QVBoxLayout *layout = new QVBoxLayout(dialog);
+    QPlainTextEdit *textEdit = new QPlainTextEdit(dialog);
+    QFont font("Courier");
+
+    font.setStyleHint(QFont::TypeWriter);
+
+    textEdit->setReadOnly(true);
+    textEdit->setLineWrapMode(QPlainTextEdit::NoWrap);
+    textEdit->setFont(font);
+    textEdit->setPlainText(text);
+    textEdit->moveCursor(QTextCursor::End);
+    layout->addWidget(textEdit);
+
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setWindowTitle(title);
+    dialog->resize(800, 500);
+    dialog->show();
+}
+
 void FtpClientWidget::updateLogData(QString logStr)
 {
     QDateTime time = QDateTime::currentDateTime();
@@ -358,9 +548,8 @@ void FtpClientWidget::updateLogData(QString logStr)
 bool FtpClientWidget::enableDownloadButton()
 {
     bool ret = false;
-    int current = ui->listWidget_server->currentRow();
+    int current = ui->listView_server->currentIndex().row();
 
-    //qDebug() << "ui->listWidget_server->currentRow(); = " << ui->listWidget_server->currentRow();
     if (current >= 0)
     {
         ret = true;
@@ -389,9 +578,8 @@ bool FtpClientWidget::enableUploadButton()
 
 void FtpClientWidget::clearServerList()
 {
-    // Clear list widget
-    ui->listWidget_server->clear();
-    isServerDirectory.clear();
+    // Store was cleared by ftpClient, start over from it
+    m_serverModel.reset();
 }
 
 void FtpClientWidget::clearLocalList()
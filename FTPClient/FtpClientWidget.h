@@ -13,7 +13,9 @@ PURPOSE:        FTP client widget UI
 #include <QHash>
 #include <QFileInfoList>
 #include <QListWidgetItem>
+#include <QTimer>
 #include "FtpClient.h"
+#include "FtpListingModel.h"
 
 namespace Ui {
 class FtpClientWidget;
@@ -43,6 +45,36 @@ public:
     -----------------------------------------------------------------------*/
     void unbind();
 
+    /*-----------------------------------------------------------------------
+    FUNCTION:		selectedServerFiles
+    PURPOSE:		Get the selected files (not directories) in server list
+    ARGUMENTS:		None
+    RETURNS:		File names in current server dir
+    -----------------------------------------------------------------------*/
+    QStringList selectedServerFiles() const;
+
+signals:
+    // Session title for the tab, e.g. server address
+    void sessionTitleChanged(QString title);
+
+    // Requests to the bound FtpClient, queued when it runs in an engine thread
+    void requestHostPort(QString ip, int port);
+    void requestUserInfo(QString user, QString pwd);
+    void requestTls(int mode);
+    void requestDataMode(int mode);
+    void requestConnect();
+    void requestDisconnect();
+    void requestGet(QString fileName, QString dir);
+    void requestGetFiles(QStringList fileNames, QString dir);
+    void requestPut(QString fileName, QString dir);
+    void requestCdTo(QString path);
+    void requestRemoveTree(QStringList names);
+
+    // List only names matching glob, empty glob lists all again
+    void requestListMatching(QString glob);
+    void requestDumpTrace();
+    void requestDumpHistory();
+
 protected:
     void resizeEvent(QResizeEvent *e);
 
@@ -50,7 +82,7 @@ private slots:
     void on_pushButton_connect_clicked();
 
     void updateProgress(int value);
-    void addToServerList(const QUrlInfo &urlInfo);
+    void updateBatchProgress(qint64 doneBytes, qint64 totalBytes, int etaSecs);
     void updateStatusBar(QString str);
     void updateConnectionStatus(bool isConnected);
 
@@ -61,14 +93,23 @@ private slots:
     void on_pushButton_upload_clicked();
 
     void processLocalListItem(QListWidgetItem *item);
-    void processServerListItem(QListWidgetItem *item);
+    void processServerListItem(const QModelIndex &index);
 
     void on_lineEdit_localDir_textChanged(const QString &arg1);
 
     void on_pushButton_serverBack_clicked();
+    void on_pushButton_serverDelete_clicked();
+    void on_lineEdit_serverFilter_textChanged(const QString &text);
+    void on_lineEdit_serverFilter_returnPressed();
+    void applyServerFilter();
 
     void on_pushButton_clear_clicked();
 
+    void on_pushButton_trace_clicked();
+    void showTrace(QString text);
+    void on_pushButton_history_clicked();
+    void showHistory(QString text);
+
     bool enableDownloadButton();
     bool enableUploadButton();
 
@@ -80,7 +121,15 @@ private:
 
     FtpClient *ftpClient;
 
-    QHash<QString, bool> isServerDirectory;
+    bool m_connectedFlag;   // Last state reported by ftpClient
+
+    enum{
+        FILTER_DELAY_MSECS = 150
+    };
+
+    FtpListingModel m_serverModel;  // Listing of the server dir, read from ftpClient
+    QTimer m_filterTimer;
+    bool m_serverListFiltered;      // Server was asked for glob matches only
     QHash<QString, bool> isLocalDirectory;
 
     QFileInfoList m_localFileInfoList;
@@ -97,6 +146,9 @@ private:
 
     // Update log
     void updateLogData(QString logStr);
+
+    // Read-only monospace text in a window of its own
+    void showTextDialog(const QString &title, const QString &text);
 };
 
 #endif // FTPCLIENTWIDGET_H
@@ -0,0 +1,287 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpCompressDevice.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Streaming deflate/inflate on top of another QIODevice
+**********************************************************************/
+
+#include "FtpCompressDevice.h"
+#include <QElapsedTimer>
+#include <string.h>
+
+
+FtpCompressDevice::FtpCompressDevice(QIODevice *device, Format format, int level, QObject *parent) :
+    QIODevice(parent),
+    m_device(device),
+    m_format(format),
+    m_level(level),
+    m_streamInit(false),
+    m_streamEnd(false),
+    m_streamError(false),
+    m_inputEnd(false),
+    m_rawBytes(0),
+    m_compressedBytes(0),
+    m_codecNsecs(0)
+{
+    memset(&m_stream, 0, sizeof(m_stream));
+}
+
+FtpCompressDevice::~FtpCompressDevice()
+{
+    close();
+}
+
+bool FtpCompressDevice::open(OpenMode mode)
+{
+    int ret = Z_STREAM_ERROR;
+
+    // Only one direction per stream
+    if(NULL == m_device || m_streamInit
+            || (mode & QIODevice::ReadWrite) == QIODevice::ReadWrite)
+    {
+        return false;
+    }
+
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_streamEnd = false;
+    m_streamError = false;
+    m_inputEnd = false;
+    m_rawBytes = 0;
+    m_compressedBytes = 0;
+    m_codecNsecs = 0;
+
+    if(mode & QIODevice::ReadOnly)
+    {
+        ret = deflateInit2(&m_stream, m_level, Z_DEFLATED, windowBits(), 8, Z_DEFAULT_STRATEGY);
+    }
+    else if(mode & QIODevice::WriteOnly)
+    {
+        ret = inflateInit2(&m_stream, windowBits());
+    }
+
+    if(Z_OK != ret)
+    {
+        return false;
+    }
+
+    m_streamInit = true;
+    m_buffer.resize(COMPRESS_CHUNK_SIZE);
+
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void FtpCompressDevice::close()
+{
+    if(!isOpen())
+    {
+        return;
+    }
+
+    // Decompression stopped before the end of the stream
+    if((openMode() & QIODevice::WriteOnly) && !m_streamEnd)
+    {
+        m_streamError = true;
+    }
+
+    endStream();
+
+    QIODevice::close();
+}
+
+bool FtpCompressDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 FtpCompressDevice::bytesAvailable() const
+{
+    if(!(openMode() & QIODevice::ReadOnly) || m_streamEnd)
+    {
+        return QIODevice::bytesAvailable();
+    }
+
+    // Compressed size is unknown in advance, report what the source still has
+    return QIODevice::bytesAvailable() + qMax<qint64>(m_device->bytesAvailable(), 1);
+}
+
+bool FtpCompressDevice::isStreamEnd() const
+{
+    return m_streamEnd;
+}
+
+bool FtpCompressDevice::hasStreamError() const
+{
+    return m_streamError;
+}
+
+qint64 FtpCompressDevice::rawBytes() const
+{
+    return m_rawBytes;
+}
+
+qint64 FtpCompressDevice::compressedBytes() const
+{
+    return m_compressedBytes;
+}
+
+double FtpCompressDevice::ratio() const
+{
+    if(0 == m_compressedBytes)
+    {
+        return 0.0;
+    }
+
+    return (double)m_rawBytes / (double)m_compressedBytes;
+}
+
+qint64 FtpCompressDevice::codecMsecs() const
+{
+    return m_codecNsecs / 1000000;
+}
+
+qint64 FtpCompressDevice::readData(char *data, qint64 maxSize)
+{
+    QElapsedTimer timer;
+    qint64 done = 0;
+
+    if(!m_streamInit || m_streamEnd || m_streamError)
+    {
+        return -1;
+    }
+
+    timer.start();
+
+    m_stream.next_out = (Bytef *)data;
+    m_stream.avail_out = (uInt)qMin<qint64>(maxSize, COMPRESS_CHUNK_SIZE);
+
+    while(m_stream.avail_out > 0 && !m_streamEnd)
+    {
+        // Refill input, one bounded chunk at a time
+        if(0 == m_stream.avail_in && !m_inputEnd)
+        {
+            qint64 readLen = m_device->read(m_buffer.data(), m_buffer.size());
+            if(readLen <= 0)
+            {
+                m_inputEnd = true;
+                readLen = 0;
+            }
+
+            m_rawBytes += readLen;
+            m_stream.next_in = (Bytef *)m_buffer.data();
+            m_stream.avail_in = (uInt)readLen;
+        }
+
+        int ret = deflate(&m_stream, m_inputEnd ? Z_FINISH : Z_NO_FLUSH);
+        if(Z_STREAM_END == ret)
+        {
+            m_streamEnd = true;
+        }
+        else if(Z_OK != ret && Z_BUF_ERROR != ret)
+        {
+            m_streamError = true;
+            break;
+        }
+    }
+
+    done = qMin<qint64>(maxSize, COMPRESS_CHUNK_SIZE) - m_stream.avail_out;
+    m_compressedBytes += done;
+    m_codecNsecs += timer.nsecsElapsed();
+
+    if(0 == done && (m_streamEnd || m_streamError))
+    {
+        return -1;
+    }
+
+    return done;
+}
+
+qint64 FtpCompressDevice::writeData(const char *data, qint64 maxSize)
+{
+    QElapsedTimer timer;
+    qint64 consumed = 0;
+
+    if(!m_streamInit || m_streamError)
+    {
+        return -1;
+    }
+
+    timer.start();
+
+    // Feed in bounded slices so avail_in never overflows uInt
+    while(consumed < maxSize && !m_streamEnd)
+    {
+        qint64 sliceLen = qMin<qint64>(maxSize - consumed, COMPRESS_CHUNK_SIZE);
+
+        m_stream.next_in = (Bytef *)(data + consumed);
+        m_stream.avail_in = (uInt)sliceLen;
+
+        do
+        {
+            m_stream.next_out = (Bytef *)m_buffer.data();
+            m_stream.avail_out = (uInt)m_buffer.size();
+
+            int ret = inflate(&m_stream, Z_NO_FLUSH);
+            if(Z_STREAM_END == ret)
+            {
+                m_streamEnd = true;
+            }
+            else if(Z_OK != ret && Z_BUF_ERROR != ret)
+            {
+                m_streamError = true;
+                return -1;
+            }
+
+            qint64 outLen = m_buffer.size() - m_stream.avail_out;
+            if(outLen > 0 && m_device->write(m_buffer.constData(), outLen) != outLen)
+            {
+                m_streamError = true;
+                return -1;
+            }
+
+            m_rawBytes += outLen;
+        }
+        while(0 == m_stream.avail_out && !m_streamEnd);
+
+        consumed += sliceLen - m_stream.avail_in;
+
+        if(m_stream.avail_in > 0 && !m_streamEnd)
+        {
+            // No progress possible, corrupt stream
+            m_streamError = true;
+            return -1;
+        }
+    }
+
+    m_compressedBytes += consumed;
+    m_codecNsecs += timer.nsecsElapsed();
+
+    // Trailing bytes after the end of stream are dropped
+    return maxSize;
+}
+
+int FtpCompressDevice::windowBits() const
+{
+    // +16 selects the gzip wrapper
+    return (FORMAT_GZIP == m_format) ? (MAX_WBITS + 16) : MAX_WBITS;
+}
+
+void FtpCompressDevice::endStream()
+{
+    if(!m_streamInit)
+    {
+        return;
+    }
+
+    if(openMode() & QIODevice::ReadOnly)
+    {
+        deflateEnd(&m_stream);
+    }
+    else
+    {
+        inflateEnd(&m_stream);
+    }
+
+    m_streamInit = false;
+    m_buffer.clear();
+}
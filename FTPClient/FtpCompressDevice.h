@@ -0,0 +1,76 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpCompressDevice.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Streaming deflate/inflate on top of another QIODevice
+**********************************************************************/
+
+#ifndef FTPCOMPRESSDEVICE_H
+#define FTPCOMPRESSDEVICE_H
+#include <QIODevice>
+#include <QByteArray>
+#include <zlib.h>
+
+class FtpCompressDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    enum Format{
+        FORMAT_ZLIB = 0,    // MODE Z data stream (RFC 1950)
+        FORMAT_GZIP         // Compressed file (.gz)
+    };
+
+    enum{
+        COMPRESS_CHUNK_SIZE = 64 * 1024,
+        COMPRESS_DEFAULT_LEVEL = 6
+    };
+
+    // Opened ReadOnly, reading returns the compressed content of device.
+    // Opened WriteOnly, written data is decompressed into device.
+    // The device is not owned and must stay valid while this is open
+    explicit FtpCompressDevice(QIODevice *device, Format format = FORMAT_ZLIB,
+                               int level = COMPRESS_DEFAULT_LEVEL, QObject *parent = 0);
+    ~FtpCompressDevice();
+
+    bool open(OpenMode mode);
+    void close();
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+    // True once the whole compressed stream was produced or consumed
+    bool isStreamEnd() const;
+    bool hasStreamError() const;
+
+    // Transfer statistics
+    qint64 rawBytes() const;            // Uncompressed bytes
+    qint64 compressedBytes() const;     // Bytes on the wire
+    double ratio() const;               // rawBytes / compressedBytes
+    qint64 codecMsecs() const;          // Time spent in zlib
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    QIODevice *m_device;
+    Format m_format;
+    int m_level;
+
+    z_stream m_stream;
+    bool m_streamInit;
+    bool m_streamEnd;
+    bool m_streamError;
+    bool m_inputEnd;        // Source device exhausted (compress)
+
+    QByteArray m_buffer;    // Bounded input (compress) or output (decompress) chunk
+
+    qint64 m_rawBytes;
+    qint64 m_compressedBytes;
+    qint64 m_codecNsecs;
+
+    int windowBits() const;
+    void endStream();
+};
+
+#endif // FTPCOMPRESSDEVICE_H
@@ -0,0 +1,358 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpConnector.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Cached host resolution and connection racing (happy eyeballs)
+**********************************************************************/
+
+#include "FtpConnector.h"
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDateTime>
+
+namespace
+{
+    struct Dns_Entry
+    {
+        QList<QHostAddress> addresses;
+        QHostAddress preferred;     // Address that won the last race
+        QDateTime expires;
+    };
+
+    // Shared by all sessions
+    QHash<QString, struct Dns_Entry> s_dnsCache;
+    QMutex s_dnsCacheMutex;
+
+    bool lookupCache(const QString &host, QList<QHostAddress> &addresses, QHostAddress &preferred)
+    {
+        QMutexLocker locker(&s_dnsCacheMutex);
+        QHash<QString, struct Dns_Entry>::iterator it = s_dnsCache.find(host);
+
+        if(it == s_dnsCache.end())
+        {
+            return false;
+        }
+
+        if(it.value().expires < QDateTime::currentDateTime())
+        {
+            s_dnsCache.erase(it);
+            return false;
+        }
+
+        addresses = it.value().addresses;
+        preferred = it.value().preferred;
+
+        return true;
+    }
+
+    void storeCache(const QString &host, const QList<QHostAddress> &addresses)
+    {
+        QMutexLocker locker(&s_dnsCacheMutex);
+        struct Dns_Entry &entry = s_dnsCache[host];
+
+        entry.addresses = addresses;
+        entry.expires = QDateTime::currentDateTime().addSecs(FtpConnector::DNS_CACHE_TTL_SECS);
+    }
+
+    void storePreferred(const QString &host, const QHostAddress &address)
+    {
+        QMutexLocker locker(&s_dnsCacheMutex);
+
+        if(s_dnsCache.contains(host))
+        {
+            s_dnsCache[host].preferred = address;
+        }
+    }
+}
+
+
+FtpConnector::FtpConnector(QObject *parent) :
+    QObject(parent),
+    m_port(0),
+    m_lookupId(-1),
+    m_attemptCount(0),
+    m_failedCount(0),
+    m_attemptTimer(this),
+    m_timeoutTimer(this),
+    m_resolveMsecs(0),
+    m_raceMsecs(0),
+    m_fromCache(false)
+{
+    m_attemptTimer.setSingleShot(true);
+    m_attemptTimer.setInterval(CONNECT_ATTEMPT_DELAY_MSECS);
+    connect(&m_attemptTimer, SIGNAL(timeout()), this, SLOT(startNextAttempt()));
+
+    m_timeoutTimer.setSingleShot(true);
+    m_timeoutTimer.setInterval(CONNECT_TIMEOUT_MSECS);
+    connect(&m_timeoutTimer, SIGNAL(timeout()), this, SLOT(dealTimeout()));
+}
+
+FtpConnector::~FtpConnector()
+{
+    abort();
+}
+
+void FtpConnector::start(const QString &host, quint16 port)
+{
+    QList<QHostAddress> addresses;
+    QHostAddress preferred;
+
+    abort();
+
+    m_host = host.toLower();
+    m_port = port;
+    m_address.clear();
+    m_errorString.clear();
+    m_candidates.clear();
+    m_attemptCount = 0;
+    m_failedCount = 0;
+    m_resolveMsecs = 0;
+    m_raceMsecs = 0;
+    m_fromCache = false;
+
+    m_clock.start();
+    m_timeoutTimer.start();
+
+    // Literal address, nothing to resolve or race
+    QHostAddress literal(host);
+    if(!literal.isNull())
+    {
+        m_candidates.append(literal);
+        QTimer::singleShot(0, this, SLOT(startNextAttempt()));
+        return;
+    }
+
+    if(lookupCache(m_host, addresses, preferred))
+    {
+        m_fromCache = true;
+        m_candidates = sortAddresses(addresses, preferred);
+        QTimer::singleShot(0, this, SLOT(startNextAttempt()));
+        return;
+    }
+
+    m_lookupId = QHostInfo::lookupHost(host, this, SLOT(dealLookup(QHostInfo)));
+}
+
+void FtpConnector::abort()
+{
+    if(-1 != m_lookupId)
+    {
+        QHostInfo::abortHostLookup(m_lookupId);
+        m_lookupId = -1;
+    }
+
+    m_attemptTimer.stop();
+    m_timeoutTimer.stop();
+
+    closeSockets();
+}
+
+QHostAddress FtpConnector::address() const
+{
+    return m_address;
+}
+
+QString FtpConnector::errorString() const
+{
+    return m_errorString;
+}
+
+qint64 FtpConnector::resolveMsecs() const
+{
+    return m_resolveMsecs;
+}
+
+qint64 FtpConnector::raceMsecs() const
+{
+    return m_raceMsecs;
+}
+
+int FtpConnector::candidateCount() const
+{
+    return m_candidates.size();
+}
+
+int FtpConnector::attemptCount() const
+{
+    return m_attemptCount;
+}
+
+bool FtpConnector::fromCache() const
+{
+    return m_fromCache;
+}
+
+void FtpConnector::invalidate(const QString &host)
+{
+    QMutexLocker locker(&s_dnsCacheMutex);
+
+    s_dnsCache.remove(host.toLower());
+}
+
+void FtpConnector::dealLookup(const QHostInfo &info)
+{
+    m_lookupId = -1;
+    m_resolveMsecs = m_clock.elapsed();
+
+    if(QHostInfo::NoError != info.error() || info.addresses().isEmpty())
+    {
+        m_errorString = info.errorString();
+        finish(false);
+        return;
+    }
+
+    storeCache(m_host, info.addresses());
+    m_candidates = sortAddresses(info.addresses(), QHostAddress());
+
+    startNextAttempt();
+}
+
+void FtpConnector::startNextAttempt()
+{
+    int index = m_attemptCount;
+
+    // Aborted, or every address already tried
+    if(!m_timeoutTimer.isActive() || index >= m_candidates.size())
+    {
+        return;
+    }
+
+    // Nothing to race, the caller connects directly
+    if(1 == m_candidates.size())
+    {
+        m_address = m_candidates.first();
+        finish(true);
+        return;
+    }
+
+    QTcpSocket *socket = new QTcpSocket(this);
+    connect(socket, SIGNAL(connected()), this, SLOT(dealSocketConnected()));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(dealSocketError()));
+
+    m_sockets.append(socket);
+    m_attemptCount++;
+    socket->connectToHost(m_candidates.at(index), m_port);
+
+    // Next address gets its turn unless this one connects first
+    if(index + 1 < m_candidates.size())
+    {
+        m_attemptTimer.start();
+    }
+}
+
+void FtpConnector::dealSocketConnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+
+    if(NULL == socket)
+    {
+        return;
+    }
+
+    m_address = socket->peerAddress();
+    storePreferred(m_host, m_address);
+
+    finish(true);
+}
+
+void FtpConnector::dealSocketError()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+
+    if(NULL == socket || !m_sockets.contains(socket))
+    {
+        return;
+    }
+
+    m_errorString = socket->errorString();
+    m_failedCount++;
+
+    if(m_failedCount >= m_candidates.size())
+    {
+        // Every address refused, resolve again next time
+        invalidate(m_host);
+        finish(false);
+        return;
+    }
+
+    // Failed early, do not wait for the head start to run out
+    if(m_failedCount >= m_attemptCount)
+    {
+        m_attemptTimer.stop();
+        startNextAttempt();
+    }
+}
+
+void FtpConnector::dealTimeout()
+{
+    m_errorString = tr("Connection timed out");
+    finish(false);
+}
+
+void FtpConnector::finish(bool ok)
+{
+    m_raceMsecs = m_clock.elapsed() - m_resolveMsecs;
+
+    abort();
+
+    // Emit signal
+    emit finished(ok);
+}
+
+void FtpConnector::closeSockets()
+{
+    for(int i = 0; i < m_sockets.size(); i++)
+    {
+        m_sockets.at(i)->disconnect(this);
+        m_sockets.at(i)->abort();
+        m_sockets.at(i)->deleteLater();
+    }
+
+    m_sockets.clear();
+}
+
+QList<QHostAddress> FtpConnector::sortAddresses(const QList<QHostAddress> &addresses,
+                                                const QHostAddress &preferred)
+{
+    QList<QHostAddress> ipv6;
+    QList<QHostAddress> ipv4;
+    QList<QHostAddress> sorted;
+
+    for(int i = 0; i < addresses.size(); i++)
+    {
+        if(addresses.at(i) == preferred)
+        {
+            continue;
+        }
+
+        if(QAbstractSocket::IPv6Protocol == addresses.at(i).protocol())
+        {
+            ipv6.append(addresses.at(i));
+        }
+        else
+        {
+            ipv4.append(addresses.at(i));
+        }
+    }
+
+    if(!preferred.isNull())
+    {
+        sorted.append(preferred);
+    }
+
+    while(!ipv6.isEmpty() || !ipv4.isEmpty())
+    {
+        if(!ipv6.isEmpty())
+        {
+            sorted.append(ipv6.takeFirst());
+        }
+        if(!ipv4.isEmpty())
+        {
+            sorted.append(ipv4.takeFirst());
+        }
+    }
+
+    return sorted;
+}
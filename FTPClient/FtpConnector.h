@@ -0,0 +1,88 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpConnector.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Cached host resolution and connection racing (happy eyeballs)
+**********************************************************************/
+
+#ifndef FTPCONNECTOR_H
+#define FTPCONNECTOR_H
+#include <QObject>
+#include <QHostInfo>
+#include <QHostAddress>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+
+class FtpConnector : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        CONNECT_ATTEMPT_DELAY_MSECS = 250,  // Head start of each address (RFC 8305)
+        CONNECT_TIMEOUT_MSECS = 15000,
+        DNS_CACHE_TTL_SECS = 300
+    };
+
+    explicit FtpConnector(QObject *parent = 0);
+    ~FtpConnector();
+
+    // Resolve host (from cache if fresh) and race TCP connects to its
+    // addresses, finished() reports the first address that accepted
+    void start(const QString &host, quint16 port);
+    void abort();
+
+    QHostAddress address() const;
+    QString errorString() const;
+
+    // Metrics of the last start()
+    qint64 resolveMsecs() const;
+    qint64 raceMsecs() const;
+    int candidateCount() const;
+    int attemptCount() const;
+    bool fromCache() const;
+
+    // Drop the cached addresses of host, e.g. after the server moved
+    static void invalidate(const QString &host);
+
+signals:
+    void finished(bool ok);
+
+private slots:
+    void dealLookup(const QHostInfo &info);
+    void startNextAttempt();
+    void dealSocketConnected();
+    void dealSocketError();
+    void dealTimeout();
+
+private:
+    QString m_host;
+    quint16 m_port;
+    int m_lookupId;
+
+    QList<QHostAddress> m_candidates;
+    QList<QTcpSocket *> m_sockets;
+    int m_attemptCount;
+    int m_failedCount;
+
+    QTimer m_attemptTimer;
+    QTimer m_timeoutTimer;
+    QElapsedTimer m_clock;
+
+    QHostAddress m_address;
+    QString m_errorString;
+    qint64 m_resolveMsecs;
+    qint64 m_raceMsecs;
+    bool m_fromCache;
+
+    void finish(bool ok);
+    void closeSockets();
+
+    // IPv6 and IPv4 alternating, last winner of host first
+    static QList<QHostAddress> sortAddresses(const QList<QHostAddress> &addresses,
+                                             const QHostAddress &preferred);
+};
+
+#endif // FTPCONNECTOR_H
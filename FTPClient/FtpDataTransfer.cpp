@@ -0,0 +1,573 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpDataTransfer.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        RETR/STOR over raw commands and an own data socket
+**********************************************************************/
+
+#include "FtpDataTransfer.h"
+#include "FtpListenerPool.h"
+#include <QSslSocket>
+
+
+FtpDataTransfer::FtpDataTransfer(FtpSession *ftp, const QHostAddress &serverAddress, QObject *parent) :
+    QObject(parent),
+    m_ftp(ftp),
+    m_serverAddress(serverAddress),
+    m_pSocket(NULL),
+    m_pListener(NULL),
+    m_timeoutTimer(this),
+    m_dataMode(ftp->dataMode()),
+    m_setupMsecs(-1),
+    m_pDevice(NULL),
+    m_direction(DIRECTION_GET),
+    m_offset(0),
+    m_totalSize(-1),
+    m_transferredBytes(0),
+    m_queueBytes((qint64)DATA_CHUNK_SIZE * ftp->socketTuning().queueDepth()),
+    m_sizeId(-1),
+    m_setupId(-1),
+    m_restId(-1),
+    m_transferId(-1),
+    m_running(false),
+    m_dataReady(false),
+    m_transferStarted(false),
+    m_controlDone(false),
+    m_dataClosed(false),
+    m_sourceDone(false),
+    m_dataDone(false),
+    m_replyCode(0)
+{
+    m_timeoutTimer.setSingleShot(true);
+    m_timeoutTimer.setInterval(DATA_CONNECT_TIMEOUT_MSECS);
+    connect(&m_timeoutTimer, SIGNAL(timeout()), this, SLOT(dealTimeout()));
+
+    connect(m_ftp, SIGNAL(rawCommandReply(int,QString)), this, SLOT(dealReply(int,QString)));
+    connect(m_ftp, SIGNAL(commandStarted(int)), this, SLOT(dealCommandStarted(int)));
+}
+
+FtpDataTransfer::~FtpDataTransfer()
+{
+    closeSocket();
+}
+
+void FtpDataTransfer::get(const QString &remoteName, QIODevice *device, qint64 offset, qint64 totalSize)
+{
+    m_direction = DIRECTION_GET;
+    m_remoteName = remoteName;
+    m_pDevice = device;
+    m_offset = qMax<qint64>(offset, 0);
+    m_totalSize = totalSize;
+    m_running = true;
+
+    // A sink with a write buffer tells when it has room again
+    connect(m_pDevice, SIGNAL(bytesWritten(qint64)), this, SLOT(dealDeviceBytesWritten()));
+
+    queueCommand("TYPE I");
+    queueTransfer();
+}
+
+void FtpDataTransfer::put(const QString &remoteName, QIODevice *device, bool resume)
+{
+    m_direction = DIRECTION_PUT;
+    m_remoteName = remoteName;
+    m_pDevice = device;
+    m_offset = 0;
+    m_totalSize = device->isSequential() ? -1 : device->size();
+    m_running = true;
+
+    if(device->isSequential())
+    {
+        QAbstractSocket *socket = qobject_cast<QAbstractSocket *>(device);
+
+        // Unread data of a socket source stays with its sender
+        if(NULL != socket && 0 == socket->readBufferSize())
+        {
+            socket->setReadBufferSize(m_queueBytes);
+        }
+
+        connect(device, SIGNAL(readyRead()), this, SLOT(dealDeviceReadyRead()));
+        connect(device, SIGNAL(readChannelFinished()), this, SLOT(dealDeviceReadChannelFinished()));
+        resume = false;
+    }
+
+    // SIZE counts bytes only in binary mode on most servers
+    queueCommand("TYPE I");
+
+    if(resume)
+    {
+        // PASV and STOR follow once the size is known
+        m_sizeId = queueCommand(QString("SIZE %1").arg(remoteName));
+    }
+    else
+    {
+        queueTransfer();
+    }
+}
+
+void FtpDataTransfer::abort()
+{
+    if(!m_running)
+    {
+        return;
+    }
+
+    fail(0, tr("Aborted"));
+}
+
+bool FtpDataTransfer::ownsCommand(int commandId) const
+{
+    return m_commandIds.contains(commandId);
+}
+
+int FtpDataTransfer::direction() const
+{
+    return m_direction;
+}
+
+qint64 FtpDataTransfer::offset() const
+{
+    return m_offset;
+}
+
+qint64 FtpDataTransfer::transferredBytes() const
+{
+    return m_transferredBytes;
+}
+
+int FtpDataTransfer::replyCode() const
+{
+    return m_replyCode;
+}
+
+QString FtpDataTransfer::errorString() const
+{
+    return m_errorString;
+}
+
+int FtpDataTransfer::dataMode() const
+{
+    return m_dataMode;
+}
+
+qint64 FtpDataTransfer::setupMsecs() const
+{
+    return m_setupMsecs;
+}
+
+void FtpDataTransfer::dealCommandStarted(int commandId)
+{
+    // Queued commands wait for the ones before, time from the real send
+    if(commandId == m_setupId)
+    {
+        m_setupTimer.start();
+    }
+}
+
+void FtpDataTransfer::dealReply(int replyCode, const QString &detail)
+{
+    int commandId = m_ftp->currentId();
+
+    // Replies after a failure still belong to us, nothing left to do with them
+    if(!m_running || !m_commandIds.contains(commandId))
+    {
+        return;
+    }
+
+    if(commandId == m_sizeId)
+    {
+        qint64 remoteSize = (213 == replyCode) ? detail.trimmed().toLongLong() : 0;
+
+        // Larger remote file is not ours to append to, send it again
+        if(remoteSize > 0 && remoteSize <= m_totalSize && m_pDevice->seek(remoteSize))
+        {
+            m_offset = remoteSize;
+        }
+        else
+        {
+            m_pDevice->seek(0);
+        }
+
+        // A 550 makes QFtp drop its pending commands after this slot
+        QTimer::singleShot(0, this, SLOT(queueTransfer()));
+    }
+    else if(commandId == m_setupId)
+    {
+        QHostAddress address = m_serverAddress;
+        quint16 port = 0;
+
+        if(FtpSession::DATA_MODE_ACTIVE == m_dataMode)
+        {
+            if(200 != replyCode)
+            {
+                fail(replyCode, tr("PORT refused: %1").arg(detail));
+                return;
+            }
+
+            // Server connects once RETR/STOR is sent
+            m_timeoutTimer.start();
+            return;
+        }
+
+        if(FtpSession::DATA_MODE_EXTENDED == m_dataMode)
+        {
+            if(229 != replyCode || !FtpSession::parseEpsvReply(detail, port) || address.isNull())
+            {
+                fail(replyCode, tr("EPSV refused: %1").arg(detail));
+                return;
+            }
+        }
+        else if(227 != replyCode || !FtpSession::parsePasvReply(detail, m_serverAddress, address, port))
+        {
+            fail(replyCode, tr("PASV refused: %1").arg(detail));
+            return;
+        }
+
+        // Encrypted (PROT P) data is ready after the handshake
+        m_pSocket = m_ftp->openDataSocket(address, port, this, SLOT(dealDataConnected()));
+        attachSocket();
+
+        m_timeoutTimer.start();
+    }
+    else if(commandId == m_restId)
+    {
+        if(350 != replyCode)
+        {
+            fail(replyCode, tr("REST %1 refused: %2").arg(m_offset).arg(detail));
+        }
+    }
+    else if(commandId == m_transferId)
+    {
+        // 1xx is preliminary, the final reply follows
+        if(replyCode < 200)
+        {
+            m_transferStarted = true;
+            writeChunk();
+            return;
+        }
+
+        if(replyCode >= 400)
+        {
+            fail(replyCode, detail);
+            return;
+        }
+
+        m_controlDone = true;
+        checkDone();
+    }
+    else if(replyCode >= 400)
+    {
+        // TYPE I
+        fail(replyCode, detail);
+    }
+}
+
+void FtpDataTransfer::dealDataAccepted(int descriptor)
+{
+    m_pListener->disconnect(this);
+    m_pListener->deleteLater();
+    m_pListener = NULL;
+
+    m_pSocket = m_ftp->adoptDataSocket(descriptor, this);
+    attachSocket();
+
+    // Plain TCP is connected already, TLS still does its handshake
+    if(NULL != qobject_cast<QSslSocket *>(m_pSocket))
+    {
+        connect(m_pSocket, SIGNAL(encrypted()), this, SLOT(dealDataConnected()));
+    }
+    else
+    {
+        dealDataConnected();
+    }
+}
+
+void FtpDataTransfer::dealDataConnected()
+{
+    m_timeoutTimer.stop();
+    m_dataReady = true;
+
+    // Send side of a socket Qt had to connect untuned
+    m_ftp->socketTuning().applyConnected(m_pSocket);
+
+    if(m_setupTimer.isValid())
+    {
+        m_setupMsecs = m_setupTimer.elapsed();
+    }
+
+    writeChunk();
+}
+
+void FtpDataTransfer::dealDataReadyRead()
+{
+    qint64 readBytes = 0;
+
+    if(DIRECTION_GET != m_direction || NULL == m_pSocket)
+    {
+        return;
+    }
+
+    // Data left in the socket holds the TCP window closed, the bounded
+    // read buffer keeps it from piling up here instead
+    while(m_running && m_pSocket->bytesAvailable() > 0
+          && m_pDevice->bytesToWrite() < m_queueBytes)
+    {
+        QByteArray data = m_pSocket->read(DATA_CHUNK_SIZE);
+
+        if(m_pDevice->write(data) != data.size())
+        {
+            fail(0, m_pDevice->errorString());
+            return;
+        }
+
+        readBytes += data.size();
+    }
+
+    if(readBytes > 0)
+    {
+        m_transferredBytes += readBytes;
+
+        // Emit signal
+        emit progress(m_offset + m_transferredBytes, m_totalSize);
+    }
+
+    // Server closed first and the sink took the rest
+    if(m_running && m_dataClosed && 0 == m_pSocket->bytesAvailable())
+    {
+        m_dataDone = true;
+        checkDone();
+    }
+}
+
+void FtpDataTransfer::dealDataBytesWritten()
+{
+    if(DIRECTION_PUT != m_direction)
+    {
+        return;
+    }
+
+    // Emit signal
+    emit progress(m_offset + m_transferredBytes - m_pSocket->bytesToWrite(), m_totalSize);
+
+    writeChunk();
+}
+
+void FtpDataTransfer::dealDeviceBytesWritten()
+{
+    // Sink drained below the high water mark
+    dealDataReadyRead();
+}
+
+void FtpDataTransfer::dealDeviceReadyRead()
+{
+    writeChunk();
+}
+
+void FtpDataTransfer::dealDeviceReadChannelFinished()
+{
+    m_sourceDone = true;
+    writeChunk();
+}
+
+void FtpDataTransfer::dealDataDisconnected()
+{
+    if(NULL == m_pSocket)
+    {
+        return;
+    }
+
+    // Server closed first, what is still buffered goes out as the sink takes it
+    if(DIRECTION_GET == m_direction)
+    {
+        m_dataClosed = true;
+        dealDataReadyRead();
+        return;
+    }
+
+    m_dataDone = true;
+    checkDone();
+}
+
+void FtpDataTransfer::dealDataError(QAbstractSocket::SocketError error)
+{
+    // End of a download, disconnected() follows
+    if(QAbstractSocket::RemoteHostClosedError == error && DIRECTION_GET == m_direction)
+    {
+        return;
+    }
+
+    fail(0, m_pSocket->errorString());
+}
+
+void FtpDataTransfer::dealTimeout()
+{
+    fail(0, tr("Data connection timed out"));
+}
+
+void FtpDataTransfer::dealListenFailed()
+{
+    fail(0, tr("Unable to listen for the active mode data connection"));
+}
+
+int FtpDataTransfer::queueCommand(const QString &command)
+{
+    int commandId = m_ftp->rawCommand(command);
+
+    m_commandIds.insert(commandId);
+
+    // Emit signal
+    emit commandQueued(commandId, command);
+
+    return commandId;
+}
+
+void FtpDataTransfer::queueTransfer()
+{
+    if(FtpSession::DATA_MODE_ACTIVE == m_dataMode)
+    {
+        QHostAddress localAddress = m_ftp->localAddress();
+
+        if(localAddress.isNull())
+        {
+            localAddress = FtpListenerPool::routeAddress(m_serverAddress);
+        }
+
+        // Pooled listeners are open already, the PORT goes out at once
+        m_pListener = m_ftp->takeListener(localAddress, this);
+
+        // Not from within get()/put(), the caller is still setting up
+        if(NULL == m_pListener)
+        {
+            QTimer::singleShot(0, this, SLOT(dealListenFailed()));
+            return;
+        }
+
+        connect(m_pListener, SIGNAL(accepted(int)), this, SLOT(dealDataAccepted(int)));
+
+        m_setupId = queueCommand(FtpSession::portCommand(m_pListener->serverAddress(),
+                                                         m_pListener->serverPort()));
+    }
+    else
+    {
+        m_setupId = queueCommand(FtpSession::DATA_MODE_EXTENDED == m_dataMode ? "EPSV" : "PASV");
+    }
+
+    if(m_offset > 0)
+    {
+        m_restId = queueCommand(QString("REST %1").arg(m_offset));
+    }
+
+    m_transferId = queueCommand(QString("%1 %2")
+                                .arg(DIRECTION_GET == m_direction ? "RETR" : "STOR")
+                                .arg(m_remoteName));
+}
+
+void FtpDataTransfer::writeChunk()
+{
+    if(DIRECTION_PUT != m_direction || !m_running || !m_transferStarted || !m_dataReady
+            || QAbstractSocket::ConnectedState != m_pSocket->state())
+    {
+        return;
+    }
+
+    // Keep the queue depth in the socket buffer, a producer is asked
+    // for more only when it went out
+    while(m_pSocket->bytesToWrite() < m_queueBytes && !sourceAtEnd())
+    {
+        QByteArray data = m_pDevice->read(DATA_CHUNK_SIZE);
+
+        // Sequential source has nothing right now, its readyRead follows
+        if(data.isEmpty())
+        {
+            break;
+        }
+
+        m_pSocket->write(data);
+        m_transferredBytes += data.size();
+    }
+
+    // Closing the data connection marks the end of the file
+    if(sourceAtEnd() && 0 == m_pSocket->bytesToWrite())
+    {
+        m_pSocket->disconnectFromHost();
+    }
+}
+
+bool FtpDataTransfer::sourceAtEnd() const
+{
+    if(!m_pDevice->isSequential())
+    {
+        return m_pDevice->atEnd();
+    }
+
+    // Closed by its owner counts as finished too
+    return (m_sourceDone || !m_pDevice->isOpen()) && m_pDevice->bytesAvailable() <= 0;
+}
+
+void FtpDataTransfer::fail(int replyCode, const QString &reason)
+{
+    m_running = false;
+    m_replyCode = replyCode;
+    m_errorString = reason;
+
+    m_timeoutTimer.stop();
+    closeSocket();
+    disconnect(m_pDevice, 0, this, 0);
+
+    // Emit signal
+    emit finished(false);
+}
+
+void FtpDataTransfer::checkDone()
+{
+    if(!m_running || !m_controlDone || !m_dataDone)
+    {
+        return;
+    }
+
+    m_running = false;
+    closeSocket();
+    disconnect(m_pDevice, 0, this, 0);
+
+    // Emit signal
+    emit finished(true);
+}
+
+void FtpDataTransfer::attachSocket()
+{
+    // Ready is reported through openDataSocket or by dealDataAccepted
+    connect(m_pSocket, SIGNAL(readyRead()), this, SLOT(dealDataReadyRead()));
+    connect(m_pSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(dealDataBytesWritten()));
+    connect(m_pSocket, SIGNAL(disconnected()), this, SLOT(dealDataDisconnected()));
+
+    // Unread data stays in the kernel, the server is throttled by TCP
+    if(DIRECTION_GET == m_direction)
+    {
+        m_pSocket->setReadBufferSize(m_queueBytes);
+    }
+    connect(m_pSocket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(dealDataError(QAbstractSocket::SocketError)));
+}
+
+void FtpDataTransfer::closeSocket()
+{
+    m_dataReady = false;
+
+    if(NULL != m_pListener)
+    {
+        m_pListener->disconnect(this);
+        m_pListener->deleteLater();
+        m_pListener = NULL;
+    }
+
+    if(NULL == m_pSocket)
+    {
+        return;
+    }
+
+    m_pSocket->disconnect(this);
+    m_pSocket->abort();
+    m_pSocket->deleteLater();
+    m_pSocket = NULL;
+}
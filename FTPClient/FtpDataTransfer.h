@@ -0,0 +1,144 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpDataTransfer.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        RETR/STOR over raw commands and an own data socket
+**********************************************************************/
+
+#ifndef FTPDATATRANSFER_H
+#define FTPDATATRANSFER_H
+#include <QObject>
+#include "FtpSession.h"
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QIODevice>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSet>
+
+class FtpListener;
+
+class FtpDataTransfer : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        DIRECTION_GET = 0,
+        DIRECTION_PUT
+    };
+
+    enum{
+        DATA_CHUNK_SIZE = 64 * 1024,
+        DATA_CONNECT_TIMEOUT_MSECS = 15000
+    };
+
+    // QFtp get/put can not start at an offset (no REST), this sends
+    // TYPE I, PASV/EPSV/PORT (data mode of ftp), REST and RETR/STOR as
+    // raw commands on ftp instead. serverAddress replaces a private
+    // address in the PASV reply of a server behind NAT, and is where EPSV connects
+    explicit FtpDataTransfer(FtpSession *ftp, const QHostAddress &serverAddress, QObject *parent = 0);
+    ~FtpDataTransfer();
+
+    // Download remoteName into device from offset on, device is
+    // positioned at offset by the caller (e.g. opened for append).
+    // Any writable device will do: a process, socket or pipe that has
+    // the queue depth (FtpSocketTuning) in chunks unwritten stops the data
+    // socket being read until its bytesWritten, so the server waits
+    // instead of memory growing
+    void get(const QString &remoteName, QIODevice *device, qint64 offset = 0, qint64 totalSize = -1);
+
+    // Upload device as remoteName. With resume SIZE asks how much of it
+    // the server has and the upload continues from there.
+    // A sequential device (process, socket, a QIODevice that produces
+    // data in readData) has no size: it is read only while the data
+    // socket has room, and the upload ends after its readChannelFinished
+    // once all it had is sent. Not resumable
+    void put(const QString &remoteName, QIODevice *device, bool resume = false);
+
+    void abort();
+
+    // Commands of this transfer, their replies are handled here
+    bool ownsCommand(int commandId) const;
+
+    int direction() const;
+    qint64 offset() const;
+    qint64 transferredBytes() const;    // Without offset
+
+    // Reply code of the command that failed, 0 if the data connection failed
+    int replyCode() const;
+    QString errorString() const;
+
+    // FtpSession::DATA_MODE_* used, and the time from sending its command
+    // to the data connection being ready. -1 if it never got ready
+    int dataMode() const;
+    qint64 setupMsecs() const;
+
+signals:
+    void commandQueued(int commandId, QString command);
+    void progress(qint64 doneBytes, qint64 totalBytes);     // doneBytes includes offset
+    void finished(bool ok);
+
+private slots:
+    void dealReply(int replyCode, const QString &detail);
+    void dealCommandStarted(int commandId);
+    void dealDataAccepted(int descriptor);
+    void dealDataConnected();
+    void dealDataReadyRead();
+    void dealDataBytesWritten();
+    void dealDeviceBytesWritten();
+    void dealDeviceReadyRead();
+    void dealDeviceReadChannelFinished();
+    void dealDataDisconnected();
+    void dealDataError(QAbstractSocket::SocketError error);
+    void dealTimeout();
+    void dealListenFailed();
+
+    // PASV/EPSV/PORT, REST (if offset) and RETR/STOR
+    void queueTransfer();
+
+private:
+    FtpSession *m_ftp;
+    QHostAddress m_serverAddress;
+    QTcpSocket *m_pSocket;
+    FtpListener *m_pListener;   // Active mode, until the server connected
+    QTimer m_timeoutTimer;
+    int m_dataMode;
+    QElapsedTimer m_setupTimer;
+    qint64 m_setupMsecs;
+
+    QIODevice *m_pDevice;
+    QString m_remoteName;
+    int m_direction;
+    qint64 m_offset;
+    qint64 m_totalSize;
+    qint64 m_transferredBytes;
+    qint64 m_queueBytes;        // Read ahead / written behind, from the tuning of ftp
+
+    QSet<int> m_commandIds;
+    int m_sizeId;
+    int m_setupId;              // PASV, EPSV or PORT/EPRT
+    int m_restId;
+    int m_transferId;
+
+    bool m_running;
+    bool m_dataReady;           // Connected, and encrypted with PROT P
+    bool m_transferStarted;     // 1xx reply to RETR/STOR
+    bool m_controlDone;         // 2xx reply to RETR/STOR
+    bool m_dataClosed;          // Server closed the data connection
+    bool m_sourceDone;          // Sequential device to upload has no more data
+    bool m_dataDone;            // Data connection closed, all data handled
+
+    int m_replyCode;
+    QString m_errorString;
+
+    int queueCommand(const QString &command);
+    void writeChunk();
+    bool sourceAtEnd() const;
+    void fail(int replyCode, const QString &reason);
+    void checkDone();
+    void attachSocket();
+    void closeSocket();
+};
+
+#endif // FTPDATATRANSFER_H
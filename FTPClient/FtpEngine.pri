@@ -0,0 +1,71 @@
+#-------------------------------------------------
+#
+# Transfer engine without the widgets, shared by the
+# application and the tests
+#
+#-------------------------------------------------
+
+QT       += core network
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/FtpClient.cpp \
+    $$PWD/QUtilityBox.cpp \
+    $$PWD/FtpTarArchive.cpp \
+    $$PWD/FtpCompressDevice.cpp \
+    $$PWD/FtpChecksum.cpp \
+    $$PWD/FtpHashDevice.cpp \
+    $$PWD/FtpCapabilities.cpp \
+    $$PWD/FtpFxpTransfer.cpp \
+    $$PWD/FtpTrace.cpp \
+    $$PWD/FtpTransferJournal.cpp \
+    $$PWD/FtpHotFolder.cpp \
+    $$PWD/FtpConnector.cpp \
+    $$PWD/FtpRetryPolicy.cpp \
+    $$PWD/FtpDataTransfer.cpp \
+    $$PWD/FtpSession.cpp \
+    $$PWD/FtpPlainSession.cpp \
+    $$PWD/FtpTlsSession.cpp \
+    $$PWD/FtpRemoteBatch.cpp \
+    $$PWD/FtpListingIndex.cpp \
+    $$PWD/FtpListingStore.cpp \
+    $$PWD/FtpListenerPool.cpp \
+    $$PWD/FtpOperation.cpp \
+    $$PWD/FtpSocketTuning.cpp \
+    $$PWD/FtpTransferHistory.cpp
+
+HEADERS  += \
+    $$PWD/FtpClient.h \
+    $$PWD/QtBaseType.h \
+    $$PWD/QUtilityBox.h \
+    $$PWD/FtpTarArchive.h \
+    $$PWD/FtpCompressDevice.h \
+    $$PWD/FtpChecksum.h \
+    $$PWD/FtpHashDevice.h \
+    $$PWD/FtpCapabilities.h \
+    $$PWD/FtpFxpTransfer.h \
+    $$PWD/FtpTrace.h \
+    $$PWD/FtpTransferJournal.h \
+    $$PWD/FtpHotFolder.h \
+    $$PWD/FtpConnector.h \
+    $$PWD/FtpRetryPolicy.h \
+    $$PWD/FtpDataTransfer.h \
+    $$PWD/FtpSession.h \
+    $$PWD/FtpPlainSession.h \
+    $$PWD/FtpTlsSession.h \
+    $$PWD/FtpRemoteBatch.h \
+    $$PWD/FtpListingIndex.h \
+    $$PWD/FtpListingStore.h \
+    $$PWD/FtpListenerPool.h \
+    $$PWD/FtpOperation.h \
+    $$PWD/FtpSocketTuning.h \
+    $$PWD/FtpTransferHistory.h
+
+# zlib for MODE Z and gzip transfers, on Windows QtCore exports the bundled copy
+unix:LIBS += -lz
+win32:INCLUDEPATH += $$[QT_INSTALL_PREFIX]/src/3rdparty/zlib
+
+# setsockopt for the buffer sizes of FtpSocketTuning
+win32:LIBS += -lws2_32
@@ -0,0 +1,216 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpFxpTransfer.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Server to server (FXP) copy between two FtpClients
+**********************************************************************/
+
+#include "FtpFxpTransfer.h"
+#include "FtpClient.h"
+#include <QRegExp>
+#include <QTimer>
+
+
+FtpFxpTransfer::FtpFxpTransfer(FtpClient *source, FtpClient *dest,
+                               QStringList fileNames, QObject *parent) :
+    QObject(parent),
+    m_source(source),
+    m_dest(dest),
+    m_fileNames(fileNames),
+    m_index(-1),
+    m_failedCount(0),
+    m_pasvId(-1),
+    m_portId(-1),
+    m_storId(-1),
+    m_retrId(-1),
+    m_storDone(false),
+    m_retrDone(false),
+    m_fileFailed(false)
+{
+    connect(m_source, SIGNAL(rawCommandReply(int,int,QString)),
+            this, SLOT(dealSourceReply(int,int,QString)));
+    connect(m_dest, SIGNAL(rawCommandReply(int,int,QString)),
+            this, SLOT(dealDestReply(int,int,QString)));
+}
+
+void FtpFxpTransfer::start()
+{
+    m_index = -1;
+    m_failedCount = 0;
+
+    emit progressVal(0);
+
+    nextFile();
+}
+
+void FtpFxpTransfer::nextFile()
+{
+    m_index++;
+
+    m_pasvId = -1;
+    m_portId = -1;
+    m_storId = -1;
+    m_retrId = -1;
+    m_storDone = false;
+    m_retrDone = false;
+    m_fileFailed = false;
+
+    if(m_index >= m_fileNames.size())
+    {
+        emit statusMsg(tr("FXP copy finished, %1 of %2 files copied")
+                       .arg(m_fileNames.size() - m_failedCount)
+                       .arg(m_fileNames.size()));
+        emit finished(0 == m_failedCount);
+
+        return;
+    }
+
+    // Both sides must agree on the representation type
+    m_source->sendRawCommand("TYPE I");
+    m_dest->sendRawCommand("TYPE I");
+
+    m_pasvId = m_source->sendRawCommand("PASV");
+    if(m_pasvId < 0)
+    {
+        failFile(tr("source is not connected"));
+    }
+}
+
+void FtpFxpTransfer::dealSourceReply(int commandId, int replyCode, QString detail)
+{
+    if(commandId == m_pasvId)
+    {
+        QString address = parsePasvReply(detail);
+
+        m_pasvId = -1;
+
+        if(227 != replyCode || address.isEmpty())
+        {
+            failFile(tr("source refused PASV: %1").arg(detail));
+            return;
+        }
+
+        m_portId = m_dest->sendRawCommand(QString("PORT %1").arg(address));
+        if(m_portId < 0)
+        {
+            failFile(tr("destination is not connected"));
+        }
+    }
+    else if(commandId == m_retrId)
+    {
+        // 1xx is preliminary, the final reply follows
+        if(replyCode < 200)
+        {
+            return;
+        }
+
+        m_retrDone = true;
+
+        if(replyCode >= 400)
+        {
+            failFile(tr("source failed to send: %1").arg(detail));
+            return;
+        }
+
+        checkFileDone();
+    }
+}
+
+void FtpFxpTransfer::dealDestReply(int commandId, int replyCode, QString detail)
+{
+    if(commandId == m_portId)
+    {
+        const QString &fileName = m_fileNames.at(m_index);
+
+        m_portId = -1;
+
+        if(replyCode >= 300)
+        {
+            // Servers often refuse PORT to a third party address unless FXP is enabled
+            failFile(tr("destination refused PORT: %1").arg(detail));
+            return;
+        }
+
+        // STOR first, so the destination connects as soon as the source is ready
+        m_storId = m_dest->sendRawCommand(QString("STOR %1").arg(fileName));
+        m_retrId = m_source->sendRawCommand(QString("RETR %1").arg(fileName));
+
+        emit statusMsg(tr("FXP copying %1...").arg(fileName));
+    }
+    else if(commandId == m_storId)
+    {
+        if(replyCode < 200)
+        {
+            return;
+        }
+
+        m_storDone = true;
+
+        if(replyCode >= 400)
+        {
+            failFile(tr("destination failed to store: %1").arg(detail));
+            return;
+        }
+
+        checkFileDone();
+    }
+}
+
+void FtpFxpTransfer::failFile(QString reason)
+{
+    if(m_index < 0 || m_index >= m_fileNames.size())
+    {
+        return;
+    }
+
+    if(!m_fileFailed)
+    {
+        m_fileFailed = true;
+        m_failedCount++;
+
+        emit statusMsg(tr("FXP copy of %1 failed, %2")
+                       .arg(m_fileNames.at(m_index))
+                       .arg(reason));
+    }
+
+    // Wait for the other side of a started transfer to give up too
+    if((m_storId >= 0 && !m_storDone) || (m_retrId >= 0 && !m_retrDone))
+    {
+        return;
+    }
+
+    // QFtp drops the commands queued while it reports a failed reply
+    QTimer::singleShot(0, this, SLOT(nextFile()));
+}
+
+void FtpFxpTransfer::checkFileDone()
+{
+    if(!m_storDone || !m_retrDone)
+    {
+        return;
+    }
+
+    if(m_fileFailed)
+    {
+        QTimer::singleShot(0, this, SLOT(nextFile()));
+        return;
+    }
+
+    emit statusMsg(tr("FXP copied %1").arg(m_fileNames.at(m_index)));
+    emit progressVal(100 * (m_index + 1) / m_fileNames.size());
+
+    nextFile();
+}
+
+QString FtpFxpTransfer::parsePasvReply(const QString &detail)
+{
+    QRegExp addressRx("(\\d+),(\\d+),(\\d+),(\\d+),(\\d+),(\\d+)");
+
+    if(addressRx.indexIn(detail) < 0)
+    {
+        return "";
+    }
+
+    return addressRx.cap(0);
+}
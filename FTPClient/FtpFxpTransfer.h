@@ -0,0 +1,65 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpFxpTransfer.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Server to server (FXP) copy between two FtpClients
+**********************************************************************/
+
+#ifndef FTPFXPTRANSFER_H
+#define FTPFXPTRANSFER_H
+#include <QObject>
+#include <QStringList>
+
+class FtpClient;
+
+class FtpFxpTransfer : public QObject
+{
+    Q_OBJECT
+public:
+    // Copy fileNames from current dir of source to current dir of dest.
+    // Source is put in passive mode and dest connects to it with PORT,
+    // so the data never passes through this host.
+    // Both clients must be logged in and live in the thread of this object
+    explicit FtpFxpTransfer(FtpClient *source, FtpClient *dest,
+                            QStringList fileNames, QObject *parent = 0);
+
+    void start();
+
+signals:
+    void statusMsg(QString);
+    void progressVal(int);
+    void finished(bool ok);
+
+private slots:
+    void dealSourceReply(int commandId, int replyCode, QString detail);
+    void dealDestReply(int commandId, int replyCode, QString detail);
+
+    // Start copy of next file, or finish
+    void nextFile();
+
+private:
+    FtpClient *m_source;
+    FtpClient *m_dest;
+
+    QStringList m_fileNames;
+    int m_index;            // File being copied
+    int m_failedCount;
+
+    int m_pasvId;
+    int m_portId;
+    int m_storId;
+    int m_retrId;
+
+    bool m_storDone;
+    bool m_retrDone;
+    bool m_fileFailed;
+
+    void failFile(QString reason);
+    void checkFileDone();
+
+    // "227 Entering Passive Mode (h1,h2,h3,h4,p1,p2)" to "h1,h2,h3,h4,p1,p2"
+    static QString parsePasvReply(const QString &detail);
+};
+
+#endif // FTPFXPTRANSFER_H
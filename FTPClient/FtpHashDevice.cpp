@@ -0,0 +1,150 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpHashDevice.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Pass-through QIODevice computing a checksum of the data
+**********************************************************************/
+
+#include "FtpHashDevice.h"
+
+
+FtpHashDevice::FtpHashDevice(QIODevice *device, int algorithm, QObject *parent) :
+    QIODevice(parent),
+    m_device(device),
+    m_checksum(algorithm),
+    m_hashedBytes(0),
+    m_trace(NULL),
+    m_traceType(FtpTrace::TRACE_DATA_IN),
+    m_traceId(-1)
+{
+}
+
+FtpHashDevice::~FtpHashDevice()
+{
+    close();
+}
+
+bool FtpHashDevice::open(OpenMode mode)
+{
+    if(NULL == m_device)
+    {
+        return false;
+    }
+
+    m_checksum.reset();
+    m_hashedBytes = 0;
+
+    if(!QIODevice::open(mode | QIODevice::Unbuffered))
+    {
+        return false;
+    }
+
+    // Start where the wrapped device is
+    if(!isSequential() && m_device->pos() != 0)
+    {
+        QIODevice::seek(m_device->pos());
+    }
+
+    return true;
+}
+
+bool FtpHashDevice::isSequential() const
+{
+    return (NULL == m_device) || m_device->isSequential();
+}
+
+qint64 FtpHashDevice::bytesAvailable() const
+{
+    if(!isSequential())
+    {
+        return m_device->size() - m_device->pos();
+    }
+
+    return QIODevice::bytesAvailable() + m_device->bytesAvailable();
+}
+
+qint64 FtpHashDevice::size() const
+{
+    return isSequential() ? QIODevice::size() : m_device->size();
+}
+
+bool FtpHashDevice::atEnd() const
+{
+    return !isOpen() || m_device->atEnd();
+}
+
+bool FtpHashDevice::seek(qint64 pos)
+{
+    if(isSequential() || !m_device->seek(pos))
+    {
+        return false;
+    }
+
+    // A rewind starts the digest over, any other jump leaves it covering
+    // only what passed through
+    if(0 == pos)
+    {
+        m_checksum.reset();
+        m_hashedBytes = 0;
+    }
+
+    return QIODevice::seek(pos);
+}
+
+const FtpChecksum &FtpHashDevice::checksum() const
+{
+    return m_checksum;
+}
+
+qint64 FtpHashDevice::hashedBytes() const
+{
+    return m_hashedBytes;
+}
+
+void FtpHashDevice::setTrace(FtpTrace *trace, int type, int id)
+{
+    m_trace = trace;
+    m_traceType = type;
+    m_traceId = id;
+}
+
+qint64 FtpHashDevice::readData(char *data, qint64 maxSize)
+{
+    qint64 ret = m_device->read(data, maxSize);
+
+    if(ret > 0)
+    {
+        m_checksum.addData(data, ret);
+        m_hashedBytes += ret;
+
+        if(NULL != m_trace)
+        {
+            m_trace->recordData(m_traceType, m_traceId, data, ret);
+        }
+    }
+    else if(0 == ret && m_device->atEnd())
+    {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+qint64 FtpHashDevice::writeData(const char *data, qint64 maxSize)
+{
+    qint64 ret = m_device->write(data, maxSize);
+
+    if(ret > 0)
+    {
+        m_checksum.addData(data, ret);
+        m_hashedBytes += ret;
+
+        if(NULL != m_trace)
+        {
+            m_trace->recordData(m_traceType, m_traceId, data, ret);
+        }
+    }
+
+    return ret;
+}
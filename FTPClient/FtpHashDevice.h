@@ -0,0 +1,54 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpHashDevice.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Pass-through QIODevice computing a checksum of the data
+**********************************************************************/
+
+#ifndef FTPHASHDEVICE_H
+#define FTPHASHDEVICE_H
+#include <QIODevice>
+#include "FtpChecksum.h"
+#include "FtpTrace.h"
+
+class FtpHashDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    // Data read from or written to device is hashed on the way through,
+    // so verification needs no second pass over the file.
+    // The device is not owned and must stay valid while this is open
+    explicit FtpHashDevice(QIODevice *device, int algorithm, QObject *parent = 0);
+    ~FtpHashDevice();
+
+    // Random access as the wrapped device: over a file QFtp still knows
+    // the size of a put, so its progress has a total
+    bool open(OpenMode mode);
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+    qint64 size() const;
+    bool atEnd() const;
+    bool seek(qint64 pos);
+
+    const FtpChecksum &checksum() const;
+    qint64 hashedBytes() const;
+
+    // Data passing through is sampled into trace as records of type
+    void setTrace(FtpTrace *trace, int type, int id);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    QIODevice *m_device;
+    FtpChecksum m_checksum;
+    qint64 m_hashedBytes;
+
+    FtpTrace *m_trace;
+    int m_traceType;
+    int m_traceId;
+};
+
+#endif // FTPHASHDEVICE_H
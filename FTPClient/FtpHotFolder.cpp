@@ -0,0 +1,309 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpHotFolder.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Watch a local dir tree and report files once written
+**********************************************************************/
+
+#include "FtpHotFolder.h"
+#include <QDir>
+#include <QFileInfo>
+
+
+FtpHotFolder::FtpHotFolder(QObject *parent) :
+    QObject(parent),
+    m_pWatcher(NULL),
+    m_checkTimer(this),
+    m_batchTimer(this)
+{
+    m_checkTimer.setInterval(HOT_CHECK_MSECS);
+    connect(&m_checkTimer, SIGNAL(timeout()), this, SLOT(checkSettled()));
+
+    m_batchTimer.setSingleShot(true);
+    m_batchTimer.setInterval(HOT_BATCH_MSECS);
+    connect(&m_batchTimer, SIGNAL(timeout()), this, SLOT(flushBatch()));
+}
+
+FtpHotFolder::~FtpHotFolder()
+{
+    stop();
+}
+
+bool FtpHotFolder::start(const QString &dir)
+{
+    stop();
+
+    m_rootDir = QDir(dir).canonicalPath();
+    if(m_rootDir.isEmpty())
+    {
+        return false;
+    }
+
+    // Kernel notifications (inotify on Linux), no rescans
+    m_pWatcher = new QFileSystemWatcher(this);
+    connect(m_pWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(dealDirectoryChanged(QString)));
+    connect(m_pWatcher, SIGNAL(fileChanged(QString)), this, SLOT(dealFileChanged(QString)));
+
+    watchTree(m_rootDir, true);
+
+    return true;
+}
+
+void FtpHotFolder::stop()
+{
+    m_checkTimer.stop();
+    m_batchTimer.stop();
+
+    delete m_pWatcher;
+    m_pWatcher = NULL;
+
+    m_rootDir.clear();
+    m_knownFiles.clear();
+    m_pendingFiles.clear();
+    m_watchedDirs.clear();
+    m_dirEntries.clear();
+    m_batch.clear();
+}
+
+bool FtpHotFolder::isActive() const
+{
+    return NULL != m_pWatcher;
+}
+
+QString FtpHotFolder::rootDir() const
+{
+    return m_rootDir;
+}
+
+void FtpHotFolder::dealDirectoryChanged(const QString &path)
+{
+    // The watcher drops removed dirs by itself
+    if(!QFileInfo(path).isDir())
+    {
+        forgetPath(path);
+        return;
+    }
+
+    scanDir(path, false);
+}
+
+void FtpHotFolder::dealFileChanged(const QString &path)
+{
+    if(m_pendingFiles.contains(path))
+    {
+        // Still being written
+        m_pendingFiles[path].stableTimer.start();
+    }
+}
+
+void FtpHotFolder::checkSettled()
+{
+    QHash<QString, struct Pending_File>::iterator it = m_pendingFiles.begin();
+
+    while(it != m_pendingFiles.end())
+    {
+        QFileInfo fileInfo(it.key());
+
+        if(!fileInfo.exists())
+        {
+            m_pWatcher->removePath(it.key());
+            it = m_pendingFiles.erase(it);
+            continue;
+        }
+
+        if(fileInfo.size() != it.value().size || fileInfo.lastModified() != it.value().mtime)
+        {
+            it.value().size = fileInfo.size();
+            it.value().mtime = fileInfo.lastModified();
+            it.value().stableTimer.start();
+        }
+        else if(it.value().stableTimer.elapsed() >= HOT_SETTLE_MSECS)
+        {
+            m_knownFiles.insert(it.key(), it.value().mtime);
+            m_pWatcher->removePath(it.key());
+            m_batch.append(it.key());
+
+            it = m_pendingFiles.erase(it);
+            continue;
+        }
+
+        ++it;
+    }
+
+    if(m_pendingFiles.isEmpty())
+    {
+        m_checkTimer.stop();
+    }
+
+    if(m_batch.size() >= HOT_BATCH_MAX)
+    {
+        flushBatch();
+    }
+    else if(!m_batch.isEmpty() && !m_batchTimer.isActive())
+    {
+        m_batchTimer.start();
+    }
+}
+
+void FtpHotFolder::flushBatch()
+{
+    QStringList paths = m_batch;
+
+    m_batchTimer.stop();
+    m_batch.clear();
+
+    if(!paths.isEmpty())
+    {
+        // Emit signal
+        emit filesReady(paths);
+    }
+}
+
+void FtpHotFolder::scanDir(const QString &dir, bool initial)
+{
+    // Names only, no stat per entry
+    QStringList names = QDir(dir).entryList(QDir::AllEntries | QDir::NoDotAndDotDot
+                                            | QDir::Hidden | QDir::System, QDir::Unsorted);
+    QSet<QString> previous = m_dirEntries.value(dir);
+    QSet<QString> current;
+    QStringList added;
+
+    for(int i = 0; i < names.size(); i++)
+    {
+        current.insert(names.at(i));
+        if(!previous.contains(names.at(i)))
+        {
+            added.append(names.at(i));
+        }
+    }
+
+    // Gone since the last scan, a file of the same name later is new
+    for(QSet<QString>::const_iterator it = previous.constBegin(); it != previous.constEnd(); ++it)
+    {
+        if(!current.contains(*it))
+        {
+            forgetPath(dir + "/" + *it);
+        }
+    }
+
+    // Same names as before: renamed over or touched, compare them all
+    if(added.isEmpty() && previous.size() == current.size())
+    {
+        added = names;
+    }
+
+    m_dirEntries.insert(dir, current);
+
+    for(int i = 0; i < added.size(); i++)
+    {
+        QFileInfo fileInfo(dir + "/" + added.at(i));
+        QString path = fileInfo.absoluteFilePath();
+
+        if(fileInfo.isDir())
+        {
+            if(m_watchedDirs.contains(path))
+            {
+                continue;
+            }
+
+            if(!initial)
+            {
+                // Emit signal
+                emit dirCreated(QDir(m_rootDir).relativeFilePath(path));
+            }
+
+            watchTree(path, initial);
+            continue;
+        }
+
+        // Files present at start are not uploaded
+        if(initial)
+        {
+            m_knownFiles.insert(path, fileInfo.lastModified());
+            continue;
+        }
+
+        if(m_pendingFiles.contains(path)
+                || (m_knownFiles.contains(path) && m_knownFiles.value(path) == fileInfo.lastModified()))
+        {
+            continue;
+        }
+
+        struct Pending_File pending;
+        pending.size = fileInfo.size();
+        pending.mtime = fileInfo.lastModified();
+        pending.stableTimer.start();
+
+        m_pendingFiles.insert(path, pending);
+        m_pWatcher->addPath(path);
+
+        if(!m_checkTimer.isActive())
+        {
+            m_checkTimer.start();
+        }
+    }
+}
+
+void FtpHotFolder::forgetPath(const QString &path)
+{
+    QString prefix = path + "/";
+
+    m_knownFiles.remove(path);
+    if(m_pendingFiles.remove(path) > 0)
+    {
+        m_pWatcher->removePath(path);
+    }
+
+    if(!m_watchedDirs.contains(path))
+    {
+        return;
+    }
+
+    m_watchedDirs.remove(path);
+    m_dirEntries.remove(path);
+
+    QSet<QString>::iterator dirIt = m_watchedDirs.begin();
+    while(dirIt != m_watchedDirs.end())
+    {
+        if(dirIt->startsWith(prefix))
+        {
+            m_dirEntries.remove(*dirIt);
+            dirIt = m_watchedDirs.erase(dirIt);
+            continue;
+        }
+        ++dirIt;
+    }
+
+    QHash<QString, QDateTime>::iterator knownIt = m_knownFiles.begin();
+    while(knownIt != m_knownFiles.end())
+    {
+        if(knownIt.key().startsWith(prefix))
+        {
+            knownIt = m_knownFiles.erase(knownIt);
+            continue;
+        }
+        ++knownIt;
+    }
+
+    QHash<QString, struct Pending_File>::iterator pendingIt = m_pendingFiles.begin();
+    while(pendingIt != m_pendingFiles.end())
+    {
+        if(pendingIt.key().startsWith(prefix))
+        {
+            m_pWatcher->removePath(pendingIt.key());
+            pendingIt = m_pendingFiles.erase(pendingIt);
+            continue;
+        }
+        ++pendingIt;
+    }
+}
+
+void FtpHotFolder::watchTree(const QString &dir, bool initial)
+{
+    m_watchedDirs.insert(dir);
+    m_pWatcher->addPath(dir);
+
+    // Recurses into subdirs through scanDir
+    scanDir(dir, initial);
+}
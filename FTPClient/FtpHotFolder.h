@@ -0,0 +1,82 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpHotFolder.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Watch a local dir tree and report files once written
+**********************************************************************/
+
+#ifndef FTPHOTFOLDER_H
+#define FTPHOTFOLDER_H
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QDateTime>
+#include <QElapsedTimer>
+
+class FtpHotFolder : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        HOT_SETTLE_MSECS = 300,     // File unchanged this long is complete
+        HOT_CHECK_MSECS = 50,       // Settle check interval while files are pending
+        HOT_BATCH_MSECS = 100,      // Settled files are reported together
+        HOT_BATCH_MAX = 256
+    };
+
+    explicit FtpHotFolder(QObject *parent = 0);
+    ~FtpHotFolder();
+
+    // Start watching dir and its subdirs, files already there are not reported
+    bool start(const QString &dir);
+    void stop();
+    bool isActive() const;
+    QString rootDir() const;
+
+signals:
+    // Complete files, absolute paths below rootDir
+    void filesReady(QStringList paths);
+
+    // New subdir below rootDir, relative path
+    void dirCreated(QString relativePath);
+
+private slots:
+    void dealDirectoryChanged(const QString &path);
+    void dealFileChanged(const QString &path);
+    void checkSettled();
+    void flushBatch();
+
+private:
+    struct Pending_File
+    {
+        qint64 size;
+        QDateTime mtime;
+        QElapsedTimer stableTimer;  // Since size/mtime last changed
+    };
+
+    QFileSystemWatcher *m_pWatcher;
+    QString m_rootDir;
+    QTimer m_checkTimer;
+    QTimer m_batchTimer;
+
+    QHash<QString, QDateTime> m_knownFiles;     // Reported or pre-existing, with mtime
+    QHash<QString, struct Pending_File> m_pendingFiles;
+    QSet<QString> m_watchedDirs;
+    QHash<QString, QSet<QString> > m_dirEntries;    // Names last seen in each watched dir
+    QStringList m_batch;
+
+    // Scan one dir (no recursion unless it is new) for new or changed files.
+    // Only entries not seen before are looked at, unless the names are
+    // the same as last time: then an entry was replaced or touched
+    void scanDir(const QString &dir, bool initial);
+    void watchTree(const QString &dir, bool initial);
+
+    // Entry is gone, and with a dir everything below it
+    void forgetPath(const QString &path);
+};
+
+#endif // FTPHOTFOLDER_H
@@ -0,0 +1,175 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListenerPool.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Listening sockets opened ahead for active mode data connections
+**********************************************************************/
+
+#include "FtpListenerPool.h"
+#include <QUdpSocket>
+#include <QTimer>
+
+
+FtpListener::FtpListener(QObject *parent) :
+    QTcpServer(parent)
+{
+    setMaxPendingConnections(1);
+}
+
+#if QT_VERSION >= 0x050000
+void FtpListener::incomingConnection(qintptr descriptor)
+#else
+void FtpListener::incomingConnection(int descriptor)
+#endif
+{
+    // One connection per PORT, the next transfer takes a new listener.
+    // The accepted descriptor outlives the listening socket
+    close();
+
+    // Emit signal
+    emit accepted((int)descriptor);
+}
+
+
+FtpListenerPool::FtpListenerPool(QObject *parent) :
+    QObject(parent),
+    m_size(POOL_DEFAULT_SIZE),
+    m_refillQueued(false),
+    m_hits(0),
+    m_misses(0)
+{
+}
+
+FtpListenerPool::~FtpListenerPool()
+{
+    dropIdle();
+}
+
+void FtpListenerPool::setSize(int size)
+{
+    m_size = qBound(0, size, (int)POOL_MAX_SIZE);
+
+    while(m_idle.size() > m_size)
+    {
+        delete m_idle.takeLast();
+    }
+}
+
+int FtpListenerPool::size() const
+{
+    return m_size;
+}
+
+FtpListener *FtpListenerPool::take(const QHostAddress &address)
+{
+    FtpListener *listener = NULL;
+
+    // Control connection went out another interface, e.g. after failover
+    if(address != m_address)
+    {
+        dropIdle();
+        m_address = address;
+    }
+
+    if(!m_idle.isEmpty())
+    {
+        listener = m_idle.takeFirst();
+        m_hits++;
+    }
+    else
+    {
+        listener = openListener();
+        m_misses++;
+    }
+
+    if(!m_refillQueued && m_size > 0)
+    {
+        m_refillQueued = true;
+        QTimer::singleShot(0, this, SLOT(refill()));
+    }
+
+    if(NULL != listener)
+    {
+        listener->setParent(NULL);
+    }
+
+    return listener;
+}
+
+void FtpListenerPool::prepare(const QHostAddress &address)
+{
+    if(address != m_address)
+    {
+        dropIdle();
+        m_address = address;
+    }
+
+    refill();
+}
+
+int FtpListenerPool::hits() const
+{
+    return m_hits;
+}
+
+int FtpListenerPool::misses() const
+{
+    return m_misses;
+}
+
+QHostAddress FtpListenerPool::routeAddress(const QHostAddress &peer)
+{
+    QUdpSocket socket;
+
+    // Connecting UDP sends nothing, it only picks the route
+    socket.connectToHost(peer, 21);
+
+    return socket.localAddress();
+}
+
+void FtpListenerPool::refill()
+{
+    m_refillQueued = false;
+
+    while(m_idle.size() < m_size)
+    {
+        FtpListener *listener = openListener();
+
+        if(NULL == listener)
+        {
+            break;
+        }
+
+        m_idle.append(listener);
+    }
+}
+
+FtpListener *FtpListenerPool::openListener()
+{
+    FtpListener *listener = NULL;
+
+    if(m_address.isNull())
+    {
+        return listener;
+    }
+
+    listener = new FtpListener(this);
+
+    // Port chosen by the system
+    if(!listener->listen(m_address, 0))
+    {
+        delete listener;
+        listener = NULL;
+    }
+
+    return listener;
+}
+
+void FtpListenerPool::dropIdle()
+{
+    while(!m_idle.isEmpty())
+    {
+        delete m_idle.takeFirst();
+    }
+}
@@ -0,0 +1,82 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListenerPool.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Listening sockets opened ahead for active mode data connections
+**********************************************************************/
+
+#ifndef FTPLISTENERPOOL_H
+#define FTPLISTENERPOOL_H
+#include <QObject>
+#include <QTcpServer>
+#include <QHostAddress>
+#include <QList>
+
+// Listens for the one data connection a PORT/EPRT announced, hands out
+// its descriptor so the session can wrap it (QSslSocket for FTPS)
+class FtpListener : public QTcpServer
+{
+    Q_OBJECT
+public:
+    explicit FtpListener(QObject *parent = 0);
+
+signals:
+    void accepted(int descriptor);
+
+protected:
+#if QT_VERSION >= 0x050000
+    void incomingConnection(qintptr descriptor);
+#else
+    void incomingConnection(int descriptor);
+#endif
+};
+
+class FtpListenerPool : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        POOL_DEFAULT_SIZE = 4,
+        POOL_MAX_SIZE = 64
+    };
+
+    explicit FtpListenerPool(QObject *parent = 0);
+    ~FtpListenerPool();
+
+    // Listeners kept open, 0 opens one per transfer
+    void setSize(int size);
+    int size() const;
+
+    // A listener on address, taken from the pool or opened now. The
+    // caller owns it, NULL if listening failed. Taken ones are replaced
+    // when the event loop is idle, not while the transfer waits
+    FtpListener *take(const QHostAddress &address);
+
+    // Open the listeners for address ahead, e.g. right after login
+    void prepare(const QHostAddress &address);
+
+    // take() calls served from the pool and those that had to open one
+    int hits() const;
+    int misses() const;
+
+    // Address of this host the system routes to peer by, for a session
+    // that does not know the local end of its control connection
+    static QHostAddress routeAddress(const QHostAddress &peer);
+
+private slots:
+    void refill();
+
+private:
+    QHostAddress m_address;         // Of all idle listeners
+    QList<FtpListener *> m_idle;
+    int m_size;
+    bool m_refillQueued;
+    int m_hits;
+    int m_misses;
+
+    FtpListener *openListener();
+    void dropIdle();
+};
+
+#endif // FTPLISTENERPOOL_H
@@ -0,0 +1,500 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListingIndex.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Search index over a FtpListingStore, built as it grows
+**********************************************************************/
+
+#include "FtpListingIndex.h"
+#include "FtpListingStore.h"
+#include <QList>
+#include <algorithm>
+
+namespace
+{
+    inline char foldByte(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+    }
+
+    // Orders ids by folded name, store read lock held by the caller
+    struct Less_Name
+    {
+        const FtpListingStore *store;
+
+        bool operator()(int a, int b) const
+        {
+            int aLength = 0;
+            int bLength = 0;
+            const char *aName = store->rawName(a, aLength);
+            const char *bName = store->rawName(b, bLength);
+
+            for(int i = 0; i < aLength && i < bLength; i++)
+            {
+                char x = foldByte(aName[i]);
+                char y = foldByte(bName[i]);
+
+                if(x != y)
+                {
+                    return (uchar)x < (uchar)y;
+                }
+            }
+
+            return aLength < bLength;
+        }
+    };
+}
+
+
+FtpListingIndex::FtpListingIndex(const FtpListingStore *store) :
+    m_store(store),
+    m_indexed(0)
+{
+}
+
+void FtpListingIndex::setStore(const FtpListingStore *store)
+{
+    m_store = store;
+    clear();
+}
+
+void FtpListingIndex::clear()
+{
+    m_indexed = 0;
+    m_sorted = QVector<int>();
+    m_unsorted = QVector<int>();
+    m_trigrams.clear();
+}
+
+void FtpListingIndex::sync()
+{
+    int count = 0;
+
+    if(NULL == m_store)
+    {
+        return;
+    }
+
+    m_store->lockForRead();
+
+    count = m_store->rawSize();
+    for(int id = m_indexed; id < count; id++)
+    {
+        int length = 0;
+        const char *name = m_store->rawName(id, length);
+
+        for(int i = 0; i + 3 <= length; i++)
+        {
+            struct Posting_List &postings = m_trigrams[trigramKey(name + i)];
+            uint delta = (uint)(id - postings.lastId);
+
+            // Same trigram twice in one name
+            if(postings.lastId == id)
+            {
+                continue;
+            }
+
+            // Gaps of common trigrams fit in one byte
+            while(delta >= 0x80)
+            {
+                postings.deltas.append((char)(0x80 | (delta & 0x7F)));
+                delta >>= 7;
+            }
+            postings.deltas.append((char)delta);
+            postings.lastId = id;
+        }
+
+        m_unsorted.append(id);
+    }
+
+    m_store->unlock();
+
+    m_indexed = qMax(m_indexed, count);
+}
+
+int FtpListingIndex::size() const
+{
+    return m_indexed;
+}
+
+QVector<int> FtpListingIndex::filterRange(int first, int last, const QString &filter) const
+{
+    QByteArray folded = fold(filter);
+    bool glob = isGlob(filter);
+    QVector<int> result;
+
+    if(NULL == m_store)
+    {
+        return result;
+    }
+
+    m_store->lockForRead();
+
+    last = qMin(last, m_store->rawSize());
+    for(int id = qMax(first, 0); id < last; id++)
+    {
+        if(matchesLocked(id, folded, glob))
+        {
+            result.append(id);
+        }
+    }
+
+    m_store->unlock();
+
+    return result;
+}
+
+QVector<int> FtpListingIndex::find(const QString &filter, int limit) const
+{
+    QByteArray folded = fold(filter);
+    bool glob = isGlob(filter);
+    QVector<int> candidates;
+    QVector<int> result;
+    bool nameOrder = false;
+
+    if(NULL == m_store)
+    {
+        return result;
+    }
+
+    if(folded.isEmpty())
+    {
+        for(int i = 0; i < m_indexed && (limit < 0 || i < limit); i++)
+        {
+            result.append(i);
+        }
+
+        return result;
+    }
+
+    m_store->lockForRead();
+
+    // Cleared by the engine meanwhile, the caller resets on the next sync
+    if(m_store->rawSize() < m_indexed)
+    {
+        m_store->unlock();
+        return result;
+    }
+
+    mergeSorted();
+
+    if(glob)
+    {
+        QByteArray literals = folded;
+        QList<QByteArray> fragments = literals.replace('?', '*').split('*');
+        QByteArray longest;
+
+        for(int i = 0; i < fragments.size(); i++)
+        {
+            if(fragments.at(i).size() > longest.size())
+            {
+                longest = fragments.at(i);
+            }
+        }
+
+        if(longest.size() >= 3)
+        {
+            candidates = trigramCandidates(longest);
+        }
+        else if(!fragments.first().isEmpty())
+        {
+            // "ab*": the literal start narrows to a range of the sorted names
+            candidates = prefixRange(fragments.first());
+            nameOrder = true;
+        }
+        else
+        {
+            candidates = m_sorted;
+            nameOrder = true;
+        }
+    }
+    else if(folded.size() >= 3)
+    {
+        candidates = trigramCandidates(folded);
+    }
+    else
+    {
+        candidates = m_sorted;
+        nameOrder = true;
+    }
+
+    // Trigrams only say the pieces are there, not in which order
+    for(int i = 0; i < candidates.size(); i++)
+    {
+        if(matchesLocked(candidates.at(i), folded, glob))
+        {
+            result.append(candidates.at(i));
+
+            if(nameOrder && limit >= 0 && result.size() >= limit)
+            {
+                break;
+            }
+        }
+    }
+
+    if(!nameOrder)
+    {
+        Less_Name lessName;
+        lessName.store = m_store;
+
+        std::sort(result.begin(), result.end(), lessName);
+    }
+
+    m_store->unlock();
+
+    if(limit >= 0 && result.size() > limit)
+    {
+        result.resize(limit);
+    }
+
+    return result;
+}
+
+bool FtpListingIndex::isGlob(const QString &filter)
+{
+    return filter.contains('*') || filter.contains('?');
+}
+
+void FtpListingIndex::mergeSorted() const
+{
+    Less_Name lessName;
+    int sortedCount = m_sorted.size();
+
+    if(m_unsorted.isEmpty())
+    {
+        return;
+    }
+
+    lessName.store = m_store;
+
+    // Sort the new batch only, then one linear merge
+    m_sorted += m_unsorted;
+    m_unsorted = QVector<int>();
+
+    std::sort(m_sorted.begin() + sortedCount, m_sorted.end(), lessName);
+    std::inplace_merge(m_sorted.begin(), m_sorted.begin() + sortedCount, m_sorted.end(), lessName);
+}
+
+QVector<int> FtpListingIndex::trigramCandidates(const QByteArray &fragment) const
+{
+    QList<const struct Posting_List *> lists;
+    QVector<int> result;
+    int shortest = 0;
+
+    for(int i = 0; i + 3 <= fragment.size(); i++)
+    {
+        QHash<quint32, struct Posting_List>::const_iterator it = m_trigrams.find(trigramKey(fragment.constData() + i));
+
+        // A trigram no name has
+        if(it == m_trigrams.end())
+        {
+            return result;
+        }
+
+        lists.append(&it.value());
+        if(it.value().deltas.size() < lists.at(shortest)->deltas.size())
+        {
+            shortest = lists.size() - 1;
+        }
+    }
+
+    // Start from the rarest trigram, intersect the others in
+    result = decode(lists.at(shortest)->deltas);
+    for(int i = 0; i < lists.size() && !result.isEmpty(); i++)
+    {
+        QVector<int> other;
+        QVector<int> narrowed;
+
+        if(i == shortest)
+        {
+            continue;
+        }
+
+        other = decode(lists.at(i)->deltas);
+        narrowed.resize(qMin(result.size(), other.size()));
+        narrowed.resize(std::set_intersection(result.constBegin(), result.constEnd(),
+                                              other.constBegin(), other.constEnd(),
+                                              narrowed.begin()) - narrowed.begin());
+        result = narrowed;
+    }
+
+    return result;
+}
+
+QVector<int> FtpListingIndex::prefixRange(const QByteArray &prefix) const
+{
+    QVector<int> result;
+    int low = 0;
+    int high = m_sorted.size();
+
+    // First name not below prefix
+    while(low < high)
+    {
+        int middle = low + (high - low) / 2;
+        int length = 0;
+        const char *name = m_store->rawName(m_sorted.at(middle), length);
+
+        if(compareFolded(name, length, prefix.constData(), prefix.size()) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for(int i = low; i < m_sorted.size(); i++)
+    {
+        int length = 0;
+        const char *name = m_store->rawName(m_sorted.at(i), length);
+
+        if(length < prefix.size() || 0 != compareFolded(name, prefix.size(), prefix.constData(), prefix.size()))
+        {
+            break;
+        }
+
+        result.append(m_sorted.at(i));
+    }
+
+    return result;
+}
+
+bool FtpListingIndex::matchesLocked(int id, const QByteArray &filter, bool glob) const
+{
+    int length = 0;
+    const char *name = m_store->rawName(id, length);
+
+    return glob ? globMatch(name, length, filter) : containsFolded(name, length, filter);
+}
+
+QByteArray FtpListingIndex::fold(const QString &text)
+{
+    QByteArray folded = text.toUtf8();
+
+    for(int i = 0; i < folded.size(); i++)
+    {
+        folded[i] = foldByte(folded.at(i));
+    }
+
+    return folded;
+}
+
+int FtpListingIndex::compareFolded(const char *a, int aLength, const char *b, int bLength)
+{
+    for(int i = 0; i < aLength && i < bLength; i++)
+    {
+        char x = foldByte(a[i]);
+        char y = foldByte(b[i]);
+
+        if(x != y)
+        {
+            return ((uchar)x < (uchar)y) ? -1 : 1;
+        }
+    }
+
+    return aLength - bLength;
+}
+
+bool FtpListingIndex::containsFolded(const char *name, int length, const QByteArray &needle)
+{
+    for(int start = 0; start + needle.size() <= length; start++)
+    {
+        int i = 0;
+
+        while(i < needle.size() && foldByte(name[start + i]) == needle.at(i))
+        {
+            i++;
+        }
+
+        if(i == needle.size())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool FtpListingIndex::globMatch(const char *name, int length, const QByteArray &glob)
+{
+    int n = 0;
+    int g = 0;
+    int starGlob = -1;      // Position after the last '*'
+    int starName = 0;       // Name position that '*' is matched up to
+
+    while(n < length)
+    {
+        if(g < glob.size() && '*' == glob.at(g))
+        {
+            starGlob = ++g;
+            starName = n;
+        }
+        else if(g < glob.size() && '?' == glob.at(g))
+        {
+            // One character, all bytes of a UTF-8 sequence
+            n++;
+            while(n < length && 0x80 == ((uchar)name[n] & 0xC0))
+            {
+                n++;
+            }
+            g++;
+        }
+        else if(g < glob.size() && foldByte(name[n]) == glob.at(g))
+        {
+            n++;
+            g++;
+        }
+        else if(starGlob >= 0)
+        {
+            // Let the last '*' take one more byte
+            g = starGlob;
+            n = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while(g < glob.size() && '*' == glob.at(g))
+    {
+        g++;
+    }
+
+    return g == glob.size();
+}
+
+quint32 FtpListingIndex::trigramKey(const char *text)
+{
+    return ((quint32)(uchar)foldByte(text[0]) << 16)
+            | ((quint32)(uchar)foldByte(text[1]) << 8)
+            | (quint32)(uchar)foldByte(text[2]);
+}
+
+QVector<int> FtpListingIndex::decode(const QByteArray &deltas)
+{
+    QVector<int> ids;
+    int id = -1;
+    uint delta = 0;
+    int shift = 0;
+
+    for(int i = 0; i < deltas.size(); i++)
+    {
+        uchar byte = (uchar)deltas.at(i);
+
+        delta |= (uint)(byte & 0x7F) << shift;
+        shift += 7;
+
+        if(0 == (byte & 0x80))
+        {
+            id += (int)delta;
+            ids.append(id);
+            delta = 0;
+            shift = 0;
+        }
+    }
+
+    return ids;
+}
@@ -0,0 +1,76 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListingIndex.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Search index over a FtpListingStore, built as it grows
+**********************************************************************/
+
+#ifndef FTPLISTINGINDEX_H
+#define FTPLISTINGINDEX_H
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QHash>
+
+class FtpListingStore;
+
+class FtpListingIndex
+{
+public:
+    explicit FtpListingIndex(const FtpListingStore *store = 0);
+
+    void setStore(const FtpListingStore *store);
+    void clear();
+
+    // Index the rows the store got since the last call
+    void sync();
+
+    // Rows indexed so far
+    int size() const;
+
+    // Ids in [first, last) matching filter, in id order
+    QVector<int> filterRange(int first, int last, const QString &filter) const;
+
+    // Ids matching filter in name order, at most limit (all if negative).
+    // Empty filter gives all ids in order of arrival
+    QVector<int> find(const QString &filter, int limit) const;
+
+    // filter is a substring, or a glob if it has * or ?. Both ignore the
+    // case of ASCII letters, names are compared as UTF-8 bytes
+    static bool isGlob(const QString &filter);
+
+private:
+    struct Posting_List
+    {
+        Posting_List() : lastId(-1) {}
+
+        QByteArray deltas;      // Id gaps as varints, ids ascending
+        int lastId;
+    };
+
+    const FtpListingStore *m_store;
+    int m_indexed;
+
+    // Sorted by folded name. Ids indexed since the last search wait in
+    // m_unsorted and are merged in at the next search
+    mutable QVector<int> m_sorted;
+    mutable QVector<int> m_unsorted;
+
+    QHash<quint32, struct Posting_List> m_trigrams;
+
+    // Callers hold the read lock of m_store
+    void mergeSorted() const;
+    QVector<int> trigramCandidates(const QByteArray &fragment) const;
+    QVector<int> prefixRange(const QByteArray &prefix) const;
+    bool matchesLocked(int id, const QByteArray &filter, bool glob) const;
+
+    static QByteArray fold(const QString &text);
+    static int compareFolded(const char *a, int aLength, const char *b, int bLength);
+    static bool containsFolded(const char *name, int length, const QByteArray &needle);
+    static bool globMatch(const char *name, int length, const QByteArray &glob);
+    static quint32 trigramKey(const char *text);
+    static QVector<int> decode(const QByteArray &deltas);
+};
+
+#endif // FTPLISTINGINDEX_H
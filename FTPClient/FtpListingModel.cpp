@@ -0,0 +1,185 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListingModel.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        List model of a FtpListingStore for the server view
+**********************************************************************/
+
+#include "FtpListingModel.h"
+#include "FtpListingStore.h"
+#include <QDateTime>
+
+
+FtpListingModel::FtpListingModel(QObject *parent) :
+    QAbstractListModel(parent),
+    m_store(NULL),
+    m_generation(-1),
+    m_entryRows(0),
+    m_dirIcon(QPixmap(":/images/dir.png")),
+    m_fileIcon(QPixmap(":/images/file.png"))
+{
+}
+
+void FtpListingModel::setStore(const FtpListingStore *store)
+{
+    m_store = store;
+    m_index.setStore(store);
+
+    reset();
+}
+
+int FtpListingModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+    {
+        return 0;
+    }
+
+    return m_filter.isEmpty() ? m_entryRows : m_filterRows.size();
+}
+
+QVariant FtpListingModel::data(const QModelIndex &index, int role) const
+{
+    int id = storeId(index.row());
+
+    if(id < 0)
+    {
+        return QVariant();
+    }
+
+    // Only the rows in sight are asked for, one icon serves them all
+    switch(role)
+    {
+    case Qt::DisplayRole:
+        return m_store->name(id);
+
+    case Qt::DecorationRole:
+        return m_store->isDir(id) ? m_dirIcon : m_fileIcon;
+
+    case Qt::ToolTipRole:
+    {
+        QDateTime mtime = m_store->lastModified(id);
+        QString tip = m_store->isDir(id) ? tr("Directory")
+                                         : tr("%1 bytes").arg(m_store->fileSize(id));
+
+        if(mtime.isValid())
+        {
+            tip.append(tr(", modified %1").arg(mtime.toString("yyyy-MM-dd hh:mm")));
+        }
+
+        return tip;
+    }
+
+    default:
+        break;
+    }
+
+    return QVariant();
+}
+
+QString FtpListingModel::name(int row) const
+{
+    int id = storeId(row);
+
+    return (id < 0) ? QString() : m_store->name(id);
+}
+
+bool FtpListingModel::isDir(int row) const
+{
+    int id = storeId(row);
+
+    return id >= 0 && m_store->isDir(id);
+}
+
+int FtpListingModel::entryCount() const
+{
+    return m_entryRows;
+}
+
+QString FtpListingModel::filter() const
+{
+    return m_filter;
+}
+
+void FtpListingModel::setFilter(const QString &filter)
+{
+    beginResetModel();
+
+    m_filter = filter;
+    m_filterRows = filter.isEmpty() ? QVector<int>() : m_index.find(filter, -1);
+
+    endResetModel();
+}
+
+void FtpListingModel::refresh()
+{
+    int first = m_index.size();
+    int last = 0;
+
+    if(NULL == m_store)
+    {
+        return;
+    }
+
+    // Cleared and maybe refilled since the rows were taken
+    if(m_store->generation() != m_generation)
+    {
+        reset();
+        return;
+    }
+
+    m_index.sync();
+    last = m_index.size();
+
+    if(last <= first)
+    {
+        return;
+    }
+
+    if(m_filter.isEmpty())
+    {
+        beginInsertRows(QModelIndex(), first, last - 1);
+        m_entryRows = last;
+        endInsertRows();
+    }
+    else
+    {
+        // Matches that arrive later go below the sorted ones
+        QVector<int> matches = m_index.filterRange(first, last, m_filter);
+
+        m_entryRows = last;
+        if(!matches.isEmpty())
+        {
+            beginInsertRows(QModelIndex(), m_filterRows.size(), m_filterRows.size() + matches.size() - 1);
+            m_filterRows += matches;
+            endInsertRows();
+        }
+    }
+}
+
+void FtpListingModel::reset()
+{
+    beginResetModel();
+
+    // Generation first, a clear after it is caught by the next refresh
+    m_generation = (NULL == m_store) ? -1 : m_store->generation();
+
+    m_index.clear();
+    m_index.sync();
+
+    m_entryRows = m_index.size();
+    m_filterRows = m_filter.isEmpty() ? QVector<int>() : m_index.find(m_filter, -1);
+
+    endResetModel();
+}
+
+int FtpListingModel::storeId(int row) const
+{
+    if(NULL == m_store || row < 0 || row >= rowCount())
+    {
+        return -1;
+    }
+
+    return m_filter.isEmpty() ? row : m_filterRows.at(row);
+}
@@ -0,0 +1,62 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListingModel.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        List model of a FtpListingStore for the server view
+**********************************************************************/
+
+#ifndef FTPLISTINGMODEL_H
+#define FTPLISTINGMODEL_H
+#include <QAbstractListModel>
+#include <QIcon>
+#include "FtpListingIndex.h"
+
+class FtpListingStore;
+
+class FtpListingModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    explicit FtpListingModel(QObject *parent = 0);
+
+    // Store filled by a FtpClient, NULL to detach
+    void setStore(const FtpListingStore *store);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+    QString name(int row) const;
+    bool isDir(int row) const;
+
+    // Entries listed, shown or not
+    int entryCount() const;
+
+    // Substring or glob, see FtpListingIndex. Empty shows all entries
+    // in the order the server sent them
+    QString filter() const;
+    void setFilter(const QString &filter);
+
+public slots:
+    // Show the rows the store got since the last call
+    void refresh();
+
+    // Start over from the store, e.g. after it was cleared
+    void reset();
+
+private:
+    const FtpListingStore *m_store;
+    FtpListingIndex m_index;
+    int m_generation;               // Of the store the rows belong to
+
+    QString m_filter;
+    int m_entryRows;                // Rows without filter, row is the store id
+    QVector<int> m_filterRows;      // Store ids of the rows with filter
+
+    QIcon m_dirIcon;
+    QIcon m_fileIcon;
+
+    int storeId(int row) const;
+};
+
+#endif // FTPLISTINGMODEL_H
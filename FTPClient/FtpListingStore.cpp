@@ -0,0 +1,255 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListingStore.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Compact column store of a server dir listing
+**********************************************************************/
+
+#include "FtpListingStore.h"
+#include <QHash>
+#include <string.h>
+
+
+FtpListingStore::FtpListingStore() :
+    m_generation(0)
+{
+}
+
+void FtpListingStore::clear()
+{
+    QWriteLocker locker(&m_lock);
+
+    m_generation++;
+
+    // Drop the memory too, the last dir may have been huge
+    m_arena = QByteArray();
+    m_nameOffset = QVector<quint32>();
+    m_nameLength = QVector<quint16>();
+    m_size = QVector<qint64>();
+    m_mtime = QVector<quint32>();
+    m_flags = QVector<quint16>();
+    m_slots = QVector<qint32>();
+}
+
+bool FtpListingStore::add(const QUrlInfo &info)
+{
+    QByteArray utf8 = info.name().toUtf8();
+    QWriteLocker locker(&m_lock);
+    int id = m_nameOffset.size();
+    quint16 flags = (quint16)(info.permissions() & PERMISSION_MASK);
+
+    if(utf8.isEmpty() || utf8.size() > 0xFFFF || -1 != findLocked(utf8))
+    {
+        return false;
+    }
+
+    if(info.isDir())
+    {
+        flags |= TYPE_DIR;
+    }
+    if(info.isFile())
+    {
+        flags |= TYPE_FILE;
+    }
+    if(info.isSymLink())
+    {
+        flags |= TYPE_SYMLINK;
+    }
+
+    m_nameOffset.append((quint32)m_arena.size());
+    m_nameLength.append((quint16)utf8.size());
+    m_arena.append(utf8);
+    m_size.append(info.size());
+    m_mtime.append(info.lastModified().isValid() ? info.lastModified().toTime_t() : 0);
+    m_flags.append(flags);
+
+    // Keep the table at most half full
+    if(2 * (id + 1) > m_slots.size())
+    {
+        growSlots();
+    }
+    else
+    {
+        insertSlot(id, qHash(utf8));
+    }
+
+    return true;
+}
+
+void FtpListingStore::squeeze()
+{
+    QWriteLocker locker(&m_lock);
+
+    // Growth by doubling leaves up to half of each buffer unused
+    m_arena.squeeze();
+    m_nameOffset.squeeze();
+    m_nameLength.squeeze();
+    m_size.squeeze();
+    m_mtime.squeeze();
+    m_flags.squeeze();
+}
+
+int FtpListingStore::size() const
+{
+    QReadLocker locker(&m_lock);
+
+    return m_nameOffset.size();
+}
+
+int FtpListingStore::generation() const
+{
+    QReadLocker locker(&m_lock);
+
+    return m_generation;
+}
+
+int FtpListingStore::find(const QString &name) const
+{
+    QByteArray utf8 = name.toUtf8();
+    QReadLocker locker(&m_lock);
+
+    return findLocked(utf8);
+}
+
+QString FtpListingStore::name(int id) const
+{
+    QReadLocker locker(&m_lock);
+
+    if(id < 0 || id >= m_nameOffset.size())
+    {
+        return QString();
+    }
+
+    return QString::fromUtf8(m_arena.constData() + m_nameOffset.at(id), m_nameLength.at(id));
+}
+
+bool FtpListingStore::isDir(int id) const
+{
+    QReadLocker locker(&m_lock);
+
+    return id >= 0 && id < m_flags.size() && (m_flags.at(id) & TYPE_DIR);
+}
+
+bool FtpListingStore::isFile(int id) const
+{
+    QReadLocker locker(&m_lock);
+
+    return id >= 0 && id < m_flags.size()
+            && TYPE_FILE == (m_flags.at(id) & (TYPE_FILE | TYPE_SYMLINK));
+}
+
+qint64 FtpListingStore::fileSize(int id) const
+{
+    QReadLocker locker(&m_lock);
+
+    return (id >= 0 && id < m_size.size()) ? m_size.at(id) : -1;
+}
+
+QDateTime FtpListingStore::lastModified(int id) const
+{
+    QReadLocker locker(&m_lock);
+
+    if(id < 0 || id >= m_mtime.size() || 0 == m_mtime.at(id))
+    {
+        return QDateTime();
+    }
+
+    return QDateTime::fromTime_t(m_mtime.at(id));
+}
+
+int FtpListingStore::permissions(int id) const
+{
+    QReadLocker locker(&m_lock);
+
+    return (id >= 0 && id < m_flags.size()) ? (m_flags.at(id) & PERMISSION_MASK) : 0;
+}
+
+void FtpListingStore::lockForRead() const
+{
+    m_lock.lockForRead();
+}
+
+void FtpListingStore::unlock() const
+{
+    m_lock.unlock();
+}
+
+int FtpListingStore::rawSize() const
+{
+    return m_nameOffset.size();
+}
+
+const char *FtpListingStore::rawName(int id, int &length) const
+{
+    length = m_nameLength.at(id);
+
+    return m_arena.constData() + m_nameOffset.at(id);
+}
+
+qint64 FtpListingStore::memoryUsage() const
+{
+    QReadLocker locker(&m_lock);
+
+    return m_arena.capacity()
+            + m_nameOffset.capacity() * (qint64)sizeof(quint32)
+            + m_nameLength.capacity() * (qint64)sizeof(quint16)
+            + m_size.capacity() * (qint64)sizeof(qint64)
+            + m_mtime.capacity() * (qint64)sizeof(quint32)
+            + m_flags.capacity() * (qint64)sizeof(quint16)
+            + m_slots.capacity() * (qint64)sizeof(qint32);
+}
+
+int FtpListingStore::findLocked(const QByteArray &utf8) const
+{
+    int mask = m_slots.size() - 1;
+
+    if(m_slots.isEmpty())
+    {
+        return -1;
+    }
+
+    // Linear probing up to the first free slot
+    for(int slot = qHash(utf8) & mask; -1 != m_slots.at(slot); slot = (slot + 1) & mask)
+    {
+        if(nameEquals(m_slots.at(slot), utf8))
+        {
+            return m_slots.at(slot);
+        }
+    }
+
+    return -1;
+}
+
+void FtpListingStore::insertSlot(int id, uint hash)
+{
+    int mask = m_slots.size() - 1;
+    int slot = hash & mask;
+
+    while(-1 != m_slots.at(slot))
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    m_slots[slot] = id;
+}
+
+void FtpListingStore::growSlots()
+{
+    int slotCount = qMax(1024, m_slots.size() * 2);
+
+    // Size a power of two, the hash is masked
+    m_slots.fill(-1, slotCount);
+
+    for(int id = 0; id < m_nameOffset.size(); id++)
+    {
+        insertSlot(id, qHash(QByteArray::fromRawData(m_arena.constData() + m_nameOffset.at(id),
+                                                     m_nameLength.at(id))));
+    }
+}
+
+bool FtpListingStore::nameEquals(int id, const QByteArray &utf8) const
+{
+    return m_nameLength.at(id) == utf8.size()
+            && 0 == memcmp(m_arena.constData() + m_nameOffset.at(id), utf8.constData(), utf8.size());
+}
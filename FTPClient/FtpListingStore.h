@@ -0,0 +1,85 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpListingStore.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Compact column store of a server dir listing
+**********************************************************************/
+
+#ifndef FTPLISTINGSTORE_H
+#define FTPLISTINGSTORE_H
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QDateTime>
+#include <QReadWriteLock>
+#include <QUrlInfo>
+
+class FtpListingStore
+{
+public:
+    enum{
+        TYPE_DIR        = 0x1000,
+        TYPE_FILE       = 0x2000,
+        TYPE_SYMLINK    = 0x4000,
+        PERMISSION_MASK = 0x01FF        // QUrlInfo::PermissionSpec, rwxrwxrwx
+    };
+
+    FtpListingStore();
+
+    // Filled by the engine thread, read by the view thread. Every call
+    // takes the lock, ids out of range (store cleared meanwhile) give
+    // empty values
+    void clear();
+    bool add(const QUrlInfo &info);
+    void squeeze();
+
+    int size() const;
+
+    // Changes on every clear(), readers holding ids compare it
+    int generation() const;
+
+    // Id of name, -1 if not listed
+    int find(const QString &name) const;
+
+    QString name(int id) const;
+    bool isDir(int id) const;
+    bool isFile(int id) const;          // Regular file, not a link
+    qint64 fileSize(int id) const;
+    QDateTime lastModified(int id) const;
+    int permissions(int id) const;
+
+    // Raw access for indexers that must not create a QString per name.
+    // rawName() gives the UTF-8 bytes of id, only while the read lock is held
+    void lockForRead() const;
+    void unlock() const;
+    int rawSize() const;
+    const char *rawName(int id, int &length) const;
+
+    // Bytes used by arena, columns and hash table
+    qint64 memoryUsage() const;
+
+private:
+    mutable QReadWriteLock m_lock;
+    int m_generation;
+
+    // All names back to back, UTF-8, no terminators
+    QByteArray m_arena;
+
+    // Columns, one row per entry
+    QVector<quint32> m_nameOffset;
+    QVector<quint16> m_nameLength;
+    QVector<qint64> m_size;
+    QVector<quint32> m_mtime;           // Seconds since 1970, 0 if unknown
+    QVector<quint16> m_flags;           // TYPE_* | permissions
+
+    // Open addressing, ids by name hash, -1 marks a free slot
+    QVector<qint32> m_slots;
+
+    int findLocked(const QByteArray &utf8) const;
+    void insertSlot(int id, uint hash);
+    void growSlots();
+    bool nameEquals(int id, const QByteArray &utf8) const;
+};
+
+#endif // FTPLISTINGSTORE_H
@@ -0,0 +1,195 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpOperation.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Result handle of one FtpClient operation
+**********************************************************************/
+
+#include "FtpOperation.h"
+#include <QEventLoop>
+#include <QFtp>
+#include <QFile>
+#include <QTimer>
+
+
+FtpOperation::FtpOperation(int type, QObject *parent) :
+    QObject(parent),
+    m_type(type),
+    m_commandId(-1),
+    m_finished(false),
+    m_ok(false),
+    m_autoDelete(false),
+    m_replyCode(0),
+    m_bytes(0),
+    m_windowBytes(0),
+    m_windowMsecs(0),
+    m_bytesPerSecond(-1),
+    m_pDevice(NULL),
+    m_pTransfer(NULL)
+{
+    connect(this, SIGNAL(progress(qint64,qint64)), this, SLOT(trackProgress(qint64)));
+}
+
+int FtpOperation::type() const
+{
+    return m_type;
+}
+
+int FtpOperation::commandId() const
+{
+    return m_commandId;
+}
+
+bool FtpOperation::isFinished() const
+{
+    return m_finished;
+}
+
+bool FtpOperation::isOk() const
+{
+    return m_ok;
+}
+
+QString FtpOperation::errorString() const
+{
+    return m_errorString;
+}
+
+int FtpOperation::replyCode() const
+{
+    return m_replyCode;
+}
+
+QString FtpOperation::replyText() const
+{
+    return m_replyText;
+}
+
+QList<QUrlInfo> FtpOperation::entries() const
+{
+    return m_entries;
+}
+
+qint64 FtpOperation::bytes() const
+{
+    return m_bytes;
+}
+
+qint64 FtpOperation::bytesPerSecond() const
+{
+    qint64 elapsed = 0;
+
+    if(m_bytesPerSecond >= 0)
+    {
+        return m_bytesPerSecond;
+    }
+
+    if(!m_rateTimer.isValid())
+    {
+        return 0;
+    }
+
+    elapsed = m_rateTimer.elapsed();
+
+    return (elapsed > 0) ? (m_bytes - m_windowBytes) * 1000 / elapsed : 0;
+}
+
+bool FtpOperation::waitForFinished(int msecs)
+{
+    QEventLoop loop;
+
+    if(m_finished)
+    {
+        return true;
+    }
+
+    connect(this, SIGNAL(finished(bool)), &loop, SLOT(quit()));
+    if(msecs >= 0)
+    {
+        QTimer::singleShot(msecs, &loop, SLOT(quit()));
+    }
+
+    loop.exec();
+
+    return m_finished;
+}
+
+void FtpOperation::setAutoDelete(bool autoDelete)
+{
+    m_autoDelete = autoDelete;
+
+    if(m_autoDelete && m_finished)
+    {
+        deleteLater();
+    }
+}
+
+void FtpOperation::finish(bool ok, const QString &errorString)
+{
+    if(m_finished)
+    {
+        return;
+    }
+
+    m_finished = true;
+    m_ok = ok;
+    m_errorString = errorString;
+
+    if(NULL != m_pDevice)
+    {
+        m_pDevice->close();
+
+        // No partial download left behind
+        QFile *file = qobject_cast<QFile *>(m_pDevice);
+        if(!ok && QFtp::Get == m_type && NULL != file)
+        {
+            file->remove();
+        }
+    }
+
+    emitFinished();
+}
+
+void FtpOperation::failLater(const QString &errorString)
+{
+    m_finished = true;
+    m_ok = false;
+    m_errorString = errorString;
+
+    QTimer::singleShot(0, this, SLOT(emitFinished()));
+}
+
+void FtpOperation::trackProgress(qint64 doneBytes)
+{
+    qint64 elapsed = 0;
+
+    if(!m_rateTimer.isValid())
+    {
+        m_rateTimer.start();
+        m_windowBytes = doneBytes;
+        m_windowMsecs = 0;
+    }
+
+    m_bytes = doneBytes;
+
+    // A window, not the whole run, so a stalled producer shows at once
+    elapsed = m_rateTimer.elapsed();
+    if(elapsed - m_windowMsecs >= RATE_WINDOW_MSECS)
+    {
+        m_bytesPerSecond = (doneBytes - m_windowBytes) * 1000 / (elapsed - m_windowMsecs);
+        m_windowBytes = doneBytes;
+        m_windowMsecs = elapsed;
+    }
+}
+
+void FtpOperation::emitFinished()
+{
+    // Emit signal
+    emit finished(m_ok);
+
+    if(m_autoDelete)
+    {
+        deleteLater();
+    }
+}
@@ -0,0 +1,102 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpOperation.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Result handle of one FtpClient operation
+**********************************************************************/
+
+#ifndef FTPOPERATION_H
+#define FTPOPERATION_H
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QUrlInfo>
+#include <QElapsedTimer>
+
+class QIODevice;
+class FtpDataTransfer;
+
+// Returned by the *Async calls of FtpClient. Holds what its own command
+// answered, so a workflow can check each step without the shared status
+// signals. Connect to finished, or call waitForFinished to write the
+// steps one after another
+class FtpOperation : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        RATE_WINDOW_MSECS = 500
+    };
+
+    explicit FtpOperation(int type, QObject *parent = 0);
+
+    // QFtp::Command of the operation
+    int type() const;
+
+    // Session command id, -1 if it could not be queued
+    int commandId() const;
+
+    bool isFinished() const;
+    bool isOk() const;
+    QString errorString() const;
+
+    // Last reply of a raw command, 0 and empty for other types
+    int replyCode() const;
+    QString replyText() const;
+
+    // Entries of a list operation
+    QList<QUrlInfo> entries() const;
+
+    // Bytes transferred by a get or put
+    qint64 bytes() const;
+
+    // Throughput over the last RATE_WINDOW_MSECS of progress, the
+    // average since the first progress before that. 0 without progress
+    qint64 bytesPerSecond() const;
+
+    // Run a local event loop until finished or msecs passed (-1 waits
+    // as long as it takes). Returns isFinished(). Other operations and
+    // signals of this thread go on meanwhile
+    bool waitForFinished(int msecs = -1);
+
+    // Delete the operation once finished was delivered. Do not wait on
+    // an operation that deletes itself
+    void setAutoDelete(bool autoDelete);
+
+signals:
+    void progress(qint64 doneBytes, qint64 totalBytes);
+    void finished(bool ok);
+
+private slots:
+    void emitFinished();
+    void trackProgress(qint64 doneBytes);
+
+private:
+    friend class FtpClient;
+
+    int m_type;
+    int m_commandId;
+    bool m_finished;
+    bool m_ok;
+    bool m_autoDelete;
+    QString m_errorString;
+
+    int m_replyCode;
+    QString m_replyText;
+    QList<QUrlInfo> m_entries;
+    qint64 m_bytes;
+    QElapsedTimer m_rateTimer;      // Since the first progress
+    qint64 m_windowBytes;           // Done at the start of the rate window
+    qint64 m_windowMsecs;
+    qint64 m_bytesPerSecond;        // Of the last full window, -1 if none yet
+    QIODevice *m_pDevice;           // Local file of a get or put, owned
+    FtpDataTransfer *m_pTransfer;   // Streamed get/put, NULL if QFtp moves the data
+
+    // Mark finished and emit; failLater defers it to the event loop so
+    // a caller gets the handle before it fails
+    void finish(bool ok, const QString &errorString = QString());
+    void failLater(const QString &errorString);
+};
+
+#endif // FTPOPERATION_H
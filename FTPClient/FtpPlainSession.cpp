@@ -0,0 +1,137 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpPlainSession.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Plain FTP session on QFtp
+**********************************************************************/
+
+#include "FtpPlainSession.h"
+
+
+FtpPlainSession::FtpPlainSession(QObject *parent) :
+    FtpSession(parent),
+    m_pFtp(new QFtp(this))
+{
+    connect(m_pFtp, SIGNAL(stateChanged(int)), this, SIGNAL(stateChanged(int)));
+    connect(m_pFtp, SIGNAL(listInfo(QUrlInfo)), this, SIGNAL(listInfo(QUrlInfo)));
+    connect(m_pFtp, SIGNAL(commandStarted(int)), this, SIGNAL(commandStarted(int)));
+    connect(m_pFtp, SIGNAL(commandFinished(int,bool)), this, SIGNAL(commandFinished(int,bool)));
+    connect(m_pFtp, SIGNAL(done(bool)), this, SIGNAL(done(bool)));
+    connect(m_pFtp, SIGNAL(dataTransferProgress(qint64,qint64)),
+            this, SIGNAL(dataTransferProgress(qint64,qint64)));
+    connect(m_pFtp, SIGNAL(rawCommandReply(int,QString)), this, SIGNAL(rawCommandReply(int,QString)));
+}
+
+FtpPlainSession::~FtpPlainSession()
+{
+}
+
+int FtpPlainSession::connectToHost(const QString &host, quint16 port)
+{
+    return m_pFtp->connectToHost(host, port);
+}
+
+int FtpPlainSession::login(const QString &user, const QString &password)
+{
+    return m_pFtp->login(user, password);
+}
+
+int FtpPlainSession::close()
+{
+    return m_pFtp->close();
+}
+
+int FtpPlainSession::list(const QString &dir)
+{
+    return m_pFtp->list(dir);
+}
+
+int FtpPlainSession::cd(const QString &dir)
+{
+    return m_pFtp->cd(dir);
+}
+
+int FtpPlainSession::get(const QString &file, QIODevice *dev)
+{
+    return m_pFtp->get(file, dev);
+}
+
+int FtpPlainSession::put(const QByteArray &data, const QString &file)
+{
+    return m_pFtp->put(data, file);
+}
+
+int FtpPlainSession::put(QIODevice *dev, const QString &file)
+{
+    return m_pFtp->put(dev, file);
+}
+
+int FtpPlainSession::mkdir(const QString &dir)
+{
+    return m_pFtp->mkdir(dir);
+}
+
+int FtpPlainSession::rmdir(const QString &dir)
+{
+    return m_pFtp->rmdir(dir);
+}
+
+int FtpPlainSession::remove(const QString &file)
+{
+    return m_pFtp->remove(file);
+}
+
+int FtpPlainSession::rename(const QString &oldName, const QString &newName)
+{
+    return m_pFtp->rename(oldName, newName);
+}
+
+int FtpPlainSession::rawCommand(const QString &command)
+{
+    return m_pFtp->rawCommand(command);
+}
+
+int FtpPlainSession::currentId() const
+{
+    return m_pFtp->currentId();
+}
+
+QFtp::Command FtpPlainSession::currentCommand() const
+{
+    return m_pFtp->currentCommand();
+}
+
+QFtp::State FtpPlainSession::state() const
+{
+    return m_pFtp->state();
+}
+
+QFtp::Error FtpPlainSession::error() const
+{
+    return m_pFtp->error();
+}
+
+QString FtpPlainSession::errorString() const
+{
+    return m_pFtp->errorString();
+}
+
+void FtpPlainSession::abort()
+{
+    m_pFtp->abort();
+}
+
+void FtpPlainSession::clearPendingCommands()
+{
+    m_pFtp->clearPendingCommands();
+}
+
+void FtpPlainSession::setDataMode(int mode)
+{
+    FtpSession::setDataMode(mode);
+
+    // Queued like a command, applies to the transfers queued after it.
+    // QFtp listens for active connections itself, without the pool
+    m_pFtp->setTransferMode(DATA_MODE_ACTIVE == mode ? QFtp::Active : QFtp::Passive);
+}
@@ -0,0 +1,50 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpPlainSession.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Plain FTP session on QFtp
+**********************************************************************/
+
+#ifndef FTPPLAINSESSION_H
+#define FTPPLAINSESSION_H
+#include "FtpSession.h"
+
+class FtpPlainSession : public FtpSession
+{
+    Q_OBJECT
+public:
+    explicit FtpPlainSession(QObject *parent = 0);
+    ~FtpPlainSession();
+
+    int connectToHost(const QString &host, quint16 port = 21);
+    int login(const QString &user = QString(), const QString &password = QString());
+    int close();
+    int list(const QString &dir = QString());
+    int cd(const QString &dir);
+    int get(const QString &file, QIODevice *dev);
+    int put(const QByteArray &data, const QString &file);
+    int put(QIODevice *dev, const QString &file);
+    int mkdir(const QString &dir);
+    int rmdir(const QString &dir);
+    int remove(const QString &file);
+    int rename(const QString &oldName, const QString &newName);
+    int rawCommand(const QString &command);
+
+    int currentId() const;
+    QFtp::Command currentCommand() const;
+    QFtp::State state() const;
+    QFtp::Error error() const;
+    QString errorString() const;
+    void abort();
+    void clearPendingCommands();
+
+    // QFtp has passive and active only. It picks EPSV over IPv6 itself,
+    // DATA_MODE_EXTENDED is passive here
+    void setDataMode(int mode);
+
+private:
+    QFtp *m_pFtp;
+};
+
+#endif // FTPPLAINSESSION_H
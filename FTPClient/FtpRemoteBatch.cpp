@@ -0,0 +1,639 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpRemoteBatch.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Bulk server side delete/rename/chmod over parallel sessions
+**********************************************************************/
+
+#include "FtpRemoteBatch.h"
+#include "FtpPlainSession.h"
+#include "FtpTlsSession.h"
+
+
+FtpRemoteBatch::FtpRemoteBatch(QObject *parent) :
+    QObject(parent),
+    m_port(21),
+    m_tls(false),
+    m_verifyPeer(true),
+    m_sessionCount(BATCH_DEFAULT_SESSIONS),
+    m_dataMode(FtpSession::DATA_MODE_PASSIVE),
+    m_pListenerPool(NULL),
+    m_operation(OP_DELETE),
+    m_phase(PHASE_IDLE),
+    m_recursive(false),
+    m_doneCount(0),
+    m_failedCount(0),
+    m_totalCount(0),
+    m_listedCount(0),
+    m_lastPercent(-1)
+{
+}
+
+FtpRemoteBatch::~FtpRemoteBatch()
+{
+    closeSessions();
+}
+
+void FtpRemoteBatch::setServer(const QString &host, const QString &address, quint16 port,
+                               const QString &user, const QString &password,
+                               bool tls, bool verifyPeer)
+{
+    m_host = host;
+    m_address = address.isEmpty() ? host : address;
+    m_port = port;
+    m_user = user;
+    m_password = password;
+    m_tls = tls;
+    m_verifyPeer = verifyPeer;
+}
+
+void FtpRemoteBatch::setSessionCount(int count)
+{
+    m_sessionCount = qBound(1, count, (int)BATCH_MAX_SESSIONS);
+}
+
+void FtpRemoteBatch::setDataMode(int mode, FtpListenerPool *pool)
+{
+    m_dataMode = mode;
+    m_pListenerPool = pool;
+}
+
+void FtpRemoteBatch::removeTree(const QString &dir, const QStringList &names)
+{
+    m_operation = OP_DELETE;
+    m_recursive = true;
+
+    start(dir);
+
+    m_selected = QSet<QString>::fromList(names);
+    m_listQueue.append(m_rootDir);
+    m_phase = PHASE_LIST;
+
+    m_statusMsg = tr("Listing %1 entries of %2 for delete...").arg(names.size()).arg(m_rootDir);
+
+    // Emit status message
+    emit statusMsg(m_statusMsg);
+
+    dispatch();
+}
+
+void FtpRemoteBatch::renameFiles(const QString &dir, const QStringList &fromNames, const QStringList &toNames)
+{
+    m_operation = OP_RENAME;
+    m_recursive = false;
+
+    start(dir);
+
+    for(int i = 0; i < fromNames.size() && i < toNames.size(); i++)
+    {
+        struct Batch_Op op;
+
+        op.type = QFtp::Rename;
+        op.arg = joinPath(m_rootDir, fromNames.at(i));
+        op.arg2 = joinPath(m_rootDir, toNames.at(i));
+        m_ops.append(op);
+    }
+
+    // Nothing to list, the names are known
+    m_totalCount = m_ops.size();
+    m_phase = PHASE_OPS;
+
+    m_statusMsg = tr("Renaming %1 files in %2...").arg(m_totalCount).arg(m_rootDir);
+
+    // Emit status message
+    emit statusMsg(m_statusMsg);
+
+    dispatch();
+}
+
+void FtpRemoteBatch::chmodTree(const QString &dir, const QStringList &names, const QString &mode, bool recursive)
+{
+    m_operation = OP_CHMOD;
+    m_recursive = recursive;
+
+    start(dir);
+
+    m_mode = mode;
+
+    if(recursive)
+    {
+        m_selected = QSet<QString>::fromList(names);
+        m_listQueue.append(m_rootDir);
+        m_phase = PHASE_LIST;
+    }
+    else
+    {
+        for(int i = 0; i < names.size(); i++)
+        {
+            struct Batch_Op op;
+
+            op.type = QFtp::RawCommand;
+            op.arg = QString("SITE CHMOD %1 %2").arg(m_mode).arg(joinPath(m_rootDir, names.at(i)));
+            m_ops.append(op);
+        }
+
+        m_totalCount = m_ops.size();
+        m_phase = PHASE_OPS;
+    }
+
+    m_statusMsg = tr("Changing mode of %1 entries in %2 to %3...").arg(names.size()).arg(m_rootDir).arg(mode);
+
+    // Emit status message
+    emit statusMsg(m_statusMsg);
+
+    dispatch();
+}
+
+void FtpRemoteBatch::abort()
+{
+    if(PHASE_IDLE == m_phase)
+    {
+        return;
+    }
+
+    m_firstError = tr("Aborted");
+    finish(false);
+}
+
+bool FtpRemoteBatch::isRunning() const
+{
+    return PHASE_IDLE != m_phase;
+}
+
+int FtpRemoteBatch::doneCount() const
+{
+    return m_doneCount;
+}
+
+int FtpRemoteBatch::failedCount() const
+{
+    return m_failedCount;
+}
+
+void FtpRemoteBatch::dealListInfo(const QUrlInfo &info)
+{
+    int index = findWorker(sender());
+    int commandId = 0;
+    QString dir;
+    QString path;
+
+    if(index < 0)
+    {
+        return;
+    }
+
+    commandId = m_workers.at(index).session->currentId();
+    if(!m_listIds.contains(commandId))
+    {
+        return;
+    }
+
+    dir = m_listIds.value(commandId);
+    if("." == info.name() || ".." == info.name() || info.name().isEmpty())
+    {
+        return;
+    }
+
+    // Only the picked entries of the top dir
+    if(dir == m_rootDir && !m_selected.contains(info.name()))
+    {
+        return;
+    }
+
+    path = joinPath(dir, info.name());
+    m_listedCount++;
+
+    // A link to a dir is removed as the link, never followed
+    if(info.isDir() && !info.isSymLink())
+    {
+        if(m_recursive)
+        {
+            m_listQueue.append(path);
+        }
+
+        if(OP_DELETE == m_operation)
+        {
+            m_dirLevels[path.count('/')].append(path);
+            return;
+        }
+    }
+
+    struct Batch_Op op;
+
+    if(OP_DELETE == m_operation)
+    {
+        op.type = QFtp::Remove;
+        op.arg = path;
+    }
+    else
+    {
+        op.type = QFtp::RawCommand;
+        op.arg = QString("SITE CHMOD %1 %2").arg(m_mode).arg(path);
+    }
+
+    m_ops.append(op);
+}
+
+void FtpRemoteBatch::dealCommandFinished(int commandId, bool error)
+{
+    int index = findWorker(sender());
+
+    if(index < 0)
+    {
+        return;
+    }
+
+    struct Batch_Worker &worker = m_workers[index];
+    worker.queuedIds.removeAll(commandId);
+
+    if(QFtp::ConnectToHost == worker.session->currentCommand()
+            || commandId == worker.loginId)
+    {
+        if(error)
+        {
+            dropWorker(index, worker.session->errorString());
+            return;
+        }
+
+        if(commandId == worker.loginId)
+        {
+            worker.ready = true;
+            dispatch();
+        }
+        return;
+    }
+
+    // Lost the connection, not the command's fault, another session runs it
+    if(error && QFtp::Unconnected == worker.session->state())
+    {
+        if(m_listIds.contains(commandId))
+        {
+            m_listQueue.prepend(m_listIds.take(commandId));
+        }
+        else if(m_opIds.contains(commandId))
+        {
+            m_ops.prepend(m_opIds.take(commandId));
+        }
+
+        dropWorker(index, worker.session->errorString());
+        return;
+    }
+
+    if(m_listIds.contains(commandId))
+    {
+        QString dir = m_listIds.take(commandId);
+
+        if(error)
+        {
+            // Its dir stays, the RMD of it reports the failure again
+            m_failedCount++;
+            if(m_firstError.isEmpty())
+            {
+                m_firstError = QString("%1: %2").arg(dir).arg(worker.session->errorString());
+            }
+        }
+    }
+    else if(m_opIds.contains(commandId))
+    {
+        struct Batch_Op op = m_opIds.take(commandId);
+
+        if(error)
+        {
+            m_failedCount++;
+            if(m_firstError.isEmpty())
+            {
+                m_firstError = QString("%1: %2").arg(op.arg).arg(worker.session->errorString());
+            }
+        }
+        else
+        {
+            m_doneCount++;
+        }
+    }
+
+    // The session dropped what was queued behind a failed command
+    if(error)
+    {
+        requeueDropped(index);
+    }
+
+    reportProgress();
+    dispatch();
+}
+
+void FtpRemoteBatch::start(const QString &dir)
+{
+    closeSessions();
+
+    m_rootDir = dir.isEmpty() ? QString("/") : dir;
+    m_mode.clear();
+    m_selected.clear();
+    m_listIds.clear();
+    m_opIds.clear();
+    m_listQueue.clear();
+    m_ops.clear();
+    m_dirLevels.clear();
+    m_doneCount = 0;
+    m_failedCount = 0;
+    m_totalCount = 0;
+    m_listedCount = 0;
+    m_lastPercent = -1;
+    m_firstError.clear();
+    m_clock.start();
+
+    for(int i = 0; i < m_sessionCount; i++)
+    {
+        struct Batch_Worker worker;
+
+        if(m_tls)
+        {
+            worker.session = new FtpTlsSession(m_host, m_verifyPeer, this);
+        }
+        else
+        {
+            worker.session = new FtpPlainSession(this);
+        }
+
+        // Parallel LISTs in active mode share the listeners of the pool
+        worker.session->setListenerPool(m_pListenerPool);
+        worker.session->setDataMode(m_dataMode);
+
+        connect(worker.session, SIGNAL(listInfo(QUrlInfo)), this, SLOT(dealListInfo(QUrlInfo)));
+        connect(worker.session, SIGNAL(commandFinished(int,bool)), this, SLOT(dealCommandFinished(int,bool)));
+
+        worker.session->connectToHost(m_address, m_port);
+        worker.loginId = worker.session->login(m_user, m_password);
+        worker.ready = false;
+
+        m_workers.append(worker);
+    }
+}
+
+void FtpRemoteBatch::dispatch()
+{
+    bool queued = true;
+    int inFlight = 0;
+
+    if(PHASE_IDLE == m_phase)
+    {
+        return;
+    }
+
+    // Round robin, so every session gets work before any queue fills up
+    while(queued)
+    {
+        queued = false;
+
+        for(int i = 0; i < m_workers.size(); i++)
+        {
+            struct Batch_Worker &worker = m_workers[i];
+            int commandId = -1;
+
+            if(!worker.ready || worker.queuedIds.size() >= BATCH_QUEUE_DEPTH)
+            {
+                continue;
+            }
+
+            if(PHASE_LIST == m_phase)
+            {
+                if(m_listQueue.isEmpty())
+                {
+                    break;
+                }
+
+                QString dir = m_listQueue.takeFirst();
+
+                commandId = worker.session->list(dir);
+                m_listIds.insert(commandId, dir);
+            }
+            else
+            {
+                if(m_ops.isEmpty())
+                {
+                    break;
+                }
+
+                struct Batch_Op op = m_ops.takeFirst();
+
+                switch(op.type)
+                {
+                case QFtp::Remove:
+                    commandId = worker.session->remove(op.arg);
+                    break;
+                case QFtp::Rmdir:
+                    commandId = worker.session->rmdir(op.arg);
+                    break;
+                case QFtp::Rename:
+                    commandId = worker.session->rename(op.arg, op.arg2);
+                    break;
+                default:
+                    commandId = worker.session->rawCommand(op.arg);
+                    break;
+                }
+
+                m_opIds.insert(commandId, op);
+            }
+
+            worker.queuedIds.append(commandId);
+            queued = true;
+        }
+    }
+
+    for(int i = 0; i < m_workers.size(); i++)
+    {
+        inFlight += m_workers.at(i).queuedIds.size();
+    }
+
+    if(0 == inFlight && m_listQueue.isEmpty() && m_ops.isEmpty())
+    {
+        advancePhase();
+    }
+}
+
+void FtpRemoteBatch::advancePhase()
+{
+    if(PHASE_LIST == m_phase)
+    {
+        int dirCount = 0;
+        QMap<int, QStringList>::const_iterator it;
+
+        for(it = m_dirLevels.constBegin(); it != m_dirLevels.constEnd(); ++it)
+        {
+            dirCount += it.value().size();
+        }
+
+        m_totalCount = m_ops.size() + dirCount;
+        m_phase = PHASE_OPS;
+
+        m_statusMsg = tr("%1 entries listed in %2 ms, %3 commands to run")
+                .arg(m_listedCount).arg(m_clock.elapsed()).arg(m_totalCount);
+
+        // Emit status message
+        emit statusMsg(m_statusMsg);
+    }
+    else if(OP_DELETE == m_operation && !m_dirLevels.isEmpty())
+    {
+        // Deepest level first, a dir is empty once the level below is gone
+        QStringList dirs = m_dirLevels.take(m_dirLevels.lastKey());
+
+        for(int i = 0; i < dirs.size(); i++)
+        {
+            struct Batch_Op op;
+
+            op.type = QFtp::Rmdir;
+            op.arg = dirs.at(i);
+            m_ops.append(op);
+        }
+
+        m_phase = PHASE_DIRS;
+    }
+    else
+    {
+        finish(0 == m_failedCount);
+        return;
+    }
+
+    dispatch();
+}
+
+void FtpRemoteBatch::finish(bool ok)
+{
+    QString operation;
+
+    closeSessions();
+    m_phase = PHASE_IDLE;
+
+    if(OP_DELETE == m_operation)
+    {
+        operation = tr("Delete");
+    }
+    else if(OP_RENAME == m_operation)
+    {
+        operation = tr("Rename");
+    }
+    else
+    {
+        operation = tr("Chmod");
+    }
+
+    m_statusMsg = tr("%1 in %2: %3 done, %4 failed in %5 s")
+            .arg(operation)
+            .arg(m_rootDir)
+            .arg(m_doneCount)
+            .arg(m_failedCount)
+            .arg(m_clock.elapsed() / 1000.0, 0, 'f', 1);
+
+    if(!m_firstError.isEmpty())
+    {
+        m_statusMsg.append(tr(", first error: %1").arg(m_firstError));
+    }
+
+    // Emit status message
+    emit statusMsg(m_statusMsg);
+    emit progressVal(100);
+
+    // Emit signal
+    emit finished(ok);
+}
+
+void FtpRemoteBatch::closeSessions()
+{
+    for(int i = 0; i < m_workers.size(); i++)
+    {
+        m_workers.at(i).session->disconnect(this);
+        m_workers.at(i).session->abort();
+        m_workers.at(i).session->deleteLater();
+    }
+
+    m_workers.clear();
+}
+
+void FtpRemoteBatch::reportProgress()
+{
+    int percent = 0;
+
+    if(m_totalCount <= 0)
+    {
+        return;
+    }
+
+    percent = (int)((qint64)(m_doneCount + m_failedCount) * 100 / m_totalCount);
+
+    if(percent != m_lastPercent)
+    {
+        m_lastPercent = percent;
+
+        // Emit signal
+        emit progressVal(percent);
+    }
+}
+
+void FtpRemoteBatch::dropWorker(int workerIndex, const QString &reason)
+{
+    struct Batch_Worker worker = m_workers.at(workerIndex);
+
+    requeueDropped(workerIndex);
+
+    worker.session->disconnect(this);
+    worker.session->abort();
+    worker.session->deleteLater();
+    m_workers.removeAt(workerIndex);
+
+    if(m_workers.isEmpty())
+    {
+        m_firstError = reason;
+        finish(false);
+        return;
+    }
+
+    // The others take over its share
+    dispatch();
+}
+
+int FtpRemoteBatch::findWorker(QObject *session) const
+{
+    for(int i = 0; i < m_workers.size(); i++)
+    {
+        if(m_workers.at(i).session == session)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void FtpRemoteBatch::requeueDropped(int workerIndex)
+{
+    struct Batch_Worker &worker = m_workers[workerIndex];
+
+    worker.session->clearPendingCommands();
+
+    // Back to the front, in their old order
+    for(int i = worker.queuedIds.size() - 1; i >= 0; i--)
+    {
+        int commandId = worker.queuedIds.at(i);
+
+        if(m_listIds.contains(commandId))
+        {
+            m_listQueue.prepend(m_listIds.take(commandId));
+        }
+        else if(m_opIds.contains(commandId))
+        {
+            m_ops.prepend(m_opIds.take(commandId));
+        }
+    }
+
+    worker.queuedIds.clear();
+}
+
+QString FtpRemoteBatch::joinPath(const QString &dir, const QString &name)
+{
+    if(name.startsWith('/'))
+    {
+        return name;
+    }
+
+    return dir.endsWith('/') ? dir + name : dir + "/" + name;
+}
@@ -0,0 +1,154 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpRemoteBatch.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Bulk server side delete/rename/chmod over parallel sessions
+**********************************************************************/
+
+#ifndef FTPREMOTEBATCH_H
+#define FTPREMOTEBATCH_H
+#include <QObject>
+#include <QUrlInfo>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+#include <QElapsedTimer>
+
+class FtpSession;
+class FtpListenerPool;
+
+class FtpRemoteBatch : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        OP_DELETE = 0,
+        OP_RENAME,
+        OP_CHMOD
+    };
+
+    enum{
+        BATCH_DEFAULT_SESSIONS = 4,
+        BATCH_MAX_SESSIONS = 8,         // Servers limit logins per user
+        BATCH_QUEUE_DEPTH = 64          // Commands queued ahead on each session
+    };
+
+    explicit FtpRemoteBatch(QObject *parent = 0);
+    ~FtpRemoteBatch();
+
+    // Login of the sessions. address is connected to, host is the name
+    // checked against the certificate when tls is set
+    void setServer(const QString &host, const QString &address, quint16 port,
+                   const QString &user, const QString &password,
+                   bool tls, bool verifyPeer);
+    void setSessionCount(int count);
+
+    // FtpSession::DATA_MODE_* of the LISTs, active mode listeners from pool
+    void setDataMode(int mode, FtpListenerPool *pool);
+
+    // names are entries of dir. Dirs are listed to the bottom first, then
+    // files are deleted, then dirs from the deepest level up
+    void removeTree(const QString &dir, const QStringList &names);
+
+    // fromNames[i] of dir becomes toNames[i], may contain a path
+    void renameFiles(const QString &dir, const QStringList &fromNames, const QStringList &toNames);
+
+    // "SITE CHMOD mode" on names, and on everything below them if recursive
+    void chmodTree(const QString &dir, const QStringList &names, const QString &mode, bool recursive);
+
+    void abort();
+    bool isRunning() const;
+
+    int doneCount() const;
+    int failedCount() const;
+
+signals:
+    void statusMsg(QString);
+    void progressVal(int);
+    void finished(bool ok);
+
+private slots:
+    void dealListInfo(const QUrlInfo &info);
+    void dealCommandFinished(int commandId, bool error);
+
+private:
+    enum{
+        PHASE_IDLE = 0,
+        PHASE_LIST,         // Build the manifest
+        PHASE_OPS,          // Independent commands, any order
+        PHASE_DIRS          // RMD, one depth level at a time
+    };
+
+    struct Batch_Op
+    {
+        int type;           // QFtp::Command
+        QString arg;
+        QString arg2;
+    };
+
+    struct Batch_Worker
+    {
+        Batch_Worker() : session(NULL), loginId(-1), ready(false) {}
+
+        FtpSession *session;
+        int loginId;
+        bool ready;                     // Logged in
+        QList<int> queuedIds;           // In the session queue, in order
+    };
+
+    QString m_host;
+    QString m_address;
+    quint16 m_port;
+    QString m_user;
+    QString m_password;
+    bool m_tls;
+    bool m_verifyPeer;
+    int m_sessionCount;
+    int m_dataMode;
+    FtpListenerPool *m_pListenerPool;
+
+    int m_operation;
+    int m_phase;
+    QString m_mode;                     // Of chmod
+    bool m_recursive;
+    QString m_rootDir;
+    QSet<QString> m_selected;           // Names picked in m_rootDir
+
+    QList<struct Batch_Worker> m_workers;
+    QHash<int, QString> m_listIds;      // LIST command id to its dir
+    QHash<int, struct Batch_Op> m_opIds;
+    QStringList m_listQueue;            // Dirs still to list
+    QList<struct Batch_Op> m_ops;       // Commands not queued yet
+    QMap<int, QStringList> m_dirLevels; // Dirs to remove, by depth
+
+    int m_doneCount;
+    int m_failedCount;
+    int m_totalCount;
+    int m_listedCount;
+    int m_lastPercent;
+    QString m_firstError;
+    QString m_statusMsg;
+    QElapsedTimer m_clock;
+
+    void start(const QString &dir);
+    void dispatch();
+    void advancePhase();
+    void finish(bool ok);
+    void closeSessions();
+    void reportProgress();
+
+    int findWorker(QObject *session) const;
+
+    // Session failed to log in or lost its connection
+    void dropWorker(int workerIndex, const QString &reason);
+
+    // Commands the session dropped after an error go back to the queues
+    void requeueDropped(int workerIndex);
+
+    static QString joinPath(const QString &dir, const QString &name);
+};
+
+#endif // FTPREMOTEBATCH_H
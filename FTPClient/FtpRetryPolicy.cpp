@@ -0,0 +1,135 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpRetryPolicy.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Error classification and backoff of transfer retries
+**********************************************************************/
+
+#include "FtpRetryPolicy.h"
+#include <QFtp>
+#include <QRegExp>
+#include <QDateTime>
+
+
+FtpRetryPolicy::FtpRetryPolicy() :
+    m_maxAttempts(RETRY_DEFAULT_ATTEMPTS),
+    m_baseDelayMsecs(RETRY_BASE_DELAY_MSECS),
+    m_maxDelayMsecs(RETRY_MAX_DELAY_MSECS),
+    m_random((quint32)QDateTime::currentMSecsSinceEpoch() ^ (quint32)(quintptr)this)
+{
+    // xorshift never leaves 0
+    if(0 == m_random)
+    {
+        m_random = 0x9E3779B9;
+    }
+}
+
+void FtpRetryPolicy::setMaxAttempts(int attempts)
+{
+    m_maxAttempts = qMax(attempts, 0);
+}
+
+int FtpRetryPolicy::maxAttempts() const
+{
+    return m_maxAttempts;
+}
+
+void FtpRetryPolicy::setDelays(int baseMsecs, int maxMsecs)
+{
+    m_baseDelayMsecs = qMax(baseMsecs, 1);
+    m_maxDelayMsecs = qMax(maxMsecs, m_baseDelayMsecs);
+}
+
+int FtpRetryPolicy::classifyReply(int replyCode)
+{
+    // 1xx-3xx never end a command in error, treat like no reply
+    return (replyCode >= 500 && replyCode < 600) ? ERROR_PERMANENT : ERROR_TRANSIENT;
+}
+
+int FtpRetryPolicy::classifyError(int ftpError, const QString &errorString)
+{
+    QRegExp codeRx("^\\s*([1-5]\\d\\d)[\\s-]");
+
+    switch(ftpError)
+    {
+    case QFtp::ConnectionRefused:
+    case QFtp::NotConnected:
+        return ERROR_TRANSIENT;
+    case QFtp::HostNotFound:
+        // A fresh lookup failed, the next one would too
+        return ERROR_PERMANENT;
+    default:
+        break;
+    }
+
+    // Some servers repeat the code in the reply text
+    if(codeRx.indexIn(errorString) >= 0)
+    {
+        return classifyReply(codeRx.cap(1).toInt());
+    }
+
+    // Wording of common 5xx replies and local failures
+    static const char *const permanentWords[] = {
+        "denied", "not found", "no such", "not allowed", "permission", "exists",
+        "not permitted", "invalid", "illegal", "not implemented", "not supported",
+        "unknown command", "quota", "unable to open", "read-only", "is a directory"
+    };
+
+    for(unsigned i = 0; i < sizeof(permanentWords) / sizeof(permanentWords[0]); i++)
+    {
+        if(errorString.contains(QLatin1String(permanentWords[i]), Qt::CaseInsensitive))
+        {
+            return ERROR_PERMANENT;
+        }
+    }
+
+    // Lost or reset connections, time outs and the wording of
+    // 421/425/426/450/451 replies
+    static const char *const transientWords[] = {
+        "connection closed", "connection reset", "reset by peer", "timed out", "timeout",
+        "connection refused", "data connection", "failed to establish connection",
+        "service not available", "too many", "try again", "try later", "temporar",
+        "busy", "transfer aborted", "local error", "broken pipe"
+    };
+
+    for(unsigned i = 0; i < sizeof(transientWords) / sizeof(transientWords[0]); i++)
+    {
+        if(errorString.contains(QLatin1String(transientWords[i]), Qt::CaseInsensitive))
+        {
+            return ERROR_TRANSIENT;
+        }
+    }
+
+    // Anything else, e.g. "Failed to open file." (550) or "Could not
+    // create file." (553), would fail the same way again
+    return ERROR_PERMANENT;
+}
+
+bool FtpRetryPolicy::shouldRetry(int errorClass, int retries) const
+{
+    return ERROR_TRANSIENT == errorClass && retries < m_maxAttempts;
+}
+
+int FtpRetryPolicy::delayMsecs(int retries)
+{
+    qint64 ceiling = m_baseDelayMsecs;
+
+    for(int i = 0; i < retries && ceiling < m_maxDelayMsecs; i++)
+    {
+        ceiling *= 2;
+    }
+
+    ceiling = qMin<qint64>(ceiling, m_maxDelayMsecs);
+
+    return (int)(ceiling / 2 + nextRandom() % (quint32)(ceiling / 2 + 1));
+}
+
+quint32 FtpRetryPolicy::nextRandom()
+{
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+
+    return m_random;
+}
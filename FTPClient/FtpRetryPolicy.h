@@ -0,0 +1,60 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpRetryPolicy.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Error classification and backoff of transfer retries
+**********************************************************************/
+
+#ifndef FTPRETRYPOLICY_H
+#define FTPRETRYPOLICY_H
+#include <QString>
+
+class FtpRetryPolicy
+{
+public:
+    enum{
+        ERROR_TRANSIENT = 0,    // 4xx, lost connection: worth another attempt
+        ERROR_PERMANENT         // 5xx, local errors: retry would fail the same way
+    };
+
+    enum{
+        RETRY_DEFAULT_ATTEMPTS = 5,
+        RETRY_BASE_DELAY_MSECS = 1000,
+        RETRY_MAX_DELAY_MSECS = 60000,
+        RETRY_FAILOVER_ATTEMPTS = 2     // Failed connects before next mirror is tried
+    };
+
+    FtpRetryPolicy();
+
+    // 0 attempts disables retries
+    void setMaxAttempts(int attempts);
+    int maxAttempts() const;
+    void setDelays(int baseMsecs, int maxMsecs);
+
+    // Class of an FTP reply code, 0 (no reply, connection lost) is transient
+    static int classifyReply(int replyCode);
+
+    // Class of a QFtp::Error. QFtp only gives the text of the server reply
+    // for failed get/put, so its code or wording decides. Text of no known
+    // transient failure is permanent
+    static int classifyError(int ftpError, const QString &errorString);
+
+    // retries is the number of retries already made for the transfer
+    bool shouldRetry(int errorClass, int retries) const;
+
+    // Exponential backoff with jitter: a random delay in the upper half
+    // of min(max, base * 2^retries), so sessions that failed together
+    // do not hit the server together again
+    int delayMsecs(int retries);
+
+private:
+    int m_maxAttempts;
+    int m_baseDelayMsecs;
+    int m_maxDelayMsecs;
+    quint32 m_random;       // xorshift state, qrand() is per thread and unseeded there
+
+    quint32 nextRandom();
+};
+
+#endif // FTPRETRYPOLICY_H
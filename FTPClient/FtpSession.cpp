@@ -0,0 +1,326 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpSession.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Control connection interface shared by plain FTP and FTPS
+**********************************************************************/
+
+#include "FtpSession.h"
+#include "FtpListenerPool.h"
+#include <QRegExp>
+#include <QStringList>
+#include <QDateTime>
+
+namespace
+{
+    bool isPrivateAddress(const QHostAddress &address)
+    {
+        return address.isInSubnet(QHostAddress::parseSubnet("10.0.0.0/8"))
+                || address.isInSubnet(QHostAddress::parseSubnet("172.16.0.0/12"))
+                || address.isInSubnet(QHostAddress::parseSubnet("192.168.0.0/16"))
+                || address.isInSubnet(QHostAddress::parseSubnet("127.0.0.0/8"));
+    }
+
+    // "rwxr-xr-x" to QUrlInfo permission bits
+    int parsePermissions(const QString &text)
+    {
+        static const int bits[9] = {
+            QUrlInfo::ReadOwner, QUrlInfo::WriteOwner, QUrlInfo::ExeOwner,
+            QUrlInfo::ReadGroup, QUrlInfo::WriteGroup, QUrlInfo::ExeGroup,
+            QUrlInfo::ReadOther, QUrlInfo::WriteOther, QUrlInfo::ExeOther
+        };
+        int permissions = 0;
+
+        for(int i = 0; i < 9 && i < text.size(); i++)
+        {
+            if('-' != text.at(i))
+            {
+                permissions |= bits[i];
+            }
+        }
+
+        return permissions;
+    }
+
+    // "Jan 31 12:00" (within the last year) or "Jan 31 2020"
+    QDateTime parseUnixDate(const QString &month, const QString &day, const QString &yearOrTime)
+    {
+        static const char *const months[12] = {
+            "jan", "feb", "mar", "apr", "may", "jun", "jul", "aug", "sep", "oct", "nov", "dec"
+        };
+        QDate today = QDate::currentDate();
+        int monthIndex = 0;
+        int year = today.year();
+        QTime time(0, 0);
+
+        while(monthIndex < 12 && 0 != month.compare(QLatin1String(months[monthIndex]), Qt::CaseInsensitive))
+        {
+            monthIndex++;
+        }
+
+        if(12 == monthIndex)
+        {
+            return QDateTime();
+        }
+
+        if(yearOrTime.contains(':'))
+        {
+            time = QTime::fromString(yearOrTime, "h:mm");
+
+            // Time instead of year means the last 12 months
+            if(QDate(year, monthIndex + 1, 1) > today)
+            {
+                year--;
+            }
+        }
+        else
+        {
+            year = yearOrTime.toInt();
+        }
+
+        return QDateTime(QDate(year, monthIndex + 1, day.toInt()), time);
+    }
+}
+
+
+FtpSession::FtpSession(QObject *parent) :
+    QObject(parent),
+    m_dataMode(DATA_MODE_PASSIVE),
+    m_pListenerPool(NULL)
+{
+}
+
+FtpSession::~FtpSession()
+{
+}
+
+QTcpSocket *FtpSession::openDataSocket(const QHostAddress &address, quint16 port, QObject *parent,
+                                       const char *readyMember)
+{
+    QTcpSocket *socket = new QTcpSocket(parent);
+
+    // Tuned before the SYN, connectToHost() would send it at once
+    m_socketTuning.connectSocket(socket, address, port, parent, readyMember);
+
+    return socket;
+}
+
+QTcpSocket *FtpSession::adoptDataSocket(int descriptor, QObject *parent)
+{
+    QTcpSocket *socket = new QTcpSocket(parent);
+
+    // Receive buffer is the one of the tuned listener
+    socket->setSocketDescriptor(descriptor);
+    m_socketTuning.applyConnected(socket);
+
+    return socket;
+}
+
+QHostAddress FtpSession::localAddress() const
+{
+    return QHostAddress();
+}
+
+qint64 FtpSession::dataSetupMsecs() const
+{
+    return -1;
+}
+
+void FtpSession::setDataMode(int mode)
+{
+    m_dataMode = mode;
+}
+
+int FtpSession::dataMode() const
+{
+    return m_dataMode;
+}
+
+void FtpSession::setListenerPool(FtpListenerPool *pool)
+{
+    m_pListenerPool = pool;
+}
+
+FtpListenerPool *FtpSession::listenerPool() const
+{
+    return m_pListenerPool;
+}
+
+FtpListener *FtpSession::takeListener(const QHostAddress &address, QObject *parent)
+{
+    FtpListener *listener = NULL;
+
+    if(NULL != m_pListenerPool)
+    {
+        listener = m_pListenerPool->take(address);
+    }
+    else
+    {
+        listener = new FtpListener();
+
+        // Port chosen by the system
+        if(!listener->listen(address, 0))
+        {
+            delete listener;
+            listener = NULL;
+        }
+    }
+
+    if(NULL != listener)
+    {
+        listener->setParent(parent);
+
+        // Accepted connections take the buffer sizes of the listening socket
+        m_socketTuning.apply((int)listener->socketDescriptor());
+    }
+
+    return listener;
+}
+
+void FtpSession::setSocketTuning(const FtpSocketTuning &tuning)
+{
+    m_socketTuning = tuning;
+}
+
+const FtpSocketTuning &FtpSession::socketTuning() const
+{
+    return m_socketTuning;
+}
+
+QString FtpSession::securityInfo() const
+{
+    return "";
+}
+
+bool FtpSession::parsePasvReply(const QString &detail, const QHostAddress &controlAddress,
+                                QHostAddress &address, quint16 &port)
+{
+    QRegExp addressRx("(\\d+),(\\d+),(\\d+),(\\d+),(\\d+),(\\d+)");
+
+    if(addressRx.indexIn(detail) < 0)
+    {
+        return false;
+    }
+
+    address.setAddress(QString("%1.%2.%3.%4")
+                       .arg(addressRx.cap(1)).arg(addressRx.cap(2))
+                       .arg(addressRx.cap(3)).arg(addressRx.cap(4)));
+    port = (quint16)((addressRx.cap(5).toUInt() << 8) | addressRx.cap(6).toUInt());
+
+    // Server behind NAT announces its inside address
+    if(!controlAddress.isNull() && (address.isNull() || address == QHostAddress::Any
+            || (isPrivateAddress(address) && !isPrivateAddress(controlAddress))))
+    {
+        address = controlAddress;
+    }
+
+    return 0 != port;
+}
+
+bool FtpSession::parseEpsvReply(const QString &detail, quint16 &port)
+{
+    // Delimiter is usually '|' but any printable character is allowed
+    QRegExp portRx("\\((.)\\1\\1(\\d+)\\1\\)");
+
+    if(portRx.indexIn(detail) < 0)
+    {
+        return false;
+    }
+
+    port = (quint16)portRx.cap(2).toUInt();
+
+    return 0 != port;
+}
+
+QString FtpSession::portCommand(const QHostAddress &address, quint16 port)
+{
+    if(QAbstractSocket::IPv6Protocol == address.protocol())
+    {
+        return QString("EPRT |2|%1|%2|").arg(address.toString()).arg(port);
+    }
+
+    return QString("PORT %1,%2,%3")
+            .arg(address.toString().replace('.', ','))
+            .arg(port >> 8)
+            .arg(port & 0xFF);
+}
+
+QString FtpSession::dataModeName(int mode)
+{
+    switch(mode)
+    {
+    case DATA_MODE_EXTENDED:
+        return "EPSV";
+    case DATA_MODE_ACTIVE:
+        return "active";
+    default:
+        break;
+    }
+
+    return "PASV";
+}
+
+bool FtpSession::parseListLine(const QString &line, QUrlInfo &info)
+{
+    // drwxr-xr-x  2 owner group  4096 Jan 31 12:00 name
+    static const QRegExp unixRx("^([\\-dlbcps])([rwxsStT\\-]{9})\\S*\\s+\\d+\\s+(\\S+)\\s+(\\S+)\\s+(\\d+)\\s+"
+                                "(\\w{3})\\s+(\\d{1,2})\\s+(\\d{1,2}:\\d{2}|\\d{4})\\s(.+)$");
+    // 01-31-20  12:00PM  <DIR>  name
+    static const QRegExp dosRx("^(\\d{2}-\\d{2}-\\d{2,4})\\s+(\\d{1,2}:\\d{2}[AP]M)\\s+(<DIR>|\\d+)\\s+(.+)$");
+    QRegExp rx;
+
+    rx = unixRx;
+    if(rx.exactMatch(line))
+    {
+        QString name = rx.cap(9);
+        QChar type = rx.cap(1).at(0);
+
+        // Link target is not part of the name
+        if('l' == type && name.contains(" -> "))
+        {
+            name = name.left(name.indexOf(" -> "));
+        }
+
+        info.setName(name);
+        info.setDir('d' == type);
+        info.setFile('-' == type);
+        info.setSymLink('l' == type);
+        info.setPermissions(parsePermissions(rx.cap(2)));
+        info.setOwner(rx.cap(3));
+        info.setGroup(rx.cap(4));
+        info.setSize(rx.cap(5).toLongLong());
+        info.setLastModified(parseUnixDate(rx.cap(6), rx.cap(7), rx.cap(8)));
+        info.setReadable(true);
+        info.setWritable(true);
+
+        return "." != name && ".." != name;
+    }
+
+    rx = dosRx;
+    if(rx.exactMatch(line))
+    {
+        QString dateFormat = (10 == rx.cap(1).size()) ? "MM-dd-yyyy" : "MM-dd-yy";
+        QDate date = QDate::fromString(rx.cap(1), dateFormat);
+        bool isDir = ("<DIR>" == rx.cap(3));
+
+        // Two digit years are 19xx in Qt
+        if(date.isValid() && date.year() < 1970)
+        {
+            date = date.addYears(100);
+        }
+
+        info.setName(rx.cap(4));
+        info.setDir(isDir);
+        info.setFile(!isDir);
+        info.setSymLink(false);
+        info.setSize(isDir ? 0 : rx.cap(3).toLongLong());
+        info.setLastModified(QDateTime(date, QTime::fromString(rx.cap(2), "h:mmAP")));
+        info.setReadable(true);
+        info.setWritable(true);
+
+        return "." != info.name() && ".." != info.name();
+    }
+
+    return false;
+}
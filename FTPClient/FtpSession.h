@@ -0,0 +1,124 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpSession.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Control connection interface shared by plain FTP and FTPS
+**********************************************************************/
+
+#ifndef FTPSESSION_H
+#define FTPSESSION_H
+#include <QObject>
+#include <QFtp>
+#include <QUrlInfo>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include "FtpSocketTuning.h"
+
+class FtpListenerPool;
+class FtpListener;
+
+class FtpSession : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        DATA_MODE_PASSIVE = 0,      // PASV
+        DATA_MODE_EXTENDED,         // EPSV, port only, IPv6 and NAT safe
+        DATA_MODE_ACTIVE            // PORT (EPRT on IPv6), server connects to us
+    };
+
+    explicit FtpSession(QObject *parent = 0);
+    virtual ~FtpSession();
+
+    // How the following transfers open data connections, DATA_MODE_*
+    virtual void setDataMode(int mode);
+    int dataMode() const;
+
+    // Listeners for active mode, not owned. NULL opens one per transfer
+    void setListenerPool(FtpListenerPool *pool);
+    FtpListenerPool *listenerPool() const;
+
+    // Listener on address for one active mode connection, from the pool
+    // if there is one. Owned by parent, NULL if listening failed
+    FtpListener *takeListener(const QHostAddress &address, QObject *parent);
+
+    // Buffer sizes and queue depth of the data connections opened from now on
+    void setSocketTuning(const FtpSocketTuning &tuning);
+    const FtpSocketTuning &socketTuning() const;
+
+    // Queued commands, same meaning and return value (command id) as in QFtp
+    virtual int connectToHost(const QString &host, quint16 port = 21) = 0;
+    virtual int login(const QString &user = QString(), const QString &password = QString()) = 0;
+    virtual int close() = 0;
+    virtual int list(const QString &dir = QString()) = 0;
+    virtual int cd(const QString &dir) = 0;
+    virtual int get(const QString &file, QIODevice *dev) = 0;
+    virtual int put(const QByteArray &data, const QString &file) = 0;
+    virtual int put(QIODevice *dev, const QString &file) = 0;
+    virtual int mkdir(const QString &dir) = 0;
+    virtual int rmdir(const QString &dir) = 0;
+    virtual int remove(const QString &file) = 0;
+    virtual int rename(const QString &oldName, const QString &newName) = 0;
+    virtual int rawCommand(const QString &command) = 0;
+
+    virtual int currentId() const = 0;
+    virtual QFtp::Command currentCommand() const = 0;
+    virtual QFtp::State state() const = 0;
+    virtual QFtp::Error error() const = 0;
+    virtual QString errorString() const = 0;
+    virtual void abort() = 0;
+    virtual void clearPendingCommands() = 0;
+
+    // Start a data connection opened by the caller (e.g. FtpDataTransfer),
+    // a QSslSocket when the session protects data. readyMember of parent
+    // is called once it is ready: connected, or encrypted for a QSslSocket
+    virtual QTcpSocket *openDataSocket(const QHostAddress &address, quint16 port, QObject *parent,
+                                       const char *readyMember);
+
+    // Same for a connection the server opened to us in active mode
+    virtual QTcpSocket *adoptDataSocket(int descriptor, QObject *parent);
+
+    // Local end of the control connection, announced by PORT/EPRT.
+    // Null if the session can not tell
+    virtual QHostAddress localAddress() const;
+
+    // From PASV/EPSV/PORT sent to data connection ready, of the last
+    // transfer the session opened itself. -1 if not known
+    virtual qint64 dataSetupMsecs() const;
+
+    // Protocol and cipher of the control connection, empty if not encrypted
+    virtual QString securityInfo() const;
+
+    // "227 Entering Passive Mode (h1,h2,h3,h4,p1,p2)". A private address
+    // announced by a server behind NAT is replaced by controlAddress
+    static bool parsePasvReply(const QString &detail, const QHostAddress &controlAddress,
+                               QHostAddress &address, quint16 &port);
+
+    // "229 Entering Extended Passive Mode (|||port|)"
+    static bool parseEpsvReply(const QString &detail, quint16 &port);
+
+    // "PORT h1,h2,h3,h4,p1,p2" for IPv4, "EPRT |2|address|port|" for IPv6
+    static QString portCommand(const QHostAddress &address, quint16 port);
+
+    static QString dataModeName(int mode);
+
+    // One line of a Unix or DOS style LIST reply
+    static bool parseListLine(const QString &line, QUrlInfo &info);
+
+signals:
+    void stateChanged(int state);
+    void listInfo(const QUrlInfo &info);
+    void commandStarted(int id);
+    void commandFinished(int id, bool error);
+    void done(bool error);
+    void dataTransferProgress(qint64 done, qint64 total);
+    void rawCommandReply(int replyCode, const QString &detail);
+
+protected:
+    int m_dataMode;
+    FtpListenerPool *m_pListenerPool;
+    FtpSocketTuning m_socketTuning;
+};
+
+#endif // FTPSESSION_H
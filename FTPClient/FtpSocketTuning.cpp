@@ -0,0 +1,394 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpSocketTuning.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Socket buffer sizing of data connections from the bandwidth-delay product
+**********************************************************************/
+
+#include "FtpSocketTuning.h"
+#include <QAbstractSocket>
+#include <QSslSocket>
+#include <QFile>
+
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+namespace
+{
+#ifdef Q_OS_LINUX
+    // Last value of a sysctl under /proc/sys, 0 if unknown. The largest
+    // buffer autotuning grows to is the last of tcp_rmem / tcp_wmem
+    int sysctlValue(const char *path)
+    {
+        QFile file(path);
+        QList<QByteArray> values;
+
+        if(!file.open(QIODevice::ReadOnly))
+        {
+            return 0;
+        }
+
+        values = file.readAll().simplified().split(' ');
+
+        return values.last().toInt();
+    }
+#endif
+}
+
+
+FtpSocketTuning::FtpSocketTuning() :
+    m_bandwidth(0),
+    m_roundTripMsecs(-1),
+    m_measuredRoundTripMsecs(-1),
+    m_notSentLowat(0),
+    m_queueDepth(TUNING_DEFAULT_QUEUE_DEPTH)
+{
+}
+
+void FtpSocketTuning::setBandwidth(qint64 bytesPerSec)
+{
+    m_bandwidth = qMax<qint64>(bytesPerSec, 0);
+}
+
+qint64 FtpSocketTuning::bandwidth() const
+{
+    return m_bandwidth;
+}
+
+void FtpSocketTuning::setRoundTripMsecs(int msecs)
+{
+    m_roundTripMsecs = (msecs < 0) ? -1 : msecs;
+}
+
+int FtpSocketTuning::roundTripMsecs() const
+{
+    return (m_roundTripMsecs >= 0) ? m_roundTripMsecs : m_measuredRoundTripMsecs;
+}
+
+void FtpSocketTuning::setMeasuredRoundTripMsecs(int msecs)
+{
+    m_measuredRoundTripMsecs = (msecs < 0) ? -1 : msecs;
+}
+
+void FtpSocketTuning::setNotSentLowat(int bytes)
+{
+    m_notSentLowat = qMax(bytes, 0);
+}
+
+int FtpSocketTuning::notSentLowat() const
+{
+    return m_notSentLowat;
+}
+
+void FtpSocketTuning::setQueueDepth(int chunks)
+{
+    m_queueDepth = qBound(1, chunks, (int)TUNING_MAX_QUEUE_DEPTH);
+}
+
+int FtpSocketTuning::queueDepth() const
+{
+    return m_queueDepth;
+}
+
+int FtpSocketTuning::bufferBytes() const
+{
+    int roundTrip = roundTripMsecs();
+    qint64 product = 0;
+
+    if(m_bandwidth <= 0 || roundTrip <= 0)
+    {
+        return 0;
+    }
+
+    // In flight on a full link: one round trip worth of data
+    product = m_bandwidth * roundTrip / 1000;
+
+    return (int)qBound<qint64>(TUNING_MIN_BUFFER_BYTES, product, TUNING_MAX_BUFFER_BYTES);
+}
+
+bool FtpSocketTuning::isTuned() const
+{
+    return bufferBytes() > 0 || m_notSentLowat > 0;
+}
+
+bool FtpSocketTuning::apply(QAbstractSocket *socket) const
+{
+    return (NULL != socket) && apply((int)socket->socketDescriptor());
+}
+
+bool FtpSocketTuning::apply(int descriptor) const
+{
+    return applyOptions(descriptor, true);
+}
+
+bool FtpSocketTuning::applyConnected(QAbstractSocket *socket) const
+{
+    return (NULL != socket) && applyOptions((int)socket->socketDescriptor(), false);
+}
+
+void FtpSocketTuning::connectSocket(QAbstractSocket *socket, const QHostAddress &address, quint16 port,
+                                    QObject *receiver, const char *connectedMember) const
+{
+    int descriptor = -1;
+    FtpTunedConnect *tunedConnect = NULL;
+
+    // Only one of the two fires
+    if(NULL != receiver && NULL != connectedMember)
+    {
+        QObject::connect(socket, SIGNAL(connected()), receiver, connectedMember);
+    }
+
+    if(isTuned())
+    {
+        descriptor = openConnecting(address, port);
+    }
+
+    if(descriptor < 0)
+    {
+        FtpTunedConnect::connectPlain(socket, address, port);
+        return;
+    }
+
+    tunedConnect = new FtpTunedConnect(socket, descriptor, address, port);
+
+    if(NULL != receiver && NULL != connectedMember)
+    {
+        QObject::connect(tunedConnect, SIGNAL(connected()), receiver, connectedMember);
+    }
+}
+
+bool FtpSocketTuning::applyOptions(int descriptor, bool receiveBuffer) const
+{
+    bool ret = true;
+    int size = bufferBytes();
+    int receiveSize = size;
+    int sendSize = size;
+
+    if(descriptor < 0)
+    {
+        return false;
+    }
+
+#ifdef Q_OS_LINUX
+    // Setting SO_RCVBUF/SO_SNDBUF turns off the autotuning of Linux for the
+    // socket, and the value is capped at net.core.rmem_max / wmem_max
+    // (208 KiB by default). The "tuned" buffer could end up smaller than
+    // what autotuning reaches (tcp_rmem / tcp_wmem, 6 / 4 MiB by default).
+    // So it is only set when the product is beyond autotuning and the
+    // administrator raised the cap above it
+    static const int receiveAuto = sysctlValue("/proc/sys/net/ipv4/tcp_rmem");
+    static const int receiveCap = sysctlValue("/proc/sys/net/core/rmem_max");
+    static const int sendAuto = sysctlValue("/proc/sys/net/ipv4/tcp_wmem");
+    static const int sendCap = sysctlValue("/proc/sys/net/core/wmem_max");
+
+    if(receiveAuto > 0 && (receiveSize <= receiveAuto || receiveCap <= receiveAuto))
+    {
+        receiveSize = 0;
+    }
+    if(sendAuto > 0 && (sendSize <= sendAuto || sendCap <= sendAuto))
+    {
+        sendSize = 0;
+    }
+#endif
+
+    if(receiveBuffer && receiveSize > 0)
+    {
+        ret = (0 == setsockopt(descriptor, SOL_SOCKET, SO_RCVBUF, (const char *)&receiveSize, sizeof(receiveSize))) && ret;
+    }
+    if(sendSize > 0)
+    {
+        ret = (0 == setsockopt(descriptor, SOL_SOCKET, SO_SNDBUF, (const char *)&sendSize, sizeof(sendSize))) && ret;
+    }
+
+#ifdef TCP_NOTSENT_LOWAT
+    if(m_notSentLowat > 0)
+    {
+        int lowat = m_notSentLowat;
+
+        ret = (0 == setsockopt(descriptor, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char *)&lowat, sizeof(lowat))) && ret;
+    }
+#endif
+
+    return ret;
+}
+
+int FtpSocketTuning::openConnecting(const QHostAddress &address, quint16 port) const
+{
+    struct sockaddr_in address4;
+    struct sockaddr_in6 address6;
+    struct sockaddr *target = NULL;
+    int length = 0;
+    int descriptor = -1;
+    int ret = 0;
+
+    memset(&address4, 0, sizeof(address4));
+    memset(&address6, 0, sizeof(address6));
+
+    if(QAbstractSocket::IPv4Protocol == address.protocol())
+    {
+        address4.sin_family = AF_INET;
+        address4.sin_port = htons(port);
+        address4.sin_addr.s_addr = htonl(address.toIPv4Address());
+        target = (struct sockaddr *)&address4;
+        length = sizeof(address4);
+    }
+    else if(QAbstractSocket::IPv6Protocol == address.protocol())
+    {
+        Q_IPV6ADDR bytes = address.toIPv6Address();
+
+        address6.sin6_family = AF_INET6;
+        address6.sin6_port = htons(port);
+        memcpy(&address6.sin6_addr, &bytes, sizeof(bytes));
+        address6.sin6_scope_id = address.scopeId().toUInt();
+        target = (struct sockaddr *)&address6;
+        length = sizeof(address6);
+    }
+    else
+    {
+        return -1;
+    }
+
+    descriptor = (int)::socket(target->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if(descriptor < 0)
+    {
+        return -1;
+    }
+
+    // Before connect(), the SYN announces the window scale
+    apply(descriptor);
+
+#ifdef Q_OS_WIN
+    u_long nonBlocking = 1;
+    ioctlsocket(descriptor, FIONBIO, &nonBlocking);
+
+    ret = ::connect(descriptor, target, length);
+    if(0 != ret && WSAEWOULDBLOCK != WSAGetLastError())
+#else
+    fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+
+    ret = ::connect(descriptor, target, (socklen_t)length);
+    if(0 != ret && EINPROGRESS != errno)
+#endif
+    {
+        FtpTunedConnect::closeDescriptor(descriptor);
+        return -1;
+    }
+
+    return descriptor;
+}
+
+QString FtpSocketTuning::toString() const
+{
+    int size = bufferBytes();
+
+    if(0 == size)
+    {
+        return QString();
+    }
+
+    return QString("%1 KiB buffers (%2 Mbit/s x %3 ms%4)")
+            .arg(size / 1024)
+            .arg(m_bandwidth * 8 / 1000000)
+            .arg(roundTripMsecs())
+            .arg((m_roundTripMsecs >= 0) ? QString() : QString(" measured"));
+}
+
+
+FtpTunedConnect::FtpTunedConnect(QAbstractSocket *socket, int descriptor,
+                                 const QHostAddress &address, quint16 port) :
+    QObject(socket),
+    m_socket(socket),
+    m_descriptor(descriptor),
+    m_address(address),
+    m_port(port),
+    m_writeNotifier(descriptor, QSocketNotifier::Write, this),
+    m_errorNotifier(descriptor, QSocketNotifier::Exception, this)
+{
+    connect(&m_writeNotifier, SIGNAL(activated(int)), this, SLOT(dealConnected()));
+    connect(&m_errorNotifier, SIGNAL(activated(int)), this, SLOT(dealConnected()));
+}
+
+FtpTunedConnect::~FtpTunedConnect()
+{
+    // Socket deleted while still connecting
+    if(m_descriptor >= 0)
+    {
+        m_writeNotifier.setEnabled(false);
+        m_errorNotifier.setEnabled(false);
+        closeDescriptor(m_descriptor);
+    }
+}
+
+void FtpTunedConnect::connectPlain(QAbstractSocket *socket, const QHostAddress &address, quint16 port)
+{
+    QSslSocket *sslSocket = qobject_cast<QSslSocket *>(socket);
+
+    // The peer name to verify is set on the socket, see FtpTlsSession
+    if(NULL != sslSocket)
+    {
+        sslSocket->connectToHostEncrypted(address.toString(), port);
+    }
+    else
+    {
+        socket->connectToHost(address, port);
+    }
+}
+
+void FtpTunedConnect::closeDescriptor(int descriptor)
+{
+#ifdef Q_OS_WIN
+    closesocket(descriptor);
+#else
+    ::close(descriptor);
+#endif
+}
+
+void FtpTunedConnect::dealConnected()
+{
+    int error = 0;
+#ifdef Q_OS_WIN
+    int length = sizeof(error);
+#else
+    socklen_t length = sizeof(error);
+#endif
+    QSslSocket *sslSocket = qobject_cast<QSslSocket *>(m_socket);
+
+    m_writeNotifier.setEnabled(false);
+    m_errorNotifier.setEnabled(false);
+
+    getsockopt(m_descriptor, SOL_SOCKET, SO_ERROR, (char *)&error, &length);
+
+    if(0 != error || !m_socket->setSocketDescriptor(m_descriptor))
+    {
+        // Qt tries again untuned and reports its own error if that fails too
+        closeDescriptor(m_descriptor);
+        m_descriptor = -1;
+        connectPlain(m_socket, m_address, m_port);
+        deleteLater();
+        return;
+    }
+
+    m_descriptor = -1;
+
+    if(NULL != sslSocket)
+    {
+        sslSocket->startClientEncryption();
+    }
+
+    // Emit signal
+    emit connected();
+
+    deleteLater();
+}
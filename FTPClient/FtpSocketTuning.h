@@ -0,0 +1,123 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpSocketTuning.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Socket buffer sizing of data connections from the bandwidth-delay product
+**********************************************************************/
+
+#ifndef FTPSOCKETTUNING_H
+#define FTPSOCKETTUNING_H
+#include <QString>
+#include <QObject>
+#include <QHostAddress>
+#include <QSocketNotifier>
+
+class QAbstractSocket;
+
+class FtpSocketTuning
+{
+public:
+    enum{
+        TUNING_MIN_BUFFER_BYTES = 64 * 1024,
+        TUNING_MAX_BUFFER_BYTES = 32 * 1024 * 1024,
+        TUNING_DEFAULT_QUEUE_DEPTH = 4,     // Chunks read ahead / written behind
+        TUNING_MAX_QUEUE_DEPTH = 256
+    };
+
+    FtpSocketTuning();
+
+    // Link bandwidth in bytes per second, 0 leaves the buffers to the system
+    void setBandwidth(qint64 bytesPerSec);
+    qint64 bandwidth() const;
+
+    // Round trip of the link, -1 uses the measured one
+    void setRoundTripMsecs(int msecs);
+    int roundTripMsecs() const;
+
+    // TCP handshake time of the control connection, taken when no round
+    // trip is configured
+    void setMeasuredRoundTripMsecs(int msecs);
+
+    // TCP_NOTSENT_LOWAT in bytes where the system has it, 0 leaves it.
+    // Keeps unsent data in the application, where it still can be cancelled
+    void setNotSentLowat(int bytes);
+    int notSentLowat() const;
+
+    // Chunks a data connection keeps queued in the application above
+    // the socket buffers, see FtpDataTransfer
+    void setQueueDepth(int chunks);
+    int queueDepth() const;
+
+    // Bandwidth times round trip within TUNING_*_BUFFER_BYTES, 0 if
+    // the bandwidth or round trip is not known
+    int bufferBytes() const;
+
+    // Buffer sizes or TCP_NOTSENT_LOWAT set
+    bool isTuned() const;
+
+    // SO_RCVBUF/SO_SNDBUF and TCP_NOTSENT_LOWAT on the native socket, for
+    // sockets not connected yet and listeners: the receive window scale
+    // is fixed by the SYN. False if there is no descriptor or the system
+    // refused
+    bool apply(QAbstractSocket *socket) const;
+    bool apply(int descriptor) const;
+
+    // Same without SO_RCVBUF, for sockets connected already
+    bool applyConnected(QAbstractSocket *socket) const;
+
+    // Connect socket to address on a native socket tuned before the SYN
+    // goes out. Qt connects by itself when not tuned or the native connect
+    // fails. A QSslSocket starts client encryption once connected.
+    // connectedMember of receiver is called once the TCP connection is up,
+    // whichever way it was made: a socket given the tuned descriptor does
+    // not emit connected() itself
+    void connectSocket(QAbstractSocket *socket, const QHostAddress &address, quint16 port,
+                       QObject *receiver = 0, const char *connectedMember = 0) const;
+
+    // "1831 KiB buffers (100 Mbit/s x 150 ms)", empty if not tuned
+    QString toString() const;
+
+private:
+    qint64 m_bandwidth;
+    int m_roundTripMsecs;
+    int m_measuredRoundTripMsecs;
+    int m_notSentLowat;
+    int m_queueDepth;
+
+    bool applyOptions(int descriptor, bool receiveBuffer) const;
+    int openConnecting(const QHostAddress &address, quint16 port) const;
+};
+
+// Waits for the native connect of FtpSocketTuning::connectSocket and
+// hands the descriptor to the socket. Child of the socket, gone with it
+class FtpTunedConnect : public QObject
+{
+    Q_OBJECT
+public:
+    FtpTunedConnect(QAbstractSocket *socket, int descriptor, const QHostAddress &address, quint16 port);
+    ~FtpTunedConnect();
+
+    // Untuned connect of Qt, the way the socket connects without tuning
+    static void connectPlain(QAbstractSocket *socket, const QHostAddress &address, quint16 port);
+
+    static void closeDescriptor(int descriptor);
+
+signals:
+    // Descriptor handed to the socket. Not emitted when Qt connects
+    // untuned after all, the socket emits connected() then
+    void connected();
+
+private slots:
+    void dealConnected();
+
+private:
+    QAbstractSocket *m_socket;
+    int m_descriptor;
+    QHostAddress m_address;
+    quint16 m_port;
+    QSocketNotifier m_writeNotifier;
+    QSocketNotifier m_errorNotifier;    // Windows reports a refused connect here
+};
+
+#endif // FTPSOCKETTUNING_H
@@ -0,0 +1,341 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTarArchive.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Stream local files as a tar archive on the fly
+**********************************************************************/
+
+#include "FtpTarArchive.h"
+#include <QFileInfo>
+#include <QDateTime>
+#include <string.h>
+
+
+FtpTarArchive::FtpTarArchive(QObject *parent) :
+    QIODevice(parent),
+    m_index(-1),
+    m_pendingPos(0),
+    m_fileRemain(0),
+    m_totalSize(2 * TAR_BLOCK_SIZE), // End of archive is two zero blocks
+    m_readBytes(0)
+{
+}
+
+FtpTarArchive::~FtpTarArchive()
+{
+    close();
+}
+
+void FtpTarArchive::addFile(const QString &localPath, const QString &archivePath)
+{
+    QFileInfo fileInfo(localPath);
+    struct Entry_Info entry;
+
+    entry.localPath = localPath;
+    entry.archivePath = archivePath.toUtf8();
+    entry.size = fileInfo.size();
+    entry.mtime = fileInfo.lastModified().toTime_t();
+
+    m_entries.push_back(entry);
+
+    m_totalSize += headerSize(entry.archivePath) + paddedSize(entry.size);
+}
+
+int FtpTarArchive::fileCount() const
+{
+    return m_entries.size();
+}
+
+qint64 FtpTarArchive::totalSize() const
+{
+    return m_totalSize;
+}
+
+QByteArray FtpTarArchive::manifest() const
+{
+    QByteArray ret;
+
+    for(int i = 0; i < m_entries.size(); i++)
+    {
+        ret.append(QByteArray::number(m_entries.at(i).size));
+        ret.append('\t');
+        ret.append(QByteArray::number(m_entries.at(i).mtime));
+        ret.append('\t');
+        ret.append(m_entries.at(i).archivePath);
+        ret.append('\n');
+    }
+
+    return ret;
+}
+
+QStringList FtpTarArchive::failedFiles() const
+{
+    return m_failedFiles;
+}
+
+bool FtpTarArchive::open(OpenMode mode)
+{
+    if(mode & QIODevice::WriteOnly)
+    {
+        return false;
+    }
+
+    m_index = -1;
+    m_pending.clear();
+    m_pendingPos = 0;
+    m_fileRemain = 0;
+    m_readBytes = 0;
+    m_failedFiles.clear();
+
+    return QIODevice::open(mode);
+}
+
+void FtpTarArchive::close()
+{
+    if(m_file.isOpen())
+    {
+        m_file.close();
+    }
+
+    QIODevice::close();
+}
+
+bool FtpTarArchive::isSequential() const
+{
+    return true;
+}
+
+qint64 FtpTarArchive::bytesAvailable() const
+{
+    return (m_totalSize - m_readBytes) + QIODevice::bytesAvailable();
+}
+
+qint64 FtpTarArchive::readData(char *data, qint64 maxSize)
+{
+    qint64 done = 0;
+
+    while(done < maxSize)
+    {
+        if(m_pendingPos < m_pending.size())
+        {
+            qint64 len = qMin<qint64>(m_pending.size() - m_pendingPos, maxSize - done);
+            memcpy(data + done, m_pending.constData() + m_pendingPos, len);
+
+            m_pendingPos += len;
+            done += len;
+        }
+        else if(m_fileRemain > 0)
+        {
+            qint64 len = qMin(m_fileRemain, maxSize - done);
+            qint64 readLen = m_file.isOpen() ? m_file.read(data + done, len) : -1;
+
+            if(readLen <= 0)
+            {
+                // File shrank or became unreadable after it was added,
+                // keep the announced size so the archive stays consistent
+                if(m_file.isOpen())
+                {
+                    m_failedFiles.append(m_entries.at(m_index).localPath);
+                    m_file.close();
+                }
+
+                memset(data + done, 0, len);
+                readLen = len;
+            }
+
+            m_fileRemain -= readLen;
+            done += readLen;
+
+            if(0 == m_fileRemain)
+            {
+                m_file.close();
+
+                // Pad member content to the block size
+                m_pending.fill('\0', paddedSize(m_entries.at(m_index).size) - m_entries.at(m_index).size);
+                m_pendingPos = 0;
+            }
+        }
+        else if(!nextEntry())
+        {
+            break;
+        }
+    }
+
+    m_readBytes += done;
+
+    if(0 == done && maxSize > 0)
+    {
+        // End of archive
+        return -1;
+    }
+
+    return done;
+}
+
+qint64 FtpTarArchive::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+
+    return -1;
+}
+
+bool FtpTarArchive::nextEntry()
+{
+    bool ret = false;
+
+    m_index++;
+    m_pendingPos = 0;
+
+    if(m_index < m_entries.size())
+    {
+        const struct Entry_Info &entry = m_entries.at(m_index);
+
+        m_pending = buildHeaders(entry);
+        m_fileRemain = entry.size;
+
+        if(m_fileRemain > 0)
+        {
+            m_file.setFileName(entry.localPath);
+            if(!m_file.open(QIODevice::ReadOnly))
+            {
+                m_failedFiles.append(entry.localPath);
+            }
+        }
+
+        ret = true;
+    }
+    else if(m_index == m_entries.size())
+    {
+        m_pending.fill('\0', 2 * TAR_BLOCK_SIZE);
+
+        ret = true;
+    }
+    else
+    {
+        m_pending.clear();
+    }
+
+    return ret;
+}
+
+QByteArray FtpTarArchive::buildHeaders(const struct Entry_Info &entry) const
+{
+    QByteArray ret;
+    QByteArray prefix;
+    QByteArray name;
+
+    if(!splitPath(entry.archivePath, prefix, name))
+    {
+        // Path does not fit ustar fields, use a GNU long name record
+        QByteArray longName = entry.archivePath;
+        longName.append('\0');
+
+        ret.append(buildHeader("././@LongLink", QByteArray(), longName.size(), 0, 'L'));
+        ret.append(longName);
+        ret.append(QByteArray(paddedSize(longName.size()) - longName.size(), '\0'));
+
+        prefix.clear();
+        name = entry.archivePath.left(TAR_NAME_SIZE);
+    }
+
+    ret.append(buildHeader(name, prefix, entry.size, entry.mtime, '0'));
+
+    return ret;
+}
+
+QByteArray FtpTarArchive::buildHeader(const QByteArray &name, const QByteArray &prefix,
+                                      qint64 size, uint mtime, char type) const
+{
+    QByteArray header(TAR_BLOCK_SIZE, '\0');
+    char *p = header.data();
+    uint checksum = 0;
+
+    memcpy(p, name.constData(), qMin(name.size(), (int)TAR_NAME_SIZE));
+    writeOctal(p + 100, 8, 0644);       // mode
+    writeOctal(p + 108, 8, 0);          // uid
+    writeOctal(p + 116, 8, 0);          // gid
+    writeOctal(p + 124, 12, size);      // size
+    writeOctal(p + 136, 12, mtime);     // mtime
+    memset(p + 148, ' ', 8);            // checksum, blank while summing
+    p[156] = type;
+    memcpy(p + 257, "ustar", 6);        // magic
+    memcpy(p + 263, "00", 2);           // version
+    memcpy(p + 345, prefix.constData(), qMin(prefix.size(), (int)TAR_PREFIX_SIZE));
+
+    for(int i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        checksum += (quint8)p[i];
+    }
+
+    writeOctal(p + 148, 7, checksum);
+
+    return header;
+}
+
+qint64 FtpTarArchive::headerSize(const QByteArray &archivePath)
+{
+    QByteArray prefix;
+    QByteArray name;
+
+    if(splitPath(archivePath, prefix, name))
+    {
+        return TAR_BLOCK_SIZE;
+    }
+
+    // Long name record + name data + real header
+    return 2 * TAR_BLOCK_SIZE + paddedSize(archivePath.size() + 1);
+}
+
+qint64 FtpTarArchive::paddedSize(qint64 size)
+{
+    return (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+}
+
+bool FtpTarArchive::splitPath(const QByteArray &path, QByteArray &prefix, QByteArray &name)
+{
+    if(path.size() <= TAR_NAME_SIZE)
+    {
+        prefix.clear();
+        name = path;
+        return true;
+    }
+
+    // Split at the last '/' which keeps prefix within 155 bytes,
+    // any split further left would only make the name longer
+    int pos = path.lastIndexOf('/', TAR_PREFIX_SIZE);
+    if(pos > 0 && pos < path.size() - 1 && path.size() - pos - 1 <= TAR_NAME_SIZE)
+    {
+        prefix = path.left(pos);
+        name = path.mid(pos + 1);
+        return true;
+    }
+
+    return false;
+}
+
+void FtpTarArchive::writeOctal(char *field, int len, qint64 value)
+{
+    // Octal digits followed by NUL, use base-256 when value does not fit
+    qint64 limit = (qint64)1 << (3 * (len - 1));
+
+    if(value < limit)
+    {
+        field[len - 1] = '\0';
+        for(int i = len - 2; i >= 0; i--)
+        {
+            field[i] = '0' + (value & 7);
+            value >>= 3;
+        }
+    }
+    else
+    {
+        for(int i = len - 1; i > 0; i--)
+        {
+            field[i] = (char)(value & 0xFF);
+            value >>= 8;
+        }
+        field[0] = (char)0x80;
+    }
+}
@@ -0,0 +1,88 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTarArchive.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Stream local files as a tar archive on the fly
+**********************************************************************/
+
+#ifndef FTPTARARCHIVE_H
+#define FTPTARARCHIVE_H
+#include <QIODevice>
+#include <QFile>
+#include <QList>
+#include <QStringList>
+
+class FtpTarArchive : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit FtpTarArchive(QObject *parent = 0);
+    ~FtpTarArchive();
+
+    // Add a local file as archive member, archivePath is the relative
+    // path stored in the archive. Must be called before open()
+    void addFile(const QString &localPath, const QString &archivePath);
+
+    int fileCount() const;
+
+    // Archive size in bytes, known before streaming starts
+    qint64 totalSize() const;
+
+    // One line per member: "<size>\t<mtime>\t<path>\n"
+    QByteArray manifest() const;
+
+    // Members which could not be read while streaming (zero filled)
+    QStringList failedFiles() const;
+
+    bool open(OpenMode mode);
+    void close();
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    enum{
+        TAR_BLOCK_SIZE = 512,
+        TAR_NAME_SIZE = 100,
+        TAR_PREFIX_SIZE = 155
+    };
+
+    struct Entry_Info
+    {
+        QString localPath;
+        QByteArray archivePath; // UTF-8
+        qint64 size;
+        uint mtime;
+    };
+
+    QList<struct Entry_Info> m_entries;
+
+    int m_index;            // Member currently being streamed
+    QByteArray m_pending;   // Header/padding bytes not read yet
+    int m_pendingPos;
+    QFile m_file;
+    qint64 m_fileRemain;    // Content bytes of current member not read yet
+
+    qint64 m_totalSize;
+    qint64 m_readBytes;
+
+    QStringList m_failedFiles;
+
+    // Move to next member, return false after the trailer was queued
+    bool nextEntry();
+
+    QByteArray buildHeaders(const struct Entry_Info &entry) const;
+    QByteArray buildHeader(const QByteArray &name, const QByteArray &prefix,
+                           qint64 size, uint mtime, char type) const;
+
+    static qint64 headerSize(const QByteArray &archivePath);
+    static qint64 paddedSize(qint64 size);
+    static bool splitPath(const QByteArray &path, QByteArray &prefix, QByteArray &name);
+    static void writeOctal(char *field, int len, qint64 value);
+};
+
+#endif // FTPTARARCHIVE_H
@@ -0,0 +1,1142 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTlsSession.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Explicit FTPS session (AUTH TLS, PROT P) on QSslSocket
+**********************************************************************/
+
+#include "FtpTlsSession.h"
+#include "FtpListenerPool.h"
+#include <QSslConfiguration>
+#include <QStringList>
+#include <QRegExp>
+#include <QAtomicInt>
+
+namespace
+{
+    QAtomicInt s_nextCommandId(0);
+}
+
+
+FtpTlsSession::FtpTlsSession(const QString &peerName, bool verifyPeer, QObject *parent) :
+    FtpSession(parent),
+    m_peerName(peerName),
+    m_verifyPeer(verifyPeer),
+    m_ciphers(preferredCiphers()),
+    m_pControl(NULL),
+    m_pData(NULL),
+    m_pListener(NULL),
+    m_pBuffer(NULL),
+    m_timeoutTimer(this),
+    m_step(STEP_NONE),
+    m_state(QFtp::Unconnected),
+    m_error(QFtp::NoError),
+    m_replyCode(0),
+    m_dataReady(false),
+    m_transferStarted(false),
+    m_controlDone(false),
+    m_dataDone(false),
+    m_transferredBytes(0),
+    m_totalBytes(-1),
+    m_controlHandshakeMsecs(0),
+    m_dataHandshakeMsecs(-1),
+    m_transferDataMode(DATA_MODE_PASSIVE),
+    m_dataSetupMsecs(-1)
+{
+    m_timeoutTimer.setSingleShot(true);
+    m_timeoutTimer.setInterval(TLS_TIMEOUT_MSECS);
+    connect(&m_timeoutTimer, SIGNAL(timeout()), this, SLOT(dealTimeout()));
+}
+
+FtpTlsSession::~FtpTlsSession()
+{
+    closeData();
+
+    if(NULL != m_pControl)
+    {
+        m_pControl->disconnect(this);
+        m_pControl->abort();
+    }
+}
+
+int FtpTlsSession::connectToHost(const QString &host, quint16 port)
+{
+    Command command;
+
+    command.type = QFtp::ConnectToHost;
+    command.arg = host;
+    command.arg2 = QString::number(port);
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::login(const QString &user, const QString &password)
+{
+    Command command;
+
+    // Same default as QFtp
+    command.type = QFtp::Login;
+    command.arg = user.isEmpty() ? QString("anonymous") : user;
+    command.arg2 = user.isEmpty() ? QString("anonymous@") : password;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::close()
+{
+    Command command;
+
+    command.type = QFtp::Close;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::list(const QString &dir)
+{
+    Command command;
+
+    command.type = QFtp::List;
+    command.arg = dir;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::cd(const QString &dir)
+{
+    Command command;
+
+    command.type = QFtp::Cd;
+    command.arg = dir;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::get(const QString &file, QIODevice *dev)
+{
+    Command command;
+
+    command.type = QFtp::Get;
+    command.arg = file;
+    command.device = dev;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::put(const QByteArray &data, const QString &file)
+{
+    Command command;
+
+    command.type = QFtp::Put;
+    command.arg = file;
+    command.data = data;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::put(QIODevice *dev, const QString &file)
+{
+    Command command;
+
+    command.type = QFtp::Put;
+    command.arg = file;
+    command.device = dev;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::mkdir(const QString &dir)
+{
+    Command command;
+
+    command.type = QFtp::Mkdir;
+    command.arg = dir;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::rmdir(const QString &dir)
+{
+    Command command;
+
+    command.type = QFtp::Rmdir;
+    command.arg = dir;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::remove(const QString &file)
+{
+    Command command;
+
+    command.type = QFtp::Remove;
+    command.arg = file;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::rename(const QString &oldName, const QString &newName)
+{
+    Command command;
+
+    command.type = QFtp::Rename;
+    command.arg = oldName;
+    command.arg2 = newName;
+
+    return addCommand(command);
+}
+
+int FtpTlsSession::rawCommand(const QString &command)
+{
+    Command rawCommand;
+
+    rawCommand.type = QFtp::RawCommand;
+    rawCommand.arg = command;
+
+    return addCommand(rawCommand);
+}
+
+int FtpTlsSession::currentId() const
+{
+    return m_current.id;
+}
+
+QFtp::Command FtpTlsSession::currentCommand() const
+{
+    return m_current.type;
+}
+
+QFtp::State FtpTlsSession::state() const
+{
+    return m_state;
+}
+
+QFtp::Error FtpTlsSession::error() const
+{
+    return m_error;
+}
+
+QString FtpTlsSession::errorString() const
+{
+    return m_errorString;
+}
+
+void FtpTlsSession::abort()
+{
+    m_pending.clear();
+
+    if(STEP_NONE == m_step)
+    {
+        return;
+    }
+
+    // Server answers 426 and 226, both arrive after the command is gone
+    if(NULL != m_pData && NULL != m_pControl && m_pControl->isEncrypted())
+    {
+        m_pControl->write("ABOR\r\n");
+    }
+
+    fail(QFtp::UnknownError, tr("Aborted"));
+}
+
+void FtpTlsSession::clearPendingCommands()
+{
+    m_pending.clear();
+}
+
+QTcpSocket *FtpTlsSession::openDataSocket(const QHostAddress &address, quint16 port, QObject *parent,
+                                          const char *readyMember)
+{
+    QSslSocket *socket = new QSslSocket(parent);
+
+    configureSocket(socket, true);
+
+    if(NULL != readyMember)
+    {
+        connect(socket, SIGNAL(encrypted()), parent, readyMember);
+    }
+
+    // TLS starts right away, servers wait for it after the 150 reply.
+    // The native socket is tuned before the SYN
+    m_socketTuning.connectSocket(socket, address, port);
+
+    return socket;
+}
+
+QTcpSocket *FtpTlsSession::adoptDataSocket(int descriptor, QObject *parent)
+{
+    QSslSocket *socket = new QSslSocket(parent);
+
+    configureSocket(socket, true);
+
+    // Still the TLS client, whoever opened the connection
+    socket->setSocketDescriptor(descriptor);
+    m_socketTuning.applyConnected(socket);
+    socket->startClientEncryption();
+
+    return socket;
+}
+
+QHostAddress FtpTlsSession::localAddress() const
+{
+    return (NULL == m_pControl) ? QHostAddress() : m_pControl->localAddress();
+}
+
+qint64 FtpTlsSession::dataSetupMsecs() const
+{
+    return m_dataSetupMsecs;
+}
+
+QString FtpTlsSession::securityInfo() const
+{
+    QString info;
+
+    if(NULL == m_pControl || !m_pControl->isEncrypted())
+    {
+        return info;
+    }
+
+    info = tr("%1, %2 bits, handshake %3 ms")
+            .arg(m_pControl->sessionCipher().name())
+            .arg(m_pControl->sessionCipher().usedBits())
+            .arg(m_controlHandshakeMsecs);
+
+    if(m_dataHandshakeMsecs >= 0)
+    {
+        info.append(tr(", data connection %1 ms").arg(m_dataHandshakeMsecs));
+    }
+
+    return info;
+}
+
+QList<QSslCipher> FtpTlsSession::preferredCiphers()
+{
+    QList<QSslCipher> supported = QSslSocket::supportedCiphers();
+    QList<QSslCipher> gcm;
+    QList<QSslCipher> aes;
+    QList<QSslCipher> others;
+
+    for(int i = 0; i < supported.size(); i++)
+    {
+        const QSslCipher &cipher = supported.at(i);
+        QString name = cipher.name().toUpper();
+
+        if(cipher.usedBits() < 128 || name.contains("NULL") || name.contains("EXP")
+                || name.contains("RC4") || name.contains("DES-CBC-") || name.contains("ADH")
+                || name.contains("AECDH") || name.contains("MD5"))
+        {
+            continue;
+        }
+
+        // Forward secrecy first within each group
+        bool ephemeral = name.startsWith("ECDHE") || name.startsWith("DHE");
+
+        if(name.contains("GCM"))
+        {
+            if(ephemeral)
+            {
+                gcm.prepend(cipher);
+            }
+            else
+            {
+                gcm.append(cipher);
+            }
+        }
+        else if(name.contains("AES"))
+        {
+            if(ephemeral)
+            {
+                aes.prepend(cipher);
+            }
+            else
+            {
+                aes.append(cipher);
+            }
+        }
+        else
+        {
+            others.append(cipher);
+        }
+    }
+
+    return gcm + aes + others;
+}
+
+void FtpTlsSession::startNextCommand()
+{
+    if(QFtp::None != m_current.type || m_pending.isEmpty())
+    {
+        return;
+    }
+
+    m_current = m_pending.takeFirst();
+
+    // Emit signal
+    emit commandStarted(m_current.id);
+
+    if(QFtp::ConnectToHost == m_current.type)
+    {
+        closeData();
+
+        if(NULL != m_pControl)
+        {
+            m_pControl->disconnect(this);
+            m_pControl->abort();
+            m_pControl->deleteLater();
+        }
+
+        m_pControl = new QSslSocket(this);
+        configureSocket(m_pControl, false);
+        connect(m_pControl, SIGNAL(encrypted()), this, SLOT(dealControlEncrypted()));
+        connect(m_pControl, SIGNAL(readyRead()), this, SLOT(dealControlReadyRead()));
+        connect(m_pControl, SIGNAL(disconnected()), this, SLOT(dealControlDisconnected()));
+        connect(m_pControl, SIGNAL(error(QAbstractSocket::SocketError)),
+                this, SLOT(dealControlError(QAbstractSocket::SocketError)));
+
+        m_replyCode = 0;
+        m_sslErrors.clear();
+
+        m_step = STEP_GREETING;
+        m_timeoutTimer.start();
+        setState(QFtp::Connecting);
+
+        // Plain until AUTH TLS was accepted
+        m_pControl->connectToHost(m_current.arg, m_current.arg2.toUShort());
+        return;
+    }
+
+    if(NULL == m_pControl || !m_pControl->isEncrypted())
+    {
+        if(QFtp::Close == m_current.type)
+        {
+            finishCommand(false);
+            return;
+        }
+
+        fail(QFtp::NotConnected, tr("Not connected"));
+        return;
+    }
+
+    switch(m_current.type)
+    {
+    case QFtp::Login:
+        sendCommand("USER " + m_current.arg, STEP_USER);
+        break;
+    case QFtp::Close:
+        sendCommand("QUIT", STEP_SIMPLE);
+        break;
+    case QFtp::Cd:
+        sendCommand("CWD " + m_current.arg, STEP_SIMPLE);
+        break;
+    case QFtp::Mkdir:
+        sendCommand("MKD " + m_current.arg, STEP_SIMPLE);
+        break;
+    case QFtp::Rmdir:
+        sendCommand("RMD " + m_current.arg, STEP_SIMPLE);
+        break;
+    case QFtp::Remove:
+        sendCommand("DELE " + m_current.arg, STEP_SIMPLE);
+        break;
+    case QFtp::Rename:
+        sendCommand("RNFR " + m_current.arg, STEP_RNFR);
+        break;
+    case QFtp::RawCommand:
+        sendCommand(m_current.arg, STEP_SIMPLE);
+        break;
+    case QFtp::List:
+        sendCommand("TYPE A", STEP_TYPE);
+        break;
+    case QFtp::Get:
+    case QFtp::Put:
+        sendCommand("TYPE I", STEP_TYPE);
+        break;
+    default:
+        fail(QFtp::UnknownError, tr("Unsupported command"));
+        break;
+    }
+}
+
+void FtpTlsSession::dealControlEncrypted()
+{
+    m_controlHandshakeMsecs = m_handshakeTimer.elapsed();
+
+    if(STEP_HANDSHAKE == m_step)
+    {
+        setState(QFtp::Connected);
+        finishCommand(false);
+    }
+}
+
+void FtpTlsSession::dealControlReadyRead()
+{
+    static const QRegExp codeRx("^([1-5]\\d\\d)([ -]|$)");
+
+    while(m_pControl->canReadLine())
+    {
+        QString line = QString::fromLatin1(m_pControl->readLine());
+        QRegExp rx = codeRx;
+
+        line.remove('\r').remove('\n');
+
+        if(0 == m_replyCode)
+        {
+            if(rx.indexIn(line) < 0)
+            {
+                continue;
+            }
+
+            if("-" == rx.cap(2))
+            {
+                // First line of a multi-line reply
+                m_replyCode = rx.cap(1).toInt();
+                m_replyText = line.mid(4);
+                continue;
+            }
+
+            processReply(rx.cap(1).toInt(), line.mid(4));
+        }
+        else if(line.startsWith(QString::number(m_replyCode) + " "))
+        {
+            int replyCode = m_replyCode;
+
+            m_replyCode = 0;
+            processReply(replyCode, m_replyText + "\n" + line.mid(4));
+        }
+        else
+        {
+            m_replyText.append("\n").append(line);
+        }
+
+        // A reply may have ended the session
+        if(NULL == m_pControl)
+        {
+            return;
+        }
+    }
+}
+
+void FtpTlsSession::dealControlDisconnected()
+{
+    setState(QFtp::Unconnected);
+
+    if(QFtp::None != m_current.type && STEP_NONE != m_step)
+    {
+        fail(QFtp::UnknownError, tr("Connection closed"));
+    }
+}
+
+void FtpTlsSession::dealControlError(QAbstractSocket::SocketError socketError)
+{
+    QFtp::Error error = QFtp::UnknownError;
+    QString text = m_pControl->errorString();
+
+    // disconnected() follows
+    if(QAbstractSocket::RemoteHostClosedError == socketError)
+    {
+        return;
+    }
+
+    if(QAbstractSocket::HostNotFoundError == socketError)
+    {
+        error = QFtp::HostNotFound;
+    }
+    else if(QAbstractSocket::ConnectionRefusedError == socketError)
+    {
+        error = QFtp::ConnectionRefused;
+    }
+
+    for(int i = 0; i < m_sslErrors.size(); i++)
+    {
+        text.append("; ").append(m_sslErrors.at(i).errorString());
+    }
+
+    if(QFtp::None != m_current.type && STEP_NONE != m_step)
+    {
+        fail(error, text);
+    }
+
+    setState(QFtp::Unconnected);
+}
+
+void FtpTlsSession::dealSslErrors(const QList<QSslError> &errors)
+{
+    QSslSocket *socket = qobject_cast<QSslSocket *>(sender());
+
+    if(NULL == socket)
+    {
+        return;
+    }
+
+    if(!m_verifyPeer)
+    {
+        socket->ignoreSslErrors();
+        return;
+    }
+
+    // Handshake fails next, tell why
+    m_sslErrors = errors;
+}
+
+void FtpTlsSession::dealDataAccepted(int descriptor)
+{
+    m_pListener->disconnect(this);
+    m_pListener->deleteLater();
+    m_pListener = NULL;
+
+    m_handshakeTimer.start();
+    attachData(static_cast<QSslSocket *>(adoptDataSocket(descriptor, this)));
+}
+
+void FtpTlsSession::dealDataEncrypted()
+{
+    m_dataHandshakeMsecs = m_handshakeTimer.elapsed();
+    m_dataSetupMsecs = m_setupTimer.elapsed();
+    m_dataReady = true;
+    m_timeoutTimer.start();
+
+    // Send side of a socket Qt had to connect untuned
+    m_socketTuning.applyConnected(m_pData);
+
+    writeChunk();
+}
+
+void FtpTlsSession::dealDataReadyRead()
+{
+    QByteArray data = m_pData->readAll();
+
+    if(data.isEmpty())
+    {
+        return;
+    }
+
+    m_timeoutTimer.start();
+
+    if(QFtp::List == m_current.type)
+    {
+        m_listData.append(data);
+        return;
+    }
+
+    if(QFtp::Get != m_current.type)
+    {
+        return;
+    }
+
+    if(m_current.device->write(data) != data.size())
+    {
+        fail(QFtp::UnknownError, m_current.device->errorString());
+        return;
+    }
+
+    m_transferredBytes += data.size();
+
+    // Emit signal
+    emit dataTransferProgress(m_transferredBytes, m_totalBytes);
+}
+
+void FtpTlsSession::dealDataBytesWritten()
+{
+    if(QFtp::Put != m_current.type)
+    {
+        return;
+    }
+
+    m_timeoutTimer.start();
+
+    // Emit signal
+    emit dataTransferProgress(m_transferredBytes - m_pData->bytesToWrite(), m_totalBytes);
+
+    writeChunk();
+}
+
+void FtpTlsSession::dealDataDisconnected()
+{
+    if(NULL == m_pData)
+    {
+        return;
+    }
+
+    // Server closed first, take what is still buffered
+    if(m_pData->bytesAvailable() > 0)
+    {
+        dealDataReadyRead();
+    }
+
+    m_dataDone = true;
+    checkTransferDone();
+}
+
+void FtpTlsSession::dealDataError(QAbstractSocket::SocketError socketError)
+{
+    QString text;
+
+    // End of a download or listing, disconnected() follows
+    if(QAbstractSocket::RemoteHostClosedError == socketError && QFtp::Put != m_current.type)
+    {
+        return;
+    }
+
+    text = m_pData->errorString();
+    for(int i = 0; i < m_sslErrors.size(); i++)
+    {
+        text.append("; ").append(m_sslErrors.at(i).errorString());
+    }
+
+    fail(QFtp::UnknownError, text);
+}
+
+void FtpTlsSession::dealTimeout()
+{
+    if(STEP_NONE != m_step)
+    {
+        fail(QFtp::UnknownError, tr("Server did not answer in %1 s").arg(TLS_TIMEOUT_MSECS / 1000));
+    }
+}
+
+int FtpTlsSession::addCommand(const Command &command)
+{
+    Command queued = command;
+
+    // Unique over all sessions as QFtp ids are, callers key on them
+    queued.id = s_nextCommandId.fetchAndAddRelaxed(1) + 1;
+    m_pending.append(queued);
+
+    // Like QFtp, commands start from the event loop
+    QTimer::singleShot(0, this, SLOT(startNextCommand()));
+
+    return queued.id;
+}
+
+void FtpTlsSession::sendCommand(const QString &command, int step)
+{
+    m_step = step;
+    m_timeoutTimer.start();
+
+    // Names keep their bytes as QFtp does
+    m_pControl->write(command.toLatin1() + "\r\n");
+}
+
+void FtpTlsSession::processReply(int replyCode, const QString &text)
+{
+    QHostAddress address;
+    quint16 port = 0;
+
+    m_timeoutTimer.start();
+
+    switch(m_step)
+    {
+    case STEP_GREETING:
+        // 120 "ready in n minutes"
+        if(replyCode < 200)
+        {
+            break;
+        }
+
+        if(220 != replyCode)
+        {
+            fail(QFtp::ConnectionRefused, text);
+            break;
+        }
+
+        sendCommand("AUTH TLS", STEP_AUTH);
+        break;
+
+    case STEP_AUTH:
+        // Never fall back to cleartext
+        if(234 != replyCode && 334 != replyCode)
+        {
+            fail(QFtp::UnknownError, tr("Server refused AUTH TLS: %1").arg(text));
+            break;
+        }
+
+        m_step = STEP_HANDSHAKE;
+        m_handshakeTimer.start();
+        m_pControl->startClientEncryption();
+        break;
+
+    case STEP_USER:
+        if(331 == replyCode)
+        {
+            sendCommand("PASS " + m_current.arg2, STEP_PASS);
+        }
+        else if(230 == replyCode)
+        {
+            sendCommand("PBSZ 0", STEP_PBSZ);
+        }
+        else
+        {
+            fail(QFtp::UnknownError, text);
+        }
+        break;
+
+    case STEP_PASS:
+        if(230 == replyCode || 202 == replyCode)
+        {
+            sendCommand("PBSZ 0", STEP_PBSZ);
+        }
+        else
+        {
+            fail(QFtp::UnknownError, text);
+        }
+        break;
+
+    case STEP_PBSZ:
+        if(replyCode >= 300)
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        sendCommand("PROT P", STEP_PROT);
+        break;
+
+    case STEP_PROT:
+        // Data in cleartext is not what the user asked for
+        if(replyCode >= 300)
+        {
+            fail(QFtp::UnknownError, tr("Server refused PROT P: %1").arg(text));
+            break;
+        }
+
+        setState(QFtp::LoggedIn);
+        finishCommand(false);
+        break;
+
+    case STEP_SIMPLE:
+        if(QFtp::RawCommand == m_current.type)
+        {
+            // Emit signal
+            emit rawCommandReply(replyCode, text);
+        }
+
+        // Preliminary, e.g. a raw RETR whose data runs on another socket
+        if(replyCode < 200)
+        {
+            m_timeoutTimer.stop();
+            break;
+        }
+
+        if(replyCode >= 400)
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        if(QFtp::Close == m_current.type)
+        {
+            setState(QFtp::Closing);
+            m_pControl->disconnectFromHost();
+        }
+
+        finishCommand(false);
+        break;
+
+    case STEP_RNFR:
+        if(350 != replyCode)
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        sendCommand("RNTO " + m_current.arg2, STEP_SIMPLE);
+        break;
+
+    case STEP_TYPE:
+        if(replyCode >= 400)
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        // A mode change applies from the next transfer on
+        m_transferDataMode = m_dataMode;
+        m_dataSetupMsecs = -1;
+        m_setupTimer.start();
+
+        if(DATA_MODE_ACTIVE == m_transferDataMode)
+        {
+            m_pListener = takeListener(localAddress(), this);
+            if(NULL == m_pListener)
+            {
+                fail(QFtp::UnknownError, tr("Unable to listen for the active mode data connection"));
+                break;
+            }
+
+            connect(m_pListener, SIGNAL(accepted(int)), this, SLOT(dealDataAccepted(int)));
+            sendCommand(portCommand(m_pListener->serverAddress(), m_pListener->serverPort()), STEP_PORT);
+        }
+        else
+        {
+            sendCommand(DATA_MODE_EXTENDED == m_transferDataMode ? "EPSV" : "PASV", STEP_PASV);
+        }
+        break;
+
+    case STEP_PASV:
+        if(DATA_MODE_EXTENDED == m_transferDataMode)
+        {
+            // Same host as the control connection, only the port is sent
+            address = m_pControl->peerAddress();
+
+            if(229 != replyCode || !parseEpsvReply(text, port))
+            {
+                fail(QFtp::UnknownError, text);
+                break;
+            }
+        }
+        else if(227 != replyCode || !parsePasvReply(text, m_pControl->peerAddress(), address, port))
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        prepareTransfer();
+
+        m_handshakeTimer.start();
+        // attachData waits for encrypted(), as for an accepted connection
+        attachData(static_cast<QSslSocket *>(openDataSocket(address, port, this, NULL)));
+
+        sendTransferCommand();
+        break;
+
+    case STEP_PORT:
+        if(200 != replyCode)
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        // Server connects after the transfer command, see dealDataAccepted
+        prepareTransfer();
+        sendTransferCommand();
+        break;
+
+    case STEP_TRANSFER:
+        if(replyCode < 200)
+        {
+            // "150 Opening BINARY mode data connection for name (1234 bytes)"
+            QRegExp sizeRx("\\((\\d+) bytes\\)");
+
+            if(QFtp::Get == m_current.type && sizeRx.indexIn(text) >= 0)
+            {
+                m_totalBytes = sizeRx.cap(1).toLongLong();
+            }
+
+            m_transferStarted = true;
+            writeChunk();
+            break;
+        }
+
+        if(replyCode >= 400)
+        {
+            fail(QFtp::UnknownError, text);
+            break;
+        }
+
+        m_controlDone = true;
+        checkTransferDone();
+        break;
+
+    default:
+        // Unrequested, e.g. the 426/226 after ABOR
+        break;
+    }
+}
+
+void FtpTlsSession::finishCommand(bool error)
+{
+    int commandId = m_current.id;
+
+    m_timeoutTimer.stop();
+    m_step = STEP_NONE;
+    closeData();
+
+    // currentCommand() is still valid while the signal is handled
+    emit commandFinished(commandId, error);
+
+    m_current = Command();
+
+    if(m_pending.isEmpty())
+    {
+        // Emit signal
+        emit done(error);
+    }
+    else
+    {
+        QTimer::singleShot(0, this, SLOT(startNextCommand()));
+    }
+}
+
+void FtpTlsSession::fail(QFtp::Error error, const QString &text)
+{
+    m_error = error;
+    m_errorString = text;
+
+    // As QFtp, an error drops the commands queued behind
+    m_pending.clear();
+
+    finishCommand(true);
+}
+
+void FtpTlsSession::setState(QFtp::State state)
+{
+    if(state == m_state)
+    {
+        return;
+    }
+
+    m_state = state;
+
+    // Emit signal
+    emit stateChanged(state);
+}
+
+void FtpTlsSession::configureSocket(QSslSocket *socket, bool dataConnection)
+{
+    QSslConfiguration config = socket->sslConfiguration();
+
+#if QT_VERSION >= 0x050400
+    // Data connections resume the session of the control connection, an
+    // abbreviated handshake (and required by servers with require_ssl_reuse)
+    if(dataConnection && NULL != m_pControl && m_pControl->isEncrypted())
+    {
+        config = m_pControl->sslConfiguration();
+    }
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+#else
+    Q_UNUSED(dataConnection);
+#endif
+
+    config.setCiphers(m_ciphers);
+    config.setPeerVerifyMode(m_verifyPeer ? QSslSocket::VerifyPeer : QSslSocket::VerifyNone);
+
+    socket->setSslConfiguration(config);
+    socket->setPeerVerifyName(m_peerName);
+
+    connect(socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(dealSslErrors(QList<QSslError>)));
+}
+
+void FtpTlsSession::prepareTransfer()
+{
+    m_dataReady = false;
+    m_transferStarted = false;
+    m_controlDone = false;
+    m_dataDone = false;
+    m_listData.clear();
+    m_transferredBytes = 0;
+    m_totalBytes = -1;
+
+    if(QFtp::Put == m_current.type)
+    {
+        if(NULL == m_current.device)
+        {
+            m_pBuffer = new QBuffer(&m_current.data, this);
+            m_pBuffer->open(QIODevice::ReadOnly);
+            m_current.device = m_pBuffer;
+        }
+
+        m_totalBytes = m_current.device->isSequential() ? -1 : m_current.device->size();
+    }
+}
+
+void FtpTlsSession::attachData(QSslSocket *socket)
+{
+    m_pData = socket;
+    connect(m_pData, SIGNAL(encrypted()), this, SLOT(dealDataEncrypted()));
+    connect(m_pData, SIGNAL(readyRead()), this, SLOT(dealDataReadyRead()));
+    connect(m_pData, SIGNAL(bytesWritten(qint64)), this, SLOT(dealDataBytesWritten()));
+    connect(m_pData, SIGNAL(disconnected()), this, SLOT(dealDataDisconnected()));
+    connect(m_pData, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(dealDataError(QAbstractSocket::SocketError)));
+}
+
+void FtpTlsSession::sendTransferCommand()
+{
+    if(QFtp::List == m_current.type)
+    {
+        sendCommand(m_current.arg.isEmpty() ? QString("LIST") : "LIST " + m_current.arg, STEP_TRANSFER);
+    }
+    else
+    {
+        sendCommand((QFtp::Get == m_current.type ? "RETR " : "STOR ") + m_current.arg, STEP_TRANSFER);
+    }
+}
+
+void FtpTlsSession::writeChunk()
+{
+    QIODevice *device = m_current.device;
+
+    if(QFtp::Put != m_current.type || !m_transferStarted || !m_dataReady || NULL == m_pData
+            || QAbstractSocket::ConnectedState != m_pData->state())
+    {
+        return;
+    }
+
+    while(m_pData->bytesToWrite() < TLS_DATA_CHUNK_SIZE * m_socketTuning.queueDepth())
+    {
+        QByteArray data(TLS_DATA_CHUNK_SIZE, Qt::Uninitialized);
+        qint64 len = device->read(data.data(), data.size());
+
+        // Wrapping devices signal their end with -1
+        if(len <= 0)
+        {
+            // Closing the data connection marks the end of the file
+            m_pData->disconnectFromHost();
+            return;
+        }
+
+        m_pData->write(data.constData(), len);
+        m_transferredBytes += len;
+    }
+}
+
+void FtpTlsSession::checkTransferDone()
+{
+    if(!m_controlDone || !m_dataDone)
+    {
+        return;
+    }
+
+    if(QFtp::List == m_current.type)
+    {
+        QStringList lines = QString::fromLatin1(m_listData).split(QRegExp("\\r?\\n"), QString::SkipEmptyParts);
+
+        for(int i = 0; i < lines.size(); i++)
+        {
+            QUrlInfo info;
+
+            if(parseListLine(lines.at(i), info))
+            {
+                // Emit signal
+                emit listInfo(info);
+            }
+        }
+    }
+
+    finishCommand(false);
+}
+
+void FtpTlsSession::closeData()
+{
+    if(NULL != m_pListener)
+    {
+        m_pListener->disconnect(this);
+        m_pListener->deleteLater();
+        m_pListener = NULL;
+    }
+
+    if(NULL != m_pData)
+    {
+        m_pData->disconnect(this);
+        m_pData->abort();
+        m_pData->deleteLater();
+        m_pData = NULL;
+    }
+
+    if(NULL != m_pBuffer)
+    {
+        m_pBuffer->deleteLater();
+        m_pBuffer = NULL;
+    }
+
+    m_dataReady = false;
+}
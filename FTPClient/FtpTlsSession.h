@@ -0,0 +1,164 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTlsSession.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Explicit FTPS session (AUTH TLS, PROT P) on QSslSocket
+**********************************************************************/
+
+#ifndef FTPTLSSESSION_H
+#define FTPTLSSESSION_H
+#include "FtpSession.h"
+#include <QSslSocket>
+#include <QSslCipher>
+#include <QSslError>
+#include <QBuffer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+
+class FtpTlsSession : public FtpSession
+{
+    Q_OBJECT
+public:
+    enum{
+        TLS_DATA_CHUNK_SIZE = 64 * 1024,
+        TLS_TIMEOUT_MSECS = 30000       // No reply or data for this long fails the command
+    };
+
+    // peerName is checked against the server certificate unless verifyPeer
+    // is false (self-signed certificates of many FTP servers)
+    explicit FtpTlsSession(const QString &peerName, bool verifyPeer = true, QObject *parent = 0);
+    ~FtpTlsSession();
+
+    int connectToHost(const QString &host, quint16 port = 21);
+    int login(const QString &user = QString(), const QString &password = QString());
+    int close();
+    int list(const QString &dir = QString());
+    int cd(const QString &dir);
+    int get(const QString &file, QIODevice *dev);
+    int put(const QByteArray &data, const QString &file);
+    int put(QIODevice *dev, const QString &file);
+    int mkdir(const QString &dir);
+    int rmdir(const QString &dir);
+    int remove(const QString &file);
+    int rename(const QString &oldName, const QString &newName);
+    int rawCommand(const QString &command);
+
+    int currentId() const;
+    QFtp::Command currentCommand() const;
+    QFtp::State state() const;
+    QFtp::Error error() const;
+    QString errorString() const;
+    void abort();
+    void clearPendingCommands();
+
+    QTcpSocket *openDataSocket(const QHostAddress &address, quint16 port, QObject *parent,
+                               const char *readyMember);
+    QTcpSocket *adoptDataSocket(int descriptor, QObject *parent);
+    QHostAddress localAddress() const;
+    qint64 dataSetupMsecs() const;
+    QString securityInfo() const;
+
+    // Ciphers of the linked OpenSSL, AES-GCM first (AES-NI and carry-less
+    // multiply on current CPUs), then other AES, weak suites dropped
+    static QList<QSslCipher> preferredCiphers();
+
+private slots:
+    void startNextCommand();
+    void dealControlEncrypted();
+    void dealControlReadyRead();
+    void dealControlDisconnected();
+    void dealControlError(QAbstractSocket::SocketError socketError);
+    void dealSslErrors(const QList<QSslError> &errors);
+    void dealDataAccepted(int descriptor);
+    void dealDataEncrypted();
+    void dealDataReadyRead();
+    void dealDataBytesWritten();
+    void dealDataDisconnected();
+    void dealDataError(QAbstractSocket::SocketError socketError);
+    void dealTimeout();
+
+private:
+    enum{
+        STEP_NONE = 0,
+        STEP_GREETING,
+        STEP_AUTH,
+        STEP_HANDSHAKE,
+        STEP_USER,
+        STEP_PASS,
+        STEP_PBSZ,
+        STEP_PROT,
+        STEP_SIMPLE,        // CWD, MKD, RMD, DELE, RNTO, QUIT, raw command: one reply ends it
+        STEP_RNFR,
+        STEP_TYPE,
+        STEP_PASV,          // PASV or EPSV
+        STEP_PORT,          // PORT or EPRT
+        STEP_TRANSFER
+    };
+
+    struct Command
+    {
+        Command() : id(0), type(QFtp::None), device(NULL) {}
+
+        int id;
+        QFtp::Command type;
+        QString arg;
+        QString arg2;           // Password of login, new name of rename
+        QIODevice *device;
+        QByteArray data;        // put(QByteArray)
+    };
+
+    QString m_peerName;
+    bool m_verifyPeer;
+    QList<QSslCipher> m_ciphers;
+    QList<QSslError> m_sslErrors;
+
+    QSslSocket *m_pControl;
+    QSslSocket *m_pData;
+    FtpListener *m_pListener;   // Active mode, until the server connected
+    QBuffer *m_pBuffer;         // Source of put(QByteArray)
+    QTimer m_timeoutTimer;
+
+    QList<Command> m_pending;
+    Command m_current;
+    int m_step;
+
+    QFtp::State m_state;
+    QFtp::Error m_error;
+    QString m_errorString;
+
+    QString m_replyText;        // Lines of a multi-line reply so far
+    int m_replyCode;            // Code of multi-line reply in progress, 0 if none
+
+    bool m_dataReady;
+    bool m_transferStarted;     // 1xx reply to LIST/RETR/STOR
+    bool m_controlDone;         // 2xx reply to LIST/RETR/STOR
+    bool m_dataDone;            // Data connection closed
+    QByteArray m_listData;
+    qint64 m_transferredBytes;
+    qint64 m_totalBytes;
+
+    QElapsedTimer m_handshakeTimer;
+    qint64 m_controlHandshakeMsecs;
+    qint64 m_dataHandshakeMsecs;    // Last data connection
+    int m_transferDataMode;         // Data mode of the running transfer
+    QElapsedTimer m_setupTimer;
+    qint64 m_dataSetupMsecs;
+
+    int addCommand(const Command &command);
+    void sendCommand(const QString &command, int step);
+    void processReply(int replyCode, const QString &text);
+    void finishCommand(bool error);
+    void fail(QFtp::Error error, const QString &text);
+    void setState(QFtp::State state);
+    void configureSocket(QSslSocket *socket, bool dataConnection);
+    void prepareTransfer();
+    void attachData(QSslSocket *socket);
+    void sendTransferCommand();
+    void writeChunk();
+    void checkTransferDone();
+    void closeData();
+};
+
+#endif // FTPTLSSESSION_H
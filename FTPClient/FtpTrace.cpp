@@ -0,0 +1,218 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTrace.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Always-on protocol trace kept in a lock-free ring buffer
+**********************************************************************/
+
+#include "FtpTrace.h"
+#include "QUtilityBox.h"
+#include <QStringList>
+#include <string.h>
+
+namespace
+{
+    const int TRACE_SLOT_MASK = FtpTrace::TRACE_CAPACITY - 1;
+
+    // Sequence stamp of a slot once record n is complete, kept positive
+    inline int doneStamp(int n)
+    {
+        return ((n & 0x3FFFFFFF) << 1) + 2;
+    }
+
+    const char *typeName(int type)
+    {
+        switch(type)
+        {
+        case FtpTrace::TRACE_COMMAND:
+            return "CMD ";
+        case FtpTrace::TRACE_REPLY:
+            return "RPL ";
+        case FtpTrace::TRACE_EVENT:
+            return "EVT ";
+        case FtpTrace::TRACE_DATA_IN:
+            return "DIN ";
+        case FtpTrace::TRACE_DATA_OUT:
+            return "DOUT";
+        default:
+            return "??? ";
+        }
+    }
+}
+
+
+FtpTrace::FtpTrace() :
+    m_records(new Trace_Record[TRACE_CAPACITY]),
+    m_sequence(new QAtomicInt[TRACE_CAPACITY]),
+    m_head(0),
+    m_tail(0),
+    m_dataCount(0),
+    m_enabled(true)
+{
+    memset(m_records, 0, sizeof(Trace_Record) * TRACE_CAPACITY);
+
+    m_startTime = QDateTime::currentDateTime();
+    m_clock.start();
+}
+
+FtpTrace::~FtpTrace()
+{
+    delete [] m_records;
+    delete [] m_sequence;
+}
+
+void FtpTrace::setEnabled(bool enable)
+{
+    m_enabled = enable;
+}
+
+bool FtpTrace::isEnabled() const
+{
+    return m_enabled;
+}
+
+void FtpTrace::record(int type, int id, int code, const QString &text)
+{
+    int seq = 0;
+
+    if(!m_enabled)
+    {
+        return;
+    }
+
+    QByteArray textData = text.toUtf8();
+    Trace_Record *rec = beginRecord(&seq);
+
+    rec->type = type;
+    rec->id = id;
+    rec->code = code;
+    rec->value = textData.size();
+    rec->len = qMin<int>(textData.size(), TRACE_TEXT_SIZE);
+    memcpy(rec->data, textData.constData(), rec->len);
+
+    endRecord(seq);
+}
+
+void FtpTrace::recordData(int type, int id, const char *data, qint64 len)
+{
+    int seq = 0;
+
+    // One atomic add per chunk when the chunk is not sampled
+    if(!m_enabled || len <= 0
+            || 0 != (m_dataCount.fetchAndAddRelaxed(1) % TRACE_SAMPLE_INTERVAL))
+    {
+        return;
+    }
+
+    Trace_Record *rec = beginRecord(&seq);
+
+    rec->type = type;
+    rec->id = id;
+    rec->code = 0;
+    rec->value = len;
+    rec->len = (int)qMin<qint64>(len, TRACE_SAMPLE_BYTES);
+    memcpy(rec->data, data, rec->len);
+
+    endRecord(seq);
+}
+
+QList<FtpTrace::Trace_Record> FtpTrace::snapshot() const
+{
+    QList<Trace_Record> records;
+    QAtomicInt &head = const_cast<QAtomicInt &>(m_head);
+    QAtomicInt &tail = const_cast<QAtomicInt &>(m_tail);
+
+    int last = head.fetchAndAddOrdered(0);
+    int first = qMax<int>(tail.fetchAndAddOrdered(0), last - TRACE_CAPACITY);
+
+    for(int n = first; n < last; n++)
+    {
+        int slot = n & TRACE_SLOT_MASK;
+        int stamp = doneStamp(n);
+
+        // Seqlock read: skip slots still written or already reused
+        if(m_sequence[slot].fetchAndAddOrdered(0) != stamp)
+        {
+            continue;
+        }
+
+        Trace_Record rec = m_records[slot];
+
+        if(m_sequence[slot].fetchAndAddOrdered(0) != stamp)
+        {
+            continue;
+        }
+
+        records.append(rec);
+    }
+
+    return records;
+}
+
+QString FtpTrace::dump() const
+{
+    QUtilityBox toolBox;
+    QList<Trace_Record> records = snapshot();
+    QStringList lines;
+
+    lines.append(QString("Trace since %1, %2 records")
+                 .arg(m_startTime.toString("yyyy-MM-dd hh:mm:ss:zzz"))
+                 .arg(records.size()));
+
+    for(int i = 0; i < records.size(); i++)
+    {
+        const Trace_Record &rec = records.at(i);
+        QString line = QString("[%1] %2 #%3 ")
+                .arg(m_startTime.addMSecs(rec.usecs / 1000).toString("hh:mm:ss:zzz"))
+                .arg(typeName(rec.type))
+                .arg(rec.id);
+
+        if(TRACE_DATA_IN == rec.type || TRACE_DATA_OUT == rec.type)
+        {
+            line.append(QString("%1 bytes: ").arg(rec.value));
+            line.append(toolBox.convertDataToHexString((const uint8_t *)rec.data, rec.len));
+        }
+        else
+        {
+            if(TRACE_REPLY == rec.type)
+            {
+                line.append(QString("%1 ").arg(rec.code));
+            }
+
+            line.append(QString::fromUtf8(rec.data, rec.len));
+            if(rec.value > rec.len)
+            {
+                line.append("...");
+            }
+        }
+
+        lines.append(line);
+    }
+
+    return lines.join("\n");
+}
+
+void FtpTrace::clear()
+{
+    m_tail.fetchAndStoreOrdered(m_head.fetchAndAddOrdered(0));
+}
+
+FtpTrace::Trace_Record *FtpTrace::beginRecord(int *seq)
+{
+    int n = m_head.fetchAndAddOrdered(1);
+    int slot = n & TRACE_SLOT_MASK;
+
+    // Odd stamp marks the slot as being written
+    m_sequence[slot].fetchAndStoreOrdered(doneStamp(n) - 1);
+    m_records[slot].usecs = m_clock.nsecsElapsed() / 1000;
+
+    *seq = n;
+
+    return &m_records[slot];
+}
+
+void FtpTrace::endRecord(int seq)
+{
+    m_sequence[seq & TRACE_SLOT_MASK].fetchAndStoreRelease(doneStamp(seq));
+}
@@ -0,0 +1,86 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTrace.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Always-on protocol trace kept in a lock-free ring buffer
+**********************************************************************/
+
+#ifndef FTPTRACE_H
+#define FTPTRACE_H
+#include <QString>
+#include <QList>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QDateTime>
+
+class FtpTrace
+{
+public:
+    enum{
+        TRACE_CAPACITY = 1024,          // Records kept, power of two
+        TRACE_TEXT_SIZE = 96,           // Bytes of command/reply text kept
+        TRACE_SAMPLE_INTERVAL = 64,     // Every Nth data chunk is sampled
+        TRACE_SAMPLE_BYTES = 32         // Header bytes kept per sample
+    };
+
+    enum RecordType{
+        TRACE_COMMAND = 0,  // Command sent on the control channel
+        TRACE_REPLY,        // Reply to a raw command
+        TRACE_EVENT,        // State change, command result
+        TRACE_DATA_IN,      // Sampled download chunk
+        TRACE_DATA_OUT      // Sampled upload chunk
+    };
+
+    struct Trace_Record
+    {
+        qint64 usecs;       // Since the trace was created
+        int type;
+        int id;             // QFtp command id, -1 if none
+        int code;           // Reply code
+        qint64 value;       // Chunk length of data samples
+        int len;            // Valid bytes in data
+        char data[TRACE_TEXT_SIZE];
+    };
+
+    FtpTrace();
+    ~FtpTrace();
+
+    void setEnabled(bool enable);
+    bool isEnabled() const;
+
+    // Writers never block, the oldest record is overwritten when full
+    void record(int type, int id, int code, const QString &text);
+
+    // Keeps the first bytes of every TRACE_SAMPLE_INTERVAL-th chunk
+    void recordData(int type, int id, const char *data, qint64 len);
+
+    // Consistent copy of the records, oldest first.
+    // Safe from any thread, records being overwritten are skipped
+    QList<Trace_Record> snapshot() const;
+
+    // Text rendering of snapshot(), data samples as hex
+    QString dump() const;
+
+    void clear();
+
+private:
+    Trace_Record *m_records;
+    QAtomicInt *m_sequence;     // Per slot: odd while written, 2 * n + 2 when record n is done
+    QAtomicInt m_head;          // Number of records ever reserved
+    QAtomicInt m_tail;          // First record still reported after clear()
+    QAtomicInt m_dataCount;     // Chunks seen, drives the sampling
+    volatile bool m_enabled;
+
+    QElapsedTimer m_clock;
+    QDateTime m_startTime;
+
+    Trace_Record *beginRecord(int *seq);
+    void endRecord(int seq);
+
+    // Disable copy, the ring is owned
+    FtpTrace(const FtpTrace &);
+    FtpTrace &operator=(const FtpTrace &);
+};
+
+#endif // FTPTRACE_H
@@ -0,0 +1,398 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTransferHistory.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Append-only history of finished transfers with throughput statistics
+**********************************************************************/
+
+#include "FtpTransferHistory.h"
+#include <QDataStream>
+#include <QFileInfo>
+#include <QDir>
+#include <QRegExp>
+#include <QTextStream>
+#include <QtEndian>
+#include <QtAlgorithms>
+#include <QMap>
+#include "FtpCapabilities.h"
+#include <zlib.h>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const quint8 RECORD_VERSION = 1;
+    const int RECORD_HEADER_SIZE = 8;           // Payload length, CRC32 of payload
+    const quint32 RECORD_MAX_SIZE = 64 * 1024;  // Larger length means a torn header
+
+    quint32 payloadCrc(const QByteArray &payload)
+    {
+        return (quint32)crc32(0, (const Bytef *)payload.constData(), (uInt)payload.size());
+    }
+
+    // Nearest rank of sorted rates
+    qint64 percentile(const QList<qint64> &sorted, int percent)
+    {
+        int rank = 0;
+
+        if(sorted.isEmpty())
+        {
+            return -1;
+        }
+
+        rank = (percent * sorted.size() + 99) / 100;
+
+        return sorted.at(qBound(0, rank - 1, sorted.size() - 1));
+    }
+}
+
+
+qint64 FtpTransferHistory::History_Record::rate() const
+{
+    return (durationMsecs > 0) ? bytes * 1000 / durationMsecs : -1;
+}
+
+FtpTransferHistory::FtpTransferHistory(QObject *parent) :
+    QObject(parent),
+    m_syncTimer(this),
+    m_unsyncedRecords(0)
+{
+    m_syncTimer.setSingleShot(true);
+    m_syncTimer.setInterval(HISTORY_SYNC_MSECS);
+    connect(&m_syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+}
+
+FtpTransferHistory::~FtpTransferHistory()
+{
+    close();
+}
+
+bool FtpTransferHistory::open(const QString &path)
+{
+    close();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    m_file.setFileName(path);
+    if(!m_file.open(QIODevice::ReadWrite))
+    {
+        return false;
+    }
+
+    if(!truncateTorn())
+    {
+        m_file.close();
+        return false;
+    }
+
+    // Reopened unbuffered for append: a record goes out in one write, so
+    // two sessions on the same server do not interleave theirs
+    m_file.close();
+
+    return m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered);
+}
+
+void FtpTransferHistory::close()
+{
+    if(!m_file.isOpen())
+    {
+        return;
+    }
+
+    sync();
+    m_file.close();
+}
+
+bool FtpTransferHistory::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+QString FtpTransferHistory::path() const
+{
+    return m_file.fileName();
+}
+
+void FtpTransferHistory::append(const History_Record &record)
+{
+    QByteArray payload;
+    QByteArray data;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    uchar header[RECORD_HEADER_SIZE];
+
+    if(!m_file.isOpen())
+    {
+        return;
+    }
+
+    stream << RECORD_VERSION
+           << (qint64)record.finished.toMSecsSinceEpoch()
+           << record.server << record.path
+           << (quint8)record.direction
+           << record.bytes << record.durationMsecs
+           << (quint32)record.retries
+           << (quint8)record.ok
+           << record.error;
+
+    qToLittleEndian<quint32>(payload.size(), header);
+    qToLittleEndian<quint32>(payloadCrc(payload), header + 4);
+
+    data.append((const char *)header, RECORD_HEADER_SIZE);
+    data.append(payload);
+    m_file.write(data);
+
+    // The fsync waits for a quiet moment, the write itself is cheap
+    m_unsyncedRecords++;
+    if(!m_syncTimer.isActive())
+    {
+        m_syncTimer.start();
+    }
+}
+
+void FtpTransferHistory::sync()
+{
+    m_syncTimer.stop();
+
+    if(!m_file.isOpen() || 0 == m_unsyncedRecords)
+    {
+        return;
+    }
+
+#ifdef Q_OS_WIN
+    _commit(m_file.handle());
+#else
+    fsync(m_file.handle());
+#endif
+
+    m_unsyncedRecords = 0;
+}
+
+QList<FtpTransferHistory::History_Record> FtpTransferHistory::read(const QString &path,
+                                                                  const QDateTime &from,
+                                                                  const QDateTime &to)
+{
+    QList<History_Record> records;
+    QFile file(path);
+    History_Record record;
+
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return records;
+    }
+
+    while(readRecord(file, record))
+    {
+        // Record of a newer format
+        if(!record.finished.isValid())
+        {
+            continue;
+        }
+
+        if((from.isValid() && record.finished < from) || (to.isValid() && record.finished >= to))
+        {
+            continue;
+        }
+
+        records.append(record);
+    }
+
+    return records;
+}
+
+QList<FtpTransferHistory::Rate_Stats> FtpTransferHistory::rateStats(const QList<History_Record> &records,
+                                                                   int bucketSecs)
+{
+    QMap<qint64, Rate_Stats> buckets;
+    QMap<qint64, QList<qint64> > rates;
+    qint64 bucketMsecs = (qint64)qMax(bucketSecs, 1) * 1000;
+    QList<Rate_Stats> ret;
+
+    for(int i = 0; i < records.size(); i++)
+    {
+        const History_Record &record = records.at(i);
+        qint64 start = record.finished.toMSecsSinceEpoch() / bucketMsecs * bucketMsecs;
+        Rate_Stats &stats = buckets[start];
+
+        stats.start = QDateTime::fromMSecsSinceEpoch(start).toUTC();
+        stats.transfers++;
+        stats.retries += record.retries;
+
+        if(!record.ok)
+        {
+            stats.failed++;
+            continue;
+        }
+
+        stats.bytes += record.bytes;
+        if(record.bytes >= HISTORY_MIN_RATE_BYTES && record.rate() >= 0)
+        {
+            rates[start].append(record.rate());
+        }
+    }
+
+    for(QMap<qint64, Rate_Stats>::iterator it = buckets.begin(); it != buckets.end(); ++it)
+    {
+        QList<qint64> sorted = rates.value(it.key());
+
+        qSort(sorted);
+        it.value().p50 = percentile(sorted, 50);
+        it.value().p90 = percentile(sorted, 90);
+        it.value().p99 = percentile(sorted, 99);
+
+        ret.append(it.value());
+    }
+
+    return ret;
+}
+
+QString FtpTransferHistory::report(int bucketSecs)
+{
+    QString text;
+    QTextStream out(&text);
+    QDir dir(defaultDir());
+    QFileInfoList files = dir.entryInfoList(QStringList() << "*.history", QDir::Files, QDir::Name);
+
+    if(files.isEmpty())
+    {
+        out << tr("No transfers recorded in %1").arg(dir.absolutePath()) << "\n";
+        out.flush();
+        return text;
+    }
+
+    out << tr("Throughput of successful transfers from %1 bytes on, per %2 hours (UTC)")
+           .arg((int)HISTORY_MIN_RATE_BYTES).arg(bucketSecs / 3600.0, 0, 'g', 3) << "\n";
+
+    for(int i = 0; i < files.size(); i++)
+    {
+        QList<History_Record> records = read(files.at(i).absoluteFilePath());
+        QList<Rate_Stats> stats = rateStats(records, bucketSecs);
+
+        if(records.isEmpty())
+        {
+            continue;
+        }
+
+        out << "\n" << records.last().server << "\n";
+        out << QString("  %1 %2 %3 %4 %5 %6 %7 %8\n")
+               .arg(tr("Bucket"), -16).arg(tr("Transfers"), 9).arg(tr("Failed"), 6)
+               .arg(tr("Retries"), 7).arg(tr("MiB"), 9)
+               .arg(tr("p50"), 11).arg(tr("p90"), 11).arg(tr("p99"), 11);
+
+        for(int j = 0; j < stats.size(); j++)
+        {
+            const Rate_Stats &bucket = stats.at(j);
+
+            out << QString("  %1 %2 %3 %4 %5 %6 %7 %8\n")
+                   .arg(bucket.start.toString("yyyy-MM-dd hh:mm"), -16)
+                   .arg(bucket.transfers, 9).arg(bucket.failed, 6).arg(bucket.retries, 7)
+                   .arg(bucket.bytes / (1024 * 1024), 9)
+                   .arg(formatRate(bucket.p50), 11)
+                   .arg(formatRate(bucket.p90), 11)
+                   .arg(formatRate(bucket.p99), 11);
+        }
+    }
+
+    out.flush();
+
+    return text;
+}
+
+QString FtpTransferHistory::defaultPath(const QString &host, int port)
+{
+    QString name = QString("%1_%2.history").arg(host.toLower()).arg(port);
+
+    // Keep the name a single path component
+    name.replace(QRegExp("[/\\\\:*?\"<>|]"), "_");
+
+    return defaultDir() + "/" + name;
+}
+
+QString FtpTransferHistory::defaultDir()
+{
+    return FtpCapabilities::settingsDir() + "/history";
+}
+
+bool FtpTransferHistory::truncateTorn()
+{
+    qint64 validSize = 0;
+    History_Record record;
+
+    m_file.seek(0);
+
+    while(readRecord(m_file, record))
+    {
+        validSize = m_file.pos();
+    }
+
+    // Drop the record a crash left half written
+    return validSize == m_file.size() || m_file.resize(validSize);
+}
+
+bool FtpTransferHistory::readRecord(QFile &file, History_Record &record)
+{
+    uchar header[RECORD_HEADER_SIZE];
+    quint8 version = 0;
+    qint64 finished = 0;
+    quint8 direction = 0;
+    quint32 retries = 0;
+    quint8 ok = 0;
+
+    if(file.read((char *)header, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    quint32 length = qFromLittleEndian<quint32>(header);
+    quint32 crc = qFromLittleEndian<quint32>(header + 4);
+
+    if(length > RECORD_MAX_SIZE)
+    {
+        return false;
+    }
+
+    QByteArray payload = file.read(length);
+    if((quint32)payload.size() != length || payloadCrc(payload) != crc)
+    {
+        return false;
+    }
+
+    QDataStream stream(payload);
+
+    stream >> version;
+    if(RECORD_VERSION != version)
+    {
+        // Written by a newer build, read() skips it
+        record = History_Record();
+        return true;
+    }
+
+    stream >> finished >> record.server >> record.path >> direction
+           >> record.bytes >> record.durationMsecs >> retries >> ok >> record.error;
+
+    record.finished = QDateTime::fromMSecsSinceEpoch(finished).toUTC();
+    record.direction = direction;
+    record.retries = (int)retries;
+    record.ok = (0 != ok);
+
+    return true;
+}
+
+QString FtpTransferHistory::formatRate(qint64 bytesPerSec)
+{
+    if(bytesPerSec < 0)
+    {
+        return "-";
+    }
+
+    if(bytesPerSec >= 1024 * 1024)
+    {
+        return QString("%1 MiB/s").arg(bytesPerSec / (1024.0 * 1024.0), 0, 'f', 1);
+    }
+
+    return QString("%1 KiB/s").arg(bytesPerSec / 1024.0, 0, 'f', 1);
+}
@@ -0,0 +1,109 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTransferHistory.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Append-only history of finished transfers with throughput statistics
+**********************************************************************/
+
+#ifndef FTPTRANSFERHISTORY_H
+#define FTPTRANSFERHISTORY_H
+#include <QObject>
+#include <QFile>
+#include <QTimer>
+#include <QList>
+#include <QString>
+#include <QDateTime>
+
+class FtpTransferHistory : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        HISTORY_SYNC_MSECS = 1000,          // Longest delay before a record is on disk
+        HISTORY_DEFAULT_BUCKET_SECS = 24 * 3600,
+        HISTORY_MIN_RATE_BYTES = 1024 * 1024    // Smaller files measure latency, not throughput
+    };
+
+    enum{
+        DIRECTION_GET = 0,
+        DIRECTION_PUT
+    };
+
+    struct History_Record
+    {
+        History_Record() : direction(DIRECTION_GET), bytes(0), durationMsecs(0), retries(0), ok(false) {}
+
+        QDateTime finished;     // UTC
+        QString server;         // host:port
+        QString path;           // Remote path
+        int direction;
+        qint64 bytes;
+        qint64 durationMsecs;   // From start to end, retries included
+        int retries;
+        bool ok;
+        QString error;
+
+        // Bytes per second, -1 if unknown
+        qint64 rate() const;
+    };
+
+    struct Rate_Stats
+    {
+        Rate_Stats() : transfers(0), failed(0), retries(0), bytes(0), p50(-1), p90(-1), p99(-1) {}
+
+        QDateTime start;        // Of the bucket, UTC
+        int transfers;
+        int failed;
+        int retries;
+        qint64 bytes;
+        qint64 p50;             // Bytes per second of the successful transfers
+        qint64 p90;             // large enough to measure, -1 if none was
+        qint64 p99;
+    };
+
+    explicit FtpTransferHistory(QObject *parent = 0);
+    ~FtpTransferHistory();
+
+    // Append to the history at path, a torn record at the end is cut off
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+    QString path() const;
+
+    // Written at once, synced to disk in batches off the transfer path
+    void append(const History_Record &record);
+
+    // Records of the history file at path finished in [from, to), an
+    // invalid bound is open
+    static QList<History_Record> read(const QString &path,
+                                      const QDateTime &from = QDateTime(),
+                                      const QDateTime &to = QDateTime());
+
+    // Records grouped into buckets of bucketSecs by finish time, oldest first
+    static QList<Rate_Stats> rateStats(const QList<History_Record> &records,
+                                       int bucketSecs = HISTORY_DEFAULT_BUCKET_SECS);
+
+    // Rate percentiles of each server with a history file, bucket by bucket
+    static QString report(int bucketSecs = HISTORY_DEFAULT_BUCKET_SECS);
+
+    // History file of a server, next to the settings files. One file
+    // per host:port, so mirrors can be compared
+    static QString defaultPath(const QString &host, int port);
+    static QString defaultDir();
+
+public slots:
+    // Flush and fsync the records written so far
+    void sync();
+
+private:
+    QFile m_file;
+    QTimer m_syncTimer;
+    int m_unsyncedRecords;
+
+    bool truncateTorn();
+    static bool readRecord(QFile &file, History_Record &record);
+    static QString formatRate(qint64 bytesPerSec);
+};
+
+#endif // FTPTRANSFERHISTORY_H
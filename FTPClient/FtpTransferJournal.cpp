@@ -0,0 +1,444 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTransferJournal.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Append-only journal of queued transfers for crash recovery
+**********************************************************************/
+
+#include "FtpTransferJournal.h"
+#include <QDataStream>
+#include <QFileInfo>
+#include <QDir>
+#include <QRegExp>
+#include <QtEndian>
+#include "FtpCapabilities.h"
+#include <zlib.h>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+namespace
+{
+    enum{
+        RECORD_ADD = 1,     // id, file name, local dir, remote dir
+        RECORD_STATE        // id, state
+    };
+
+    const int RECORD_HEADER_SIZE = 8;           // Payload length, CRC32 of payload
+    const quint32 RECORD_MAX_SIZE = 64 * 1024;  // Larger length means a torn header
+
+    quint32 payloadCrc(const QByteArray &payload)
+    {
+        return (quint32)crc32(0, (const Bytef *)payload.constData(), (uInt)payload.size());
+    }
+}
+
+
+FtpTransferJournal::FtpTransferJournal(QObject *parent) :
+    QObject(parent),
+    m_syncTimer(this),
+    m_unsyncedRecords(0),
+    m_staleRecords(0),
+    m_nextId(1)
+{
+    m_syncTimer.setSingleShot(true);
+    m_syncTimer.setInterval(JOURNAL_SYNC_MSECS);
+    connect(&m_syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+}
+
+FtpTransferJournal::~FtpTransferJournal()
+{
+    close();
+}
+
+bool FtpTransferJournal::open(const QString &path)
+{
+    QString slotPath = path;
+
+    close();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    // Two sessions on one file would resume the same entries twice
+    for(int slot = 1; !lock(slotPath); slot++)
+    {
+        if(slot >= JOURNAL_MAX_SLOTS)
+        {
+            return false;
+        }
+
+        slotPath = QString("%1.%2").arg(path).arg(slot);
+    }
+
+    m_file.setFileName(slotPath);
+    if(!m_file.open(QIODevice::ReadWrite))
+    {
+        unlock();
+        return false;
+    }
+
+    if(!replay())
+    {
+        m_file.close();
+        unlock();
+        return false;
+    }
+
+    if(m_staleRecords >= JOURNAL_COMPACT_RECORDS)
+    {
+        compact();
+    }
+
+    return m_file.isOpen();
+}
+
+void FtpTransferJournal::close()
+{
+    if(!m_file.isOpen())
+    {
+        return;
+    }
+
+    m_syncTimer.stop();
+
+    // Nothing left to recover, start the next run with an empty file
+    if(m_entries.isEmpty())
+    {
+        m_file.resize(0);
+    }
+
+    sync();
+    m_file.close();
+    unlock();
+
+    m_entries.clear();
+    m_staleRecords = 0;
+    m_nextId = 1;
+}
+
+bool FtpTransferJournal::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+QString FtpTransferJournal::path() const
+{
+    return m_file.fileName();
+}
+
+quint32 FtpTransferJournal::append(const QString &fileName, const QString &localDir, const QString &remoteDir)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    Journal_Entry entry;
+
+    entry.id = m_nextId++;
+    entry.state = STATE_PENDING;
+    entry.attempts = 0;
+    entry.fileName = fileName;
+    entry.localDir = localDir;
+    entry.remoteDir = remoteDir;
+
+    stream << (quint8)RECORD_ADD << entry.id << fileName << localDir << remoteDir;
+
+    m_entries.insert(entry.id, entry);
+    writeRecord(payload);
+
+    return entry.id;
+}
+
+bool FtpTransferJournal::setState(quint32 id, int state)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+
+    if(!m_entries.contains(id))
+    {
+        return false;
+    }
+
+    stream << (quint8)RECORD_STATE << id << (quint8)state;
+
+    m_staleRecords++;
+    writeRecord(payload);
+
+    return applyState(id, state);
+}
+
+QList<FtpTransferJournal::Journal_Entry> FtpTransferJournal::unfinished() const
+{
+    // Ids grow with queue order
+    return m_entries.values();
+}
+
+void FtpTransferJournal::sync()
+{
+    m_syncTimer.stop();
+
+    if(!m_file.isOpen() || 0 == m_unsyncedRecords)
+    {
+        return;
+    }
+
+    m_file.flush();
+    syncFile(m_file);
+
+    m_unsyncedRecords = 0;
+}
+
+QString FtpTransferJournal::defaultPath(const QString &host, int port, const QString &user)
+{
+    QString name = QString("%1@%2_%3.journal").arg(user).arg(host.toLower()).arg(port);
+
+    // Keep the name a single path component
+    name.replace(QRegExp("[/\\\\:*?\"<>|]"), "_");
+
+    return FtpCapabilities::settingsDir() + "/journal/" + name;
+}
+
+bool FtpTransferJournal::replay()
+{
+    qint64 validSize = 0;
+    int records = 0;
+
+    m_entries.clear();
+    m_staleRecords = 0;
+    m_nextId = 1;
+
+    m_file.seek(0);
+
+    while(true)
+    {
+        uchar header[RECORD_HEADER_SIZE];
+
+        if(m_file.read((char *)header, RECORD_HEADER_SIZE) != RECORD_HEADER_SIZE)
+        {
+            break;
+        }
+
+        quint32 length = qFromLittleEndian<quint32>(header);
+        quint32 crc = qFromLittleEndian<quint32>(header + 4);
+
+        if(length > RECORD_MAX_SIZE)
+        {
+            break;
+        }
+
+        QByteArray payload = m_file.read(length);
+        if((quint32)payload.size() != length || payloadCrc(payload) != crc)
+        {
+            break;
+        }
+
+        applyRecord(payload);
+
+        validSize += RECORD_HEADER_SIZE + length;
+        records++;
+    }
+
+    // Drop the record a crash left half written
+    if(validSize != m_file.size() && !m_file.resize(validSize))
+    {
+        return false;
+    }
+
+    m_staleRecords = records - m_entries.size();
+
+    return m_file.seek(validSize);
+}
+
+void FtpTransferJournal::compact()
+{
+    QString path = m_file.fileName();
+    QString tmpPath = path + ".tmp";
+    QList<Journal_Entry> entries = m_entries.values();
+
+    m_file.close();
+
+    QFile tmpFile(tmpPath);
+    if(!tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        m_file.open(QIODevice::ReadWrite | QIODevice::Append);
+        return;
+    }
+
+    // Only unfinished entries survive, ids are kept
+    for(int i = 0; i < entries.size(); i++)
+    {
+        QByteArray payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        const Journal_Entry &entry = entries.at(i);
+        uchar header[RECORD_HEADER_SIZE];
+
+        stream << (quint8)RECORD_ADD << entry.id << entry.fileName << entry.localDir << entry.remoteDir;
+
+        qToLittleEndian<quint32>(payload.size(), header);
+        qToLittleEndian<quint32>(payloadCrc(payload), header + 4);
+        tmpFile.write((const char *)header, RECORD_HEADER_SIZE);
+        tmpFile.write(payload);
+
+        // Failures so far, so compacting does not reset the attempt count
+        for(int j = 0; j < entry.attempts; j++)
+        {
+            QByteArray state;
+            QDataStream stateStream(&state, QIODevice::WriteOnly);
+
+            stateStream << (quint8)RECORD_STATE << entry.id << (quint8)STATE_FAILED;
+
+            qToLittleEndian<quint32>(state.size(), header);
+            qToLittleEndian<quint32>(payloadCrc(state), header + 4);
+            tmpFile.write((const char *)header, RECORD_HEADER_SIZE);
+            tmpFile.write(state);
+        }
+    }
+
+    tmpFile.flush();
+    syncFile(tmpFile);
+    tmpFile.close();
+
+    // QFile::rename does not overwrite
+    QFile::remove(path);
+    QFile::rename(tmpPath, path);
+
+    m_file.setFileName(path);
+    m_file.open(QIODevice::ReadWrite | QIODevice::Append);
+    m_staleRecords = 0;
+}
+
+void FtpTransferJournal::writeRecord(const QByteArray &payload)
+{
+    uchar header[RECORD_HEADER_SIZE];
+
+    if(!m_file.isOpen())
+    {
+        return;
+    }
+
+    qToLittleEndian<quint32>(payload.size(), header);
+    qToLittleEndian<quint32>(payloadCrc(payload), header + 4);
+
+    m_file.write((const char *)header, RECORD_HEADER_SIZE);
+    m_file.write(payload);
+
+    // Batched: one fsync covers every record of the last interval
+    m_unsyncedRecords++;
+    if(m_unsyncedRecords >= JOURNAL_SYNC_RECORDS)
+    {
+        sync();
+    }
+    else if(!m_syncTimer.isActive())
+    {
+        m_syncTimer.start();
+    }
+}
+
+void FtpTransferJournal::applyRecord(const QByteArray &payload)
+{
+    QDataStream stream(payload);
+    quint8 type = 0;
+    quint32 id = 0;
+
+    stream >> type >> id;
+
+    if(RECORD_ADD == type)
+    {
+        Journal_Entry entry;
+
+        entry.id = id;
+        entry.state = STATE_PENDING;
+        entry.attempts = 0;
+        stream >> entry.fileName >> entry.localDir >> entry.remoteDir;
+
+        m_entries.insert(id, entry);
+    }
+    else if(RECORD_STATE == type && m_entries.contains(id))
+    {
+        quint8 state = STATE_PENDING;
+
+        stream >> state;
+        applyState(id, state);
+    }
+
+    m_nextId = qMax(m_nextId, id + 1);
+}
+
+bool FtpTransferJournal::applyState(quint32 id, int state)
+{
+    Journal_Entry &entry = m_entries[id];
+
+    entry.state = state;
+    if(STATE_FAILED == state)
+    {
+        entry.attempts++;
+    }
+
+    // Done, or failed too often to be worth another login
+    if(STATE_DONE == state || entry.attempts >= JOURNAL_MAX_ATTEMPTS)
+    {
+        m_entries.remove(id);
+        return false;
+    }
+
+    return true;
+}
+
+bool FtpTransferJournal::lock(const QString &path)
+{
+    // A separate lock file, compact() replaces the journal file itself
+    m_lockFile.setFileName(path + ".lock");
+    if(!m_lockFile.open(QIODevice::ReadWrite))
+    {
+        return false;
+    }
+
+#ifdef Q_OS_WIN
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+
+    if(!LockFileEx((HANDLE)_get_osfhandle(m_lockFile.handle()),
+                   LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped))
+#else
+    if(0 != flock(m_lockFile.handle(), LOCK_EX | LOCK_NB))
+#endif
+    {
+        m_lockFile.close();
+        return false;
+    }
+
+    return true;
+}
+
+void FtpTransferJournal::unlock()
+{
+    if(!m_lockFile.isOpen())
+    {
+        return;
+    }
+
+    // The lock file stays, removing it would race with the next locker
+#ifdef Q_OS_WIN
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+
+    UnlockFileEx((HANDLE)_get_osfhandle(m_lockFile.handle()), 0, 1, 0, &overlapped);
+#else
+    flock(m_lockFile.handle(), LOCK_UN);
+#endif
+
+    m_lockFile.close();
+}
+
+bool FtpTransferJournal::syncFile(QFile &file)
+{
+#ifdef Q_OS_WIN
+    return 0 == _commit(file.handle());
+#else
+    return 0 == fsync(file.handle());
+#endif
+}
@@ -0,0 +1,94 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTransferJournal.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Append-only journal of queued transfers for crash recovery
+**********************************************************************/
+
+#ifndef FTPTRANSFERJOURNAL_H
+#define FTPTRANSFERJOURNAL_H
+#include <QObject>
+#include <QFile>
+#include <QTimer>
+#include <QMap>
+#include <QList>
+#include <QString>
+
+class FtpTransferJournal : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        JOURNAL_SYNC_MSECS = 200,       // Longest delay before a record is on disk
+        JOURNAL_SYNC_RECORDS = 4096,    // Or sync after this many records
+        JOURNAL_COMPACT_RECORDS = 65536,// Rewrite on open when this many records are stale
+        JOURNAL_MAX_ATTEMPTS = 5,       // Failed uploads before an entry is dropped for good
+        JOURNAL_MAX_SLOTS = 16          // Sessions of one account with a journal each
+    };
+
+    enum{
+        STATE_PENDING = 0,
+        STATE_IN_FLIGHT,
+        STATE_DONE,
+        STATE_FAILED
+    };
+
+    struct Journal_Entry
+    {
+        quint32 id;
+        int state;
+        int attempts;           // Failed uploads so far
+        QString fileName;
+        QString localDir;
+        QString remoteDir;
+    };
+
+    explicit FtpTransferJournal(QObject *parent = 0);
+    ~FtpTransferJournal();
+
+    // Replay the journal at path, a torn record at the end is cut off.
+    // The journal is locked while open: when another session of the
+    // account holds path, the first free of path.1, path.2... is taken
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+    QString path() const;
+
+    // Record a queued transfer, returns its id (never 0)
+    quint32 append(const QString &fileName, const QString &localDir, const QString &remoteDir);
+
+    // The JOURNAL_MAX_ATTEMPTS-th STATE_FAILED drops the entry, it is not
+    // resumed again. Returns false if the entry is gone
+    bool setState(quint32 id, int state);
+
+    // Pending, in-flight and failed entries in queue order
+    QList<Journal_Entry> unfinished() const;
+
+    // Journal file of an account, next to the settings files
+    static QString defaultPath(const QString &host, int port, const QString &user);
+
+public slots:
+    // Flush and fsync the records written so far
+    void sync();
+
+private:
+    QFile m_file;
+    QFile m_lockFile;           // Held locked while the journal is open
+    QTimer m_syncTimer;
+    int m_unsyncedRecords;
+    int m_staleRecords;         // Records superseded by later ones
+    quint32 m_nextId;
+    QMap<quint32, Journal_Entry> m_entries;     // Unfinished only
+
+    bool lock(const QString &path);
+    void unlock();
+    bool replay();
+    void compact();
+    void writeRecord(const QByteArray &payload);
+    void applyRecord(const QByteArray &payload);
+    bool applyState(quint32 id, int state);
+    static bool syncFile(QFile &file);
+};
+
+#endif // FTPTRANSFERJOURNAL_H
@@ -1,16 +1,20 @@
 #include "MainWindow.h"
 #include "ui_MainWindow.h"
+#include <QInputDialog>
+#include <QMessageBox>
+#include <QFileDialog>
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    ftpClient(new FtpClient),
-    ftpClientW(new FtpClientWidget)
+    m_engineThread(new QThread(this))
 {
     ui->setupUi(this);
 
-    ftpClientW->setParent(ui->centralWidget);
-    ftpClientW->bindModel(ftpClient);
+    m_engineThread->start();
+
+    // First session
+    addSession();
 
     // Set Window Title
     this->setWindowTitle( tr("FTP Client") );
@@ -21,12 +25,199 @@ MainWindow::MainWindow(QWidget *parent) :
 
 MainWindow::~MainWindow()
 {
+    // Close connections in the engine thread before it stops
+    for(int i = 0; i < m_sessions.size(); i++)
+    {
+        m_sessions.at(i).widget->unbind();
+        QMetaObject::invokeMethod(m_sessions.at(i).client, "disconnectFromServer",
+                                  Qt::BlockingQueuedConnection);
+    }
+
+    m_engineThread->quit();
+    m_engineThread->wait();
+
+    // Engine thread finished, engines can be deleted from here
+    for(int i = 0; i < m_sessions.size(); i++)
+    {
+        delete m_sessions.at(i).client;
+    }
+
     delete ui;
-    delete ftpClientW;
-    delete ftpClient;
 }
 
-void MainWindow::resizeEvent(QResizeEvent *e)
+void MainWindow::on_actionNewSession_triggered()
+{
+    addSession();
+}
+
+void MainWindow::on_actionCloseSession_triggered()
+{
+    removeSession(ui->tabWidget_sessions->currentIndex());
+}
+
+void MainWindow::on_actionFxpCopy_triggered()
+{
+    int sourceIndex = ui->tabWidget_sessions->currentIndex();
+    QStringList targetNames;
+    QList<int> targetIndexes;
+
+    FtpClientWidget *sourceWidget = qobject_cast<FtpClientWidget *>(ui->tabWidget_sessions->widget(sourceIndex));
+    if(NULL == sourceWidget)
+    {
+        return;
+    }
+
+    QStringList fileNames = sourceWidget->selectedServerFiles();
+    if(fileNames.isEmpty())
+    {
+        QMessageBox::information(this, tr("FXP Copy"), tr("Select files on the server first."));
+        return;
+    }
+
+    for(int i = 0; i < ui->tabWidget_sessions->count(); i++)
+    {
+        if(i != sourceIndex)
+        {
+            targetNames.append(QString("%1: %2").arg(i + 1).arg(ui->tabWidget_sessions->tabText(i)));
+            targetIndexes.append(i);
+        }
+    }
+
+    if(targetNames.isEmpty())
+    {
+        QMessageBox::information(this, tr("FXP Copy"), tr("Open a session to the destination server first."));
+        return;
+    }
+
+    bool ok = false;
+    QString target = QInputDialog::getItem(this, tr("FXP Copy"), tr("Copy %1 files to session:").arg(fileNames.size()),
+                                           targetNames, 0, false, &ok);
+    if(!ok)
+    {
+        return;
+    }
+
+    FtpClient *source = sessionClient(sourceIndex);
+    FtpClient *dest = sessionClient(targetIndexes.at(targetNames.indexOf(target)));
+
+    // Runs in the engine thread, progress comes through the source session
+    QMetaObject::invokeMethod(source, "fxpFiles", Qt::QueuedConnection,
+                              Q_ARG(QObject*, dest), Q_ARG(QStringList, fileNames));
+}
+
+void MainWindow::on_actionHotFolder_triggered()
+{
+    FtpClient *client = sessionClient(ui->tabWidget_sessions->currentIndex());
+
+    if(NULL == client)
+    {
+        return;
+    }
+
+    QString localDir = QFileDialog::getExistingDirectory(this, tr("Hot Folder"));
+    if(localDir.isEmpty())
+    {
+        return;
+    }
+
+    bool ok = false;
+    QString remoteDir = QInputDialog::getText(this, tr("Hot Folder"),
+                                              tr("Upload to server dir (empty for current dir):"),
+                                              QLineEdit::Normal, "", &ok);
+    if(!ok)
+    {
+        return;
+    }
+
+    // Watcher runs in the engine thread next to the session
+    QMetaObject::invokeMethod(client, "setHotFolder", Qt::QueuedConnection,
+                              Q_ARG(QString, localDir), Q_ARG(QString, remoteDir));
+}
+
+void MainWindow::on_actionStopHotFolder_triggered()
 {
-    ftpClientW->resize(ui->centralWidget->size());
+    FtpClient *client = sessionClient(ui->tabWidget_sessions->currentIndex());
+
+    if(NULL != client)
+    {
+        QMetaObject::invokeMethod(client, "setHotFolder", Qt::QueuedConnection,
+                                  Q_ARG(QString, QString()), Q_ARG(QString, QString()));
+    }
+}
+
+void MainWindow::on_tabWidget_sessions_tabCloseRequested(int index)
+{
+    removeSession(index);
+}
+
+void MainWindow::updateSessionTitle(QString title)
+{
+    FtpClientWidget *widget = qobject_cast<FtpClientWidget *>(sender());
+    int index = ui->tabWidget_sessions->indexOf(widget);
+
+    if(index >= 0)
+    {
+        ui->tabWidget_sessions->setTabText(index, title);
+    }
+}
+
+FtpClient *MainWindow::sessionClient(int index) const
+{
+    QWidget *widget = ui->tabWidget_sessions->widget(index);
+
+    // Tabs are movable, look up by widget
+    for(int i = 0; i < m_sessions.size(); i++)
+    {
+        if(m_sessions.at(i).widget == widget)
+        {
+            return m_sessions.at(i).client;
+        }
+    }
+
+    return NULL;
+}
+
+void MainWindow::addSession()
+{
+    struct Session_Info session;
+
+    session.client = new FtpClient;
+    session.client->moveToThread(m_engineThread);
+
+    session.widget = new FtpClientWidget;
+    session.widget->bindModel(session.client);
+    connect(session.widget, SIGNAL(sessionTitleChanged(QString)), this, SLOT(updateSessionTitle(QString)));
+
+    m_sessions.append(session);
+
+    int index = ui->tabWidget_sessions->addTab(session.widget, tr("Session %1").arg(m_sessions.size()));
+    ui->tabWidget_sessions->setCurrentIndex(index);
+}
+
+void MainWindow::removeSession(int index)
+{
+    QWidget *widget = ui->tabWidget_sessions->widget(index);
+
+    // Keep at least one session
+    if(NULL == widget || ui->tabWidget_sessions->count() <= 1)
+    {
+        return;
+    }
+
+    for(int i = 0; i < m_sessions.size(); i++)
+    {
+        if(m_sessions.at(i).widget == widget)
+        {
+            struct Session_Info session = m_sessions.takeAt(i);
+
+            ui->tabWidget_sessions->removeTab(index);
+
+            session.widget->unbind();
+            delete session.widget;
+
+            // Destructor disconnects, it must run in the engine thread
+            session.client->deleteLater();
+            break;
+        }
+    }
 }
@@ -2,6 +2,8 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QThread>
+#include <QList>
 #include "FtpClient.h"
 #include "FtpClientWidget.h"
 
@@ -16,15 +18,38 @@ class MainWindow : public QMainWindow
 public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
-    
-protected:
-    void resizeEvent(QResizeEvent *e);
+
+private slots:
+    void on_actionNewSession_triggered();
+    void on_actionCloseSession_triggered();
+    void on_actionFxpCopy_triggered();
+    void on_actionHotFolder_triggered();
+    void on_actionStopHotFolder_triggered();
+    void on_tabWidget_sessions_tabCloseRequested(int index);
+
+    void updateSessionTitle(QString title);
 
 private:
     Ui::MainWindow *ui;
 
-    FtpClient *ftpClient;
-    FtpClientWidget *ftpClientW;
+    // All FtpClient engines share one I/O thread, the UI thread only
+    // handles their queued signals
+    QThread *m_engineThread;
+
+    struct Session_Info
+    {
+        FtpClient *client;
+        FtpClientWidget *widget;
+    };
+
+    QList<struct Session_Info> m_sessions;
+
+    // Create a FtpClient engine and its widget in a new tab
+    void addSession();
+    void removeSession(int index);
+
+    // Engine of the session in tab index
+    FtpClient *sessionClient(int index) const;
 };
 
 #endif // MAINWINDOW_H
@@ -8,9 +8,218 @@ PURPOSE:        General tool box, provide buffer convert function and etc.
 
 #include "QUtilityBox.h"
 #include <QStringList>
-#include <QRegExp>
 #include <QDir>
 #include <QDebug>
+#include <string.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+namespace
+{
+    const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+    // Digit value of ASCII characters, 0xFF if not a digit of base 36
+    uchar s_digitValue[128];
+
+    bool initDigitValue()
+    {
+        memset(s_digitValue, 0xFF, sizeof(s_digitValue));
+
+        for(int i = 0; i < 10; i++)
+        {
+            s_digitValue['0' + i] = i;
+        }
+        for(int i = 0; i < 26; i++)
+        {
+            s_digitValue['a' + i] = 10 + i;
+            s_digitValue['A' + i] = 10 + i;
+        }
+
+        return true;
+    }
+
+    const bool s_digitValueReady = initDigitValue();
+
+    // Write "XX " for every byte, out must hold 3 * len characters
+    void encodeHex(const uchar *data, int len, ushort *out)
+    {
+        int i = 0;
+
+#if defined(__SSSE3__)
+        // 8 bytes give 24 characters: nibbles to ASCII, spread the digit
+        // pairs into "HL " triplets with pshufb, widen to UTF-16
+        const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i asciiZero = _mm_set1_epi8('0');
+        const __m128i letterGap = _mm_set1_epi8('A' - '0' - 10);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i shuffle0 = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10);
+        const __m128i shuffle1 = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m128i space0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+        const __m128i space1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, 0, 0, 0, 0, 0, 0);
+
+        for(; i + 8 <= len; i += 8)
+        {
+            __m128i bytes = _mm_loadl_epi64((const __m128i *)(data + i));
+            __m128i lo = _mm_and_si128(bytes, nibbleMask);
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask);
+
+            // Digit pairs "H0 L0 H1 L1 ..." as nibble values
+            __m128i pairs = _mm_unpacklo_epi8(hi, lo);
+            __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(pairs, nine), letterGap);
+            pairs = _mm_add_epi8(_mm_add_epi8(pairs, asciiZero), letters);
+
+            __m128i chars0 = _mm_or_si128(_mm_shuffle_epi8(pairs, shuffle0), space0);
+            __m128i chars1 = _mm_or_si128(_mm_shuffle_epi8(pairs, shuffle1), space1);
+
+            _mm_storeu_si128((__m128i *)(out + 3 * i), _mm_unpacklo_epi8(chars0, zero));
+            _mm_storeu_si128((__m128i *)(out + 3 * i + 8), _mm_unpackhi_epi8(chars0, zero));
+            _mm_storeu_si128((__m128i *)(out + 3 * i + 16), _mm_unpacklo_epi8(chars1, zero));
+        }
+#endif
+
+        for(; i < len; i++)
+        {
+            out[3 * i] = HEX_DIGITS[data[i] >> 4];
+            out[3 * i + 1] = HEX_DIGITS[data[i] & 0x0F];
+            out[3 * i + 2] = ' ';
+        }
+    }
+
+    inline bool isSpace(ushort c)
+    {
+        if(c < 0x80)
+        {
+            return ' ' == c || (c >= '\t' && c <= '\r');
+        }
+
+        return QChar(c).isSpace();
+    }
+
+    // Parse one token like QString::toInt(&ok, base), 0 if it is not a number
+    uchar parseToken(const ushort *p, const ushort *end, int base)
+    {
+        bool negative = false;
+        quint64 value = 0;
+
+        if('+' == *p || '-' == *p)
+        {
+            negative = ('-' == *p);
+            p++;
+        }
+
+        if(16 == base && end - p > 2 && '0' == p[0] && ('x' == p[1] || 'X' == p[1]))
+        {
+            p += 2;
+        }
+
+        if(p == end)
+        {
+            return 0;
+        }
+
+        for(; p < end; p++)
+        {
+            uchar digit = (*p < 0x80) ? s_digitValue[*p] : 0xFF;
+            if(digit >= base)
+            {
+                return 0;
+            }
+
+            value = value * base + digit;
+
+            // Out of int range, toInt() fails
+            if(value > (quint64)0x80000000)
+            {
+                return 0;
+            }
+        }
+
+        if(!negative && value > 0x7FFFFFFF)
+        {
+            return 0;
+        }
+
+        return negative ? (uchar)(0 - value) : (uchar)value;
+    }
+
+    // Split str at white space and store each token as one byte,
+    // returns number of tokens stored, at most bufferSize
+    uint32_t decodeTokens(const ushort *str, int len, int base, uint8_t *buffer, uint32_t bufferSize)
+    {
+        const ushort *p = str;
+        const ushort *end = str + len;
+        const uchar base8 = (uchar)base;
+        uint32_t count = 0;
+
+        while(count < bufferSize)
+        {
+            while(p < end && isSpace(*p))
+            {
+                p++;
+            }
+
+            if(p == end)
+            {
+                break;
+            }
+
+            // Fastest path: the "XX " layout written by encodeHex
+            if(end - p >= 3 && ' ' == p[2] && p[0] < 0x80 && p[1] < 0x80)
+            {
+                uchar hi = s_digitValue[p[0]];
+                uchar lo = s_digitValue[p[1]];
+                if(hi < base8 && lo < base8)
+                {
+                    buffer[count++] = (uchar)(hi * base8 + lo);
+                    p += 3;
+                    continue;
+                }
+            }
+
+            // Fast path: plain digits, accumulated while scanning
+            const ushort *tokenStart = p;
+            quint32 value = 0;
+            while(p < end && *p < 0x80 && s_digitValue[*p] < base8 && p - tokenStart < 7)
+            {
+                value = value * base + s_digitValue[*p];
+                p++;
+            }
+
+            if(p == end || isSpace(*p))
+            {
+                buffer[count++] = (uchar)value;
+                continue;
+            }
+
+            // Sign, prefix, long or invalid token
+            while(p < end && !isSpace(*p))
+            {
+                p++;
+            }
+
+            buffer[count++] = parseToken(tokenStart, p, base);
+        }
+
+        return count;
+    }
+
+    // Tokens need at least one character plus a separator
+    QByteArray decodeToByteArray(const QString &inputStr, int base)
+    {
+        QByteArray data;
+
+        data.resize((inputStr.size() + 1) / 2);
+        uint32_t count = decodeTokens(inputStr.utf16(), inputStr.size(), base,
+                                      (uint8_t *)data.data(), (uint32_t)data.size());
+        data.resize((int)count);
+
+        return data;
+    }
+}
+
 
 QUtilityBox::QUtilityBox()
 {
@@ -22,64 +231,63 @@ QUtilityBox::~QUtilityBox()
 
 uint32_t QUtilityBox::convertHexStringToDataBuffer(uint8_t *convertedDataBuffer, const QString inputStr)
 {
-    int len = 0;
-    bool ok;
-
-    QStringList dataList;
-    dataList = inputStr.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+    return convertHexStringToDataBuffer(convertedDataBuffer, 0xFFFFFFFF, inputStr);
+}
 
-    len = dataList.size();
-    for(int i = 0; i < dataList.size(); i++)
+uint32_t QUtilityBox::convertHexStringToDataBuffer(uint8_t *convertedDataBuffer, uint32_t bufferSize, const QString &inputStr)
+{
+    if(NULL == convertedDataBuffer)
     {
-        //qDebug() << "dataList.at(" << i << ") = " << dataList.at(i);
-        *(convertedDataBuffer + i) = dataList.at(i).toInt(&ok, 16);
+        return 0;
     }
 
-    return len;
+    return decodeTokens(inputStr.utf16(), inputStr.size(), 16, convertedDataBuffer, bufferSize);
 }
 
-uint32_t QUtilityBox::convertDecStringToDataBuffer(uint8_t *convertedDataBuffer, const QString inputStr)
+QByteArray QUtilityBox::convertHexStringToData(const QString &inputStr)
 {
-    int len = 0;
-    bool ok;
+    return decodeToByteArray(inputStr, 16);
+}
 
-    QStringList dataList;
-    dataList = inputStr.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+uint32_t QUtilityBox::convertDecStringToDataBuffer(uint8_t *convertedDataBuffer, const QString inputStr)
+{
+    return convertDecStringToDataBuffer(convertedDataBuffer, 0xFFFFFFFF, inputStr);
+}
 
-    len = dataList.size();
-    for(int i = 0; i < dataList.size(); i++)
+uint32_t QUtilityBox::convertDecStringToDataBuffer(uint8_t *convertedDataBuffer, uint32_t bufferSize, const QString &inputStr)
+{
+    if(NULL == convertedDataBuffer)
     {
-        //qDebug() << "dataList.at(" << i << ") = " << dataList.at(i);
-        *(convertedDataBuffer + i) = dataList.at(i).toInt(&ok, 10);
+        return 0;
     }
 
-    return len;
+    return decodeTokens(inputStr.utf16(), inputStr.size(), 10, convertedDataBuffer, bufferSize);
 }
 
-QString QUtilityBox::convertDataToHexString(QByteArray data)
+QByteArray QUtilityBox::convertDecStringToData(const QString &inputStr)
 {
-    QString retStr = "";
-
-    for(int i = 0; i < data.size(); i++)
-    {
-    #if 1
-        retStr.append(QString::number((uint8_t)data.at(i), 16).rightJustified(2, '0').toUpper());
-        retStr.append(" ");
-    #else
-        char tmpBuf[2048] = {0};
-        sprintf(tmpBuf, "%02X ", (uint8_t)data.at(i));
-        retStr.append(tmpBuf);
-    #endif
-    }
+    return decodeToByteArray(inputStr, 10);
+}
 
-    return retStr;
+QString QUtilityBox::convertDataToHexString(QByteArray data)
+{
+    return convertDataToHexString((const uint8_t *)data.constData(), data.size());
 }
 
 QString QUtilityBox::convertDataToHexString(const uint8_t *data, int len)
 {
-    QByteArray tmpData((char *)data, len);
+    QString retStr;
 
-    return convertDataToHexString(tmpData);
+    if(NULL == data || len <= 0)
+    {
+        return retStr;
+    }
+
+    // Sized once, every byte takes exactly three characters
+    retStr.resize(len * 3);
+    encodeHex(data, len, reinterpret_cast<ushort *>(retStr.data()));
+
+    return retStr;
 }
 
 QFileInfoList QUtilityBox::getFolderInfo(const QString &path)
@@ -9,6 +9,7 @@ PURPOSE:        General tool box, provide buffer convert function and etc.
 #ifndef QUTILITYBOX_H
 #define QUTILITYBOX_H
 #include <QString>
+#include <QByteArray>
 #include <QFileInfoList>
 #include <stdint.h>
 
@@ -21,12 +22,26 @@ public:
 
     // Convert Hex QString to data buffer
     // For example, "12 34 56" to 0x12, 0x34, 0x56, return 3
+    // The buffer must hold one byte per token, prefer the bounded overload
     uint32_t convertHexStringToDataBuffer(uint8_t *convertedDataBuffer, const QString inputStr);
 
+    // Same, stores at most bufferSize bytes and returns the number stored
+    uint32_t convertHexStringToDataBuffer(uint8_t *convertedDataBuffer, uint32_t bufferSize, const QString &inputStr);
+
+    // Same, the result is sized to the number of tokens
+    QByteArray convertHexStringToData(const QString &inputStr);
+
     // Convert Decimal QString to data buffer
     // For example, "16 128" to 16, 128, return 2
+    // The buffer must hold one byte per token, prefer the bounded overload
     uint32_t convertDecStringToDataBuffer(uint8_t *convertedDataBuffer, const QString inputStr);
 
+    // Same, stores at most bufferSize bytes and returns the number stored
+    uint32_t convertDecStringToDataBuffer(uint8_t *convertedDataBuffer, uint32_t bufferSize, const QString &inputStr);
+
+    // Same, the result is sized to the number of tokens
+    QByteArray convertDecStringToData(const QString &inputStr);
+
     // Convert data buffer to Hex QString
     // For example, data[0]=15 data[1]=32, return "0F 20 "
     QString convertDataToHexString(QByteArray data);
@@ -1,63 +1,74 @@
-#include <QtGui/QApplication>
-#include "mainwindow.h"
+#include <QApplication>
+#include "MainWindow.h"
 #include <QTextCodec>
-#include <windows.h>
+#include <QElapsedTimer>
+#include <QDir>
 #include <QDebug>
 
-#define USE_SYS_QTEXTCODEC 1
+// Window shown and first events handled within this, else a warning is logged
+#define STARTUP_BUDGET_MSECS 400
 
-void getSysLanguage();
+void addPluginPath();
+void setCodecFromEnv();
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startupClock;
+    startupClock.start();
+
     QApplication a(argc, argv);
-    MainWindow w;
 
-    // Add the plugins path, so the picture will be displayed normally
-    // SQL driver and TextCodec will be parsed normally
-    QApplication::addLibraryPath("./plugins");
+    // Before any plugin (image format, codec) is loaded on first use
+    addPluginPath();
 
-    // Check Sys language
-    getSysLanguage();
+    // Locale codec is the system one (GBK on Chinese Windows, UTF-8 on
+    // Linux) and is looked up by Qt when first needed
+    setCodecFromEnv();
 
-#ifdef USE_SYS_QTEXTCODEC
-    QTextCodec *codec = QTextCodec::codecForName("GBK");
-    QTextCodec::setCodecForTr(codec);
+    MainWindow w;
+    w.show();
 
-#if 1
-    QTextCodec::setCodecForLocale(codec);
-    QTextCodec::setCodecForCStrings(codec);
-#else
-    QTextCodec::setCodecForLocale(QTextCodec::codecForLocale());
-    QTextCodec::setCodecForCStrings(QTextCodec::codecForLocale());
-#endif
+    // Startup time as the user sees it: first paint is queued by show()
+    a.processEvents();
 
-#endif
+    qint64 startupMsecs = startupClock.elapsed();
+    if(startupMsecs > STARTUP_BUDGET_MSECS)
+    {
+        qWarning() << "Startup took" << startupMsecs << "ms, budget" << STARTUP_BUDGET_MSECS << "ms";
+    }
 
-    w.show();
-    
     return a.exec();
 }
 
-void getSysLanguage()
+void addPluginPath()
 {
-    UINT  nLanID   =   GetSystemDefaultLangID();
-    WORD  PriLan   =   PRIMARYLANGID(nLanID);
-    WORD  SubLan   =   SUBLANGID(nLanID);
+    // Plugins shipped next to the executable, not relative to the working dir
+    QString pluginPath = QDir(QCoreApplication::applicationDirPath()).filePath("plugins");
 
-    if( PriLan == LANG_ENGLISH )
+    if(QDir(pluginPath).exists())
     {
-        qDebug() << "Sys language is English";
+        QApplication::addLibraryPath(pluginPath);
     }
-    else if( PriLan == LANG_CHINESE )
+}
+
+void setCodecFromEnv()
+{
+    // e.g. FTPCLIENT_CODEC=GBK for local file names of a system whose
+    // locale does not say so, loaded only when asked for
+    QByteArray codecName = qgetenv("FTPCLIENT_CODEC");
+    QTextCodec *codec = NULL;
+
+    if(codecName.isEmpty())
+    {
+        return;
+    }
+
+    codec = QTextCodec::codecForName(codecName);
+    if(NULL == codec)
     {
-        if( SubLan == SUBLANG_CHINESE_SIMPLIFIED )
-        {
-            qDebug() << "Sys language is Chinese Simplified";
-        }
-        else if( SubLan == SUBLANG_CHINESE_TRADITIONAL )
-        {
-            qDebug() << "Sys language is Chinese Traditional";
-        }
+        qWarning() << "Unknown codec" << codecName << ", using the system locale";
+        return;
     }
+
+    QTextCodec::setCodecForLocale(codec);
 }
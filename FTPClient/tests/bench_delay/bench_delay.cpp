@@ -0,0 +1,342 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           bench_delay.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Single stream throughput of a data connection over a
+                loopback with injected delay, with and without
+                FtpSocketTuning
+**********************************************************************/
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QTcpSocket>
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QTimer>
+#include "FtpSocketTuning.h"
+#include "FtpListenerPool.h"
+
+namespace
+{
+    enum{
+        DEFAULT_RTT_MSECS = 150,
+        DEFAULT_MBIT = 100,
+        DEFAULT_SECONDS = 10,
+        CHUNK_BYTES = 64 * 1024,
+        CONNECT_TIMEOUT_MSECS = 10000
+    };
+
+    QTextStream s_out(stdout);
+
+    // Run the event loop until done is set, sleeping while nothing happens
+    bool spin(const bool &done, int msecs)
+    {
+        QElapsedTimer timer;
+        QTimer wake;
+
+        // Wakes the loop up to check the time
+        wake.start(100);
+
+        timer.start();
+        while(!done && timer.elapsed() < msecs)
+        {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+
+        return done;
+    }
+
+    // netem on lo delays every packet, so each way gets half the round trip
+    bool netem(const QStringList &args)
+    {
+        QProcess tc;
+
+        tc.start("tc", args);
+        if(!tc.waitForFinished() || 0 != tc.exitCode())
+        {
+            s_out << "tc " << args.join(" ") << " failed: "
+                  << tc.readAllStandardError().trimmed() << "\n";
+            return false;
+        }
+
+        return true;
+    }
+}
+
+
+// Download direction: the listener side sends, as a server does after
+// RETR, the connecting side is the tuned client
+class DelayBench : public QObject
+{
+    Q_OBJECT
+public:
+    DelayBench();
+
+    // False on timeout. connectMsecs is the TCP handshake, one round trip
+    bool run(const FtpSocketTuning &tuning, qint64 bytes, int timeoutMsecs,
+             qint64 &connectMsecs, qint64 &transferMsecs);
+
+private slots:
+    void dealAccepted(int descriptor);
+    void dealConnected();
+    void dealReadyRead();
+    void dealBytesWritten();
+
+private:
+    const FtpSocketTuning *m_tuning;
+    QTcpSocket *m_pSender;
+    QTcpSocket *m_pReceiver;
+    QByteArray m_chunk;
+    qint64 m_toSend;
+    qint64 m_sent;
+    qint64 m_received;
+    bool m_connected;
+    bool m_done;
+
+    void fill();
+};
+
+DelayBench::DelayBench() :
+    QObject(),
+    m_tuning(NULL),
+    m_pSender(NULL),
+    m_pReceiver(NULL),
+    m_chunk(CHUNK_BYTES, 'x'),
+    m_toSend(0),
+    m_sent(0),
+    m_received(0),
+    m_connected(false),
+    m_done(false)
+{
+}
+
+bool DelayBench::run(const FtpSocketTuning &tuning, qint64 bytes, int timeoutMsecs,
+                     qint64 &connectMsecs, qint64 &transferMsecs)
+{
+    FtpListener listener;
+    QElapsedTimer timer;
+    bool ok = false;
+
+    m_tuning = &tuning;
+    m_toSend = bytes;
+    m_sent = 0;
+    m_received = 0;
+    m_connected = false;
+    m_done = false;
+
+    connect(&listener, SIGNAL(accepted(int)), this, SLOT(dealAccepted(int)));
+    if(!listener.listen(QHostAddress::LocalHost))
+    {
+        return false;
+    }
+
+    // As a passive data connection: receive window fixed by the SYN
+    m_pReceiver = new QTcpSocket(this);
+    connect(m_pReceiver, SIGNAL(readyRead()), this, SLOT(dealReadyRead()));
+
+    // A tuned connect is reported by FtpSocketTuning, not the socket
+    timer.start();
+    tuning.connectSocket(m_pReceiver, QHostAddress(QHostAddress::LocalHost), listener.serverPort(),
+                         this, SLOT(dealConnected()));
+
+    if(spin(m_connected, CONNECT_TIMEOUT_MSECS))
+    {
+        connectMsecs = timer.elapsed();
+
+        timer.start();
+        fill();
+        ok = spin(m_done, timeoutMsecs);
+        transferMsecs = timer.elapsed();
+    }
+
+    delete m_pSender;
+    delete m_pReceiver;
+    m_pSender = NULL;
+    m_pReceiver = NULL;
+
+    return ok;
+}
+
+void DelayBench::dealAccepted(int descriptor)
+{
+    m_pSender = new QTcpSocket(this);
+    connect(m_pSender, SIGNAL(bytesWritten(qint64)), this, SLOT(dealBytesWritten()));
+
+    // As FtpSession::adoptDataSocket
+    m_pSender->setSocketDescriptor(descriptor);
+    m_tuning->applyConnected(m_pSender);
+
+    fill();
+}
+
+void DelayBench::dealConnected()
+{
+    m_connected = true;
+}
+
+void DelayBench::dealReadyRead()
+{
+    m_received += m_pReceiver->readAll().size();
+
+    if(m_received >= m_toSend)
+    {
+        m_done = true;
+    }
+}
+
+void DelayBench::dealBytesWritten()
+{
+    fill();
+}
+
+void DelayBench::fill()
+{
+    // Both ends up before the clock starts
+    if(NULL == m_pSender || !m_connected)
+    {
+        return;
+    }
+
+    // Write-behind of FtpDataTransfer: a few chunks above the socket buffer
+    while(m_sent < m_toSend && m_pSender->bytesToWrite() < m_tuning->queueDepth() * m_chunk.size())
+    {
+        qint64 len = qMin<qint64>(m_chunk.size(), m_toSend - m_sent);
+
+        m_pSender->write(m_chunk.constData(), len);
+        m_sent += len;
+    }
+}
+
+static void usage()
+{
+    s_out << "Usage: bench_delay [--rtt msecs] [--mbit n] [--seconds n] [--netem]\n"
+          << "--netem sets the delay and rate on lo with tc (root, removed at exit).\n"
+          << "Without it, inject them yourself, for the defaults:\n"
+          << "  tc qdisc add dev lo root netem delay 75ms rate 100mbit limit 100000\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int rttMsecs = DEFAULT_RTT_MSECS;
+    int mbit = DEFAULT_MBIT;
+    int seconds = DEFAULT_SECONDS;
+    bool useNetem = false;
+
+    for(int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args.at(i);
+        int value = (i + 1 < args.size()) ? args.at(i + 1).toInt() : 0;
+
+        if("--netem" == arg)
+        {
+            useNetem = true;
+            continue;
+        }
+
+        if(value <= 0)
+        {
+            usage();
+            return 1;
+        }
+
+        if("--rtt" == arg)
+        {
+            rttMsecs = value;
+        }
+        else if("--mbit" == arg)
+        {
+            mbit = value;
+        }
+        else if("--seconds" == arg)
+        {
+            seconds = value;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    if(useNetem && !netem(QStringList() << "qdisc" << "replace" << "dev" << "lo" << "root" << "netem"
+                          << "delay" << QString("%1ms").arg(rttMsecs / 2)
+                          << "rate" << QString("%1mbit").arg(mbit)
+                          << "limit" << "100000"))
+    {
+        return 1;
+    }
+
+    // Enough data for the window to open, the link limit gives the time
+    qint64 linkBytesPerSec = (qint64)mbit * 1000 * 1000 / 8;
+    qint64 bytes = linkBytesPerSec * seconds;
+    int timeoutMsecs = 20 * seconds * 1000;
+
+    FtpSocketTuning untuned;
+    FtpSocketTuning tuned;
+    FtpSocketTuning lowat;
+
+    tuned.setBandwidth(linkBytesPerSec);
+    tuned.setRoundTripMsecs(rttMsecs);
+    lowat.setBandwidth(linkBytesPerSec);
+    lowat.setRoundTripMsecs(rttMsecs);
+    lowat.setNotSentLowat(128 * 1024);
+
+    QList<const FtpSocketTuning *> rows;
+    QStringList names;
+    rows << &untuned << &tuned << &lowat;
+    names << "System defaults" << "Tuned" << "Tuned, 128 KiB not-sent low mark";
+
+    s_out << "Link " << mbit << " Mbit/s x " << rttMsecs << " ms, "
+          << bytes / (1024 * 1024) << " MiB per run\n";
+
+    DelayBench bench;
+    int ret = 0;
+
+    for(int i = 0; i < rows.size(); i++)
+    {
+        qint64 connectMsecs = 0;
+        qint64 transferMsecs = 0;
+
+        s_out << names.at(i);
+        if(rows.at(i)->isTuned())
+        {
+            s_out << " (" << rows.at(i)->toString() << ")";
+        }
+        s_out << ": ";
+        s_out.flush();
+
+        if(!bench.run(*rows.at(i), bytes, timeoutMsecs, connectMsecs, transferMsecs))
+        {
+            s_out << "timed out\n";
+            ret = 1;
+            continue;
+        }
+
+        double bytesPerSec = (transferMsecs > 0) ? (double)bytes * 1000.0 / transferMsecs : 0.0;
+
+        s_out << QString("%1 Mbit/s, %2% of the link, connect %3 ms\n")
+                 .arg(bytesPerSec * 8 / (1000 * 1000), 0, 'f', 1)
+                 .arg(100.0 * bytesPerSec / linkBytesPerSec, 0, 'f', 0)
+                 .arg(connectMsecs);
+
+        // A connect well below the round trip means no delay on lo
+        if(0 == i && connectMsecs < rttMsecs / 2)
+        {
+            s_out << "  The connect took less than the round trip, is the delay injected?\n";
+        }
+    }
+
+    if(useNetem)
+    {
+        netem(QStringList() << "qdisc" << "del" << "dev" << "lo" << "root");
+    }
+
+    return ret;
+}
+
+#include "bench_delay.moc"
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Data connection throughput over a delayed loopback, not run by "make check"
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = bench_delay
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+include(../../FtpEngine.pri)
+
+SOURCES += \
+    bench_delay.cpp
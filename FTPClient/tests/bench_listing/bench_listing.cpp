@@ -0,0 +1,186 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           bench_listing.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Memory per entry and search time of a huge listing in
+                FtpListingStore and FtpListingIndex, against QUrlInfos
+**********************************************************************/
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+#include <QList>
+#include <QUrlInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include "FtpListingStore.h"
+#include "FtpListingIndex.h"
+
+namespace
+{
+    enum{
+        DEFAULT_ENTRIES = 500000,
+        NAME_KINDS = 5
+    };
+
+    QTextStream s_out(stdout);
+
+    // Resident set of this process in bytes, -1 where /proc is missing
+    qint64 residentBytes()
+    {
+        QFile status("/proc/self/status");
+
+        if(!status.open(QIODevice::ReadOnly))
+        {
+            return -1;
+        }
+
+        QList<QByteArray> lines = status.readAll().split('\n');
+        for(int i = 0; i < lines.size(); i++)
+        {
+            if(lines.at(i).startsWith("VmRSS:"))
+            {
+                // "VmRSS:    123456 kB"
+                return lines.at(i).mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+            }
+        }
+
+        return -1;
+    }
+
+    // Mix of names as seen on camera, backup and log servers
+    QUrlInfo entry(int i)
+    {
+        QUrlInfo info;
+        QString name;
+
+        switch(i % NAME_KINDS)
+        {
+        case 0:
+            name = QString("IMG_%1.JPG").arg(i, 7, 10, QChar('0'));
+            break;
+        case 1:
+            name = QString("report-%1-%2.pdf").arg(2000 + i % 25).arg(i);
+            break;
+        case 2:
+            name = QString("access.log.%1.gz").arg(i);
+            break;
+        case 3:
+            name = QString::fromUtf8("\xc3\x9c""bersicht Projekt %1.xlsx").arg(i);
+            break;
+        default:
+            name = QString("backup_%1").arg(i, 6, 16, QChar('0'));
+            break;
+        }
+
+        info.setName(name);
+        info.setSize((qint64)(i % 1000) * 4099);
+        info.setLastModified(QDateTime::fromTime_t(1500000000U + (uint)i * 7));
+        info.setPermissions(0644);
+        info.setDir(NAME_KINDS - 1 == i % NAME_KINDS);
+        info.setFile(NAME_KINDS - 1 != i % NAME_KINDS);
+
+        return info;
+    }
+
+    QString perEntry(qint64 bytes, int entries)
+    {
+        if(bytes < 0)
+        {
+            return QString("n/a");
+        }
+
+        return QString("%1 bytes/entry (%2 MB)")
+                .arg((double)bytes / entries, 0, 'f', 1)
+                .arg((double)bytes / (1024 * 1024), 0, 'f', 1);
+    }
+
+    qint64 delta(qint64 before, qint64 after)
+    {
+        return (before < 0 || after < 0) ? -1 : after - before;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    int entries = DEFAULT_ENTRIES;
+    QElapsedTimer timer;
+
+    if(3 == args.size() && "--entries" == args.at(1) && args.at(2).toInt() > 0)
+    {
+        entries = args.at(2).toInt();
+    }
+    else if(1 != args.size())
+    {
+        s_out << "Usage: bench_listing [--entries n]\n";
+        return 1;
+    }
+
+    s_out << "Entries: " << entries << "\n";
+
+    // Store, filled as FtpClient::addToList does, squeezed when LIST is done
+    FtpListingStore store;
+    qint64 rss0 = residentBytes();
+
+    timer.start();
+    for(int i = 0; i < entries; i++)
+    {
+        store.add(entry(i));
+    }
+    store.squeeze();
+    qint64 addMsecs = timer.elapsed();
+    qint64 rss1 = residentBytes();
+
+    s_out << "Store: " << addMsecs << " ms to add, own count "
+          << perEntry(store.memoryUsage(), entries)
+          << ", resident " << perEntry(delta(rss0, rss1), entries) << "\n";
+
+    // Index of the filter box
+    FtpListingIndex index(&store);
+
+    timer.start();
+    index.sync();
+    qint64 syncMsecs = timer.elapsed();
+    qint64 rss2 = residentBytes();
+
+    s_out << "Index: " << syncMsecs << " ms to build, resident "
+          << perEntry(delta(rss1, rss2), entries) << "\n";
+
+    // Searches the filter box runs while typing
+    QStringList filters;
+    filters << "" << "I" << "IMG_00123" << "bersicht" << "*.gz" << "report-2013-*.pdf" << "zzz";
+
+    for(int i = 0; i < filters.size(); i++)
+    {
+        timer.start();
+        int found = index.find(filters.at(i), 5000).size();
+
+        s_out << "Find \"" << filters.at(i) << "\": " << found << " shown, "
+              << timer.nsecsElapsed() / 1000 << " us\n";
+    }
+
+    // Same entries as QUrlInfos, as the list kept them before the store
+    QList<QUrlInfo> infos;
+
+    timer.start();
+    for(int i = 0; i < entries; i++)
+    {
+        infos.append(entry(i));
+    }
+    qint64 listMsecs = timer.elapsed();
+    qint64 rss3 = residentBytes();
+
+    s_out << "QList<QUrlInfo>: " << listMsecs << " ms to add, resident "
+          << perEntry(delta(rss2, rss3), entries) << "\n";
+
+    if(rss0 < 0)
+    {
+        s_out << "No /proc/self/status, resident sizes are not measured\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Memory and search time of a 500k entry listing, not run by "make check"
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = bench_listing
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+include(../../FtpEngine.pri)
+
+SOURCES += \
+    bench_listing.cpp
@@ -0,0 +1,488 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           bench_tls.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Cost of TLS on the loopback: handshakes of data
+                connections and throughput per cipher
+**********************************************************************/
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextStream>
+#include <QFile>
+#include <QSslSocket>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QSslCipher>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QtAlgorithms>
+#include "FtpTlsSession.h"
+#include "FtpListenerPool.h"
+
+namespace
+{
+    enum{
+        DEFAULT_HANDSHAKES = 100,
+        DEFAULT_MEGABYTES = 256,
+        CHUNKS_IN_FLIGHT = 4,
+        TIMEOUT_MSECS = 60000
+    };
+
+    QTextStream s_out(stdout);
+
+    // Nearest rank of sorted values
+    qint64 percentile(const QList<qint64> &sorted, int percent)
+    {
+        int rank = (percent * sorted.size() + 99) / 100;
+
+        return sorted.isEmpty() ? -1 : sorted.at(qBound(0, rank - 1, sorted.size() - 1));
+    }
+
+    // Run the event loop until done is set, sleeping while nothing happens
+    bool spin(const bool &done, int msecs = TIMEOUT_MSECS)
+    {
+        QElapsedTimer timer;
+        QTimer wake;
+
+        // Wakes the loop up to check the time
+        wake.start(100);
+
+        timer.start();
+        while(!done && timer.elapsed() < msecs)
+        {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+        }
+
+        return done;
+    }
+}
+
+
+// Client and server in one thread: a throughput figure is encryption
+// plus decryption on one core, a handshake is both sides of it
+class TlsBench : public QObject
+{
+    Q_OBJECT
+public:
+    TlsBench(const QSslCertificate &certificate, const QSslKey &key);
+
+    // Full handshakes on a new listener each, as FtpTlsSession does for
+    // every data connection. Microseconds from connect to encrypted
+    bool handshakes(int count, QList<qint64> &usecs);
+
+    // Bytes from client to server over one connection, plain TCP if
+    // tls is false. cipherName gets the negotiated cipher
+    bool throughput(bool tls, const QList<QSslCipher> &ciphers, bool forceTls12,
+                    qint64 bytes, qint64 &usecs, QString &cipherName);
+
+private slots:
+    void dealAccepted(int descriptor);
+    void dealClientReady();
+    void dealServerReady();
+    void dealServerReadyRead();
+    void dealClientBytesWritten();
+    void dealSslErrors();
+
+private:
+    QSslCertificate m_certificate;
+    QSslKey m_key;
+
+    bool m_tls;
+    QSslSocket *m_pClient;
+    QSslSocket *m_pServer;
+    bool m_clientReady;
+    bool m_serverReady;
+
+    QByteArray m_chunk;
+    qint64 m_toSend;
+    qint64 m_sent;
+    qint64 m_received;
+    bool m_allReceived;
+
+    bool connectPair(const QList<QSslCipher> &ciphers, bool forceTls12);
+    void dropPair();
+    void fill();
+};
+
+TlsBench::TlsBench(const QSslCertificate &certificate, const QSslKey &key) :
+    QObject(),
+    m_certificate(certificate),
+    m_key(key),
+    m_tls(true),
+    m_pClient(NULL),
+    m_pServer(NULL),
+    m_clientReady(false),
+    m_serverReady(false),
+    m_chunk(FtpTlsSession::TLS_DATA_CHUNK_SIZE, 'x'),
+    m_toSend(0),
+    m_sent(0),
+    m_received(0),
+    m_allReceived(false)
+{
+}
+
+bool TlsBench::handshakes(int count, QList<qint64> &usecs)
+{
+    QElapsedTimer timer;
+
+    m_tls = true;
+    usecs.clear();
+
+    for(int i = 0; i < count; i++)
+    {
+        timer.start();
+        if(!connectPair(FtpTlsSession::preferredCiphers(), false))
+        {
+            dropPair();
+            return false;
+        }
+        usecs.append(timer.nsecsElapsed() / 1000);
+
+        dropPair();
+    }
+
+    qSort(usecs);
+
+    return true;
+}
+
+bool TlsBench::throughput(bool tls, const QList<QSslCipher> &ciphers, bool forceTls12,
+                          qint64 bytes, qint64 &usecs, QString &cipherName)
+{
+    QElapsedTimer timer;
+
+    m_tls = tls;
+    if(!connectPair(ciphers, forceTls12))
+    {
+        dropPair();
+        return false;
+    }
+
+    cipherName = tls ? m_pClient->sessionCipher().name() : QString("none");
+
+    m_toSend = bytes;
+    m_sent = 0;
+    m_received = 0;
+    m_allReceived = false;
+
+    timer.start();
+    fill();
+    if(!spin(m_allReceived))
+    {
+        dropPair();
+        return false;
+    }
+    usecs = timer.nsecsElapsed() / 1000;
+
+    dropPair();
+
+    return true;
+}
+
+bool TlsBench::connectPair(const QList<QSslCipher> &ciphers, bool forceTls12)
+{
+    FtpListener listener;
+
+    m_clientReady = false;
+    m_serverReady = false;
+
+    connect(&listener, SIGNAL(accepted(int)), this, SLOT(dealAccepted(int)));
+    if(!listener.listen(QHostAddress::LocalHost))
+    {
+        return false;
+    }
+
+    m_pClient = new QSslSocket(this);
+    connect(m_pClient, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(dealSslErrors()));
+
+    if(!m_tls)
+    {
+        connect(m_pClient, SIGNAL(connected()), this, SLOT(dealClientReady()));
+        m_pClient->connectToHost(QHostAddress(QHostAddress::LocalHost), listener.serverPort());
+    }
+    else
+    {
+        QSslConfiguration config = m_pClient->sslConfiguration();
+
+        // Self-signed, as FtpTlsSession with verifyPeer false
+        config.setCiphers(ciphers);
+        config.setPeerVerifyMode(QSslSocket::VerifyNone);
+#if QT_VERSION >= 0x050000
+        if(forceTls12)
+        {
+            // TLS 1.3 picks its suites apart from the cipher list
+            config.setProtocol(QSsl::TlsV1_2);
+        }
+#else
+        Q_UNUSED(forceTls12);
+#endif
+        m_pClient->setSslConfiguration(config);
+
+        connect(m_pClient, SIGNAL(encrypted()), this, SLOT(dealClientReady()));
+        m_pClient->connectToHostEncrypted("127.0.0.1", listener.serverPort());
+    }
+
+    // Both ends must be done, the server may still owe its Finished
+    return spin(m_clientReady) && spin(m_serverReady);
+}
+
+void TlsBench::dropPair()
+{
+    delete m_pClient;
+    delete m_pServer;
+    m_pClient = NULL;
+    m_pServer = NULL;
+}
+
+void TlsBench::dealAccepted(int descriptor)
+{
+    m_pServer = new QSslSocket(this);
+    connect(m_pServer, SIGNAL(readyRead()), this, SLOT(dealServerReadyRead()));
+    connect(m_pServer, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(dealSslErrors()));
+
+    m_pServer->setSocketDescriptor(descriptor);
+    if(!m_tls)
+    {
+        m_serverReady = true;
+        return;
+    }
+
+    connect(m_pServer, SIGNAL(encrypted()), this, SLOT(dealServerReady()));
+    m_pServer->setLocalCertificate(m_certificate);
+    m_pServer->setPrivateKey(m_key);
+    m_pServer->startServerEncryption();
+}
+
+void TlsBench::dealClientReady()
+{
+    m_clientReady = true;
+}
+
+void TlsBench::dealServerReady()
+{
+    m_serverReady = true;
+}
+
+void TlsBench::dealServerReadyRead()
+{
+    m_received += m_pServer->readAll().size();
+
+    if(m_toSend > 0 && m_received >= m_toSend)
+    {
+        m_allReceived = true;
+    }
+}
+
+void TlsBench::dealClientBytesWritten()
+{
+    fill();
+}
+
+void TlsBench::dealSslErrors()
+{
+    // Self-signed certificate of the loopback server
+    QSslSocket *socket = qobject_cast<QSslSocket *>(sender());
+
+    if(NULL != socket)
+    {
+        socket->ignoreSslErrors();
+    }
+}
+
+void TlsBench::fill()
+{
+    if(NULL == m_pClient)
+    {
+        return;
+    }
+
+    if(0 == m_sent)
+    {
+        connect(m_pClient, SIGNAL(bytesWritten(qint64)), this, SLOT(dealClientBytesWritten()),
+                Qt::UniqueConnection);
+    }
+
+    // Keep a few chunks queued, as FtpTlsSession::writeChunk does
+    while(m_sent < m_toSend && m_pClient->bytesToWrite() < CHUNKS_IN_FLIGHT * m_chunk.size())
+    {
+        qint64 len = qMin<qint64>(m_chunk.size(), m_toSend - m_sent);
+
+        m_pClient->write(m_chunk.constData(), len);
+        m_sent += len;
+    }
+}
+
+// Cipher of preferredCiphers() named part, or the first with name
+// containing part and not other
+static QSslCipher findCipher(const QString &part, const QString &other = QString())
+{
+    QList<QSslCipher> ciphers = FtpTlsSession::preferredCiphers();
+
+    for(int i = 0; i < ciphers.size(); i++)
+    {
+        if(ciphers.at(i).name() == part)
+        {
+            return ciphers.at(i);
+        }
+    }
+
+    for(int i = 0; i < ciphers.size(); i++)
+    {
+        QString name = ciphers.at(i).name();
+
+        if(name.contains(part) && (other.isEmpty() || !name.contains(other)))
+        {
+            return ciphers.at(i);
+        }
+    }
+
+    return QSslCipher();
+}
+
+static void usage()
+{
+    s_out << "Usage: bench_tls [--cert file --key file] [--handshakes n] [--megabytes n] [--cipher name]...\n"
+          << "Without --cipher the first AES-GCM and the first AES-CBC cipher are measured\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    QString certPath = QString(BENCH_TLS_SRCDIR) + "/certs/localhost.crt";
+    QString keyPath = QString(BENCH_TLS_SRCDIR) + "/certs/localhost.key";
+    int handshakeCount = DEFAULT_HANDSHAKES;
+    qint64 bytes = (qint64)DEFAULT_MEGABYTES * 1024 * 1024;
+    QStringList cipherNames;
+
+    for(int i = 1; i < args.size(); i++)
+    {
+        const QString &arg = args.at(i);
+        QString value = (i + 1 < args.size()) ? args.at(i + 1) : QString();
+
+        if("--cert" == arg && !value.isEmpty())
+        {
+            certPath = value;
+        }
+        else if("--key" == arg && !value.isEmpty())
+        {
+            keyPath = value;
+        }
+        else if("--handshakes" == arg && value.toInt() > 0)
+        {
+            handshakeCount = value.toInt();
+        }
+        else if("--megabytes" == arg && value.toInt() > 0)
+        {
+            bytes = (qint64)value.toInt() * 1024 * 1024;
+        }
+        else if("--cipher" == arg && !value.isEmpty())
+        {
+            cipherNames.append(value);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+
+    if(!QSslSocket::supportsSsl())
+    {
+        s_out << "No TLS support in this Qt build\n";
+        return 1;
+    }
+
+    QFile certFile(certPath);
+    QFile keyFile(keyPath);
+    if(!certFile.open(QIODevice::ReadOnly) || !keyFile.open(QIODevice::ReadOnly))
+    {
+        s_out << "Cannot read " << certPath << " or " << keyPath << "\n";
+        return 1;
+    }
+
+    QSslCertificate certificate(certFile.readAll(), QSsl::Pem);
+    QSslKey key(keyFile.readAll(), QSsl::Rsa, QSsl::Pem);
+    TlsBench bench(certificate, key);
+
+    // Handshakes, the cost FTPS adds to every data connection
+    QList<qint64> usecs;
+    if(!bench.handshakes(handshakeCount, usecs))
+    {
+        s_out << "Handshake failed\n";
+        return 1;
+    }
+    s_out << QString("Handshakes: %1, p50 %2 us, p90 %3 us, p99 %4 us\n")
+             .arg(usecs.size())
+             .arg(percentile(usecs, 50))
+             .arg(percentile(usecs, 90))
+             .arg(percentile(usecs, 99));
+
+    // Throughput, plain TCP is the baseline
+    QList<QList<QSslCipher> > rows;
+    QList<bool> rowTls;
+    QList<bool> rowForced;
+
+    rows.append(QList<QSslCipher>());
+    rowTls.append(false);
+    rowForced.append(false);
+    rows.append(FtpTlsSession::preferredCiphers());
+    rowTls.append(true);
+    rowForced.append(false);
+
+    if(cipherNames.isEmpty())
+    {
+        QSslCipher gcm = findCipher("GCM");
+        QSslCipher cbc = findCipher("AES", "GCM");
+
+        if(!gcm.isNull())
+        {
+            cipherNames.append(gcm.name());
+        }
+        if(!cbc.isNull())
+        {
+            cipherNames.append(cbc.name());
+        }
+    }
+
+    for(int i = 0; i < cipherNames.size(); i++)
+    {
+        QSslCipher cipher = findCipher(cipherNames.at(i));
+
+        if(cipher.isNull())
+        {
+            s_out << "Unknown cipher " << cipherNames.at(i) << "\n";
+            continue;
+        }
+
+        rows.append(QList<QSslCipher>() << cipher);
+        rowTls.append(true);
+        rowForced.append(true);
+    }
+
+    for(int i = 0; i < rows.size(); i++)
+    {
+        qint64 elapsed = 0;
+        QString cipherName;
+
+        if(!bench.throughput(rowTls.at(i), rows.at(i), rowForced.at(i), bytes, elapsed, cipherName))
+        {
+            s_out << "Transfer failed, row " << i << "\n";
+            continue;
+        }
+
+        s_out << QString("%1 %2: %3 MB in %4 ms, %5 MB/s\n")
+                 .arg(rowTls.at(i) ? "TLS " : "TCP ")
+                 .arg(cipherName, -32)
+                 .arg(bytes / (1024 * 1024))
+                 .arg(elapsed / 1000)
+                 .arg(elapsed > 0 ? (double)bytes / elapsed * 1000000.0 / (1024 * 1024) : 0.0, 0, 'f', 1);
+    }
+
+    return 0;
+}
+
+#include "bench_tls.moc"
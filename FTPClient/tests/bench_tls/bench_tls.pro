@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# TLS handshake and throughput on the loopback, not run by "make check"
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = bench_tls
+TEMPLATE = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+include(../../FtpEngine.pri)
+
+# Self-signed localhost certificate of the loopback server
+DEFINES += BENCH_TLS_SRCDIR=\\\"$$PWD\\\"
+
+SOURCES += \
+    bench_tls.cpp
+
+OTHER_FILES += \
+    certs/localhost.crt \
+    certs/localhost.key
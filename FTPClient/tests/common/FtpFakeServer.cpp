@@ -0,0 +1,1174 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpFakeServer.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Scriptable in-memory FTP server for the tests
+**********************************************************************/
+
+#include "FtpFakeServer.h"
+#include <QDir>
+#include <QRegExp>
+
+#ifdef Q_OS_WIN
+#include <winsock2.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+
+FtpFakeServer::FtpFakeServer(QObject *parent) :
+    QObject(parent),
+    m_server(this),
+    m_dataRate(0),
+    m_splitReplies(false),
+    m_sessionCount(0),
+    m_activeSessions(0),
+    m_maxActiveSessions(0)
+{
+    m_dirs.insert("/");
+    m_features << "SIZE" << "MDTM" << "REST STREAM";
+
+    connect(&m_server, SIGNAL(newConnection()), this, SLOT(dealNewConnection()));
+}
+
+FtpFakeServer::~FtpFakeServer()
+{
+    m_server.close();
+}
+
+bool FtpFakeServer::listen(const QHostAddress &address, quint16 port)
+{
+    return m_server.listen(address, port);
+}
+
+QHostAddress FtpFakeServer::serverAddress() const
+{
+    return m_server.serverAddress();
+}
+
+quint16 FtpFakeServer::serverPort() const
+{
+    return m_server.serverPort();
+}
+
+void FtpFakeServer::addFile(const QString &path, const QByteArray &data)
+{
+    QString filePath = cleanPath(path);
+
+    m_files.insert(filePath, data);
+    addDir(filePath.left(filePath.lastIndexOf('/')));
+}
+
+void FtpFakeServer::addDir(const QString &path)
+{
+    QString dir = cleanPath(path);
+
+    while("/" != dir)
+    {
+        m_dirs.insert(dir);
+        dir = cleanPath(dir.left(dir.lastIndexOf('/')));
+    }
+}
+
+bool FtpFakeServer::hasFile(const QString &path) const
+{
+    return m_files.contains(cleanPath(path));
+}
+
+bool FtpFakeServer::hasDir(const QString &path) const
+{
+    return m_dirs.contains(cleanPath(path));
+}
+
+QByteArray FtpFakeServer::file(const QString &path) const
+{
+    return m_files.value(cleanPath(path));
+}
+
+void FtpFakeServer::setFeatures(const QStringList &features)
+{
+    m_features = features;
+}
+
+void FtpFakeServer::scriptReply(const QString &verb, int code, const QString &text, int times)
+{
+    Fault_Info fault;
+
+    fault.type = FAULT_REPLY;
+    fault.code = code;
+    fault.text = text;
+
+    for(int i = 0; i < times; i++)
+    {
+        m_faults[verb.toUpper()].append(fault);
+    }
+}
+
+void FtpFakeServer::scriptDropData(const QString &verb, qint64 afterBytes)
+{
+    Fault_Info fault;
+
+    fault.type = FAULT_DROP_DATA;
+    fault.afterBytes = afterBytes;
+
+    m_faults[verb.toUpper()].append(fault);
+}
+
+void FtpFakeServer::scriptResetData(const QString &verb, qint64 afterBytes)
+{
+    Fault_Info fault;
+
+    fault.type = FAULT_RESET_DATA;
+    fault.afterBytes = afterBytes;
+
+    m_faults[verb.toUpper()].append(fault);
+}
+
+void FtpFakeServer::setDataRate(qint64 bytesPerSec)
+{
+    m_dataRate = qMax<qint64>(bytesPerSec, 0);
+}
+
+qint64 FtpFakeServer::dataRate() const
+{
+    return m_dataRate;
+}
+
+void FtpFakeServer::setSplitReplies(bool split)
+{
+    m_splitReplies = split;
+}
+
+bool FtpFakeServer::splitReplies() const
+{
+    return m_splitReplies;
+}
+
+QStringList FtpFakeServer::commands() const
+{
+    return m_commands;
+}
+
+int FtpFakeServer::commandCount(const QString &verb) const
+{
+    int count = 0;
+
+    for(int i = 0; i < m_commands.size(); i++)
+    {
+        const QString &command = m_commands.at(i);
+
+        if(command == verb || command.startsWith(verb + " "))
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void FtpFakeServer::clearCommands()
+{
+    m_commands.clear();
+}
+
+int FtpFakeServer::sessionCount() const
+{
+    return m_sessionCount;
+}
+
+int FtpFakeServer::activeSessions() const
+{
+    return m_activeSessions;
+}
+
+int FtpFakeServer::maxActiveSessions() const
+{
+    return m_maxActiveSessions;
+}
+
+void FtpFakeServer::dealNewConnection()
+{
+    while(m_server.hasPendingConnections())
+    {
+        FtpFakeSession *session = new FtpFakeSession(this, m_server.nextPendingConnection());
+
+        connect(session, SIGNAL(closed()), this, SLOT(dealSessionClosed()));
+
+        m_sessionCount++;
+        m_activeSessions++;
+        m_maxActiveSessions = qMax(m_maxActiveSessions, m_activeSessions);
+    }
+}
+
+void FtpFakeServer::dealSessionClosed()
+{
+    m_activeSessions--;
+
+    sender()->deleteLater();
+}
+
+bool FtpFakeServer::takeFault(const QString &verb, bool dataFault, Fault_Info &fault)
+{
+    QHash<QString, QList<Fault_Info> >::iterator it = m_faults.find(verb);
+
+    if(it == m_faults.end())
+    {
+        return false;
+    }
+
+    for(int i = 0; i < it.value().size(); i++)
+    {
+        if((FAULT_REPLY != it.value().at(i).type) == dataFault)
+        {
+            fault = it.value().takeAt(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FtpFakeServer::recordCommand(const QString &command)
+{
+    m_commands.append(command);
+
+    // Emit signal
+    emit commandReceived(command);
+}
+
+QString FtpFakeServer::cleanPath(const QString &path)
+{
+    QString clean = QDir::cleanPath(QString("/") + path);
+
+    while(clean.startsWith("//"))
+    {
+        clean.remove(0, 1);
+    }
+
+    return clean.isEmpty() ? QString("/") : clean;
+}
+
+
+FtpFakeSession::FtpFakeSession(FtpFakeServer *server, QTcpSocket *control) :
+    QObject(server),
+    m_server(server),
+    m_control(control),
+    m_cwd("/"),
+    m_restOffset(0),
+    m_pPassive(NULL),
+    m_activePort(0),
+    m_dataReady(false),
+    m_dataClosed(false),
+    m_transfer(TRANSFER_NONE),
+    m_transferStarted(false),
+    m_sendPos(0),
+    m_storeOffset(0),
+    m_sendDone(false),
+    m_hasFault(false),
+    m_rateTimer(this),
+    m_replyTimer(this),
+    m_closeAfterReplies(false)
+{
+    m_control->setParent(this);
+
+    connect(m_control, SIGNAL(readyRead()), this, SLOT(dealControlReadyRead()));
+    connect(m_control, SIGNAL(disconnected()), this, SLOT(dealControlDisconnected()));
+
+    m_rateTimer.setInterval(FtpFakeServer::RATE_TICK_MSECS);
+    connect(&m_rateTimer, SIGNAL(timeout()), this, SLOT(dealRateTick()));
+
+    m_replyTimer.setInterval(1);
+    connect(&m_replyTimer, SIGNAL(timeout()), this, SLOT(dealReplyTick()));
+
+    // Each piece of a split reply in its own segment
+    if(m_server->splitReplies())
+    {
+        m_control->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    }
+
+    reply(220, "Fake FTP server ready.");
+}
+
+FtpFakeSession::~FtpFakeSession()
+{
+    closeData();
+}
+
+void FtpFakeSession::dealControlReadyRead()
+{
+    while(!m_closeAfterReplies && m_control->canReadLine())
+    {
+        QString line = QString::fromUtf8(m_control->readLine()).trimmed();
+
+        if(!line.isEmpty())
+        {
+            dealCommand(line);
+        }
+    }
+}
+
+void FtpFakeSession::dealControlDisconnected()
+{
+    m_rateTimer.stop();
+    m_replyTimer.stop();
+    closeData();
+
+    // Emit signal
+    emit closed();
+}
+
+void FtpFakeSession::dealCommand(const QString &line)
+{
+    int space = line.indexOf(' ');
+    QString verb = ((space < 0) ? line : line.left(space)).toUpper();
+    QString arg = (space < 0) ? QString() : line.mid(space + 1);
+    FtpFakeServer::Fault_Info fault;
+
+    m_server->recordCommand(arg.isEmpty() ? verb : verb + " " + arg);
+
+    if(m_server->takeFault(verb, false, fault))
+    {
+        // A failed transfer gives up its data connection
+        if("RETR" == verb || "STOR" == verb || "APPE" == verb || "LIST" == verb || "NLST" == verb)
+        {
+            closeData();
+            m_restOffset = 0;
+        }
+
+        reply(fault.code, fault.text);
+
+        if(421 == fault.code)
+        {
+            closeControl();
+        }
+        return;
+    }
+
+    if("USER" == verb)
+    {
+        reply(331, "Please specify the password.");
+    }
+    else if("PASS" == verb)
+    {
+        reply(230, "Login successful.");
+    }
+    else if("SYST" == verb)
+    {
+        reply(215, "UNIX Type: L8");
+    }
+    else if("FEAT" == verb)
+    {
+        QStringList lines;
+
+        if(m_server->m_features.isEmpty())
+        {
+            reply(502, "Command not implemented.");
+            return;
+        }
+
+        lines << "Features:";
+        for(int i = 0; i < m_server->m_features.size(); i++)
+        {
+            lines << " " + m_server->m_features.at(i);
+        }
+        lines << "End";
+
+        replyLines(211, lines);
+    }
+    else if("OPTS" == verb || "TYPE" == verb || "STRU" == verb || "NOOP" == verb)
+    {
+        reply(200, QString("%1 ok.").arg(verb));
+    }
+    else if("MODE" == verb)
+    {
+        if("S" == arg.toUpper())
+        {
+            reply(200, "Mode set to S.");
+        }
+        else
+        {
+            reply(504, "Bad MODE command.");
+        }
+    }
+    else if("ALLO" == verb)
+    {
+        reply(202, "ALLO command ignored.");
+    }
+    else if("PWD" == verb || "XPWD" == verb)
+    {
+        reply(257, QString("\"%1\" is the current directory").arg(m_cwd));
+    }
+    else if("CWD" == verb || "CDUP" == verb)
+    {
+        QString path = resolve(("CDUP" == verb) ? QString("..") : arg);
+
+        if(m_server->m_dirs.contains(path))
+        {
+            m_cwd = path;
+            reply(250, "Directory successfully changed.");
+        }
+        else
+        {
+            reply(550, "Failed to change directory.");
+        }
+    }
+    else if("MKD" == verb)
+    {
+        QString path = resolve(arg);
+
+        if(m_server->m_dirs.contains(path) || m_server->m_files.contains(path))
+        {
+            reply(550, "Create directory operation failed.");
+        }
+        else
+        {
+            m_server->addDir(path);
+            reply(257, QString("\"%1\" created").arg(path));
+        }
+    }
+    else if("RMD" == verb)
+    {
+        QString path = resolve(arg);
+
+        if("/" == path || !m_server->m_dirs.contains(path))
+        {
+            reply(550, "Remove directory operation failed.");
+        }
+        else
+        {
+            m_server->m_dirs.remove(path);
+            reply(250, "Remove directory operation successful.");
+        }
+    }
+    else if("DELE" == verb)
+    {
+        if(0 == m_server->m_files.remove(resolve(arg)))
+        {
+            reply(550, "Delete operation failed.");
+        }
+        else
+        {
+            reply(250, "Delete operation successful.");
+        }
+    }
+    else if("RNFR" == verb)
+    {
+        QString path = resolve(arg);
+
+        if(m_server->m_files.contains(path) || m_server->m_dirs.contains(path))
+        {
+            m_renameFrom = path;
+            reply(350, "Ready for RNTO.");
+        }
+        else
+        {
+            reply(550, "RNFR command failed.");
+        }
+    }
+    else if("RNTO" == verb)
+    {
+        QString path = resolve(arg);
+
+        if(m_renameFrom.isEmpty())
+        {
+            reply(503, "RNFR required first.");
+            return;
+        }
+
+        if(m_server->m_files.contains(m_renameFrom))
+        {
+            m_server->m_files.insert(path, m_server->m_files.take(m_renameFrom));
+        }
+        else
+        {
+            m_server->m_dirs.remove(m_renameFrom);
+            m_server->addDir(path);
+        }
+
+        m_renameFrom.clear();
+        reply(250, "Rename successful.");
+    }
+    else if("SIZE" == verb)
+    {
+        QString path = resolve(arg);
+
+        if(m_server->m_files.contains(path))
+        {
+            reply(213, QString::number(m_server->m_files.value(path).size()));
+        }
+        else
+        {
+            reply(550, "Could not get file size.");
+        }
+    }
+    else if("MDTM" == verb)
+    {
+        if(m_server->m_files.contains(resolve(arg)))
+        {
+            reply(213, "20200101000000");
+        }
+        else
+        {
+            reply(550, "Could not get file modification time.");
+        }
+    }
+    else if("REST" == verb)
+    {
+        bool ok = false;
+        qint64 offset = arg.toLongLong(&ok);
+
+        if(!ok || offset < 0)
+        {
+            reply(501, "Invalid REST parameter.");
+            return;
+        }
+
+        m_restOffset = offset;
+        reply(350, QString("Restart position accepted (%1).").arg(offset));
+    }
+    else if("PASV" == verb || "EPSV" == verb)
+    {
+        QHostAddress address = m_control->localAddress();
+        quint32 ip = address.toIPv4Address();
+        quint16 port = 0;
+
+        closeData();
+
+        m_pPassive = new QTcpServer(this);
+        connect(m_pPassive, SIGNAL(newConnection()), this, SLOT(dealPassiveConnection()));
+
+        if(!m_pPassive->listen(address, 0))
+        {
+            reply(425, "Can't open passive connection.");
+            return;
+        }
+
+        port = m_pPassive->serverPort();
+
+        if("EPSV" == verb)
+        {
+            reply(229, QString("Entering Extended Passive Mode (|||%1|)").arg(port));
+        }
+        else
+        {
+            reply(227, QString("Entering Passive Mode (%1,%2,%3,%4,%5,%6).")
+                  .arg((ip >> 24) & 0xff).arg((ip >> 16) & 0xff)
+                  .arg((ip >> 8) & 0xff).arg(ip & 0xff)
+                  .arg(port >> 8).arg(port & 0xff));
+        }
+    }
+    else if("PORT" == verb)
+    {
+        QRegExp portRx("(\\d+),(\\d+),(\\d+),(\\d+),(\\d+),(\\d+)");
+
+        if(portRx.indexIn(arg) < 0)
+        {
+            reply(501, "Illegal PORT command.");
+            return;
+        }
+
+        closeData();
+
+        m_activeAddress = QHostAddress(QString("%1.%2.%3.%4")
+                                       .arg(portRx.cap(1)).arg(portRx.cap(2))
+                                       .arg(portRx.cap(3)).arg(portRx.cap(4)));
+        m_activePort = (quint16)(portRx.cap(5).toInt() * 256 + portRx.cap(6).toInt());
+
+        reply(200, "PORT command successful.");
+    }
+    else if("EPRT" == verb)
+    {
+        // "|1|127.0.0.1|port|", any delimiter
+        QStringList parts = arg.isEmpty() ? QStringList() : arg.split(arg.at(0));
+
+        if(parts.size() < 4 || QHostAddress(parts.at(2)).isNull())
+        {
+            reply(501, "Illegal EPRT command.");
+            return;
+        }
+
+        closeData();
+
+        m_activeAddress = QHostAddress(parts.at(2));
+        m_activePort = (quint16)parts.at(3).toInt();
+
+        reply(200, "EPRT command successful.");
+    }
+    else if("RETR" == verb)
+    {
+        QString path = resolve(arg);
+
+        if(!m_server->m_files.contains(path))
+        {
+            closeData();
+            m_restOffset = 0;
+            reply(550, "Failed to open file.");
+            return;
+        }
+
+        m_sendData = m_server->m_files.value(path).mid((int)m_restOffset);
+        beginTransfer(TRANSFER_SEND, verb, path);
+    }
+    else if("LIST" == verb || "NLST" == verb)
+    {
+        QStringList args = arg.split(' ', QString::SkipEmptyParts);
+        QString path;
+
+        // "LIST -la" options
+        while(!args.isEmpty() && args.first().startsWith('-'))
+        {
+            args.removeFirst();
+        }
+        path = resolve(args.join(" "));
+
+        m_sendData = listing(path);
+        if("NLST" == verb)
+        {
+            QStringList lines = QString::fromUtf8(m_sendData).split("\r\n", QString::SkipEmptyParts);
+
+            m_sendData.clear();
+            for(int i = 0; i < lines.size(); i++)
+            {
+                m_sendData.append(lines.at(i).section(' ', -1).toUtf8()).append("\r\n");
+            }
+        }
+        beginTransfer(TRANSFER_SEND, verb, path);
+    }
+    else if("STOR" == verb || "APPE" == verb)
+    {
+        QString path = resolve(arg);
+        QString parent = FtpFakeServer::cleanPath(path.left(path.lastIndexOf('/')));
+
+        if(!m_server->m_dirs.contains(parent) || m_server->m_dirs.contains(path))
+        {
+            closeData();
+            m_restOffset = 0;
+            reply(553, "Could not create file.");
+            return;
+        }
+
+        m_storeOffset = ("APPE" == verb) ? -1 : m_restOffset;
+        beginTransfer(TRANSFER_RECEIVE, verb, path);
+    }
+    else if("SITE" == verb)
+    {
+        reply(200, "SITE command ok.");
+    }
+    else if("ABOR" == verb)
+    {
+        // QFtp takes two replies to ABOR, the first ends the aborted command
+        if(TRANSFER_NONE != m_transfer)
+        {
+            if(TRANSFER_RECEIVE == m_transfer)
+            {
+                storeReceived();
+            }
+            finishTransfer(426, "Connection closed; transfer aborted.");
+        }
+        else
+        {
+            closeData();
+            reply(426, "Connection closed; transfer aborted.");
+        }
+
+        reply(226, "Abort successful.");
+    }
+    else if("QUIT" == verb)
+    {
+        reply(221, "Goodbye.");
+        closeControl();
+    }
+    else
+    {
+        reply(502, "Command not implemented.");
+    }
+}
+
+void FtpFakeSession::reply(int code, const QString &text)
+{
+    writeControl(QString("%1 %2\r\n").arg(code).arg(text).toUtf8());
+}
+
+void FtpFakeSession::replyLines(int code, const QStringList &lines)
+{
+    QByteArray data;
+
+    for(int i = 0; i < lines.size(); i++)
+    {
+        if(lines.size() - 1 == i)
+        {
+            data.append(QString("%1 %2\r\n").arg(code).arg(lines.at(i)).toUtf8());
+        }
+        else if(0 == i)
+        {
+            data.append(QString("%1-%2\r\n").arg(code).arg(lines.at(i)).toUtf8());
+        }
+        else
+        {
+            data.append(lines.at(i).toUtf8()).append("\r\n");
+        }
+    }
+
+    writeControl(data);
+}
+
+void FtpFakeSession::writeControl(const QByteArray &data)
+{
+    if(!m_server->splitReplies())
+    {
+        m_control->write(data);
+        return;
+    }
+
+    m_replyQueue.append(data);
+    if(!m_replyTimer.isActive())
+    {
+        m_replyTimer.start();
+    }
+}
+
+void FtpFakeSession::dealReplyTick()
+{
+    m_control->write(m_replyQueue.left(FtpFakeServer::SPLIT_REPLY_BYTES));
+    m_control->flush();
+    m_replyQueue.remove(0, FtpFakeServer::SPLIT_REPLY_BYTES);
+
+    if(!m_replyQueue.isEmpty())
+    {
+        return;
+    }
+
+    m_replyTimer.stop();
+
+    if(m_closeAfterReplies)
+    {
+        m_control->disconnectFromHost();
+    }
+}
+
+void FtpFakeSession::closeControl()
+{
+    m_closeAfterReplies = true;
+
+    // Pending replies go out first
+    if(m_replyQueue.isEmpty())
+    {
+        m_control->disconnectFromHost();
+    }
+}
+
+void FtpFakeSession::beginTransfer(int direction, const QString &verb, const QString &path)
+{
+    m_transfer = direction;
+    m_transferStarted = false;
+    m_transferVerb = verb;
+    m_transferPath = path;
+    m_sendPos = 0;
+    m_sendDone = false;
+    m_received.clear();
+    m_hasFault = m_server->takeFault(verb, true, m_fault);
+    m_restOffset = 0;
+
+    // Passive connection is up or still to come
+    if(m_dataReady)
+    {
+        startTransfer();
+        return;
+    }
+
+    if(NULL != m_pPassive)
+    {
+        return;
+    }
+
+    if(!m_activeAddress.isNull())
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+
+        attachData(socket);
+        socket->connectToHost(m_activeAddress, m_activePort);
+        return;
+    }
+
+    m_transfer = TRANSFER_NONE;
+    reply(425, "Use PORT or PASV first.");
+}
+
+void FtpFakeSession::attachData(QTcpSocket *socket)
+{
+    m_data = socket;
+    m_dataClosed = false;
+
+    connect(socket, SIGNAL(connected()), this, SLOT(dealDataConnected()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(dealDataReadyRead()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(dealDataBytesWritten()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(dealDataDisconnected()));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(dealDataError()));
+}
+
+void FtpFakeSession::dealPassiveConnection()
+{
+    QTcpSocket *socket = m_pPassive->nextPendingConnection();
+
+    if(NULL == socket)
+    {
+        return;
+    }
+
+    // One connection per PASV, the listener goes with closeData
+    socket->setParent(this);
+    if(!m_data.isNull())
+    {
+        socket->abort();
+        socket->deleteLater();
+        return;
+    }
+
+    attachData(socket);
+    m_dataReady = true;
+
+    if(TRANSFER_NONE != m_transfer)
+    {
+        startTransfer();
+    }
+}
+
+void FtpFakeSession::dealDataConnected()
+{
+    m_dataReady = true;
+
+    if(TRANSFER_NONE != m_transfer)
+    {
+        startTransfer();
+    }
+}
+
+void FtpFakeSession::startTransfer()
+{
+    qint64 chunk = m_server->dataRate() * FtpFakeServer::RATE_TICK_MSECS / 1000;
+
+    m_transferStarted = true;
+    reply(150, "Opening BINARY mode data connection.");
+
+    if(TRANSFER_SEND == m_transfer)
+    {
+        // Closed by the client before anything was sent
+        if(m_dataClosed)
+        {
+            finishTransfer(426, "Connection closed; transfer aborted.");
+            return;
+        }
+
+        if(m_server->dataRate() > 0)
+        {
+            m_rateTimer.start();
+        }
+        else
+        {
+            sendChunk();
+        }
+        return;
+    }
+
+    if(m_server->dataRate() > 0)
+    {
+        // Keep the rest in the socket buffers, the client sees a slow reader
+        m_data->setReadBufferSize(qMax<qint64>(chunk, 1));
+        m_rateTimer.start();
+    }
+    else
+    {
+        receiveChunk();
+    }
+}
+
+void FtpFakeSession::sendChunk()
+{
+    qint64 limit = m_sendData.size();
+    qint64 size = 0;
+
+    if(m_hasFault)
+    {
+        limit = qMin(limit, m_fault.afterBytes);
+    }
+
+    size = limit - m_sendPos;
+    if(m_server->dataRate() > 0)
+    {
+        size = qMin(size, qMax<qint64>(m_server->dataRate() * FtpFakeServer::RATE_TICK_MSECS / 1000, 1));
+    }
+
+    if(size > 0)
+    {
+        m_data->write(m_sendData.constData() + m_sendPos, size);
+        m_sendPos += size;
+    }
+
+    if(m_sendPos < limit)
+    {
+        return;
+    }
+
+    m_rateTimer.stop();
+    m_sendDone = true;
+
+    if(m_hasFault)
+    {
+        applyFault();
+        return;
+    }
+
+    // Flushed before the close, 226 follows in dealDataDisconnected
+    m_data->disconnectFromHost();
+}
+
+void FtpFakeSession::receiveChunk()
+{
+    qint64 size = m_data->bytesAvailable();
+
+    if(m_server->dataRate() > 0)
+    {
+        size = qMin(size, qMax<qint64>(m_server->dataRate() * FtpFakeServer::RATE_TICK_MSECS / 1000, 1));
+    }
+
+    if(m_hasFault)
+    {
+        size = qMin(size, m_fault.afterBytes - m_received.size());
+    }
+
+    if(size > 0)
+    {
+        m_received.append(m_data->read(size));
+    }
+
+    if(m_hasFault && m_received.size() >= m_fault.afterBytes)
+    {
+        applyFault();
+        return;
+    }
+
+    if(m_dataClosed && 0 == m_data->bytesAvailable())
+    {
+        storeReceived();
+        finishTransfer(226, "Transfer complete.");
+    }
+}
+
+void FtpFakeSession::storeReceived()
+{
+    QByteArray &stored = m_server->m_files[m_transferPath];
+
+    if(m_storeOffset >= 0)
+    {
+        stored.truncate((int)qMin<qint64>(m_storeOffset, stored.size()));
+    }
+
+    stored.append(m_received);
+    m_received.clear();
+}
+
+void FtpFakeSession::applyFault()
+{
+    if(TRANSFER_SEND == m_transfer)
+    {
+        if(FtpFakeServer::FAULT_DROP_DATA == m_fault.type)
+        {
+            // 426 follows in dealDataDisconnected
+            m_data->disconnectFromHost();
+            return;
+        }
+
+        // Bytes before the reset are on their way first
+        if(m_data->bytesToWrite() > 0)
+        {
+            return;
+        }
+    }
+    else
+    {
+        // A real server keeps what arrived
+        storeReceived();
+    }
+
+    if(FtpFakeServer::FAULT_RESET_DATA == m_fault.type)
+    {
+        resetData();
+    }
+
+    finishTransfer(426, "Connection closed; transfer aborted.");
+}
+
+void FtpFakeSession::dealDataReadyRead()
+{
+    if(TRANSFER_RECEIVE == m_transfer && m_transferStarted && 0 == m_server->dataRate())
+    {
+        receiveChunk();
+    }
+}
+
+void FtpFakeSession::dealDataBytesWritten()
+{
+    if(TRANSFER_SEND == m_transfer && m_sendDone && m_hasFault
+            && FtpFakeServer::FAULT_RESET_DATA == m_fault.type && 0 == m_data->bytesToWrite())
+    {
+        applyFault();
+    }
+}
+
+void FtpFakeSession::dealDataDisconnected()
+{
+    m_dataClosed = true;
+
+    if(!m_transferStarted)
+    {
+        return;
+    }
+
+    if(TRANSFER_SEND == m_transfer)
+    {
+        if(m_sendDone && !m_hasFault)
+        {
+            finishTransfer(226, "Transfer complete.");
+        }
+        else
+        {
+            // Client went away, or the scripted drop
+            finishTransfer(426, "Connection closed; transfer aborted.");
+        }
+    }
+    else if(TRANSFER_RECEIVE == m_transfer && 0 == m_server->dataRate())
+    {
+        // Rest of the data is still buffered
+        receiveChunk();
+    }
+}
+
+void FtpFakeSession::dealDataError()
+{
+    // Active connect failed, connected sockets end in dealDataDisconnected
+    if(!m_dataReady && TRANSFER_NONE != m_transfer)
+    {
+        finishTransfer(425, "Failed to establish connection.");
+    }
+}
+
+void FtpFakeSession::dealRateTick()
+{
+    if(m_data.isNull())
+    {
+        m_rateTimer.stop();
+        return;
+    }
+
+    if(TRANSFER_SEND == m_transfer)
+    {
+        sendChunk();
+    }
+    else if(TRANSFER_RECEIVE == m_transfer)
+    {
+        receiveChunk();
+    }
+}
+
+void FtpFakeSession::finishTransfer(int code, const QString &text)
+{
+    m_rateTimer.stop();
+
+    m_transfer = TRANSFER_NONE;
+    m_transferStarted = false;
+    m_sendData.clear();
+    m_received.clear();
+    m_hasFault = false;
+
+    // One data connection per transfer
+    closeData();
+
+    reply(code, text);
+}
+
+void FtpFakeSession::closeData()
+{
+    if(!m_data.isNull())
+    {
+        m_data->disconnect(this);
+        m_data->abort();
+        m_data->deleteLater();
+        m_data = NULL;
+    }
+
+    if(NULL != m_pPassive)
+    {
+        m_pPassive->disconnect(this);
+        m_pPassive->close();
+        m_pPassive->deleteLater();
+        m_pPassive = NULL;
+    }
+
+    m_activeAddress.clear();
+    m_activePort = 0;
+    m_dataReady = false;
+    m_dataClosed = false;
+}
+
+void FtpFakeSession::resetData()
+{
+    if(!m_data.isNull() && m_data->socketDescriptor() >= 0)
+    {
+        struct linger lingerOption;
+
+        // Close sends RST instead of FIN
+        lingerOption.l_onoff = 1;
+        lingerOption.l_linger = 0;
+        setsockopt(m_data->socketDescriptor(), SOL_SOCKET, SO_LINGER,
+                   (const char *)&lingerOption, sizeof(lingerOption));
+    }
+
+    closeData();
+}
+
+QString FtpFakeSession::resolve(const QString &path) const
+{
+    if(path.isEmpty())
+    {
+        return m_cwd;
+    }
+
+    return FtpFakeServer::cleanPath(path.startsWith('/') ? path : m_cwd + "/" + path);
+}
+
+QByteArray FtpFakeSession::listing(const QString &dir) const
+{
+    QByteArray data;
+    QString prefix = ("/" == dir) ? dir : dir + "/";
+
+    // A file lists itself
+    if(m_server->m_files.contains(dir))
+    {
+        return QString("-rw-r--r--    1 ftp      ftp      %1 Jan 01  2020 %2\r\n")
+                .arg(m_server->m_files.value(dir).size(), 12)
+                .arg(dir.section('/', -1)).toUtf8();
+    }
+
+    foreach(const QString &path, m_server->m_dirs)
+    {
+        if(path.startsWith(prefix) && path != dir && !path.mid(prefix.size()).contains('/'))
+        {
+            data.append(QString("drwxr-xr-x    2 ftp      ftp      %1 Jan 01  2020 %2\r\n")
+                        .arg(4096, 12).arg(path.mid(prefix.size())).toUtf8());
+        }
+    }
+
+    for(QMap<QString, QByteArray>::const_iterator it = m_server->m_files.constBegin();
+        it != m_server->m_files.constEnd(); ++it)
+    {
+        if(it.key().startsWith(prefix) && !it.key().mid(prefix.size()).contains('/'))
+        {
+            data.append(QString("-rw-r--r--    1 ftp      ftp      %1 Jan 01  2020 %2\r\n")
+                        .arg(it.value().size(), 12).arg(it.key().mid(prefix.size())).toUtf8());
+        }
+    }
+
+    return data;
+}
@@ -0,0 +1,211 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpFakeServer.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Scriptable in-memory FTP server for the tests
+**********************************************************************/
+
+#ifndef FTPFAKESERVER_H
+#define FTPFAKESERVER_H
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QTimer>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QList>
+#include <QStringList>
+#include <QByteArray>
+#include <QPointer>
+
+class FtpFakeSession;
+
+// Serves a file tree held in memory on the loopback. Replies and data
+// connections can be scripted to fail, one fault per command of the
+// verb it is scripted for, in the order they were scripted
+class FtpFakeServer : public QObject
+{
+    Q_OBJECT
+public:
+    enum{
+        FAULT_REPLY = 0,        // Answer the command with the scripted reply
+        FAULT_DROP_DATA,        // Close the data connection after some bytes
+        FAULT_RESET_DATA        // Reset it (RST) after some bytes
+    };
+
+    enum{
+        RATE_TICK_MSECS = 10,
+        SPLIT_REPLY_BYTES = 3   // Reply bytes per write with split replies
+    };
+
+    explicit FtpFakeServer(QObject *parent = 0);
+    ~FtpFakeServer();
+
+    // Port 0 picks a free one
+    bool listen(const QHostAddress &address = QHostAddress::LocalHost, quint16 port = 0);
+    QHostAddress serverAddress() const;
+    quint16 serverPort() const;
+
+    // Absolute paths, parent dirs are created
+    void addFile(const QString &path, const QByteArray &data);
+    void addDir(const QString &path);
+    bool hasFile(const QString &path) const;
+    bool hasDir(const QString &path) const;
+    QByteArray file(const QString &path) const;
+
+    // Lines of the FEAT reply, default SIZE, MDTM and REST STREAM
+    void setFeatures(const QStringList &features);
+
+    // Next times commands of verb get code and text instead of their
+    // normal reply. A 421 closes the control connection after it
+    void scriptReply(const QString &verb, int code, const QString &text, int times = 1);
+
+    // Next transfer of verb (RETR, STOR, APPE, LIST) stops after
+    // afterBytes, the command is answered with 426
+    void scriptDropData(const QString &verb, qint64 afterBytes);
+    void scriptResetData(const QString &verb, qint64 afterBytes);
+
+    // Limit of each data connection, 0 sends and reads as fast as it can.
+    // Reads of a limited connection keep the rest in the socket buffers
+    void setDataRate(qint64 bytesPerSec);
+    qint64 dataRate() const;
+
+    // Write replies a few bytes at a time, to test reply parsing
+    void setSplitReplies(bool split);
+    bool splitReplies() const;
+
+    // Commands received, "VERB argument", of all sessions in order
+    QStringList commands() const;
+    int commandCount(const QString &verb) const;
+    void clearCommands();
+
+    int sessionCount() const;
+    int activeSessions() const;
+    int maxActiveSessions() const;
+
+signals:
+    void commandReceived(QString command);
+
+private slots:
+    void dealNewConnection();
+    void dealSessionClosed();
+
+private:
+    friend class FtpFakeSession;
+
+    struct Fault_Info
+    {
+        Fault_Info() : type(FAULT_REPLY), code(0), afterBytes(0) {}
+
+        int type;
+        int code;
+        QString text;
+        qint64 afterBytes;
+    };
+
+    QTcpServer m_server;
+    QMap<QString, QByteArray> m_files;
+    QSet<QString> m_dirs;
+    QStringList m_features;
+    QHash<QString, QList<Fault_Info> > m_faults;
+    qint64 m_dataRate;
+    bool m_splitReplies;
+
+    QStringList m_commands;
+    int m_sessionCount;
+    int m_activeSessions;
+    int m_maxActiveSessions;
+
+    // Scripted fault of type for the next command of verb, false if none
+    bool takeFault(const QString &verb, bool dataFault, Fault_Info &fault);
+    void recordCommand(const QString &command);
+
+    static QString cleanPath(const QString &path);
+};
+
+// One control connection of FtpFakeServer
+class FtpFakeSession : public QObject
+{
+    Q_OBJECT
+public:
+    FtpFakeSession(FtpFakeServer *server, QTcpSocket *control);
+    ~FtpFakeSession();
+
+signals:
+    void closed();
+
+private slots:
+    void dealControlReadyRead();
+    void dealControlDisconnected();
+    void dealPassiveConnection();
+    void dealDataConnected();
+    void dealDataReadyRead();
+    void dealDataBytesWritten();
+    void dealDataDisconnected();
+    void dealDataError();
+    void dealRateTick();
+    void dealReplyTick();
+
+private:
+    enum{
+        TRANSFER_NONE = 0,
+        TRANSFER_SEND,          // RETR, LIST
+        TRANSFER_RECEIVE        // STOR, APPE
+    };
+
+    FtpFakeServer *m_server;
+    QTcpSocket *m_control;
+    QString m_cwd;
+    QString m_renameFrom;
+    qint64 m_restOffset;
+
+    QTcpServer *m_pPassive;             // Listener of PASV/EPSV
+    QHostAddress m_activeAddress;       // Of PORT/EPRT, null in passive mode
+    quint16 m_activePort;
+    QPointer<QTcpSocket> m_data;
+    bool m_dataReady;               // Connected, maybe closed by the client since
+    bool m_dataClosed;
+
+    int m_transfer;
+    bool m_transferStarted;         // 150 sent
+    QString m_transferPath;
+    QString m_transferVerb;
+    QByteArray m_sendData;
+    qint64 m_sendPos;
+    QByteArray m_received;
+    qint64 m_storeOffset;           // Stored file is cut here before the data, -1 appends
+    bool m_sendDone;                // All bytes up to the end or the fault written
+    bool m_hasFault;
+    FtpFakeServer::Fault_Info m_fault;
+
+    QTimer m_rateTimer;
+    QTimer m_replyTimer;
+    QByteArray m_replyQueue;
+    bool m_closeAfterReplies;
+
+    void dealCommand(const QString &line);
+    void reply(int code, const QString &text);
+    void replyLines(int code, const QStringList &lines);
+    void writeControl(const QByteArray &data);
+    void closeControl();
+
+    // Open or wait for the data connection, the transfer starts once it is up
+    void beginTransfer(int direction, const QString &verb, const QString &path);
+    void attachData(QTcpSocket *socket);
+    void startTransfer();
+    void sendChunk();
+    void receiveChunk();
+    void storeReceived();
+    void finishTransfer(int code, const QString &text);
+    void applyFault();
+    void closeData();
+    void resetData();
+
+    QString resolve(const QString &path) const;
+    QByteArray listing(const QString &dir) const;
+};
+
+#endif // FTPFAKESERVER_H
@@ -0,0 +1,179 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTestUtil.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Helpers shared by the test projects
+**********************************************************************/
+
+#include "FtpTestUtil.h"
+#include "FtpFakeServer.h"
+#include "FtpClient.h"
+#include <QtTest>
+#include <QDir>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QStringList>
+
+
+QByteArray FtpTestUtil::pattern(int size, int seed)
+{
+    QByteArray data(size, 0);
+    quint32 state = 2463534242U + (quint32)seed;
+
+    for(int i = 0; i < size; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        data[i] = (char)(state >> 24);
+    }
+
+    return data;
+}
+
+bool FtpTestUtil::writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+QByteArray FtpTestUtil::readFile(const QString &path)
+{
+    QFile file(path);
+
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return QByteArray();
+    }
+
+    return file.readAll();
+}
+
+void FtpTestUtil::removeTree(const QString &path)
+{
+    QDir dir(path);
+    QFileInfoList entries = dir.entryInfoList(QDir::AllEntries | QDir::Hidden | QDir::NoDotAndDotDot);
+
+    for(int i = 0; i < entries.size(); i++)
+    {
+        if(entries.at(i).isDir())
+        {
+            removeTree(entries.at(i).absoluteFilePath());
+        }
+        else
+        {
+            QFile::remove(entries.at(i).absoluteFilePath());
+        }
+    }
+
+    dir.rmdir(path);
+}
+
+int FtpTestUtil::countStatus(const QSignalSpy &spy, const QString &prefix)
+{
+    int count = 0;
+
+    for(int i = 0; i < spy.count(); i++)
+    {
+        if(spy.at(i).at(0).toString().startsWith(prefix))
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+bool FtpTestUtil::waitForStatus(QSignalSpy &spy, const QString &prefix, int count, int msecs)
+{
+    QElapsedTimer timer;
+
+    timer.start();
+    while(countStatus(spy, prefix) < count)
+    {
+        if(timer.elapsed() > msecs)
+        {
+            return false;
+        }
+        QTest::qWait(10);
+    }
+
+    return true;
+}
+
+bool FtpTestUtil::waitForCount(QSignalSpy &spy, int count, int msecs)
+{
+    QElapsedTimer timer;
+
+    timer.start();
+    while(spy.count() < count)
+    {
+        if(timer.elapsed() > msecs)
+        {
+            return false;
+        }
+        QTest::qWait(10);
+    }
+
+    return true;
+}
+
+QString FtpTestUtil::lastCommand(const FtpFakeServer &server, const QString &verb)
+{
+    QStringList commands = server.commands();
+
+    for(int i = commands.size() - 1; i >= 0; i--)
+    {
+        if(commands.at(i) == verb || commands.at(i).startsWith(verb + " "))
+        {
+            return commands.at(i);
+        }
+    }
+
+    return QString();
+}
+
+int FtpTestUtil::envInt(const char *name, int defaultValue)
+{
+    bool ok = false;
+    int value = qgetenv(name).toInt(&ok);
+
+    return (ok && value > 0) ? value : defaultValue;
+}
+
+qint64 FtpTestUtil::percentile(const QList<qint64> &sorted, int percent)
+{
+    int rank = (percent * sorted.size() + 99) / 100;
+
+    return sorted.isEmpty() ? -1 : sorted.at(qBound(0, rank - 1, sorted.size() - 1));
+}
+
+FtpClient *FtpTestUtil::connectClient(const FtpFakeServer &server, const QString &path)
+{
+    FtpClient *client = new FtpClient;
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->setHostPort("127.0.0.1", server.serverPort());
+    client->setUserInfo("test", "test");
+    client->setPath(path);
+
+    // Short delays, the faults are on the loopback
+    client->setRetryPolicy(3, 10, 50);
+
+    if(!client->connectToServer() || !waitForStatus(status, "Logged onto"))
+    {
+        delete client;
+        return NULL;
+    }
+
+    // Resume needs the capabilities, FEAT is answered after login
+    if(0 == countStatus(status, "Cached features of") && !waitForStatus(status, "Features of"))
+    {
+        delete client;
+        return NULL;
+    }
+
+    return client;
+}
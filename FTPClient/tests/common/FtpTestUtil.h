@@ -0,0 +1,56 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           FtpTestUtil.h
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        Helpers shared by the test projects
+**********************************************************************/
+
+#ifndef FTPTESTUTIL_H
+#define FTPTESTUTIL_H
+#include <QString>
+#include <QByteArray>
+#include <QList>
+
+class QSignalSpy;
+class FtpFakeServer;
+class FtpClient;
+
+class FtpTestUtil
+{
+public:
+    enum{
+        WAIT_MSECS = 15000
+    };
+
+    // Same bytes for the same size and seed, no two 4 KiB blocks alike
+    static QByteArray pattern(int size, int seed);
+
+    static bool writeFile(const QString &path, const QByteArray &data);
+    static QByteArray readFile(const QString &path);
+
+    // QDir::removeRecursively is Qt 5 only
+    static void removeTree(const QString &path);
+
+    // Spy of a QString signal, such as updateStatusMsg
+    static int countStatus(const QSignalSpy &spy, const QString &prefix);
+
+    // Run the event loop until count status messages started with prefix
+    static bool waitForStatus(QSignalSpy &spy, const QString &prefix, int count = 1, int msecs = WAIT_MSECS);
+    static bool waitForCount(QSignalSpy &spy, int count, int msecs = WAIT_MSECS);
+
+    // Last command of verb the server received, empty if none
+    static QString lastCommand(const FtpFakeServer &server, const QString &verb);
+
+    // Positive value of an environment variable, or defaultValue
+    static int envInt(const char *name, int defaultValue);
+
+    // Logged onto server in path with short retry delays and FEAT
+    // answered, NULL on failure. The caller owns the client
+    static FtpClient *connectClient(const FtpFakeServer &server, const QString &path = QString());
+
+    // Nearest rank of sorted values, -1 if empty
+    static qint64 percentile(const QList<qint64> &sorted, int percent);
+};
+
+#endif // FTPTESTUTIL_H
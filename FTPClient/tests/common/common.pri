@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Engine, fake server and helpers shared by the test projects
+#
+#-------------------------------------------------
+
+include(../../FtpEngine.pri)
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/FtpFakeServer.cpp \
+    $$PWD/FtpTestUtil.cpp
+
+HEADERS  += \
+    $$PWD/FtpFakeServer.h \
+    $$PWD/FtpTestUtil.h
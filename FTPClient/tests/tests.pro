@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Tests of the transfer engine, run with "make check", and bench_ tools
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    bench_delay \
+    bench_listing \
+    bench_tls \
+    tst_ftpclient \
+    tst_fxp \
+    tst_hashdevice \
+    tst_utilitybox
+
+# The SIMD encoder needs an x86 compiler that accepts -mssse3
+contains(QT_ARCH, x86_64|i386) {
+    *-g++*|*-clang* {
+        SUBDIRS += tst_utilitybox_ssse3
+    }
+}
@@ -0,0 +1,767 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           tst_ftpclient.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        FtpClient against FtpFakeServer: cancel, retry and resume
+                after injected faults, refused raw commands (FEAT, SIZE,
+                HASH, MODE Z) that must not drop the queue, dir uploads
+                and a load run
+**********************************************************************/
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QSettings>
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QtAlgorithms>
+#include "FtpClient.h"
+#include "FtpOperation.h"
+#include "FtpCapabilities.h"
+#include "FtpChecksum.h"
+#include "FtpTransferJournal.h"
+#include "FtpFakeServer.h"
+#include "FtpTestUtil.h"
+
+namespace
+{
+    enum{
+        LOAD_WAIT_MSECS = 300000
+    };
+}
+
+
+class tst_FtpClient : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void getAndPut();
+    void cancelSlowDownload();
+    void resumeAfterDroppedData();
+    void reconnectAfter421();
+    void retryAfter450();
+    void noRetryAfter550();
+    void resumeAfterResetStor();
+    void putProgressWithSlowReader();
+    void dirUploadReturnsToRoot();
+    void archiveThenManifest();
+    void failedArchiveSkipsManifest();
+    void nestedLargeFilesSentAlone();
+    void splitReplies();
+
+    // Refused raw commands, QFtp drops what was queued behind them
+    void prefetchSizeRefused();
+    void featRefusedKeepsQueue();
+    void featBusyNotCached();
+    void verifyRefusedKeepsQueue();
+    void resumeSizeRefused();
+    void modeZRefused();
+
+    void concurrentLoad();
+
+    // Load run bookkeeping
+    void dealOperationFinished(bool ok);
+
+private:
+    QString m_baseDir;
+    QString m_workDir;
+    FtpFakeServer *m_server;
+    QList<FtpClient *> m_clients;
+
+    QElapsedTimer m_loadTimer;
+    QHash<QObject *, int> m_loadClient;     // Operation to index of its client
+    QList<qint64> m_loadLastFinish;         // Per client, msecs since start
+    QList<qint64> m_loadLatencies;
+    int m_loadFinished;
+    int m_loadFailed;
+
+    // Logged in and FEAT answered, deleted in cleanup
+    FtpClient *connectClient(const QString &path = QString());
+};
+
+void tst_FtpClient::initTestCase()
+{
+    m_baseDir = QDir::tempPath() + QString("/tst_ftpclient_%1").arg(QCoreApplication::applicationPid());
+    FtpTestUtil::removeTree(m_baseDir);
+    QVERIFY(QDir().mkpath(m_baseDir));
+
+    // Journal, history and capabilities cache of the run stay here
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, m_baseDir + "/settings");
+
+    m_server = NULL;
+}
+
+void tst_FtpClient::cleanupTestCase()
+{
+    FtpTestUtil::removeTree(m_baseDir);
+}
+
+void tst_FtpClient::init()
+{
+    m_workDir = m_baseDir + "/" + QTest::currentTestFunction();
+    QVERIFY(QDir().mkpath(m_workDir));
+
+    m_server = new FtpFakeServer;
+    QVERIFY(m_server->listen());
+}
+
+void tst_FtpClient::cleanup()
+{
+    qDeleteAll(m_clients);
+    m_clients.clear();
+
+    delete m_server;
+    m_server = NULL;
+
+    // Sessions and sockets went with deleteLater
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+
+    FtpTestUtil::removeTree(m_workDir);
+    FtpTestUtil::removeTree(m_baseDir + "/settings");
+}
+
+FtpClient *tst_FtpClient::connectClient(const QString &path)
+{
+    FtpClient *client = FtpTestUtil::connectClient(*m_server, path);
+
+    if(NULL != client)
+    {
+        m_clients.append(client);
+    }
+
+    return client;
+}
+
+void tst_FtpClient::getAndPut()
+{
+    QByteArray upload = FtpTestUtil::pattern(200 * 1024, 2);
+
+    m_server->addFile("/data.bin", FtpTestUtil::pattern(300 * 1024, 1));
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->get("data.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/data.bin"), m_server->file("/data.bin"));
+
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up.bin", upload));
+    client->put("up.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded "));
+    QCOMPARE(m_server->file("/up.bin"), upload);
+}
+
+void tst_FtpClient::cancelSlowDownload()
+{
+    QString path = m_workDir + "/slow.bin";
+
+    m_server->addFile("/slow.bin", FtpTestUtil::pattern(1024 * 1024, 3));
+    m_server->setDataRate(64 * 1024);
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy progress(client, SIGNAL(updateProgressVal(int)));
+    QSignalSpy retried(client, SIGNAL(transferRetried(QString,int,int)));
+
+    client->get("slow.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForCount(progress, 1));
+
+    QMetaObject::invokeMethod(client, "cancelDownload");
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Canceled download of"));
+    QVERIFY(!QFile::exists(path));
+
+    // A canceled download is not retried
+    QTest::qWait(300);
+    QCOMPARE(retried.count(), 0);
+    QCOMPARE(m_server->commandCount("RETR"), 1);
+
+    // Nothing left to cancel
+    QMetaObject::invokeMethod(client, "cancelDownload");
+    QTest::qWait(50);
+    QCOMPARE(FtpTestUtil::countStatus(status, "Canceled download of"), 1);
+
+    // The replies to ABOR did not leave the session out of step
+    FtpOperation *op = client->listAsync();
+    QVERIFY(op->waitForFinished(FtpTestUtil::WAIT_MSECS));
+    QVERIFY(op->isOk());
+    QCOMPARE(op->entries().size(), 1);
+}
+
+void tst_FtpClient::resumeAfterDroppedData()
+{
+    QByteArray data = FtpTestUtil::pattern(2 * 1024 * 1024, 4);
+    QString rest;
+
+    m_server->addFile("/big.bin", data);
+    m_server->scriptDropData("RETR", 256 * 1024);
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy retried(client, SIGNAL(transferRetried(QString,int,int)));
+
+    client->get("big.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/big.bin"), data);
+
+    QCOMPARE(retried.count(), 1);
+    QCOMPARE(m_server->commandCount("RETR"), 2);
+
+    // Continued where the kept part ends, not from the start
+    rest = FtpTestUtil::lastCommand(*m_server, "REST");
+    QVERIFY(!rest.isEmpty());
+    QVERIFY(rest.section(' ', 1).toLongLong() > 0);
+    QVERIFY(rest.section(' ', 1).toLongLong() <= 256 * 1024);
+}
+
+void tst_FtpClient::reconnectAfter421()
+{
+    QByteArray data = FtpTestUtil::pattern(512 * 1024, 5);
+
+    m_server->addFile("/a.bin", data);
+    m_server->scriptReply("RETR", 421, "Service not available, closing control connection.");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    // The close must be seen before the retry goes out
+    client->setRetryPolicy(3, 200, 400);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy retried(client, SIGNAL(transferRetried(QString,int,int)));
+
+    client->get("a.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/a.bin"), data);
+
+    // Logged in again, FtpConnector probes are sessions without commands
+    QCOMPARE(retried.count(), 1);
+    QCOMPARE(m_server->commandCount("USER"), 2);
+}
+
+void tst_FtpClient::retryAfter450()
+{
+    QByteArray data = FtpTestUtil::pattern(128 * 1024, 6);
+
+    m_server->addFile("/busy.bin", data);
+    m_server->scriptReply("RETR", 450, "File busy, try again later.");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy retried(client, SIGNAL(transferRetried(QString,int,int)));
+
+    client->get("busy.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/busy.bin"), data);
+
+    QCOMPARE(retried.count(), 1);
+    QCOMPARE(m_server->commandCount("RETR"), 2);
+    QCOMPARE(m_server->commandCount("USER"), 1);
+}
+
+void tst_FtpClient::noRetryAfter550()
+{
+    m_server->addFile("/locked.bin", FtpTestUtil::pattern(1024, 7));
+    m_server->scriptReply("RETR", 550, "Failed to open file.");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy retried(client, SIGNAL(transferRetried(QString,int,int)));
+
+    client->get("locked.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Canceled download of"));
+    QVERIFY(!QFile::exists(m_workDir + "/locked.bin"));
+
+    QTest::qWait(200);
+    QCOMPARE(retried.count(), 0);
+    QCOMPARE(m_server->commandCount("RETR"), 1);
+}
+
+void tst_FtpClient::resumeAfterResetStor()
+{
+    QByteArray data = FtpTestUtil::pattern(1024 * 1024, 8);
+
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up.bin", data));
+    m_server->scriptResetData("STOR", 128 * 1024);
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy retried(client, SIGNAL(transferRetried(QString,int,int)));
+
+    client->put("up.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded "));
+    QCOMPARE(m_server->file("/up.bin"), data);
+
+    QCOMPARE(retried.count(), 1);
+    QCOMPARE(m_server->commandCount("STOR"), 2);
+
+    // Server kept the part before the reset, SIZE told where to go on
+    QCOMPARE(m_server->commandCount("SIZE"), 1);
+    QCOMPARE(FtpTestUtil::lastCommand(*m_server, "REST"), QString("REST %1").arg(128 * 1024));
+}
+
+void tst_FtpClient::putProgressWithSlowReader()
+{
+    QByteArray data = FtpTestUtil::pattern(512 * 1024, 9);
+
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/slow.bin", data));
+    m_server->setDataRate(256 * 1024);
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    // Trace puts the hash pass-through between QFtp and the file,
+    // QFtp still has to see the size to report progress
+    client->setTraceEnabled(true);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy progress(client, SIGNAL(updateProgressVal(int)));
+
+    client->put("slow.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded ", 1, 60000));
+    QCOMPARE(m_server->file("/slow.bin"), data);
+
+    QVERIFY(progress.count() > 0);
+    QCOMPARE(progress.last().at(0).toInt(), 100);
+}
+
+void tst_FtpClient::dirUploadReturnsToRoot()
+{
+    QVERIFY(QDir(m_workDir).mkpath("up"));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up/a.txt", FtpTestUtil::pattern(1000, 10)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up/b.txt", FtpTestUtil::pattern(2000, 11)));
+
+    // No path set, the session starts in /
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->put("up", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded ", 2));
+    QTest::qWait(200);
+
+    QCOMPARE(m_server->file("/up/a.txt"), FtpTestUtil::pattern(1000, 10));
+    QCOMPARE(m_server->file("/up/b.txt"), FtpTestUtil::pattern(2000, 11));
+    QCOMPARE(FtpTestUtil::lastCommand(*m_server, "CWD"), QString("CWD /"));
+}
+
+void tst_FtpClient::archiveThenManifest()
+{
+    QStringList commands;
+
+    m_server->addDir("/base");
+    QVERIFY(QDir(m_workDir).mkpath("pack"));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/a.txt", FtpTestUtil::pattern(1000, 12)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/b.txt", FtpTestUtil::pattern(2000, 13)));
+
+    FtpClient *client = connectClient("/base");
+    QVERIFY(NULL != client);
+
+    client->setSmallFilePacking(true, FtpClient::FTP_DEFAULT_PACK_THRESHOLD, "UNPACK %1");
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->put("pack", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded archive of"));
+    QTest::qWait(300);
+
+    QVERIFY(m_server->hasFile("/base/pack/pack.tar"));
+    QVERIFY(m_server->hasFile("/base/pack/pack.tar.manifest"));
+    QCOMPARE(FtpTestUtil::lastCommand(*m_server, "CWD"), QString("CWD /base"));
+
+    // Manifest and unpacking only once the archive is stored
+    commands = m_server->commands();
+    QVERIFY(commands.indexOf("STOR pack.tar") >= 0);
+    QVERIFY(commands.indexOf("STOR pack.tar.manifest") > commands.indexOf("STOR pack.tar"));
+    QVERIFY(commands.indexOf("SITE UNPACK pack.tar") > commands.indexOf("STOR pack.tar"));
+}
+
+void tst_FtpClient::failedArchiveSkipsManifest()
+{
+    m_server->addDir("/base");
+    QVERIFY(QDir(m_workDir).mkpath("pack"));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/a.txt", FtpTestUtil::pattern(1000, 14)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/b.txt", FtpTestUtil::pattern(2000, 15)));
+
+    FtpClient *client = connectClient("/base");
+    QVERIFY(NULL != client);
+
+    client->setSmallFilePacking(true, FtpClient::FTP_DEFAULT_PACK_THRESHOLD, "UNPACK %1");
+    m_server->scriptReply("STOR", 451, "Local error in processing.");
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->put("pack", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Failed to upload archive"));
+    QTest::qWait(300);
+
+    QVERIFY(!m_server->hasFile("/base/pack/pack.tar.manifest"));
+    QCOMPARE(m_server->commandCount("SITE"), 0);
+    QCOMPARE(FtpTestUtil::lastCommand(*m_server, "CWD"), QString("CWD /base"));
+}
+
+void tst_FtpClient::nestedLargeFilesSentAlone()
+{
+    QStringList commands;
+
+    m_server->addDir("/base");
+    QVERIFY(QDir(m_workDir).mkpath("pack/sub/deep"));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/a.txt", FtpTestUtil::pattern(100, 27)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/sub/b.txt", FtpTestUtil::pattern(200, 28)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/pack/sub/deep/big.bin", FtpTestUtil::pattern(5000, 29)));
+
+    FtpClient *client = connectClient("/base");
+    QVERIFY(NULL != client);
+
+    client->setSmallFilePacking(true, 1000, "");
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->put("pack", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded big.bin"));
+    QTest::qWait(300);
+
+    // Only the small files are packed, at every depth
+    QVERIFY(FtpTestUtil::countStatus(status, "Uploaded archive of 2 files") > 0);
+    QCOMPARE(m_server->file("/base/pack/sub/deep/big.bin"), FtpTestUtil::pattern(5000, 29));
+
+    commands = m_server->commands();
+    QVERIFY(commands.indexOf("MKD /base/pack/sub") >= 0);
+    QVERIFY(commands.indexOf("MKD /base/pack/sub/deep") > commands.indexOf("MKD /base/pack/sub"));
+    QCOMPARE(FtpTestUtil::lastCommand(*m_server, "CWD"), QString("CWD /base"));
+}
+
+void tst_FtpClient::splitReplies()
+{
+    QByteArray data = FtpTestUtil::pattern(64 * 1024, 16);
+    QBuffer sink;
+
+    m_server->addFile("/split.bin", data);
+    m_server->setSplitReplies(true);
+
+    // Multi-line FEAT arrives a few bytes at a time
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+    QVERIFY(client->capabilities().has(FtpCapabilities::CAP_REST_STREAM));
+
+    FtpOperation *list = client->listAsync();
+    QVERIFY(list->waitForFinished(FtpTestUtil::WAIT_MSECS));
+    QVERIFY(list->isOk());
+    QCOMPARE(list->entries().size(), 1);
+
+    QVERIFY(sink.open(QIODevice::WriteOnly));
+    FtpOperation *get = client->getAsync("split.bin", &sink);
+    QVERIFY(get->waitForFinished(FtpTestUtil::WAIT_MSECS));
+    QVERIFY(get->isOk());
+    QCOMPARE(sink.data(), data);
+}
+
+void tst_FtpClient::prefetchSizeRefused()
+{
+    QStringList commands;
+
+    m_server->addFile("/sub/a.bin", FtpTestUtil::pattern(3000, 18));
+    m_server->addFile("/sub/b.bin", FtpTestUtil::pattern(4000, 19));
+    m_server->scriptReply("SIZE", 550, "SIZE not allowed in ASCII mode");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    // Listing of / has no sizes of /sub, both are asked for
+    client->cdTo("/sub");
+    client->getFiles(QStringList() << "a.bin" << "b.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Batch of 2 files done"));
+
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/a.bin"), m_server->file("/sub/a.bin"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/b.bin"), m_server->file("/sub/b.bin"));
+
+    commands = m_server->commands();
+    QVERIFY(commands.indexOf("TYPE I") >= 0);
+    QVERIFY(commands.indexOf("TYPE I") < commands.indexOf("SIZE a.bin"));
+
+    // The refusal dropped the prefetches queued behind it, the batch
+    // went on without them
+    QCOMPARE(m_server->commandCount("MDTM"), 0);
+    QCOMPARE(m_server->commandCount("RETR"), 2);
+}
+
+void tst_FtpClient::featRefusedKeepsQueue()
+{
+    QStringList commands;
+
+    m_server->addFile("/a.bin", FtpTestUtil::pattern(5000, 20));
+    m_server->scriptReply("FEAT", 500, "FEAT not understood");
+
+    FtpClient *client = new FtpClient;
+    m_clients.append(client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->setHostPort("127.0.0.1", m_server->serverPort());
+    client->setUserInfo("test", "test");
+    QVERIFY(client->connectToServer());
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Logged onto"));
+
+    // Queued behind the FEAT of the login, QFtp drops it with the refusal
+    client->get("a.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/a.bin"), m_server->file("/a.bin"));
+
+    // Remembered as a server without features
+    QVERIFY(client->capabilities().isValid());
+    QCOMPARE(client->capabilities().features(), 0);
+
+    // The listing dropped with it was asked for again
+    commands = m_server->commands();
+    QVERIFY(commands.indexOf("CWD /") < commands.indexOf("FEAT"));
+    QVERIFY(commands.lastIndexOf("LIST") > commands.indexOf("FEAT"));
+}
+
+void tst_FtpClient::featBusyNotCached()
+{
+    m_server->scriptReply("FEAT", 450, "Try again later");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+    QVERIFY(!client->capabilities().isValid());
+
+    // The next login asks again instead of taking "none" from the cache
+    FtpClient *second = connectClient();
+    QVERIFY(NULL != second);
+    QCOMPARE(m_server->commandCount("FEAT"), 2);
+    QVERIFY(second->capabilities().has(FtpCapabilities::CAP_SIZE));
+}
+
+void tst_FtpClient::verifyRefusedKeepsQueue()
+{
+    QVERIFY(QDir(m_workDir).mkpath("up"));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up/a.txt", FtpTestUtil::pattern(1000, 21)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up/b.txt", FtpTestUtil::pattern(2000, 22)));
+
+    m_server->setFeatures(QStringList() << "SIZE" << "MDTM" << "REST STREAM" << "HASH SHA-1;MD5;CRC32");
+
+    // First file: OPTS refused, the HASH behind it is dropped.
+    // Second file: HASH itself refused
+    m_server->scriptReply("OPTS", 504, "Algorithm not supported");
+    m_server->scriptReply("HASH", 450, "Hashing busy");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    client->setIntegrityCheck(FtpChecksum::CHECKSUM_SHA1);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    client->put("up", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded ", 2));
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Server could not checksum", 2));
+    QTest::qWait(200);
+
+    // Neither refusal dropped the next put
+    QCOMPARE(m_server->file("/up/a.txt"), FtpTestUtil::pattern(1000, 21));
+    QCOMPARE(m_server->file("/up/b.txt"), FtpTestUtil::pattern(2000, 22));
+    QCOMPARE(m_server->commandCount("STOR"), 2);
+    QCOMPARE(FtpTestUtil::lastCommand(*m_server, "CWD"), QString("CWD /"));
+}
+
+void tst_FtpClient::resumeSizeRefused()
+{
+    QVERIFY(QDir(m_workDir).mkpath("up"));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up/a.txt", FtpTestUtil::pattern(1000, 23)));
+    QVERIFY(FtpTestUtil::writeFile(m_workDir + "/up/b.txt", FtpTestUtil::pattern(2000, 24)));
+
+    // Left in flight by a crash: a.txt never arrived, b.txt partly
+    m_server->addDir("/up");
+    m_server->addFile("/up/b.txt", FtpTestUtil::pattern(2000, 24).left(500));
+
+    FtpTransferJournal journal;
+    QVERIFY(journal.open(FtpTransferJournal::defaultPath("127.0.0.1", m_server->serverPort(), "test")));
+    QVERIFY(journal.setState(journal.append("a.txt", m_workDir + "/up", "/up"), FtpTransferJournal::STATE_IN_FLIGHT));
+    QVERIFY(journal.setState(journal.append("b.txt", m_workDir + "/up", "/up"), FtpTransferJournal::STATE_IN_FLIGHT));
+    journal.close();
+
+    // SIZE of the missing a.txt is refused, QFtp drops the one of b.txt
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Uploaded ", 2));
+    QTest::qWait(200);
+
+    QCOMPARE(m_server->file("/up/a.txt"), FtpTestUtil::pattern(1000, 23));
+    QCOMPARE(m_server->file("/up/b.txt"), FtpTestUtil::pattern(2000, 24));
+    QVERIFY(m_server->commands().contains("SIZE /up/a.txt"));
+    QVERIFY(!m_server->commands().contains("SIZE /up/b.txt"));
+}
+
+void tst_FtpClient::modeZRefused()
+{
+    m_server->addFile("/a.bin", FtpTestUtil::pattern(6000, 25));
+    m_server->addFile("/b.bin", FtpTestUtil::pattern(7000, 26));
+
+    // Advertised, but MODE Z is answered with 504
+    m_server->setFeatures(QStringList() << "SIZE" << "MDTM" << "REST STREAM" << "MODE Z");
+
+    FtpClient *client = connectClient();
+    QVERIFY(NULL != client);
+    QVERIFY(client->capabilities().has(FtpCapabilities::CAP_MODE_Z));
+
+    client->setCompression(FtpClient::COMPRESS_MODE_Z);
+
+    QSignalSpy status(client, SIGNAL(updateStatusMsg(QString)));
+
+    // The refusal drops the RETR, it is sent again uncompressed
+    client->get("a.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at"));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/a.bin"), m_server->file("/a.bin"));
+    QCOMPARE(FtpTestUtil::countStatus(status, "MODE Z refused"), 1);
+
+    // Not asked again in this session
+    client->get("b.bin", m_workDir);
+    QVERIFY(FtpTestUtil::waitForStatus(status, "Downloaded at", 2));
+    QCOMPARE(FtpTestUtil::readFile(m_workDir + "/b.bin"), m_server->file("/b.bin"));
+
+    QCOMPARE(m_server->commandCount("MODE"), 1);
+    QCOMPARE(m_server->commandCount("RETR"), 2);
+}
+
+void tst_FtpClient::concurrentLoad()
+{
+    int sessions = FtpTestUtil::envInt("FTP_LOAD_SESSIONS", 32);
+    int transfers = FtpTestUtil::envInt("FTP_LOAD_TRANSFERS", 32);
+    int total = sessions * transfers;
+    QByteArray data = FtpTestUtil::pattern(16 * 1024, 17);
+    QList<QBuffer *> buffers;
+    qint64 elapsed = 0;
+
+    m_server->addFile("/load.bin", data);
+
+    for(int i = 0; i < sessions; i++)
+    {
+        QVERIFY(NULL != connectClient());
+    }
+
+    m_loadClient.clear();
+    m_loadLastFinish.clear();
+    m_loadLatencies.clear();
+    m_loadFinished = 0;
+    m_loadFailed = 0;
+    m_loadTimer.start();
+
+    // Each session runs its share back to back, the sessions side by side
+    for(int i = 0; i < sessions; i++)
+    {
+        m_loadLastFinish.append(0);
+
+        for(int j = 0; j < transfers; j++)
+        {
+            QBuffer *buffer = new QBuffer;
+            FtpOperation *op = NULL;
+
+            buffers.append(buffer);
+
+            if(0 == j % 2)
+            {
+                buffer->open(QIODevice::WriteOnly);
+                op = m_clients.at(i)->getAsync("load.bin", buffer);
+            }
+            else
+            {
+                buffer->setData(data);
+                buffer->open(QIODevice::ReadOnly);
+                op = m_clients.at(i)->putAsync(buffer, QString("put_%1_%2.bin").arg(i).arg(j));
+            }
+
+            m_loadClient.insert(op, i);
+            connect(op, SIGNAL(finished(bool)), this, SLOT(dealOperationFinished(bool)));
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while(m_loadFinished < total && timer.elapsed() < LOAD_WAIT_MSECS)
+    {
+        QTest::qWait(10);
+    }
+    elapsed = qMax<qint64>(m_loadTimer.elapsed(), 1);
+
+    QCOMPARE(m_loadFinished, total);
+    QCOMPARE(m_loadFailed, 0);
+    QVERIFY(m_server->maxActiveSessions() >= sessions);
+
+    for(int i = 0; i < buffers.size(); i++)
+    {
+        if(buffers.at(i)->openMode() & QIODevice::WriteOnly)
+        {
+            QCOMPARE(buffers.at(i)->data(), data);
+        }
+    }
+    QCOMPARE(m_server->file("/put_0_1.bin"), data);
+    QCOMPARE(m_server->commandCount("STOR"), sessions * (transfers / 2));
+
+    qSort(m_loadLatencies);
+    qDebug("%d sessions x %d transfers of %d bytes: %lld ms, %.1f MiB/s, "
+           "%.0f transfers/s, latency p50 %lld ms, p99 %lld ms",
+           sessions, transfers, data.size(), elapsed,
+           (double)total * data.size() * 1000.0 / elapsed / (1024.0 * 1024.0),
+           total * 1000.0 / elapsed,
+           FtpTestUtil::percentile(m_loadLatencies, 50), FtpTestUtil::percentile(m_loadLatencies, 99));
+
+    qDeleteAll(buffers);
+}
+
+void tst_FtpClient::dealOperationFinished(bool ok)
+{
+    int client = m_loadClient.value(sender(), -1);
+    qint64 now = m_loadTimer.elapsed();
+
+    if(client < 0)
+    {
+        return;
+    }
+
+    // From the end of the one before it in the same session
+    m_loadLatencies.append(now - m_loadLastFinish.at(client));
+    m_loadLastFinish[client] = now;
+
+    m_loadFinished++;
+    if(!ok)
+    {
+        m_loadFailed++;
+    }
+}
+
+// Without a QApplication, the engine needs no display
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    tst_FtpClient test;
+
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_ftpclient.moc"
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# FtpClient against FtpFakeServer: faults, retries and load
+#
+#-------------------------------------------------
+
+QT       += core network testlib
+QT       -= gui
+
+TARGET = tst_ftpclient
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+include(../common/common.pri)
+
+SOURCES += \
+    tst_ftpclient.cpp
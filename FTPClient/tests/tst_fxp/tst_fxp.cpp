@@ -0,0 +1,160 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           tst_fxp.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        FXP copy between two FtpFakeServers on the loopback
+**********************************************************************/
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QSettings>
+#include <QDir>
+#include "FtpClient.h"
+#include "FtpFakeServer.h"
+#include "FtpTestUtil.h"
+
+
+class tst_Fxp : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void copyFiles();
+    void destRefusesPort();
+    void missingSourceFile();
+
+private:
+    QString m_baseDir;
+    FtpFakeServer *m_sourceServer;
+    FtpFakeServer *m_destServer;
+    FtpClient *m_source;
+    FtpClient *m_dest;
+};
+
+void tst_Fxp::initTestCase()
+{
+    m_baseDir = QDir::tempPath() + QString("/tst_fxp_%1").arg(QCoreApplication::applicationPid());
+    FtpTestUtil::removeTree(m_baseDir);
+    QVERIFY(QDir().mkpath(m_baseDir));
+
+    // Capabilities cache of the run stays here
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, m_baseDir + "/settings");
+
+    m_sourceServer = NULL;
+    m_destServer = NULL;
+    m_source = NULL;
+    m_dest = NULL;
+}
+
+void tst_Fxp::cleanupTestCase()
+{
+    FtpTestUtil::removeTree(m_baseDir);
+}
+
+void tst_Fxp::init()
+{
+    m_sourceServer = new FtpFakeServer;
+    m_destServer = new FtpFakeServer;
+    QVERIFY(m_sourceServer->listen());
+    QVERIFY(m_destServer->listen());
+
+    m_sourceServer->addFile("/out/a.bin", FtpTestUtil::pattern(300 * 1024, 21));
+    m_sourceServer->addFile("/out/b.bin", FtpTestUtil::pattern(64 * 1024, 22));
+    m_destServer->addDir("/in");
+
+    m_source = FtpTestUtil::connectClient(*m_sourceServer, "/out");
+    m_dest = FtpTestUtil::connectClient(*m_destServer, "/in");
+    QVERIFY(NULL != m_source);
+    QVERIFY(NULL != m_dest);
+}
+
+void tst_Fxp::cleanup()
+{
+    delete m_source;
+    delete m_dest;
+    m_source = NULL;
+    m_dest = NULL;
+
+    delete m_sourceServer;
+    delete m_destServer;
+    m_sourceServer = NULL;
+    m_destServer = NULL;
+
+    // Sessions and sockets went with deleteLater
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+
+    FtpTestUtil::removeTree(m_baseDir + "/settings");
+}
+
+void tst_Fxp::copyFiles()
+{
+    QSignalSpy status(m_source, SIGNAL(updateStatusMsg(QString)));
+    QSignalSpy progress(m_source, SIGNAL(updateProgressVal(int)));
+
+    m_source->fxpFiles(m_dest, QStringList() << "a.bin" << "b.bin");
+    QVERIFY(FtpTestUtil::waitForStatus(status, "FXP copy finished"));
+    QCOMPARE(FtpTestUtil::countStatus(status, "FXP copy finished, 2 of 2"), 1);
+
+    QCOMPARE(m_destServer->file("/in/a.bin"), m_sourceServer->file("/out/a.bin"));
+    QCOMPARE(m_destServer->file("/in/b.bin"), m_sourceServer->file("/out/b.bin"));
+    QCOMPARE(progress.last().at(0).toInt(), 100);
+
+    // Source listens, destination connects to it
+    QCOMPARE(m_sourceServer->commandCount("PASV"), 2);
+    QCOMPARE(m_sourceServer->commandCount("RETR"), 2);
+    QCOMPARE(m_sourceServer->commandCount("PORT"), 0);
+    QCOMPARE(m_destServer->commandCount("PORT"), 2);
+    QCOMPARE(m_destServer->commandCount("STOR"), 2);
+    QCOMPARE(m_destServer->commandCount("PASV"), 0);
+}
+
+void tst_Fxp::destRefusesPort()
+{
+    QSignalSpy status(m_source, SIGNAL(updateStatusMsg(QString)));
+
+    // As servers without FXP enabled answer a third party address
+    m_destServer->scriptReply("PORT", 500, "Illegal PORT command.");
+
+    m_source->fxpFiles(m_dest, QStringList() << "a.bin" << "b.bin");
+    QVERIFY(FtpTestUtil::waitForStatus(status, "FXP copy finished"));
+    QCOMPARE(FtpTestUtil::countStatus(status, "FXP copy finished, 1 of 2"), 1);
+    QCOMPARE(FtpTestUtil::countStatus(status, "FXP copy of a.bin failed"), 1);
+
+    // The next file starts over with a new PASV
+    QVERIFY(!m_destServer->hasFile("/in/a.bin"));
+    QCOMPARE(m_destServer->file("/in/b.bin"), m_sourceServer->file("/out/b.bin"));
+    QCOMPARE(m_sourceServer->commandCount("PASV"), 2);
+    QCOMPARE(m_sourceServer->commandCount("RETR"), 1);
+}
+
+void tst_Fxp::missingSourceFile()
+{
+    QSignalSpy status(m_source, SIGNAL(updateStatusMsg(QString)));
+
+    m_source->fxpFiles(m_dest, QStringList() << "missing.bin" << "a.bin");
+    QVERIFY(FtpTestUtil::waitForStatus(status, "FXP copy finished"));
+    QCOMPARE(FtpTestUtil::countStatus(status, "FXP copy finished, 1 of 2"), 1);
+    QCOMPARE(FtpTestUtil::countStatus(status, "FXP copy of missing.bin failed"), 1);
+
+    // The destination gave up its STOR too, both sessions are in step
+    QCOMPARE(m_destServer->file("/in/a.bin"), m_sourceServer->file("/out/a.bin"));
+    QCOMPARE(m_destServer->commandCount("STOR"), 2);
+    QCOMPARE(m_sourceServer->commandCount("RETR"), 2);
+}
+
+// Without a QApplication, the engine needs no display
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    tst_Fxp test;
+
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_fxp.moc"
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Server to server (FXP) copy between two FtpFakeServers
+#
+#-------------------------------------------------
+
+QT       += core network testlib
+QT       -= gui
+
+TARGET = tst_fxp
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+include(../common/common.pri)
+
+SOURCES += \
+    tst_fxp.cpp
@@ -0,0 +1,202 @@
+/**********************************************************************
+PACKAGE:        Communication
+FILE:           tst_hashdevice.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        FtpHashDevice over a file: random access pass-through,
+                digests, and the cost of the wrapper per checksum
+**********************************************************************/
+
+#include <QtTest>
+#include <QTemporaryFile>
+#include "FtpHashDevice.h"
+#include "FtpChecksum.h"
+#include "FtpTrace.h"
+#include "FtpTestUtil.h"
+
+namespace
+{
+    enum{
+        READ_CHUNK = 16 * 1024,             // Block QFtp reads for a put
+        BENCH_BYTES = 32 * 1024 * 1024
+    };
+
+    // Read device to the end in QFtp sized chunks, returns bytes read
+    qint64 drain(QIODevice *device)
+    {
+        static char buffer[READ_CHUNK];
+        qint64 total = 0;
+        qint64 ret;
+
+        while((ret = device->read(buffer, sizeof(buffer))) > 0)
+        {
+            total += ret;
+        }
+
+        return total;
+    }
+}
+
+
+class tst_HashDevice : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void passThrough();
+    void digestOfRead_data();
+    void digestOfRead();
+    void rewindStartsOver();
+
+    void readBenchmark_data();
+    void readBenchmark();
+
+private:
+    QTemporaryFile m_smallFile;
+    QTemporaryFile m_benchFile;
+    QByteArray m_smallData;
+};
+
+void tst_HashDevice::initTestCase()
+{
+    m_smallData = FtpTestUtil::pattern(300 * 1024 + 7, 34);
+
+    QVERIFY(m_smallFile.open());
+    QCOMPARE(m_smallFile.write(m_smallData), (qint64)m_smallData.size());
+    m_smallFile.close();
+
+    // Written in pieces, the pattern of the whole would double the memory
+    QVERIFY(m_benchFile.open());
+    for(int i = 0; i < BENCH_BYTES / (1024 * 1024); i++)
+    {
+        QCOMPARE(m_benchFile.write(FtpTestUtil::pattern(1024 * 1024, i)), (qint64)1024 * 1024);
+    }
+    m_benchFile.close();
+}
+
+void tst_HashDevice::passThrough()
+{
+    QFile file(m_smallFile.fileName());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+
+    FtpHashDevice device(&file, FtpChecksum::CHECKSUM_CRC32);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+
+    // QFtp sends ALLO and reports progress against the size
+    QVERIFY(!device.isSequential());
+    QCOMPARE(device.size(), (qint64)m_smallData.size());
+    QCOMPARE(device.bytesAvailable(), (qint64)m_smallData.size());
+
+    QCOMPARE(device.read(100), m_smallData.left(100));
+    QCOMPARE(device.pos(), (qint64)100);
+    QCOMPARE(device.bytesAvailable(), (qint64)m_smallData.size() - 100);
+
+    QCOMPARE(device.readAll(), m_smallData.mid(100));
+    QVERIFY(device.atEnd());
+    QCOMPARE(device.hashedBytes(), (qint64)m_smallData.size());
+}
+
+void tst_HashDevice::digestOfRead_data()
+{
+    QTest::addColumn<int>("algorithm");
+
+    QTest::newRow("crc32") << (int)FtpChecksum::CHECKSUM_CRC32;
+    QTest::newRow("crc32c") << (int)FtpChecksum::CHECKSUM_CRC32C;
+    QTest::newRow("md5") << (int)FtpChecksum::CHECKSUM_MD5;
+    QTest::newRow("sha1") << (int)FtpChecksum::CHECKSUM_SHA1;
+}
+
+void tst_HashDevice::digestOfRead()
+{
+    QFETCH(int, algorithm);
+    FtpChecksum expected(algorithm);
+    QFile file(m_smallFile.fileName());
+
+    expected.addData(m_smallData.constData(), m_smallData.size());
+
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    FtpHashDevice device(&file, algorithm);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+
+    QCOMPARE(drain(&device), (qint64)m_smallData.size());
+    QCOMPARE(device.checksum().hexResult(), expected.hexResult());
+}
+
+void tst_HashDevice::rewindStartsOver()
+{
+    FtpChecksum expected(FtpChecksum::CHECKSUM_CRC32);
+    QFile file(m_smallFile.fileName());
+
+    expected.addData(m_smallData.constData(), m_smallData.size());
+
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    FtpHashDevice device(&file, FtpChecksum::CHECKSUM_CRC32);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+
+    // A reset() before the transfer must not leave the first bytes hashed twice
+    device.read(4096);
+    QVERIFY(device.seek(0));
+    QCOMPARE(device.hashedBytes(), (qint64)0);
+
+    QCOMPARE(drain(&device), (qint64)m_smallData.size());
+    QCOMPARE(device.checksum().hexResult(), expected.hexResult());
+}
+
+void tst_HashDevice::readBenchmark_data()
+{
+    QTest::addColumn<bool>("wrapped");
+    QTest::addColumn<int>("algorithm");
+    QTest::addColumn<bool>("traced");
+
+    QTest::newRow("QFile") << false << (int)FtpChecksum::CHECKSUM_NONE << false;
+    QTest::newRow("wrapper, no checksum") << true << (int)FtpChecksum::CHECKSUM_NONE << false;
+    QTest::newRow("wrapper, crc32") << true << (int)FtpChecksum::CHECKSUM_CRC32 << false;
+    QTest::newRow("wrapper, crc32c") << true << (int)FtpChecksum::CHECKSUM_CRC32C << false;
+    QTest::newRow("wrapper, md5") << true << (int)FtpChecksum::CHECKSUM_MD5 << false;
+    QTest::newRow("wrapper, sha1") << true << (int)FtpChecksum::CHECKSUM_SHA1 << false;
+    QTest::newRow("wrapper, crc32, traced") << true << (int)FtpChecksum::CHECKSUM_CRC32 << true;
+}
+
+// The overhead of the wrapper is the difference to the QFile row, the
+// file is in the page cache after the first iteration
+void tst_HashDevice::readBenchmark()
+{
+    QFETCH(bool, wrapped);
+    QFETCH(int, algorithm);
+    QFETCH(bool, traced);
+    FtpTrace trace;
+    qint64 total = 0;
+
+    trace.setEnabled(true);
+
+    QBENCHMARK
+    {
+        QFile file(m_benchFile.fileName());
+        file.open(QIODevice::ReadOnly);
+
+        if(wrapped)
+        {
+            FtpHashDevice device(&file, algorithm);
+
+            if(traced)
+            {
+                device.setTrace(&trace, FtpTrace::TRACE_DATA_OUT, 1);
+            }
+
+            device.open(QIODevice::ReadOnly);
+            total = drain(&device);
+        }
+        else
+        {
+            total = drain(&file);
+        }
+    }
+
+    QCOMPARE(total, (qint64)BENCH_BYTES);
+}
+
+QTEST_APPLESS_MAIN(tst_HashDevice)
+
+#include "tst_hashdevice.moc"
@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# FtpHashDevice pass-through against direct file reads
+#
+#-------------------------------------------------
+
+QT       += core network testlib
+QT       -= gui
+
+TARGET = tst_hashdevice
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+include(../common/common.pri)
+
+SOURCES += \
+    tst_hashdevice.cpp
@@ -0,0 +1,375 @@
+/**********************************************************************
+PACKAGE:        Utility
+FILE:           tst_utilitybox.cpp
+COPYRIGHT (C):  All rights reserved.
+
+PURPOSE:        QUtilityBox conversions against the QString::toInt and
+                QString::number versions they replaced
+**********************************************************************/
+
+#include <QtTest>
+#include <QCoreApplication>
+#include <QStringList>
+#include <QRegExp>
+#include "QUtilityBox.h"
+
+namespace
+{
+    enum{
+        RANDOM_STRINGS = 3000,
+        BENCH_BYTES = 64 * 1024
+    };
+
+    // Replaced decoder: split at white space, toInt() each token
+    QByteArray legacyDecode(const QString &inputStr, int base)
+    {
+        QStringList dataList = inputStr.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+        QByteArray data;
+        bool ok;
+
+        for(int i = 0; i < dataList.size(); i++)
+        {
+            data.append((char)(uint8_t)dataList.at(i).toInt(&ok, base));
+        }
+
+        return data;
+    }
+
+    // Replaced encoder
+    QString legacyEncode(const QByteArray &data)
+    {
+        QString retStr = "";
+
+        for(int i = 0; i < data.size(); i++)
+        {
+            retStr.append(QString::number((uint8_t)data.at(i), 16).rightJustified(2, '0').toUpper());
+            retStr.append(" ");
+        }
+
+        return retStr;
+    }
+
+    // Deterministic across runs and Qt versions, unlike qrand()
+    class Random
+    {
+    public:
+        explicit Random(quint32 seed) : m_state(seed ? seed : 1) {}
+
+        quint32 next()
+        {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 17;
+            m_state ^= m_state << 5;
+
+            return m_state;
+        }
+
+        int bounded(int limit)
+        {
+            return (int)(next() % (quint32)limit);
+        }
+
+    private:
+        quint32 m_state;
+    };
+
+    QString randomDigits(Random &random, int count, int base)
+    {
+        const char *digits = (16 == base) ? "0123456789abcdefABCDEF" : "0123456789";
+        int digitCount = (16 == base) ? 22 : 10;
+        QString token;
+
+        for(int i = 0; i < count; i++)
+        {
+            token.append(QChar(digits[random.bounded(digitCount)]));
+        }
+
+        return token;
+    }
+
+    // Tokens of every shape the decoder has a path for
+    QString randomToken(Random &random, int base)
+    {
+        const char *invalid = "gGzZ.#:_";
+        QString token;
+
+        switch(random.bounded(8))
+        {
+        case 0:
+        case 1:
+        case 2:
+            // Digit pairs as written by the encoder
+            token = randomDigits(random, 2, base);
+            break;
+        case 3:
+            token = randomDigits(random, 1 + random.bounded(12), base);
+            break;
+        case 4:
+            token = QString(random.bounded(2) ? "-" : "+") + randomDigits(random, 1 + random.bounded(10), base);
+            break;
+        case 5:
+            token = QString(random.bounded(2) ? "0x" : "0X") + randomDigits(random, random.bounded(9), base);
+            break;
+        case 6:
+            token = randomDigits(random, 1 + random.bounded(4), base);
+            token.insert(random.bounded(token.size() + 1), QChar(invalid[random.bounded(8)]));
+            break;
+        default:
+            // Non-ASCII digit or letter
+            token = randomDigits(random, 1, base) + QChar(random.bounded(2) ? 0x0663 : 0x00E9);
+            break;
+        }
+
+        return token;
+    }
+
+    QString randomSeparator(Random &random)
+    {
+        static const ushort separators[] = {' ', ' ', ' ', '\t', '\n', '\r', '\v', '\f', 0x00A0, 0x3000};
+
+        QString separator(QChar(separators[random.bounded(10)]));
+        if(0 == random.bounded(4))
+        {
+            separator.append(QChar(' '));
+        }
+
+        return separator;
+    }
+
+    QString randomInput(Random &random, int base)
+    {
+        int tokens = random.bounded(24);
+        QString input;
+
+        if(0 == random.bounded(3))
+        {
+            input.append(randomSeparator(random));
+        }
+
+        for(int i = 0; i < tokens; i++)
+        {
+            if(i > 0)
+            {
+                input.append(randomSeparator(random));
+            }
+            input.append(randomToken(random, base));
+        }
+
+        if(0 == random.bounded(3))
+        {
+            input.append(randomSeparator(random));
+        }
+
+        return input;
+    }
+
+    QByteArray randomData(Random &random, int size)
+    {
+        QByteArray data(size, 0);
+
+        for(int i = 0; i < size; i++)
+        {
+            data[i] = (char)random.next();
+        }
+
+        return data;
+    }
+}
+
+
+class tst_UtilityBox : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void decode_data();
+    void decode();
+    void decodeRandom();
+    void decodeBounded();
+    void encode();
+    void encodeRandom();
+
+    void decodeBenchmark_data();
+    void decodeBenchmark();
+    void encodeBenchmark_data();
+    void encodeBenchmark();
+};
+
+void tst_UtilityBox::initTestCase()
+{
+    // The tst_utilitybox_ssse3 target is built for the SIMD encoder
+#if defined(UTILITYBOX_EXPECT_SSSE3) && !defined(__SSSE3__)
+    QFAIL("Built without SSSE3, the SIMD encoder would not be tested");
+#endif
+}
+
+void tst_UtilityBox::decode_data()
+{
+    QTest::addColumn<QString>("input");
+    QTest::addColumn<int>("base");
+
+    QTest::newRow("empty hex") << QString() << 16;
+    QTest::newRow("empty dec") << QString() << 10;
+    QTest::newRow("spaces") << QString(" \t\r\n ") << 16;
+    QTest::newRow("encoder layout") << QString("00 0F 7f FF a0 ") << 16;
+    QTest::newRow("no trailing space") << QString("12 34 56") << 16;
+    QTest::newRow("odd length") << QString("ABC") << 16;
+    QTest::newRow("odd length dec") << QString("1 22 333") << 10;
+    QTest::newRow("single digit") << QString("7") << 16;
+    QTest::newRow("leading zeros") << QString("00000000000000ff 0000000255") << 16;
+    QTest::newRow("long dec") << QString("12345678 4294967296") << 10;
+    QTest::newRow("int limits hex") << QString("7FFFFFFF 80000000 -80000000 -80000001") << 16;
+    QTest::newRow("int limits dec") << QString("2147483647 2147483648 -2147483648 -2147483649") << 10;
+    QTest::newRow("signs") << QString("+7F -1 - + +-1 --1") << 16;
+    QTest::newRow("prefix") << QString("0x 0x1 0XfF -0x10 +0x10 0x0x1") << 16;
+    QTest::newRow("prefix dec") << QString("0x10 010") << 10;
+    QTest::newRow("invalid digits hex") << QString("g1 1g 1.0 #FF") << 16;
+    QTest::newRow("invalid digits dec") << QString("1A A1 9 10") << 10;
+    QTest::newRow("two char tokens") << QString("1g 12 g1 ") << 16;
+    QTest::newRow("non-ASCII") << QString::fromUtf8("1\xd9\xa3 \xc3\xa9 12\xc2\xa0""34\xe3\x80\x80""56") << 16;
+}
+
+void tst_UtilityBox::decode()
+{
+    QFETCH(QString, input);
+    QFETCH(int, base);
+    QUtilityBox box;
+
+    QByteArray expected = legacyDecode(input, base);
+    QByteArray actual = (16 == base) ? box.convertHexStringToData(input) : box.convertDecStringToData(input);
+
+    QCOMPARE(actual, expected);
+}
+
+void tst_UtilityBox::decodeRandom()
+{
+    QUtilityBox box;
+    Random random(33);
+
+    for(int i = 0; i < RANDOM_STRINGS; i++)
+    {
+        int base = (i & 1) ? 10 : 16;
+        QString input = randomInput(random, base);
+        QByteArray expected = legacyDecode(input, base);
+        QByteArray actual = (16 == base) ? box.convertHexStringToData(input) : box.convertDecStringToData(input);
+
+        QVERIFY2(actual == expected, qPrintable(QString("Base %1 input \"%2\"").arg(base).arg(input)));
+    }
+}
+
+void tst_UtilityBox::decodeBounded()
+{
+    QUtilityBox box;
+    Random random(34);
+
+    for(int i = 0; i < RANDOM_STRINGS / 10; i++)
+    {
+        QString input = randomInput(random, 16);
+        QByteArray expected = legacyDecode(input, 16);
+        uint32_t bufferSize = (uint32_t)random.bounded(expected.size() + 2);
+        QByteArray buffer(expected.size() + 4, '\x5A');
+
+        // Stops at bufferSize and leaves the rest alone
+        uint32_t count = box.convertHexStringToDataBuffer((uint8_t *)buffer.data(), bufferSize, input);
+        QCOMPARE(count, qMin(bufferSize, (uint32_t)expected.size()));
+        QCOMPARE(buffer.left((int)count), expected.left((int)count));
+        QCOMPARE(buffer.mid((int)count), QByteArray(buffer.size() - (int)count, '\x5A'));
+
+        // Unbounded overload stores every token
+        count = box.convertHexStringToDataBuffer((uint8_t *)buffer.data(), input);
+        QCOMPARE(count, (uint32_t)expected.size());
+        QCOMPARE(buffer.left((int)count), expected);
+    }
+
+    QCOMPARE(box.convertHexStringToDataBuffer(NULL, 4, "12"), (uint32_t)0);
+    QCOMPARE(box.convertDecStringToDataBuffer(NULL, 4, "12"), (uint32_t)0);
+}
+
+void tst_UtilityBox::encode()
+{
+    QUtilityBox box;
+    QByteArray data;
+
+    QCOMPARE(box.convertDataToHexString(QByteArray()), QString());
+    QCOMPARE(box.convertDataToHexString(NULL, 4), QString());
+
+    // Every byte value, through the SIMD blocks where they are built
+    for(int i = 0; i < 256; i++)
+    {
+        data.append((char)i);
+    }
+    QCOMPARE(box.convertDataToHexString(data), legacyEncode(data));
+
+    // Round trip
+    QCOMPARE(box.convertHexStringToData(box.convertDataToHexString(data)), data);
+}
+
+void tst_UtilityBox::encodeRandom()
+{
+    QUtilityBox box;
+    Random random(35);
+
+    // Lengths around the 8 byte blocks, from unaligned addresses
+    for(int len = 0; len <= 67; len++)
+    {
+        QByteArray data = randomData(random, len + 1);
+        QByteArray tail = data.mid(1);
+
+        QCOMPARE(box.convertDataToHexString(tail), legacyEncode(tail));
+        QCOMPARE(box.convertDataToHexString((const uint8_t *)data.constData() + 1, len), legacyEncode(tail));
+    }
+}
+
+void tst_UtilityBox::decodeBenchmark_data()
+{
+    QTest::addColumn<bool>("legacy");
+
+    QTest::newRow("table") << false;
+    QTest::newRow("toInt") << true;
+}
+
+void tst_UtilityBox::decodeBenchmark()
+{
+    QFETCH(bool, legacy);
+    QUtilityBox box;
+    Random random(36);
+    QString input = legacyEncode(randomData(random, BENCH_BYTES));
+    QByteArray data;
+
+    QBENCHMARK
+    {
+        data = legacy ? legacyDecode(input, 16) : box.convertHexStringToData(input);
+    }
+
+    QCOMPARE(data.size(), (int)BENCH_BYTES);
+}
+
+void tst_UtilityBox::encodeBenchmark_data()
+{
+    QTest::addColumn<bool>("legacy");
+
+    QTest::newRow("table") << false;
+    QTest::newRow("number") << true;
+}
+
+void tst_UtilityBox::encodeBenchmark()
+{
+    QFETCH(bool, legacy);
+    QUtilityBox box;
+    Random random(37);
+    QByteArray data = randomData(random, BENCH_BYTES);
+    QString text;
+
+    QBENCHMARK
+    {
+        text = legacy ? legacyEncode(data) : box.convertDataToHexString(data);
+    }
+
+    QCOMPARE(text.size(), 3 * (int)BENCH_BYTES);
+}
+
+QTEST_APPLESS_MAIN(tst_UtilityBox)
+
+#include "tst_utilitybox.moc"
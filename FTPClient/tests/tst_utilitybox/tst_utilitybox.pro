@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# QUtilityBox conversions against the versions they replaced
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_utilitybox
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += \
+    tst_utilitybox.cpp \
+    ../../QUtilityBox.cpp
+
+HEADERS  += \
+    ../../QUtilityBox.h
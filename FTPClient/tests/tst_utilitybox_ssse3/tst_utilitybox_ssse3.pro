@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Same as tst_utilitybox, built for the SSSE3 encoder
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_utilitybox_ssse3
+TEMPLATE = app
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+# The default x86 targets stop at SSE2, the test fails if SSSE3 is missing
+*-g++*|*-clang*:QMAKE_CXXFLAGS += -mssse3
+DEFINES += UTILITYBOX_EXPECT_SSSE3
+
+INCLUDEPATH += ../..
+DEPENDPATH += ../..
+
+SOURCES += \
+    ../tst_utilitybox/tst_utilitybox.cpp \
+    ../../QUtilityBox.cpp
+
+HEADERS  += \
+    ../../QUtilityBox.h